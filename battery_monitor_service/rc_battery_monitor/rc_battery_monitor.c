@@ -13,6 +13,7 @@
 #include "../../libraries/roboticscape.h"
 #include "../../libraries/rc_defs.h"
 #include "../../libraries/mmap/rc_mmap_gpio_adc.h"
+#include "../../libraries/other/rc_battery.h"
 #include <sys/file.h>
 
 #define BATTPIDFILE	"/var/run/rc_battery_monitor.pid"
@@ -58,6 +59,8 @@ int main(int argc, char *argv[]){
 	int pack_connected = 0;
 	int c;
 	float stddev;
+	int publishing = 0;
+	rc_battery_state_t state;
 	rc_bb_model_t model;
 	rc_filter_t filterB = rc_empty_filter();
 	rc_filter_t filterJ = rc_empty_filter(); // battery and jack filters
@@ -150,6 +153,10 @@ int main(int argc, char *argv[]){
 	}
 	rc_prefill_filter_outputs(&filterJ, v_jack);
 	rc_prefill_filter_inputs(&filterJ, v_jack);		
+
+	// publish readings so programs don't need to sample the ADC themselves
+	if(battery_shm_open()==0) publishing = 1;
+	else fprintf(stderr,"WARNING: rc_battery_monitor can't publish readings\n");
 	
 	// first decide if the user has called this from a terminal
 	// or as a startup process
@@ -168,6 +175,7 @@ int main(int argc, char *argv[]){
 
 		if(v_pack==-1 || v_jack==-1){
 			fprintf(stderr,"ERROR in rc_battery_monitor, can't read ADC voltages\n");
+			battery_shm_close();
 			remove(PID_FILE);
 			return -1;
 		}
@@ -219,6 +227,14 @@ int main(int argc, char *argv[]){
 		}
 		
 		// done sensing, start outputting
+		state.pack_v = v_pack;
+		state.jack_v = v_jack;
+		state.cell_v = num_cells ? cell_voltage : 0;
+		state.num_cells = num_cells;
+		state.pack_connected = pack_connected;
+		state.charging = charging;
+		if(publishing) battery_shm_publish(&state);
+
 		if(printing){
 			printf("\r %0.2fV   %0.2fV	 %d	 %0.2fV   ", \
 									v_pack, v_jack, num_cells, cell_voltage);
@@ -256,6 +272,7 @@ int main(int argc, char *argv[]){
 	}
 
 	// exit
+	battery_shm_close();
 	illuminate_leds(0);
 	printf("battery_monitor exiting cleanly\n");
 	remove(PID_FILE);
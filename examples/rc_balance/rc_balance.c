@@ -89,6 +89,7 @@ core_state_t cstate;
 setpoint_t setpoint;
 rc_filter_t D1, D2, D3;
 rc_imu_data_t imu_data;
+rc_loop_t setpoint_loop;
 
 /*******************************************************************************
 * main()
@@ -206,6 +207,12 @@ int main(){
 		rc_usleep(10000);
 	}
 	
+	// report how well the setpoint manager kept its rate
+	if(isatty(fileno(stdout))){
+		printf("\n");
+		rc_loop_print_stats(&setpoint_loop, "setpoint_manager");
+	}
+
 	// cleanup
 	rc_free_filter(&D1);
 	rc_free_filter(&D2);
@@ -224,6 +231,7 @@ int main(){
 *******************************************************************************/
 void* setpoint_manager(void* ptr){
 	float drive_stick, turn_stick; // dsm input sticks
+	rc_loop_config_t loop_config = rc_loop_default_config();
 
 	// wait for IMU to settle
 	disarm_controller();
@@ -231,10 +239,12 @@ void* setpoint_manager(void* ptr){
 	rc_set_state(RUNNING);
 	rc_set_led(RED,0);
 	rc_set_led(GREEN,1);
-	
+
+	loop_config.rate_hz = SETPOINT_MANAGER_HZ;
+	rc_loop_init(&setpoint_loop, loop_config);
 	while(rc_get_state()!=EXITING){
 		// sleep at beginning of loop so we can use the 'continue' statement
-		rc_usleep(1000000/SETPOINT_MANAGER_HZ); 
+		rc_loop_wait(&setpoint_loop);
 		
 		// nothing to do if paused, go back to beginning of loop
 		if(rc_get_state() != RUNNING) continue;
@@ -485,16 +495,23 @@ int wait_for_starting_condition(){
 * battery_checker()
 *
 * Slow loop checking battery voltage. Also changes the D1 saturation limit
-* since that is dependent on the battery voltage.
+* since that is dependent on the battery voltage. Uses the battery monitor
+* service's filtered voltage if it's running, otherwise reads the ADC.
 *******************************************************************************/
 void* battery_checker(void* ptr){
 	float new_v;
+	rc_battery_state_t batt;
+	rc_loop_t loop;
+	rc_loop_config_t loop_config = rc_loop_default_config();
+	loop_config.rate_hz = BATTERY_CHECK_HZ;
+	rc_loop_init(&loop, loop_config);
 	while(rc_get_state()!=EXITING){
-		new_v = rc_battery_voltage();
+		if(rc_get_battery_state(&batt)==0) new_v = batt.pack_v;
+		else new_v = rc_battery_voltage();
 		// if the value doesn't make sense, use nominal voltage
 		if (new_v>9.0 || new_v<5.0) new_v = V_NOMINAL;
 		cstate.vBatt = new_v;
-		rc_usleep(1000000 / BATTERY_CHECK_HZ);
+		rc_loop_wait(&loop);
 	}
 	return NULL;
 }
@@ -507,6 +524,10 @@ void* battery_checker(void* ptr){
 *******************************************************************************/
 void* printf_loop(void* ptr){
 	rc_state_t last_rc_state, new_rc_state; // keep track of last state 
+	rc_loop_t loop;
+	rc_loop_config_t loop_config = rc_loop_default_config();
+	loop_config.rate_hz = PRINTF_HZ;
+	rc_loop_init(&loop, loop_config);
 	last_rc_state = rc_get_state();
 	while(rc_get_state()!=EXITING){
 		new_rc_state = rc_get_state();
@@ -545,7 +566,7 @@ void* printf_loop(void* ptr){
 			else printf("DISARMED |");
 			fflush(stdout);
 		}
-		rc_usleep(1000000 / PRINTF_HZ);
+		rc_loop_wait(&loop);
 	}
 	return NULL;
 } 
@@ -14,8 +14,8 @@
 #define MIN_DIM		1
 #define MAX_DIM		250
 
-#define TIMER rc_nanos_thread_time()
-#define TIMER_DELAY 2100 // ns consumed just by reading the thread time
+#define TIMER rc_cycles()
+#define ELAPSED_NS(t1,t2) rc_cycles_to_nanos(rc_cycles_diff(t1,t2)-rc_cycles_overhead())
 
 // printed if some invalid argument was given
 void print_usage(){
@@ -89,6 +89,7 @@ int main(int argc, char *argv[]){
 
 	// set clock speed to 1000mhz to make sure scaling doesn't effect results
 	rc_set_cpu_freq(FREQ_1000MHZ);
+	rc_cycles_init();
 	printf("Starting\n");
 	
 	// create a random nxn matrix for later use
@@ -96,14 +97,14 @@ int main(int argc, char *argv[]){
 	rc_random_matrix(&A,dim,dim);
 	rc_vector_zeros(&b,dim);
 	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
+	diff = ELAPSED_NS(t1,t2);
 	printf("%10lldus Time to make random matrix & vector\n", diff/1000);
 	
 	// duplicate matrix
 	t1 = TIMER;
 	rc_duplicate_matrix(A,&AA);
 	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
+	diff = ELAPSED_NS(t1,t2);
 	printf("%10lldus Time to duplicate matrix\n", diff/1000);
 	
 	// Multiply matrices
@@ -111,7 +112,7 @@ int main(int argc, char *argv[]){
 	t1 = TIMER;
 	rc_multiply_matrices(A, AA, &B);
 	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
+	diff = ELAPSED_NS(t1,t2);
 	printf("%10lldus Time to multiply matrices\n", diff/1000);
 	
 	// calculate floating pointer operations per second, both multiplication
@@ -124,14 +125,14 @@ int main(int argc, char *argv[]){
 	t1 = TIMER;
 	rc_matrix_determinant(A);
 	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
+	diff = ELAPSED_NS(t1,t2);
 	printf("%10lldus Time to find matrix determinant\n", diff/1000);
 	
 	// find inverse
 	t1 = TIMER;
 	rc_invert_matrix(A, &AA);
 	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
+	diff = ELAPSED_NS(t1,t2);
 	printf("%10lldus Time to invert matrix\n", diff/1000);
 	
 	// LUP
@@ -141,7 +142,7 @@ int main(int argc, char *argv[]){
 	t1 = TIMER;
 	rc_lup_decomp(A,&L,&U,&P);
 	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
+	diff = ELAPSED_NS(t1,t2);
 	printf("%10lldus Time to do LUP decomposition\n", diff/1000);
 
 	// do a QR decomposition on A
@@ -150,7 +151,7 @@ int main(int argc, char *argv[]){
 	t1 = TIMER;
 	rc_qr_decomp(A,&Q,&R);
 	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
+	diff = ELAPSED_NS(t1,t2);
 	printf("%10lldus Time to do QR decomposition\n", diff/1000);
 
 	// do a QR decomposition on A
@@ -158,7 +159,7 @@ int main(int argc, char *argv[]){
 	t1 = TIMER;
 	rc_lin_system_solve(A,b,&x);
 	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
+	diff = ELAPSED_NS(t1,t2);
 	printf("%10lldus Time to solve linear system\n", diff/1000);
 
 	printf("DONE\n");
@@ -2,7 +2,8 @@
 * rc_check_battery.c
 *
 * James Strawson 2016
-* Simple program to display battery state
+* Simple program to display battery state, from the battery monitor service
+* if it's running otherwise by reading the ADC
 *******************************************************************************/
 
 #include "../../libraries/rc_usefulincludes.h"
@@ -10,14 +11,43 @@
 
 #define VOLTAGE_DISCONNECT	1	// Threshold for detecting disconnected battery
 
+// prints what the battery monitor service publishes until exit or until the
+// service stops
+static void print_monitor_state(){
+	rc_battery_state_t state;
+	while(rc_get_state()!=EXITING){
+		if(rc_get_battery_state(&state)){
+			printf("\nbattery monitor stopped, reading the ADC instead\n");
+			return;
+		}
+		printf("\rPack: %0.2fV   Cell: %0.2fV   DC Jack: %0.2fV   Cells: %d%s  ", \
+					state.pack_v, state.cell_v, state.jack_v, state.num_cells,\
+					state.charging ? "   charging" : "");
+		fflush(stdout);
+		rc_usleep(1000000);
+	}
+}
+
 int main(){
 	double pack_voltage;	// 2S pack voltage on JST XH 2S balance connector
 	double cell_voltage;	// cell voltage
 	double jack_voltage;	// could be dc power supply or another battery
+	rc_battery_state_t state;
+
+	// the battery monitor service is already reading the ADC, use it if it's
+	// running rather than taking the cape from whatever else is using it
+	if(rc_get_battery_state(&state)==0){
+		rc_enable_signal_handler();
+		print_monitor_state();
+		if(rc_get_state()==EXITING){
+			printf("\n");
+			return 0;
+		}
+	}
 
 	// initialize hardware first
-	if(rc_initialize()){
-		fprintf(stderr,"ERROR: failed to run rc_initialize(), are you root?\n");
+	if(rc_initialize_ex(RC_INIT_ADC)){
+		fprintf(stderr,"ERROR: failed to run rc_initialize_ex(), are you root?\n");
 		return -1;
 	}
 
@@ -0,0 +1,117 @@
+/*******************************************************************************
+* rc_hub.c
+*
+* With -s this owns the cape and publishes the IMU, encoders, ADC, DSM, and
+* barometer to the sensor hub. Without it this connects as a client and
+* prints what the server is publishing, any number of clients can run while
+* the server does.
+*******************************************************************************/
+
+#include "../../libraries/rc_usefulincludes.h"
+#include "../../libraries/roboticscape.h"
+
+#define HUB_RATE_HZ		100
+#define PRINT_HZ		10
+
+// owns the hardware and publishes until exit
+static int run_server(){
+	rc_imu_data_t data;
+	rc_imu_config_t conf = rc_default_imu_config();
+
+	if(rc_initialize_ex(RC_INIT_ADC|RC_INIT_ENCODERS|RC_INIT_PRU)){
+		fprintf(stderr,"ERROR: failed to run rc_initialize_ex(), are you root?\n");
+		return -1;
+	}
+	if(rc_initialize_imu_dmp(&data, conf)){
+		fprintf(stderr,"ERROR: failed to initialize IMU\n");
+		rc_cleanup();
+		return -1;
+	}
+	if(rc_initialize_dsm()){
+		fprintf(stderr,"WARNING: failed to start dsm, not publishing it\n");
+	}
+	if(rc_initialize_barometer(BMP_OVERSAMPLE_16, BMP_FILTER_OFF) || \
+									rc_bmp_start_sampler(0.5, 0)){
+		fprintf(stderr,"WARNING: failed to start barometer, not publishing it\n");
+	}
+	if(rc_hub_start_server(RC_HUB_ALL, HUB_RATE_HZ, 0)){
+		fprintf(stderr,"ERROR: failed to start sensor hub server\n");
+		rc_power_off_imu();
+		rc_cleanup();
+		return -1;
+	}
+	printf("serving sensor hub, start rc_hub without -s to read it\n");
+	while(rc_get_state()!=EXITING){
+		rc_usleep(100000);
+	}
+	rc_power_off_barometer();
+	rc_power_off_imu();
+	rc_cleanup();
+	return 0;
+}
+
+// reads from the hub using the normal getters until exit
+static int run_client(){
+	rc_hub_imu_t imu;
+	uint32_t cursor;
+	int i, ret;
+
+	rc_enable_signal_handler();
+	if(rc_hub_connect()){
+		fprintf(stderr,"ERROR: failed to connect to the sensor hub\n");
+		return -1;
+	}
+
+	printf("\n");
+	printf("  yaw  |");
+	printf(" enc 1 | enc 2 | enc 3 | enc 4 |");
+	printf("battery|");
+	printf(" dsm 1 |");
+	printf("altitude|");
+	printf("\n");
+
+	cursor = rc_hub_cursor(RC_HUB_IMU);
+	while(rc_get_state()!=EXITING){
+		// sleep until the server's next IMU sample
+		ret = rc_hub_wait(RC_HUB_IMU, cursor, 1000);
+		if(ret<0){
+			printf("\rwaiting for server...");
+			fflush(stdout);
+			rc_usleep(1000000/PRINT_HZ);
+			continue;
+		}
+		cursor = rc_hub_cursor(RC_HUB_IMU);
+		printf("\r");
+		if(ret==0 && rc_hub_latest(RC_HUB_IMU, &imu)==0){
+			printf("%6.1f |", imu.data.dmp_TaitBryan[TB_YAW_Z]*RAD_TO_DEG);
+		}
+		else printf("   --  |");
+		for(i=1; i<=4; i++) printf("%6d |", rc_get_encoder_pos(i));
+		printf("%6.2f |", rc_battery_voltage());
+		printf("%6.2f |", rc_get_dsm_ch_normalized(1));
+		printf("%7.2f |", rc_bmp_get_altitude_m());
+		fflush(stdout);
+		rc_usleep(1000000/PRINT_HZ);
+	}
+	printf("\n");
+	rc_hub_disconnect();
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	int c, server = 0;
+
+	opterr = 0;
+	while ((c = getopt(argc, argv, "s")) != -1){
+		switch (c){
+		case 's':
+			server = 1;
+			break;
+		default:
+			printf("usage: rc_hub [-s]\n");
+			return -1;
+		}
+	}
+	if(server) return run_server();
+	return run_client();
+}
@@ -3,17 +3,44 @@
 *
 * James Strawson 2016
 * prints voltages read by all adc channels
+*
+* with -c <hz> the ADC samples continuously in the background at that rate and
+* the latest samples are printed along with the FIFO overrun count
 *******************************************************************************/
 
 #include "../../libraries/rc_usefulincludes.h"
 #include "../../libraries/roboticscape.h"
 
-int main(){
-	int i;
+int main(int argc, char *argv[]){
+	int i, c;
+	int rate_hz = 0;
+
+	opterr = 0;
+	while ((c = getopt(argc, argv, "c:")) != -1){
+		switch (c){
+		case 'c':
+			rate_hz = atoi(optarg);
+			if(rate_hz<1){
+				fprintf(stderr,"continuous rate must be >=1hz\n");
+				return -1;
+			}
+			break;
+		default:
+			printf("usage: rc_test_adc [-c rate_hz]\n");
+			return -1;
+		}
+	}
 
 	// initialize hardware first
-	if(rc_initialize()){
-		fprintf(stderr,"ERROR: failed to run rc_initialize(), are you root?\n");
+	if(rc_initialize_ex(RC_INIT_ADC)){
+		fprintf(stderr,"ERROR: failed to run rc_initialize_ex(), are you root?\n");
+		return -1;
+	}
+
+	// all 7 channels including the DC jack and battery dividers
+	if(rate_hz && rc_adc_start_continuous(0x7F, rate_hz, 0)){
+		fprintf(stderr,"ERROR: failed to start continuous adc\n");
+		rc_cleanup();
 		return -1;
 	}
 
@@ -23,6 +50,7 @@ int main(){
 	printf(" adc_3 |");
 	printf("DC_Jack|");
 	printf("Battery|");
+	if(rate_hz) printf("overruns|");
 	printf("\n");
 
 	while(rc_get_state()!=EXITING){
@@ -33,6 +61,7 @@ int main(){
 		}
 		printf("%6.2f |", rc_dc_jack_voltage());
 		printf("%6.2f |", rc_battery_voltage());
+		if(rate_hz) printf("%7d |", rc_adc_get_overruns());
 		fflush(stdout);
 		rc_usleep(100000);
 	}
@@ -2,6 +2,9 @@
 * rc_test_barometer.c
 *
 * This serves as an example of how to read the barometer.
+*
+* with -s the barometer is sampled and filtered by the library in the
+* background instead and the latest sample is printed
 *******************************************************************************/
 
 #include "../../libraries/rc_usefulincludes.h"
@@ -19,14 +22,53 @@
 #define CUTOFF_FREQ		2.0f	// 2rad/s, about 0.3hz
 #define BMP_CHECK_HZ	25
 #define	DT				1.0f/BMP_CHECK_HZ
+// time constant of the background sampler's first order filter
+#define SAMPLER_TC		0.5f
+
+// prints the sampler's latest data until exit
+static void print_sampler_data(){
+	rc_bmp_data_t data;
+
+	printf("\n");
+	printf("  temp  |");
+	printf(" pressure  |");
+	printf(" altitude |");
+	printf(" filtered |");
+	printf("  samples |");
+	printf("\n");
+	while(rc_get_state()!=EXITING){
+		rc_usleep(1000000/BMP_CHECK_HZ);
+		if(rc_bmp_get_data(&data)) continue;
+		printf("\r");
+		printf("%6.2fC |", data.temp_c);
+		printf("%7.2fkpa |", data.pressure_pa/1000.0);
+		printf("%8.2fm |", data.alt_m);
+		printf("%8.2fm |", data.alt_filtered_m);
+		printf("%9llu |", (unsigned long long)data.samples);
+		fflush(stdout);
+	}
+}
 
-int main(){
+int main(int argc, char *argv[]){
 	double temp, pressure, altitude, filtered_alt;
 	rc_filter_t lowpass = rc_empty_filter();
+	int c, use_sampler = 0;
+
+	opterr = 0;
+	while ((c = getopt(argc, argv, "s")) != -1){
+		switch (c){
+		case 's':
+			use_sampler = 1;
+			break;
+		default:
+			printf("usage: rc_test_barometer [-s]\n");
+			return -1;
+		}
+	}
 
 	// initialize hardware first
-	if(rc_initialize()){
-		fprintf(stderr,"ERROR: failed to run rc_initialize(), are you root?\n");
+	if(rc_initialize_ex(0)){
+		fprintf(stderr,"ERROR: failed to run rc_initialize_ex(), are you root?\n");
 		return -1;
 	}
 
@@ -34,6 +76,17 @@ int main(){
 		fprintf(stderr,"ERROR: rc_initialize_barometer failed\n");
 		return -1;
 	}
+
+	if(use_sampler){
+		if(rc_bmp_start_sampler(SAMPLER_TC, 0)){
+			fprintf(stderr,"ERROR: failed to start barometer sampler\n");
+			return -1;
+		}
+		print_sampler_data();
+		rc_power_off_barometer();
+		rc_cleanup();
+		return 0;
+	}
 	
 	// create the lowpass filter and prefill with current altitude
 	if(rc_butterworth_lowpass(&lowpass,ORDER, DT, CUTOFF_FREQ)){
@@ -290,8 +290,8 @@ int main(int argc, char *argv[]){
 		conf.orientation=orientation_prompt();
 	}
 	// initialize hardware first
-	if(rc_initialize()){
-		fprintf(stderr,"ERROR: failed to run rc_initialize(), are you root?\n");
+	if(rc_initialize_ex(0)){
+		fprintf(stderr,"ERROR: failed to run rc_initialize_ex(), are you root?\n");
 		return -1;
 	}
 	// now set up the imu for dmp interrupt operation
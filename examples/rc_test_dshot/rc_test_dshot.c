@@ -0,0 +1,128 @@
+/*******************************************************************************
+* rc_test_dshot.c
+*
+* Demonstrates driving ESCs with the DShot digital protocol from the PRU.
+* Sends the same throttle to all 8 channels at the requested frame rate.
+* Motor stop frames are sent for the first second so the ESCs arm.
+*
+* Do NOT use the servo power rail with ESCs.
+*******************************************************************************/
+
+#include "../../libraries/rc_usefulincludes.h"
+#include "../../libraries/roboticscape.h"
+
+// printed if some invalid argument was given
+void print_usage(){
+	printf("\n");
+	printf(" Options\n");
+	printf(" -s {speed}     DShot speed 150, 300, or 600 (default 600)\n");
+	printf(" -e {throttle}  Drive ESCs at normalized throttle from 0-1\n");
+	printf(" -f {hz}        Specify frame rate, otherwise 500hz is used\n");
+	printf(" -c {command}   Send a DShot command 0-47 and exit\n");
+	printf(" -h             Print this help messege \n\n");
+	printf("sample use to spin all motors slowly:\n");
+	printf("   rc_test_dshot -s 600 -e 0.05\n\n");
+}
+
+int main(int argc, char *argv[]){
+	int c, i;
+	int speed = 600;
+	int frequency_hz = 500;
+	int command = -1;
+	float throttle = -1.0;
+	float out[8];
+	uint64_t start;
+
+	// parse arguments
+	opterr = 0;
+	while ((c = getopt(argc, argv, "s:e:f:c:h")) != -1){
+		switch (c){
+		case 's':
+			speed = atoi(optarg);
+			if(speed!=150 && speed!=300 && speed!=600){
+				printf("speed must be 150, 300, or 600\n");
+				return -1;
+			}
+			break;
+		case 'e':
+			throttle = atof(optarg);
+			if(throttle<0.0 || throttle>1.0){
+				printf("throttle must be from 0 to 1\n");
+				return -1;
+			}
+			break;
+		case 'f':
+			frequency_hz = atoi(optarg);
+			if(frequency_hz<1){
+				printf("Frequency option must be >=1\n");
+				return -1;
+			}
+			break;
+		case 'c':
+			command = atoi(optarg);
+			if(command<0 || command>47){
+				printf("command must be from 0 to 47\n");
+				return -1;
+			}
+			break;
+		case 'h':
+			print_usage();
+			return 0;
+		default:
+			printf("\nInvalid Argument \n");
+			print_usage();
+			return -1;
+		}
+	}
+
+	if(throttle<0.0 && command<0){
+		printf("\nNot enough input arguments\n");
+		print_usage();
+		return -1;
+	}
+
+	// initialize hardware first
+	if(rc_initialize()){
+		fprintf(stderr,"ERROR: failed to run rc_initialize(), are you root?\n");
+		return -1;
+	}
+	if(rc_initialize_dshot(speed)){
+		fprintf(stderr,"ERROR: failed to start DShot\n");
+		rc_cleanup();
+		return -1;
+	}
+
+	// send motor stop for a second so the ESCs arm
+	printf("arming ESCs\n");
+	for(i=0;i<8;i++) out[i] = -1.0;
+	start = rc_nanos_since_boot();
+	while(rc_nanos_since_boot()-start < 1000000000){
+		if(rc_get_state()==EXITING) break;
+		rc_send_dshot_throttle_all(out);
+		rc_usleep(1000000/frequency_hz);
+	}
+
+	if(command>=0){
+		printf("sending command %d\n", command);
+		rc_send_dshot_command_all(command);
+		rc_cleanup();
+		return 0;
+	}
+
+	printf("DShot%d throttle: %f  frame rate: %d\n", speed, throttle, \
+															frequency_hz);
+	for(i=0;i<8;i++) out[i] = throttle;
+	while(rc_get_state()!=EXITING){
+		rc_send_dshot_throttle_all(out);
+		rc_usleep(1000000/frequency_hz);
+	}
+
+	// stop the motors before exiting
+	for(i=0;i<8;i++) out[i] = -1.0;
+	rc_usleep(1000);
+	rc_send_dshot_throttle_all(out);
+	rc_usleep(1000);
+	printf("\n");
+	rc_cleanup();
+	return 0;
+}
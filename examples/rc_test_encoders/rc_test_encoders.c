@@ -3,13 +3,19 @@
 *
 * Prints out current encoder ticks for all 4 channels
 * channels 1-3 are counted using eQEP 0-2. Channel 4 is counted by PRU0
+* With the -v option the velocity of each channel in counts/s is printed
+* instead, measured by the eQEP capture units and PRU edge timestamps.
 *******************************************************************************/
 
 #include "../../libraries/rc_usefulincludes.h"
 #include "../../libraries/roboticscape.h"
 
-int main(){
+int main(int argc, char *argv[]){
 	int i;
+	int velocity = 0;
+	rc_encoder_snapshot_t snap;
+
+	if(argc>1 && strcmp(argv[1],"-v")==0) velocity = 1;
 
 	// initialize hardware first
 	if(rc_initialize()){
@@ -17,7 +23,8 @@ int main(){
 		return -1;
 	}
 
-	printf("\nRaw encoder positions\n");
+	if(velocity) printf("\nEncoder velocities (counts/s)\n");
+	else printf("\nRaw encoder positions\n");
 	printf("   E1   |");
 	printf("   E2   |");
 	printf("   E3   |");
@@ -26,8 +33,11 @@ int main(){
 
 	while(rc_get_state() != EXITING){
 		printf("\r");
+		// all 4 positions sampled together
+		if(!velocity) rc_get_encoder_snapshot(&snap);
 		for(i=1;i<=4;i++){
-			printf("%6d  |", rc_get_encoder_pos(i));
+			if(velocity) printf("%8.1f|", rc_get_encoder_velocity(i));
+			else printf("%6d  |", snap.pos[i-1]);
 		}
 		fflush(stdout);
 		rc_usleep(50000);
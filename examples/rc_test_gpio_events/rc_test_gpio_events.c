@@ -0,0 +1,113 @@
+/*******************************************************************************
+* rc_test_gpio_events.c
+*
+* Watches one gpio pin with rc_gpio_event_watch and prints every edge along
+* with how long it took to reach the callback. On kernels with the GPIO
+* character device the timestamp is taken by the kernel when the edge
+* happens, so the delay shows the latency of the event thread. On the sysfs
+* fallback the timestamp is taken when the thread wakes up and the delay is
+* close to 0. The pin must already be pinmuxed as a gpio input and must not
+* be exported through sysfs if the character device is to be used.
+*******************************************************************************/
+
+#include "../../libraries/rc_usefulincludes.h"
+#include "../../libraries/roboticscape.h"
+
+static volatile int events = 0;
+static uint64_t last_ns = 0;
+
+// printed if some invalid argument was given
+void print_usage(){
+	printf("\n");
+	printf(" Options\n");
+	printf(" -g {gpio}      Gpio number to watch, required\n");
+	printf(" -e {r|f|b}     Rising, falling, or both edges (default both)\n");
+	printf(" -d {us}        Debounce time in microseconds (default 0)\n");
+	printf(" -p {priority}  SCHED_FIFO priority of the event thread (default 0)\n");
+	printf(" -h             Print this help messege \n\n");
+	printf("sample use to watch the pause button:\n");
+	printf("   rc_test_gpio_events -g 69 -d 1500\n\n");
+}
+
+// called from the gpio event thread
+void on_edge(int gpio, int value, uint64_t timestamp_ns){
+	uint64_t now = rc_nanos_since_boot();
+	events++;
+	printf("gpio %d %s  delay: %7.1fus", gpio, value ? "high" : "low ", \
+								(now-timestamp_ns)/1000.0);
+	if(last_ns) printf("  since last: %10.1fus", (timestamp_ns-last_ns)/1000.0);
+	printf("\n");
+	last_ns = timestamp_ns;
+}
+
+int main(int argc, char *argv[]){
+	int c;
+	int gpio = -1;
+	int debounce_us = 0;
+	int priority = 0;
+	rc_pin_edge_t edge = EDGE_BOTH;
+
+	// parse arguments
+	opterr = 0;
+	while ((c = getopt(argc, argv, "g:e:d:p:h")) != -1){
+		switch (c){
+		case 'g':
+			gpio = atoi(optarg);
+			break;
+		case 'e':
+			if(optarg[0]=='r') edge = EDGE_RISING;
+			else if(optarg[0]=='f') edge = EDGE_FALLING;
+			else if(optarg[0]=='b') edge = EDGE_BOTH;
+			else{
+				printf("edge must be r, f, or b\n");
+				return -1;
+			}
+			break;
+		case 'd':
+			debounce_us = atoi(optarg);
+			if(debounce_us<0){
+				printf("debounce time must be >=0\n");
+				return -1;
+			}
+			break;
+		case 'p':
+			priority = atoi(optarg);
+			if(priority<0){
+				printf("priority must be >=0\n");
+				return -1;
+			}
+			break;
+		case 'h':
+			print_usage();
+			return 0;
+		default:
+			printf("\nInvalid Argument \n");
+			print_usage();
+			return -1;
+		}
+	}
+	if(gpio<0){
+		printf("\nNot enough input arguments\n");
+		print_usage();
+		return -1;
+	}
+
+	// only the signal handler and PID file are needed
+	if(rc_initialize_ex(0)){
+		fprintf(stderr,"ERROR: failed to run rc_initialize_ex(), are you root?\n");
+		return -1;
+	}
+	if(rc_gpio_event_watch(gpio, edge, debounce_us, priority, &on_edge)){
+		fprintf(stderr,"ERROR: failed to watch gpio %d\n", gpio);
+		rc_cleanup();
+		return -1;
+	}
+	printf("watching gpio %d, toggle it to see events\n", gpio);
+	while(rc_get_state()!=EXITING){
+		rc_usleep(100000);
+	}
+	rc_gpio_event_unwatch(gpio);
+	printf("\n%d events\n", events);
+	rc_cleanup();
+	return 0;
+}
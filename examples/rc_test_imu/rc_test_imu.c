@@ -54,8 +54,8 @@ int main(int argc, char *argv[]){
 	}
 
 	// initialize hardware first
-	if(rc_initialize()){
-		fprintf(stderr,"ERROR: failed to run rc_initialize(), are you root?\n");
+	if(rc_initialize_ex(0)){
+		fprintf(stderr,"ERROR: failed to run rc_initialize_ex(), are you root?\n");
 		return -1;
 	}
 
@@ -0,0 +1,134 @@
+/*******************************************************************************
+* rc_test_pru_emulator.c
+*
+* Runs the servo and encoder 4 functions against the PRU emulator so they can
+* be checked and timed on any Linux machine, no Beaglebone required. Servo
+* pulses are sent to all channels at 50hz while the emulated encoder counts
+* at the given rate or from a script file. Every half second the number of
+* pulses the emulated PRU completed and the encoder 4 position and velocity
+* are printed. Finishes by timing rc_send_servo_pulse_us_all and
+* rc_get_encoder_pos(4) calls.
+*******************************************************************************/
+
+#include "../../libraries/rc_usefulincludes.h"
+#include "../../libraries/roboticscape.h"
+
+#define BENCH_CALLS 100000
+#define STALL_NS	1000000000	// give up if the emulator stops consuming pulses
+
+// printed if some invalid argument was given
+void print_usage(){
+	printf("\n");
+	printf(" Options\n");
+	printf(" -r {rate}      Encoder 4 counts per second (default 1000)\n");
+	printf(" -s {file}      Drive encoder 4 from a script file instead\n");
+	printf(" -f {file}      Back shared memory with a file instead of a memfd\n");
+	printf(" -t {seconds}   Run time (default 3)\n");
+	printf(" -h             Print this help messege \n\n");
+	printf("script lines are '<seconds> rate <counts/s>' or '<seconds> step <counts>'\n\n");
+}
+
+/*******************************************************************************
+* int wait_pulses_done(int sent)
+*
+* waits until the emulated PRU has finished the first sent pulses on every
+* channel so the next rc_send_servo_pulse_us_all finds all slots free even
+* if the emulator thread was scheduled late. Returns -1 if it stalls.
+*******************************************************************************/
+int wait_pulses_done(int sent){
+	uint64_t start = rc_nanos_since_boot();
+	int ch;
+	for(ch=1; ch<=8; ch++){
+		while(rc_pru_emulator_get_pulses(ch, NULL)<sent){
+			if(rc_nanos_since_boot()-start > STALL_NS){
+				fprintf(stderr,"ERROR: emulated PRU stopped sending pulses\n");
+				return -1;
+			}
+			rc_usleep(100);
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	int c, i, pulses, width;
+	int sent = 0;
+	float rate = 1000;
+	float seconds = 3;
+	char* script = NULL;
+	char* path = NULL;
+	uint64_t start, next_print, t;
+	rc_encoder_state_t state;
+
+	// parse arguments
+	opterr = 0;
+	while ((c = getopt(argc, argv, "r:s:f:t:h")) != -1){
+		switch (c){
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 's':
+			script = optarg;
+			rate = 0;
+			break;
+		case 'f':
+			path = optarg;
+			break;
+		case 't':
+			seconds = atof(optarg);
+			if(seconds<=0){
+				printf("run time must be >0\n");
+				return -1;
+			}
+			break;
+		case 'h':
+			print_usage();
+			return 0;
+		default:
+			print_usage();
+			return -1;
+		}
+	}
+
+	if(rc_pru_emulator_start(path, script)<0){
+		printf("failed to start PRU emulator\n");
+		return -1;
+	}
+	rc_pru_emulator_set_encoder_rate(rate);
+
+	printf("\n pulses ch1 | width us |  enc4 pos | enc4 counts/s\n");
+	start = rc_nanos_since_boot();
+	next_print = start;
+	while((t=rc_nanos_since_boot()) < start+(uint64_t)(seconds*1e9)){
+		if(wait_pulses_done(sent)<0) break;
+		if(rc_send_servo_pulse_us_all(1500)==0) sent++;
+		if(t>=next_print){
+			rc_get_encoder_state(4, &state);
+			pulses = rc_pru_emulator_get_pulses(1, &width);
+			printf("%11d | %8d | %9d | %13.1f\n", pulses, width, \
+										state.pos, state.velocity);
+			next_print += 500000000;
+		}
+		rc_usleep(20000);
+	}
+
+	// time the ARM side of each call, waiting for the previous pulses to
+	// finish so rc_send_servo_pulse_us_all does its full work every time
+	t = 0;
+	for(i=0;i<BENCH_CALLS/100;i++){
+		if(wait_pulses_done(sent)<0) break;
+		start = rc_nanos_since_boot();
+		if(rc_send_servo_pulse_us_all(1000)==0) sent++;
+		t += rc_nanos_since_boot()-start;
+	}
+	if(i>0) printf("\nrc_send_servo_pulse_us_all: %6.1f ns per call\n", \
+										(double)t/i);
+	start = rc_nanos_since_boot();
+	for(i=0;i<BENCH_CALLS;i++) rc_get_encoder_pos(4);
+	t = rc_nanos_since_boot()-start;
+	printf("rc_get_encoder_pos(4):      %6.1f ns per call\n\n", \
+												(double)t/BENCH_CALLS);
+
+	rc_pru_emulator_stop();
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*******************************************************************************
+* rc_test_sched.c
+*
+* Runs dummy estimator, controller, output, telemetry and housekeeping tasks
+* in 1khz, 200hz, 100hz, 10hz and 1hz rate groups from the rate group
+* scheduler and prints each task's run count, execution time and budget
+* overruns once a second. With -i the ticks come from the IMU interrupt at
+* 200hz instead of a timer. With -p the scheduler thread runs at that
+* SCHED_FIFO priority.
+*******************************************************************************/
+
+#include "../../libraries/rc_usefulincludes.h"
+#include "../../libraries/roboticscape.h"
+
+// busy wait to stand in for real work
+void spin(void* ptr){
+	uint64_t end = rc_nanos_since_boot() + *(int*)ptr*1000;
+	while(rc_nanos_since_boot()<end);
+}
+
+int main(int argc, char *argv[]){
+	int c, use_imu = 0;
+	int est_us=50, ctl_us=100, out_us=20, tel_us=300, house_us=2000;
+	rc_loop_config_t config = rc_loop_default_config();
+	rc_imu_data_t data;
+	rc_imu_config_t imu_config;
+
+	config.rate_hz = 1000;
+	opterr = 0;
+	while ((c = getopt(argc, argv, "ip:")) != -1){
+		switch (c){
+		case 'i':
+			use_imu = 1;
+			config.rate_hz = 200;
+			break;
+		case 'p':
+			config.priority = atoi(optarg);
+			break;
+		default:
+			printf("usage: rc_test_sched [-i] [-p priority]\n");
+			return -1;
+		}
+	}
+
+	if(rc_initialize()){
+		fprintf(stderr,"ERROR: failed to run rc_initialize(), are you root?\n");
+		return -1;
+	}
+	if(rc_sched_init(config)){
+		rc_cleanup();
+		return -1;
+	}
+
+	// order within a tick is the order added, estimator before controller
+	// before output. Slow tasks are offset so they don't share a tick.
+	if(use_imu){
+		rc_sched_add_task("estimator", 1, 0, 200, spin, &est_us);
+		rc_sched_add_task("controller", 1, 0, 200, spin, &ctl_us);
+		rc_sched_add_task("output", 2, 0, 100, spin, &out_us);
+		rc_sched_add_task("telemetry", 20, 1, 500, spin, &tel_us);
+		rc_sched_add_task("housekeeping", 200, 3, 1000, spin, &house_us);
+	}
+	else{
+		rc_sched_add_task("estimator", 1, 0, 200, spin, &est_us);
+		rc_sched_add_task("controller", 5, 0, 200, spin, &ctl_us);
+		rc_sched_add_task("output", 10, 0, 100, spin, &out_us);
+		rc_sched_add_task("telemetry", 100, 1, 500, spin, &tel_us);
+		rc_sched_add_task("housekeeping", 1000, 3, 1000, spin, &house_us);
+	}
+
+	if(use_imu){
+		imu_config = rc_default_imu_config();
+		imu_config.dmp_sample_rate = 200;
+		if(rc_initialize_imu_dmp(&data, imu_config)){
+			fprintf(stderr,"ERROR: can't talk to IMU\n");
+			rc_cleanup();
+			return -1;
+		}
+		if(rc_sched_start_imu()){
+			rc_power_off_imu();
+			rc_cleanup();
+			return -1;
+		}
+	}
+	else if(rc_sched_start()){
+		rc_cleanup();
+		return -1;
+	}
+
+	// housekeeping is deliberately over budget so overruns show up
+	while(rc_get_state()!=EXITING){
+		rc_usleep(1000000);
+		printf("\n");
+		rc_sched_print_stats();
+	}
+
+	rc_sched_stop();
+	if(use_imu) rc_power_off_imu();
+	rc_cleanup();
+	return 0;
+}
@@ -35,6 +35,14 @@ int main(){
 	for(i=0;i<LOOPS;i++) b=rc_nanos_thread_time();
 	nanos=(b-a)/LOOPS;
 	printf("time to call rc_nanos_thread_time: %lldns\n",nanos);
+
+	// time rc_cycles
+	if(rc_cycles_init()) printf("no cycle counter, rc_cycles falls back to rc_nanos_since_boot\n");
+	else printf("cycle counter running at %.1fmhz\n", rc_cycles_hz()/1000000.0);
+	a=rc_cycles();
+	for(i=0;i<LOOPS;i++) b=rc_cycles();
+	nanos=rc_cycles_to_nanos(rc_cycles_diff(a,b))/LOOPS;
+	printf("time to call rc_cycles: %lldns\n",nanos);
 	
 	rc_set_cpu_freq(FREQ_ONDEMAND);
 	return 0;
@@ -0,0 +1,111 @@
+/*******************************************************************************
+* rc_test_vertical.c
+*
+* Fuses the barometer and the IMU with the vertical state estimator and prints
+* the height and climb rate. Lift the board up and down to watch the estimate
+* follow. Press the pause button to restart the estimate at height 0.
+*******************************************************************************/
+
+#include "../../libraries/rc_usefulincludes.h"
+#include "../../libraries/roboticscape.h"
+
+#define PRINT_HZ	10
+// time constant of the background sampler's own filter, the estimator
+// fuses the unfiltered altitude
+#define SAMPLER_TC	0.5f
+
+rc_imu_data_t data;
+
+// restart the estimate from wherever the board is now
+void on_pause_pressed(){
+	rc_reset_vertical_estimator();
+}
+
+void print_usage(){
+	printf("\n");
+	printf("Options\n");
+	printf(" -s {rate}      IMU sample rate in hz (default 200)\n");
+	printf(" -b {std}       Barometer noise standard deviation in m\n");
+	printf(" -h             Print this help messege \n\n");
+}
+
+int main(int argc, char *argv[]){
+	rc_imu_config_t imu_conf = rc_default_imu_config();
+	rc_vertical_config_t conf = rc_default_vertical_config();
+	rc_vertical_state_t state;
+	int c;
+
+	opterr = 0;
+	while((c=getopt(argc, argv, "s:b:h"))!=-1){
+		switch(c){
+		case 's':
+			imu_conf.dmp_sample_rate = atoi(optarg);
+			if(imu_conf.dmp_sample_rate>200 || imu_conf.dmp_sample_rate<4){
+				printf("sample rate must be between 4 & 200\n");
+				return -1;
+			}
+			break;
+		case 'b':
+			conf.baro_std_m = atof(optarg);
+			break;
+		case 'h':
+			print_usage();
+			return 0;
+		default:
+			print_usage();
+			return -1;
+		}
+	}
+
+	if(rc_initialize()){
+		fprintf(stderr,"ERROR: failed to run rc_initialize(), are you root?\n");
+		return -1;
+	}
+	// the estimator steps in the IMU interrupt and reads the sampler
+	if(rc_initialize_imu_dmp(&data, imu_conf)){
+		fprintf(stderr,"ERROR: rc_initialize_imu_dmp failed\n");
+		rc_cleanup();
+		return -1;
+	}
+	if(rc_initialize_barometer(BMP_OVERSAMPLE_4, BMP_FILTER_OFF)){
+		fprintf(stderr,"ERROR: rc_initialize_barometer failed\n");
+		rc_power_off_imu();
+		rc_cleanup();
+		return -1;
+	}
+	if(rc_bmp_start_sampler(SAMPLER_TC, 0)){
+		fprintf(stderr,"ERROR: failed to start barometer sampler\n");
+		rc_power_off_barometer();
+		rc_power_off_imu();
+		rc_cleanup();
+		return -1;
+	}
+	if(rc_start_vertical_estimator(conf)){
+		rc_power_off_barometer();
+		rc_power_off_imu();
+		rc_cleanup();
+		return -1;
+	}
+	rc_set_pause_pressed_func(&on_pause_pressed);
+
+	printf("\nwaiting for the first barometer sample\n");
+	printf("  height |  climb m/s | accel m/s2 |  bias | height std | baro samples\n");
+	while(rc_get_state()!=EXITING){
+		rc_usleep(1000000/PRINT_HZ);
+		if(rc_get_vertical_state(&state)) continue;
+		printf("\r%7.2fm |", state.z_m);
+		printf(" %10.2f |", state.vz_ms);
+		printf(" %10.2f |", state.az_ms2);
+		printf(" %5.2f |", state.accel_bias);
+		printf(" %9.2fm |", state.z_std_m);
+		printf(" %12llu", (unsigned long long)state.baro_updates);
+		fflush(stdout);
+	}
+	printf("\n");
+
+	rc_stop_vertical_estimator();
+	rc_power_off_barometer();
+	rc_power_off_imu();
+	rc_cleanup();
+	return 0;
+}
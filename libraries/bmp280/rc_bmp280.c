@@ -1,12 +1,21 @@
 /*******************************************************************************
 *  rc_bmp280.c
+*
+* The barometer runs in normal mode, sampling continuously on its own. It can
+* be read on demand with rc_read_barometer() or by a background sampler which
+* reads each new sample in a gap between the IMU's FIFO reads on the same bus
+* and publishes it with a seqlock like the loop and odometry statistics.
 *******************************************************************************/
 
 #include "../roboticscape.h"
 #include "../rc_defs.h"
 #include "rc_bmp280_defs.h"
+#include "../mpu9250/rc_mpu9250.h"
+#include "rc_bmp280.h"
+#include "../other/rc_hub.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <unistd.h>
 
@@ -41,6 +50,39 @@ typedef struct bmp280_data_t{
 bmp280_cal_t cal;
 bmp280_data_t data;
 
+// background sampler
+#define DEFAULT_READ_NS	400000	// 7 byte transaction at 400khz with margin
+#define BUS_GUARD_NS	100000	// kept clear either side of IMU reads
+
+typedef struct sampler_stats_t{
+	uint64_t skipped;
+	uint64_t errors;
+} sampler_stats_t;
+
+static int bmp_initialized = 0;
+static rc_bmp_oversample_t bmp_oversample;
+static volatile int sampler_running = 0;
+static rc_loop_t sampler_loop;
+static uint64_t sampler_period_ns;
+static uint64_t read_ns;
+static rc_filter_t alt_filter;
+static sampler_stats_t sampler_stats;
+static rc_bmp_data_t snapshot;
+// odd while snapshot is being written
+static volatile unsigned int sampler_seq = 0;
+
+/*******************************************************************************
+* static uint64_t odr_period_ns(rc_bmp_oversample_t oversample)
+*
+* Max measurement time from the datasheet with 1x temperature oversampling,
+* plus the 0.5ms standby set in rc_initialize_barometer, so each read gets a
+* new sample.
+*******************************************************************************/
+static uint64_t odr_period_ns(rc_bmp_oversample_t oversample){
+	int osrs_p = 1<<((oversample>>2)-1);
+	return 1250000 + 2300000 + (2300000*osrs_p + 575000) + 500000;
+}
+
 
 /*******************************************************************************
 * int rc_initialize_barometer(rc_bmp_oversample_t oversample, rc_bmp_filter_t filter)
@@ -52,6 +94,10 @@ int rc_initialize_barometer(rc_bmp_oversample_t oversample, rc_bmp_filter_t filt
 	uint8_t buf[24];
 	uint8_t c;
 	int i;
+	if(sampler_running){
+		fprintf(stderr,"ERROR: stop the barometer sampler before reinitializing\n");
+		return -1;
+	}
 	// make sure the bus is not currently in use by another thread
 	// do not proceed to prevent interfering with that process
 	if(rc_i2c_get_in_use_state(BMP_BUS)){
@@ -161,6 +207,8 @@ int rc_initialize_barometer(rc_bmp_oversample_t oversample, rc_bmp_filter_t filt
 	
 	// use default for now unless use sets it otherwise
 	cal.sea_level_pa = DEFAULT_SEA_LEVEL_PA; 
+	bmp_oversample = oversample;
+	bmp_initialized = 1;
 	
 	// release control of the bus
 	rc_i2c_release_bus(BMP_BUS);
@@ -184,6 +232,8 @@ int rc_initialize_barometer(rc_bmp_oversample_t oversample, rc_bmp_filter_t filt
 * Puts the barometer into low power standby
 *******************************************************************************/
 int rc_power_off_barometer(){
+	rc_bmp_stop_sampler();
+	bmp_initialized = 0;
 	// make sure the bus is not currently in use by another thread
 	// do not proceed to prevent interfering with that process
 	if(rc_i2c_get_in_use_state(BMP_BUS)){
@@ -211,39 +261,15 @@ int rc_power_off_barometer(){
 
 
 /*******************************************************************************
-* int rc_read_barometer()
+* static int compensate(uint8_t* raw, float* temp, float* pressure)
 *
-* Reads the newest temperature and pressure measurments from the barometer over
-* the I2C bus. To access the data use the rc_bmp_get_temperature(), 
-* rc_bmp_get_pressure_pa(), or rc_bmp_get_altitude_m() functions. 
-* returns 0 on success, otherwise -1.
+* Turns the 6 data registers into degrees C and pascals. Returns -1 if the
+* calibration would divide by zero.
 *******************************************************************************/
-int rc_read_barometer(){
+static int compensate(uint8_t* raw, float* temp, float* pressure){
 	int64_t var1, var2, var3, var4, t_fine, T, p;
-	uint8_t raw[6];
 	int32_t adc_P, adc_T;
-	
-	// check claim bus state to avoid stepping on IMU reads
-	if(rc_i2c_get_in_use_state(BMP_BUS)){
-		printf("WARNING: i2c bus is claimed, aborting rc_read_barometer\n");
-		return -1;
-	}
-	
-	// claim bus for ourselves and set the device address
-	rc_i2c_claim_bus(BMP_BUS);
-	if(rc_i2c_set_device_address(BMP_BUS, BMP_ADDR)<0){
-		printf("ERROR: failed to set the i2c device address\n");
-		rc_i2c_release_bus(BMP_BUS);
-		return -1;
-	}
-	
-	// if new data is ready, read it in
-	if(rc_i2c_read_bytes(BMP_BUS,BMP280_PRESSURE_MSB,6,raw)<0){
-		printf("ERROR: failed to read barometer data registers\n");
-		rc_i2c_release_bus(BMP_BUS);
-		return -1;
-	}
-	
+
 	// run the numbers, thanks to Bosch for putting this code in their datasheet
 	adc_P = (raw[0] << 12)|
 			(raw[1] << 4)|(raw[2] >> 4);
@@ -259,7 +285,7 @@ int rc_read_barometer(){
 	t_fine = var1 + var2;
 	
 	T  = (t_fine * 5 + 128) >> 8;
-	data.temp =  T/100.0;
+	*temp =  T/100.0;
 
 	var3 = ((int64_t)t_fine) - 128000;
 	var4 = var3 * var3 * (int64_t)cal.dig_P6;
@@ -270,7 +296,7 @@ int rc_read_barometer(){
 	var3 = (((((int64_t)1)<<47)+var3))*((int64_t)cal.dig_P1)>>33;
 
 	if (var3 == 0){
-		return 0;  // avoid exception caused by division by zero
+		return -1;  // avoid exception caused by division by zero
 	}
   
 	p = 1048576 - adc_P;
@@ -279,15 +305,271 @@ int rc_read_barometer(){
 	var4 = (((int64_t)cal.dig_P8) * p) >> 19;
 
 	p = ((p + var3 + var4) >> 8) + (((int64_t)cal.dig_P7) << 4);
-	data.pressure = (float)p/256;
+	*pressure = (float)p/256;
+	return 0;
+}
+
+/*******************************************************************************
+* static float altitude(float pressure)
+*******************************************************************************/
+static float altitude(float pressure){
+	return 44330.0f*(1.0f - powf(pressure/cal.sea_level_pa, 0.1903f));
+}
+
+/*******************************************************************************
+* int rc_read_barometer()
+*
+* Reads the newest temperature and pressure measurments from the barometer over
+* the I2C bus. To access the data use the rc_bmp_get_temperature(), 
+* rc_bmp_get_pressure_pa(), or rc_bmp_get_altitude_m() functions. 
+* returns 0 on success, otherwise -1. While the background sampler is running
+* it keeps the data up to date so this returns immediately.
+*******************************************************************************/
+int rc_read_barometer(){
+	uint8_t raw[6];
+	
+	if(sampler_running) return 0;
+
+	// check claim bus state to avoid stepping on IMU reads
+	if(rc_i2c_get_in_use_state(BMP_BUS)){
+		printf("WARNING: i2c bus is claimed, aborting rc_read_barometer\n");
+		return -1;
+	}
 	
+	// claim bus for ourselves and set the device address
+	rc_i2c_claim_bus(BMP_BUS);
+	if(rc_i2c_set_device_address(BMP_BUS, BMP_ADDR)<0){
+		printf("ERROR: failed to set the i2c device address\n");
+		rc_i2c_release_bus(BMP_BUS);
+		return -1;
+	}
+	
+	// if new data is ready, read it in
+	if(rc_i2c_read_bytes(BMP_BUS,BMP280_PRESSURE_MSB,6,raw)<0){
+		printf("ERROR: failed to read barometer data registers\n");
+		rc_i2c_release_bus(BMP_BUS);
+		return -1;
+	}
+	rc_i2c_release_bus(BMP_BUS);
+
+	if(compensate(raw, &data.temp, &data.pressure)) return 0;
+	data.alt = altitude(data.pressure);
+	return 0;
+}
+
+/*******************************************************************************
+* static int wait_for_bus_gap(uint64_t need_ns)
+*
+* Sleeps until there's need_ns before the IMU's next FIFO read and the bus is
+* free. The IMU reads at a fixed rate so the gap after each read is known, if
+* it isn't running the bus is free whenever nobody has claimed it. Returns -1
+* if the bus stayed claimed for a whole sample period.
+*******************************************************************************/
+static int wait_for_bus_gap(uint64_t need_ns){
+	uint64_t now, start, dur, give_up;
+
+	now = rc_nanos_since_boot();
+	give_up = now + sampler_period_ns;
+	while(sampler_running){
+		now = rc_nanos_since_boot();
+		if(now>give_up) return -1;
+		if(imu_next_bus_use(&start, &dur)==0 && \
+							start < now + need_ns + BUS_GUARD_NS){
+			// wait until just after the IMU is expected to be done
+			if(start+dur+BUS_GUARD_NS > now){
+				rc_usleep((start+dur+BUS_GUARD_NS-now)/1000 + 1);
+			}
+			continue;
+		}
+		if(rc_i2c_get_in_use_state(BMP_BUS)){
+			rc_usleep(BUS_GUARD_NS/1000);
+			continue;
+		}
+		return 0;
+	}
+	return -1;
+}
+
+/*******************************************************************************
+* static void publish(rc_bmp_data_t* d)
+*
+* seqlock, readers retry if seq changed under them
+*******************************************************************************/
+static void publish(rc_bmp_data_t* d){
+	sampler_seq++;
+	__sync_synchronize();
+	snapshot = *d;
+	__sync_synchronize();
+	sampler_seq++;
+	data.temp = d->temp_c;
+	data.pressure = d->pressure_pa;
+	data.alt = d->alt_m;
+}
 
-	data.alt = 44330.0*(1.0 - pow((data.pressure/cal.sea_level_pa), 0.1903));
+/*******************************************************************************
+* static void sampler_func(void* ptr)
+*
+* runs once per output data rate period from an rc_loop_t thread
+*******************************************************************************/
+static void sampler_func(__attribute__ ((unused)) void* ptr){
+	uint8_t raw[6];
+	uint64_t start, end;
+	rc_bmp_data_t d;
+	int ret;
 
+	if(wait_for_bus_gap(read_ns)){
+		sampler_stats.skipped++;
+		return;
+	}
+	start = rc_nanos_since_boot();
+	rc_i2c_claim_bus(BMP_BUS);
+	ret = rc_i2c_set_device_address(BMP_BUS, BMP_ADDR);
+	if(ret==0) ret = rc_i2c_read_bytes(BMP_BUS,BMP280_PRESSURE_MSB,6,raw);
 	rc_i2c_release_bus(BMP_BUS);
+	end = rc_nanos_since_boot();
+	// the read time is used to find a big enough gap next time
+	if(end-start > read_ns) read_ns = end-start;
+	if(ret<0){
+		sampler_stats.errors++;
+		return;
+	}
+
+	d = snapshot;
+	if(compensate(raw, &d.temp_c, &d.pressure_pa)){
+		sampler_stats.errors++;
+		return;
+	}
+	d.timestamp_ns = start;
+	d.alt_m = altitude(d.pressure_pa);
+	if(alt_filter.initialized){
+		// start the filter at the first altitude instead of rising from 0
+		if(d.samples==0){
+			rc_prefill_filter_inputs(&alt_filter, d.alt_m);
+			rc_prefill_filter_outputs(&alt_filter, d.alt_m);
+		}
+		d.alt_filtered_m = rc_march_filter(&alt_filter, d.alt_m);
+	}
+	else d.alt_filtered_m = d.alt_m;
+	d.samples++;
+	d.skipped = sampler_stats.skipped;
+	d.errors = sampler_stats.errors;
+	publish(&d);
+}
+
+/*******************************************************************************
+* int rc_bmp_start_sampler(float alt_time_constant, int priority)
+*
+* Samples the barometer in the background at its output data rate, the
+* barometer must already be initialized. Altitude is low pass filtered with
+* the given time constant in seconds, 0 to leave it unfiltered.
+*******************************************************************************/
+int rc_bmp_start_sampler(float alt_time_constant, int priority){
+	rc_loop_config_t conf;
+	float dt;
+
+	if(!bmp_initialized){
+		fprintf(stderr,"ERROR: call rc_initialize_barometer before rc_bmp_start_sampler\n");
+		return -1;
+	}
+	if(sampler_running){
+		fprintf(stderr,"ERROR: barometer sampler already running\n");
+		return -1;
+	}
+	if(alt_time_constant<0){
+		fprintf(stderr,"ERROR: altitude time constant must be >=0\n");
+		return -1;
+	}
+
+	sampler_period_ns = odr_period_ns(bmp_oversample);
+	dt = sampler_period_ns/1000000000.0f;
+	rc_free_filter(&alt_filter);
+	if(alt_time_constant>0 && \
+			rc_first_order_lowpass(&alt_filter, dt, alt_time_constant)){
+		fprintf(stderr,"ERROR: failed to make barometer altitude filter\n");
+		return -1;
+	}
+
+	memset(&snapshot, 0, sizeof(snapshot));
+	memset(&sampler_stats, 0, sizeof(sampler_stats));
+	read_ns = DEFAULT_READ_NS;
+	conf = rc_loop_default_config();
+	conf.rate_hz = 1000000000.0/sampler_period_ns;
+	conf.priority = priority;
+	sampler_running = 1;
+	if(rc_loop_start(&sampler_loop, conf, sampler_func, NULL)){
+		sampler_running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_bmp_stop_sampler()
+*******************************************************************************/
+int rc_bmp_stop_sampler(){
+	if(!sampler_running) return 0;
+	sampler_running = 0;
+	return rc_loop_stop(&sampler_loop);
+}
+
+/*******************************************************************************
+* int bmp_try_get_data(rc_bmp_data_t* d)
+*
+* Like rc_bmp_get_data but gives up instead of spinning if the sampler is
+* publishing. For the IMU interrupt thread which on a single core would never
+* let the lower priority sampler finish.
+*******************************************************************************/
+int bmp_try_get_data(rc_bmp_data_t* d){
+	unsigned int seq = sampler_seq;
+	if(seq&1) return -1;
+	__sync_synchronize();
+	*d = snapshot;
+	__sync_synchronize();
+	if(seq!=sampler_seq || d->samples==0) return -1;
 	return 0;
 }
 
+/*******************************************************************************
+* int bmp_sampler_running()
+*******************************************************************************/
+int bmp_sampler_running(){
+	return sampler_running;
+}
+
+/*******************************************************************************
+* int rc_bmp_get_data(rc_bmp_data_t* d)
+*
+* copies the latest sample, retrying if the sampler published while copying.
+* Returns -1 if the sampler hasn't produced a sample yet.
+*******************************************************************************/
+int rc_bmp_get_data(rc_bmp_data_t* d){
+	unsigned int seq;
+	if(d==NULL){
+		fprintf(stderr,"ERROR: in rc_bmp_get_data, received NULL pointer\n");
+		return -1;
+	}
+	if(hub_client) return rc_hub_latest(RC_HUB_BARO, d);
+	do{
+		while((seq=sampler_seq)&1);
+		__sync_synchronize();
+		*d = snapshot;
+		__sync_synchronize();
+	}while(seq!=sampler_seq);
+	if(d->samples==0) return -1;
+	return 0;
+}
+
+/*******************************************************************************
+* static rc_bmp_data_t hub_baro()
+*
+* latest sample from the sensor hub for a client, zeros if there isn't one
+*******************************************************************************/
+static rc_bmp_data_t hub_baro(){
+	rc_bmp_data_t d;
+	if(rc_hub_latest(RC_HUB_BARO, &d)) memset(&d, 0, sizeof(d));
+	return d;
+}
+
 /*******************************************************************************
 * float rc_bmp_get_temperature()
 *
@@ -296,6 +578,7 @@ int rc_read_barometer(){
 * function.
 *******************************************************************************/
 float rc_bmp_get_temperature(){
+	if(hub_client) return hub_baro().temp_c;
 	return data.temp;
 }
 
@@ -306,6 +589,7 @@ float rc_bmp_get_temperature(){
 * pascals that was read by the last call to the rc_read_barometer() function.
 *******************************************************************************/
 float rc_bmp_get_pressure_pa(){
+	if(hub_client) return hub_baro().pressure_pa;
 	return data.pressure;
 }
 
@@ -319,6 +603,7 @@ float rc_bmp_get_pressure_pa(){
 * and desire more accuracy. 
 *******************************************************************************/
 float rc_bmp_get_altitude_m(){
+	if(hub_client) return hub_baro().alt_m;
 	return data.alt;
 }
 
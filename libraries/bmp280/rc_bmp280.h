@@ -0,0 +1,9 @@
+/*******************************************************************************
+* rc_bmp280.h
+*
+* internal access to the barometer sampler for the vertical estimator, the
+* barometer functions for the user are in roboticscape.h
+*******************************************************************************/
+
+int bmp_try_get_data(rc_bmp_data_t* d);
+int bmp_sampler_running();
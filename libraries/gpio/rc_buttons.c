@@ -1,20 +1,18 @@
 /*******************************************************************************
 * rc_buttons.c
 *
-* 4 threads for managing the pause and press buttons
+* handlers for the pause and mode buttons, run from the gpio event thread
 *******************************************************************************/
 #define _GNU_SOURCE
 #include "../roboticscape.h"
 #include "../rc_defs.h"
 #include "../preprocessor_macros.h"
-#include <pthread.h>
-#include <errno.h>
+#include "../rc_lazy_init.h"
 #include <stdio.h>
-#include <poll.h>
-#include <unistd.h>
-#include <fcntl.h>
+#include <sched.h>
 
-#define POLL_BUF_LEN 1024
+#define BUTTON_DEBOUNCE_US	1500
+#define BUTTON_PRIORITY		(sched_get_priority_max(SCHED_FIFO)-5)
 
 // function pointers for button handlers
 void (*pause_pressed_func)(void)	= &rc_null_func;
@@ -24,215 +22,46 @@ void (*mode_released_func)(void)	= &rc_null_func;
 
 
 /*******************************************************************************
-* local thread function declarations
-*******************************************************************************/
-void* pause_pressed_handler(void* ptr);
-void* pause_released_handler(void* ptr);
-void* mode_pressed_handler(void* ptr);
-void* mode_released_handler(void* ptr);
-
-/*******************************************************************************
-* local thread structs
+* void button_event(int gpio, int value, uint64_t timestamp_ns)
+*
+* called by the gpio event thread once a button has settled, the buttons pull
+* the pin low when pressed
 *******************************************************************************/
-pthread_t pause_pressed_thread;
-pthread_t pause_released_thread;
-pthread_t mode_pressed_thread;
-pthread_t mode_released_thread;
-
+static void button_event(int gpio, int value, __unused uint64_t timestamp_ns){
+	if(gpio==PAUSE_BTN){
+		if(value==LOW) pause_pressed_func();
+		else pause_released_func();
+	}
+	else if(gpio==MODE_BTN){
+		if(value==LOW) mode_pressed_func();
+		else mode_released_func();
+	}
+}
 
 /*******************************************************************************
 *	int initialize_button_handlers()
 *
-*	start 4 threads to handle 4 interrupt routines for pressing and
-*	releasing the two buttons.
+*	register both buttons with the gpio event thread
 *******************************************************************************/
 int initialize_button_handlers(){
 
 	#ifdef DEBUG
 	printf("setting pause_pressed function\n");
 	#endif
-	rc_set_pause_pressed_func(&rc_null_func);
-
-	#ifdef DEBUG
-	printf("setting remaining button functions\n");
-	#endif
-	//rc_set_pause_released_func(&rc_null_func);
-	//rc_set_mode_pressed_func(&rc_null_func);
-	//rc_set_mode_released_func(&rc_null_func);
+	pause_pressed_func = &rc_null_func;
 	
 	#ifdef DEBUG
-	printf("starting button threads\n");
+	printf("watching button gpio events\n");
 	#endif
-	pthread_create(&pause_pressed_thread, NULL,	\
-				pause_pressed_handler, (void*) NULL);
-	pthread_create(&pause_released_thread, NULL,	\
-				pause_released_handler, (void*) NULL);
-	pthread_create(&mode_pressed_thread, NULL,		\
-					mode_pressed_handler, (void*) NULL);
-	pthread_create(&mode_released_thread, NULL,	\
-					mode_released_handler, (void*) NULL);
-
-	// apply priority to all threads
-	#ifdef DEBUG
-	printf("setting button thread priorities\n");
-	#endif
-	struct sched_param params;
-	params.sched_priority = sched_get_priority_max(SCHED_FIFO)-5;
-	pthread_setschedparam(pause_pressed_thread, SCHED_FIFO, &params);
-	pthread_setschedparam(pause_released_thread, SCHED_FIFO, &params);
-	pthread_setschedparam(mode_pressed_thread, SCHED_FIFO, &params);
-	pthread_setschedparam(mode_released_thread, SCHED_FIFO, &params);
-	 
-	return 0;
-}
-
-/*******************************************************************************
-*	void* pause_pressed_handler( __unused void* ptr)
-* 
-*	wait on falling edge of pause button
-*******************************************************************************/
-void* pause_pressed_handler( __unused void* ptr){
-	struct pollfd fdset[1];
-	char buf[POLL_BUF_LEN];
-	int gpio_fd = rc_gpio_fd_open(PAUSE_BTN);
-	fdset[0].fd = gpio_fd;
-	fdset[0].events = POLLPRI; // high-priority interrupt
-	// keep running until the program closes
-	while(rc_get_state() != EXITING) {
-		// system hangs here until FIFO interrupt
-		poll(fdset, 1, POLL_TIMEOUT);        
-		if (fdset[0].revents & POLLPRI) {
-			lseek(fdset[0].fd, 0, SEEK_SET);  
-			read(fdset[0].fd, buf, POLL_BUF_LEN);
-			// delay debouce
-			usleep(500); 
-			if(rc_get_pause_button()==PRESSED){
-				usleep(500);
-				if(rc_get_pause_button()==PRESSED){
-					usleep(500);
-					if(rc_get_pause_button()==PRESSED){
-						pause_pressed_func(); 
-					}
-				}
-			}
-			// purge any interrupts that may have stacked up
-			lseek(fdset[0].fd, 0, SEEK_SET);  
-			read(fdset[0].fd, buf, POLL_BUF_LEN);
-		}
-	}
-	rc_gpio_fd_close(gpio_fd);
-	return 0;
-}
-
-/*******************************************************************************
-* @ void* pause_released_handler( __unused void* ptr) 
-*
-* wait on rising edge of pause button
-*******************************************************************************/
-void* pause_released_handler( __unused void* ptr){
-	struct pollfd fdset[1];
-	char buf[POLL_BUF_LEN];
-	int gpio_fd = rc_gpio_fd_open(PAUSE_BTN);
-	fdset[0].fd = gpio_fd;
-	fdset[0].events = POLLPRI; // high-priority interrupt
-	// keep running until the program closes
-	while(rc_get_state() != EXITING) {
-		// system hangs here until FIFO interrupt
-		poll(fdset, 1, POLL_TIMEOUT);        
-		if (fdset[0].revents & POLLPRI) {
-			lseek(fdset[0].fd, 0, SEEK_SET);  
-			read(fdset[0].fd, buf, POLL_BUF_LEN);
-			// delay debouce
-			usleep(500); 
-			if(rc_get_pause_button()==RELEASED){
-				usleep(500);
-				if(rc_get_pause_button()==RELEASED){
-					usleep(500);
-					if(rc_get_pause_button()==RELEASED){
-						pause_released_func(); 
-					}
-				}
-			}
-			// purge any interrupts that may have stacked up
-			lseek(fdset[0].fd, 0, SEEK_SET);  
-			read(fdset[0].fd, buf, POLL_BUF_LEN);
-		}
-	}
-	rc_gpio_fd_close(gpio_fd);
-	return 0;
-}
-
-/*******************************************************************************
-*	void* mode_pressed_handler( __unused void* ptr) 
-*	wait on falling edge of mode button
-*******************************************************************************/
-void* mode_pressed_handler( __unused void* ptr){
-	struct pollfd fdset[1];
-	char buf[POLL_BUF_LEN];
-	int gpio_fd = rc_gpio_fd_open(MODE_BTN);
-	fdset[0].fd = gpio_fd;
-	fdset[0].events = POLLPRI; // high-priority interrupt
-	// keep running until the program closes
-	while(rc_get_state() != EXITING) {
-		// system hangs here until FIFO interrupt
-		poll(fdset, 1, POLL_TIMEOUT);        
-		if (fdset[0].revents & POLLPRI) {
-			lseek(fdset[0].fd, 0, SEEK_SET);  
-			read(fdset[0].fd, buf, POLL_BUF_LEN);
-			// delay debouce
-			usleep(500); 
-			if(rc_get_mode_button()==PRESSED){
-				usleep(500);
-				if(rc_get_mode_button()==PRESSED){
-					usleep(500);
-					if(rc_get_mode_button()==PRESSED){
-						mode_pressed_func(); 
-					}
-				}
-			}
-			// purge any interrupts that may have stacked up
-			lseek(fdset[0].fd, 0, SEEK_SET);  
-			read(fdset[0].fd, buf, POLL_BUF_LEN);
-		}
+	if(rc_gpio_event_watch(PAUSE_BTN, EDGE_BOTH, BUTTON_DEBOUNCE_US,\
+						BUTTON_PRIORITY, &button_event)<0){
+		return -1;
 	}
-	rc_gpio_fd_close(gpio_fd);
-	return 0;
-}
-
-/*******************************************************************************
-*	void* mode_released_handler( __unused void* ptr) 
-*	wait on rising edge of mode button
-*******************************************************************************/
-void* mode_released_handler( __unused void* ptr){
-	struct pollfd fdset[1];
-	char buf[POLL_BUF_LEN];
-	int gpio_fd = rc_gpio_fd_open(MODE_BTN);
-	fdset[0].fd = gpio_fd;
-	fdset[0].events = POLLPRI; // high-priority interrupt
-	// keep running until the program closes
-	while(rc_get_state() != EXITING) {
-		// system hangs here until FIFO interrupt
-		poll(fdset, 1, POLL_TIMEOUT);        
-		if (fdset[0].revents & POLLPRI) {
-			lseek(fdset[0].fd, 0, SEEK_SET);  
-			read(fdset[0].fd, buf, POLL_BUF_LEN);
-			// delay debouce
-			usleep(500); 
-			if(rc_get_mode_button()==RELEASED){
-				usleep(500);
-				if(rc_get_mode_button()==RELEASED){
-					usleep(500);
-					if(rc_get_mode_button()==RELEASED){
-						mode_released_func(); 
-					}
-				}
-			}
-			// purge any interrupts that may have stacked up
-			lseek(fdset[0].fd, 0, SEEK_SET);  
-			read(fdset[0].fd, buf, POLL_BUF_LEN);
-		}
+	if(rc_gpio_event_watch(MODE_BTN, EDGE_BOTH, BUTTON_DEBOUNCE_US,\
+						BUTTON_PRIORITY, &button_event)<0){
+		rc_gpio_event_unwatch(PAUSE_BTN);
+		return -1;
 	}
-	rc_gpio_fd_close(gpio_fd);
 	return 0;
 }
 
@@ -244,6 +73,8 @@ int rc_set_pause_pressed_func(void (*func)(void)){
 		printf("ERROR: trying to assign NULL pointer to paused_pressed_func\n");
 		return -1;
 	}
+	// start watching the buttons if rc_initialize_ex didn't
+	if(lazy_initialize(RC_INIT_BUTTONS)) return -1;
 	pause_pressed_func = func;
 	return 0;
 }
@@ -252,6 +83,7 @@ int rc_set_pause_released_func(void (*func)(void)){
 		printf("ERROR: trying to assign NULL pointer to paused_released_func\n");
 		return -1;
 	}
+	if(lazy_initialize(RC_INIT_BUTTONS)) return -1;
 	pause_released_func = func;
 	return 0;
 }
@@ -260,6 +92,7 @@ int rc_set_mode_pressed_func(void (*func)(void)){
 		printf("ERROR: trying to assign NULL pointer to mode_pressed_func\n");
 		return -1;
 	}
+	if(lazy_initialize(RC_INIT_BUTTONS)) return -1;
 	mode_pressed_func = func;
 	return 0;
 }
@@ -268,6 +101,7 @@ int rc_set_mode_released_func(void (*func)(void)){
 		printf("ERROR: trying to assign NULL pointer to mode_released_func\n");
 		return -1;
 	}
+	if(lazy_initialize(RC_INIT_BUTTONS)) return -1;
 	mode_released_func = func;
 	return 0;
 }
@@ -293,42 +127,11 @@ rc_button_state_t rc_get_mode_button(){
 }
 
 /*******************************************************************************
-* int wait_for_button_handlers_to_join()
+* int stop_button_handlers()
 *******************************************************************************/
-int wait_for_button_handlers_to_join(){
+int stop_button_handlers(){
 	int ret = 0;
-
-	//allow up to 3 seconds for thread cleanup
-	struct timespec thread_timeout;
-	clock_gettime(CLOCK_REALTIME, &thread_timeout);
-	thread_timeout.tv_sec += 3;
-	int thread_err = 0;
-	thread_err = pthread_timedjoin_np(pause_pressed_thread, NULL, \
-															&thread_timeout);
-	if(thread_err == ETIMEDOUT){
-		printf("WARNING: pause_pressed_thread exit timeout\n");
-		ret = -1;
-	}
-	thread_err = 0;
-	thread_err = pthread_timedjoin_np(pause_released_thread, NULL, \
-															&thread_timeout);
-	if(thread_err == ETIMEDOUT){
-		printf("WARNING: pause_released_thread exit timeout\n");
-		ret = -1;
-	}
-	thread_err = 0;
-	thread_err = pthread_timedjoin_np(mode_pressed_thread, NULL, \
-															&thread_timeout);
-	if(thread_err == ETIMEDOUT){
-		printf("WARNING: mode_pressed_thread exit timeout\n");
-		ret = -1;
-	}
-	thread_err = 0;
-	thread_err = pthread_timedjoin_np(mode_released_thread, NULL, \
-															&thread_timeout);
-	if(thread_err == ETIMEDOUT){
-		printf("WARNING: mode_released_thread exit timeout\n");
-		ret = -1;
-	}
+	ret |= rc_gpio_event_unwatch(PAUSE_BTN);
+	ret |= rc_gpio_event_unwatch(MODE_BTN);
 	return ret;
 }
@@ -7,4 +7,4 @@
 
 
 int initialize_button_handlers();
-int wait_for_button_handlers_to_join();
\ No newline at end of file
+int stop_button_handlers();
\ No newline at end of file
@@ -0,0 +1,612 @@
+/*******************************************************************************
+* rc_gpio_events.c
+*
+* Background threads that wait on edge events from the watched GPIO lines and
+* call the callback registered for each line. Lines watched at the same
+* priority share one thread running at that SCHED_FIFO priority, so lines at
+* different priorities never wait on each other's callbacks. Lines are
+* requested from the GPIO character device so each edge comes with a kernel
+* timestamp. On kernels without the character device, or for a line already
+* exported through sysfs, the sysfs value file is polled instead and the edge
+* is timestamped when the thread wakes up.
+*
+* Debouncing doesn't sleep. Every edge just records the new level and the
+* thread wakes up again once the line has been quiet for the debounce time,
+* at which point the callback is called if the level actually changed.
+*******************************************************************************/
+#define _GNU_SOURCE
+#include "../roboticscape.h"
+#include "../preprocessor_macros.h"
+#include "rc_gpio_events.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/utsname.h>
+#include <linux/gpio.h>
+
+#define MAX_WATCHED_LINES	16	// per thread
+#define MAX_EVENT_THREADS	4	// one per distinct priority
+#define MAX_DISPATCH		64	// callbacks queued in one wakeup
+#define EVENT_READ_LEN		16	// chardev events read at once
+#define JOIN_TIMEOUT_S		3
+
+typedef struct gpio_line_t{
+	int gpio;
+	int fd;					// chardev line event fd or sysfs value fd
+	int chardev;			// 1 if fd came from the character device
+	rc_pin_edge_t edge;		// edges passed to the callback
+	uint64_t debounce_ns;
+	rc_gpio_event_func_t func;
+	int stable;				// last debounced level
+	int pending;			// 1 while waiting for the line to settle
+	int pending_value;		// level after the most recent edge
+	uint64_t pending_first_ns;	// first edge since the line was stable
+	uint64_t pending_last_ns;	// most recent edge
+	int remove;				// set by rc_gpio_event_unwatch
+} gpio_line_t;
+
+// lines watched at one priority and the thread serving them, all guarded by
+// the thread's mutex except priority which never changes
+typedef struct gpio_thread_t{
+	int priority;
+	gpio_line_t lines[MAX_WATCHED_LINES];
+	int num_lines;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;	// signaled when lines are removed
+	int wake_fd;
+	pthread_t thread;
+	int shutdown;
+} gpio_thread_t;
+
+typedef struct gpio_dispatch_t{
+	rc_gpio_event_func_t func;
+	int gpio;
+	int value;
+	uint64_t timestamp_ns;
+} gpio_dispatch_t;
+
+// threads are only added while watching and removed by
+// stop_gpio_event_thread, both under threads_mutex
+static gpio_thread_t threads[MAX_EVENT_THREADS];
+static int num_threads = 0;
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int event_clock_realtime = -1;	// -1 until the kernel is checked
+
+
+/*******************************************************************************
+* int event_clock_is_realtime()
+*
+* The line event API used here has no way to ask which clock stamps the
+* events. Kernels before 5.7 use CLOCK_REALTIME and later ones
+* CLOCK_MONOTONIC, so decide once from the running kernel's version.
+*******************************************************************************/
+static int event_clock_is_realtime(){
+	struct utsname u;
+	int major, minor;
+	if(event_clock_realtime>=0) return event_clock_realtime;
+	event_clock_realtime = 0;
+	if(uname(&u)==0 && sscanf(u.release, "%d.%d", &major, &minor)==2){
+		if(major<5 || (major==5 && minor<7)) event_clock_realtime = 1;
+	}
+	return event_clock_realtime;
+}
+
+/*******************************************************************************
+* uint64_t kernel_ns_to_boot(uint64_t ts)
+*
+* shifts a line event timestamp onto the rc_nanos_since_boot() clock
+*******************************************************************************/
+static uint64_t kernel_ns_to_boot(uint64_t ts){
+	if(event_clock_is_realtime()){
+		ts -= rc_nanos_since_epoch() - rc_nanos_since_boot();
+	}
+	return ts;
+}
+
+/*******************************************************************************
+* int edge_wanted(rc_pin_edge_t edge, int value)
+*******************************************************************************/
+static int edge_wanted(rc_pin_edge_t edge, int value){
+	if(edge==EDGE_BOTH) return 1;
+	if(edge==EDGE_RISING) return value==1;
+	if(edge==EDGE_FALLING) return value==0;
+	return 0;
+}
+
+/*******************************************************************************
+* int open_gpio_chip(int bank)
+*
+* Finds the character device for a gpio bank. The sysfs gpiochip named after
+* the bank's base number shares a parent device with the /dev/gpiochipN we
+* want. If that can't be found assume the chips are numbered by bank.
+*******************************************************************************/
+static int open_gpio_chip(int bank){
+	char path[64];
+	DIR* dir;
+	struct dirent* ent;
+	int chip = bank;
+
+	snprintf(path, sizeof(path), "/sys/class/gpio/gpiochip%d/device", bank*32);
+	dir = opendir(path);
+	if(dir!=NULL){
+		while((ent=readdir(dir))!=NULL){
+			if(sscanf(ent->d_name, "gpiochip%d", &chip)==1) break;
+		}
+		closedir(dir);
+	}
+	snprintf(path, sizeof(path), "/dev/gpiochip%d", chip);
+	return open(path, O_RDONLY);
+}
+
+/*******************************************************************************
+* int request_chardev_line(gpio_line_t* line)
+*
+* Requests the line as an input with edge events from the character device.
+* Returns 0 on success, -1 if the character device can't be used, including
+* for a line exported through sysfs which is then watched through sysfs. A line
+* held by another program through the character device is reported and gives
+* -2 since sysfs can't have it either.
+*******************************************************************************/
+static int request_chardev_line(gpio_line_t* line){
+	struct gpioevent_request req;
+	struct gpiohandle_data data;
+	struct gpioline_info info;
+	int chip_fd, ret;
+
+	chip_fd = open_gpio_chip(line->gpio/32);
+	if(chip_fd<0) return -1;
+
+	memset(&req, 0, sizeof(req));
+	req.lineoffset = line->gpio%32;
+	req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	// debouncing needs both edges to see when the line settles
+	if(line->debounce_ns || line->edge==EDGE_BOTH){
+		req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+	}
+	else if(line->edge==EDGE_RISING) req.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+	else req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+	snprintf(req.consumer_label, sizeof(req.consumer_label), "roboticscape");
+
+	ret = ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req);
+	if(ret<0 && errno==EBUSY){
+		memset(&info, 0, sizeof(info));
+		info.line_offset = line->gpio%32;
+		if(ioctl(chip_fd, GPIO_GET_LINEINFO_IOCTL, &info)==0 && \
+					strcmp(info.consumer, "sysfs")!=0){
+			fprintf(stderr,"ERROR: gpio %d is already in use by %s\n", \
+						line->gpio, info.consumer[0] ? info.consumer : "another program");
+			close(chip_fd);
+			return -2;
+		}
+	}
+	close(chip_fd);
+	if(ret<0) return -1;
+
+	if(ioctl(req.fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data)<0){
+		close(req.fd);
+		return -1;
+	}
+	line->fd = req.fd;
+	line->chardev = 1;
+	line->stable = data.values[0];
+	return 0;
+}
+
+/*******************************************************************************
+* int request_sysfs_line(gpio_line_t* line)
+*
+* fallback for kernels without the gpio character device
+*******************************************************************************/
+static int request_sysfs_line(gpio_line_t* line){
+	char buf[4];
+	rc_pin_edge_t edge = line->edge;
+
+	if(line->debounce_ns) edge = EDGE_BOTH;
+	rc_gpio_export(line->gpio);
+	if(rc_gpio_set_dir(line->gpio, INPUT_PIN)<0) return -1;
+	if(rc_gpio_set_edge(line->gpio, edge)<0) return -1;
+	line->fd = rc_gpio_fd_open(line->gpio);
+	if(line->fd<0) return -1;
+	line->chardev = 0;
+	// reading the value also clears any edge already pending
+	lseek(line->fd, 0, SEEK_SET);
+	if(read(line->fd, buf, sizeof(buf))<1) buf[0]='0';
+	line->stable = buf[0]=='1';
+	return 0;
+}
+
+/*******************************************************************************
+* void line_edge(gpio_line_t* line, int value, uint64_t ts,
+*						gpio_dispatch_t* q, int* n)
+*
+* handles one edge, queueing the callback right away if not debounced
+*******************************************************************************/
+static void line_edge(gpio_line_t* line, int value, uint64_t ts,\
+											gpio_dispatch_t* q, int* n){
+	if(line->debounce_ns==0){
+		line->stable = value;
+		if(edge_wanted(line->edge, value) && *n<MAX_DISPATCH){
+			q[*n].func = line->func;
+			q[*n].gpio = line->gpio;
+			q[*n].value = value;
+			q[*n].timestamp_ns = ts;
+			(*n)++;
+		}
+		return;
+	}
+	if(!line->pending) line->pending_first_ns = ts;
+	line->pending = 1;
+	line->pending_value = value;
+	line->pending_last_ns = ts;
+}
+
+/*******************************************************************************
+* void read_line(gpio_line_t* line, gpio_dispatch_t* q, int* n)
+*
+* drains all edges waiting on a line's fd
+*******************************************************************************/
+static void read_line(gpio_line_t* line, gpio_dispatch_t* q, int* n){
+	struct gpioevent_data ev[EVENT_READ_LEN];
+	char buf[4];
+	int ret, i;
+
+	if(!line->chardev){
+		lseek(line->fd, 0, SEEK_SET);
+		if(read(line->fd, buf, sizeof(buf))<1) return;
+		// a short pulse may be over by now so with only one edge enabled
+		// trust the edge rather than the level
+		if(line->debounce_ns==0 && line->edge==EDGE_RISING) buf[0]='1';
+		else if(line->debounce_ns==0 && line->edge==EDGE_FALLING) buf[0]='0';
+		line_edge(line, buf[0]=='1', rc_nanos_since_boot(), q, n);
+		return;
+	}
+	ret = read(line->fd, ev, sizeof(ev));
+	if(ret<(int)sizeof(ev[0])) return;
+	for(i=0; i<ret/(int)sizeof(ev[0]); i++){
+		line_edge(line, ev[i].id==GPIOEVENT_EVENT_RISING_EDGE, \
+					kernel_ns_to_boot(ev[i].timestamp), q, n);
+	}
+}
+
+/*******************************************************************************
+* void settle_line(gpio_line_t* line, uint64_t now, gpio_dispatch_t* q, int* n)
+*
+* if a debounced line has been quiet long enough, accept its new level
+*******************************************************************************/
+static void settle_line(gpio_line_t* line, uint64_t now, gpio_dispatch_t* q,\
+																	int* n){
+	if(!line->pending || now < line->pending_last_ns+line->debounce_ns) return;
+	line->pending = 0;
+	if(line->pending_value==line->stable) return; // just a glitch
+	line->stable = line->pending_value;
+	if(edge_wanted(line->edge, line->stable) && *n<MAX_DISPATCH){
+		q[*n].func = line->func;
+		q[*n].gpio = line->gpio;
+		q[*n].value = line->stable;
+		q[*n].timestamp_ns = line->pending_first_ns;
+		(*n)++;
+	}
+}
+
+/*******************************************************************************
+* void remove_marked_lines(gpio_thread_t* t)
+*
+* closes and removes lines marked by rc_gpio_event_unwatch, call with the
+* thread's mutex held
+*******************************************************************************/
+static void remove_marked_lines(gpio_thread_t* t){
+	int i, j=0;
+	for(i=0; i<t->num_lines; i++){
+		if(t->lines[i].remove){
+			close(t->lines[i].fd);
+			continue;
+		}
+		if(i!=j) t->lines[j] = t->lines[i];
+		j++;
+	}
+	if(j!=t->num_lines){
+		t->num_lines = j;
+		pthread_cond_broadcast(&t->cond);
+	}
+}
+
+/*******************************************************************************
+* void* gpio_event_handler(void* ptr)
+*
+* body of each event thread, ptr is its gpio_thread_t
+*******************************************************************************/
+static void* gpio_event_handler(void* ptr){
+	gpio_thread_t* t = (gpio_thread_t*)ptr;
+	struct pollfd fds[MAX_WATCHED_LINES+1];
+	gpio_dispatch_t q[MAX_DISPATCH];
+	struct timespec timeout, *tp;
+	uint64_t now, deadline, wake;
+	int i, j, n, nfds;
+
+	pthread_mutex_lock(&t->mutex);
+	while(!t->shutdown){
+		remove_marked_lines(t);
+		// build the poll set and find the next debounce deadline
+		fds[0].fd = t->wake_fd;
+		fds[0].events = POLLIN;
+		wake = 0;
+		for(i=0; i<t->num_lines; i++){
+			fds[i+1].fd = t->lines[i].fd;
+			fds[i+1].events = t->lines[i].chardev ? POLLIN : POLLPRI;
+			fds[i+1].revents = 0;
+			if(t->lines[i].pending){
+				deadline = t->lines[i].pending_last_ns + t->lines[i].debounce_ns;
+				if(wake==0 || deadline<wake) wake = deadline;
+			}
+		}
+		nfds = t->num_lines+1;
+		tp = NULL;
+		if(wake){
+			now = rc_nanos_since_boot();
+			deadline = wake>now ? wake-now : 0;
+			timeout.tv_sec = deadline/1000000000;
+			timeout.tv_nsec = deadline%1000000000;
+			tp = &timeout;
+		}
+		pthread_mutex_unlock(&t->mutex);
+
+		ppoll(fds, nfds, tp, NULL);
+
+		pthread_mutex_lock(&t->mutex);
+		if(fds[0].revents & POLLIN){
+			uint64_t v;
+			read(t->wake_fd, &v, sizeof(v));
+		}
+		// lines may have been added while unlocked so match them up by fd,
+		// only this thread removes lines so the fds are still valid
+		n = 0;
+		for(i=1; i<nfds; i++){
+			if(!(fds[i].revents & (POLLIN|POLLPRI))) continue;
+			for(j=0; j<t->num_lines && t->lines[j].fd!=fds[i].fd; j++);
+			if(j<t->num_lines && !t->lines[j].remove){
+				read_line(&t->lines[j], q, &n);
+			}
+		}
+		now = rc_nanos_since_boot();
+		for(j=0; j<t->num_lines; j++){
+			if(!t->lines[j].remove) settle_line(&t->lines[j], now, q, &n);
+		}
+		pthread_mutex_unlock(&t->mutex);
+
+		// callbacks run unlocked so they may watch or unwatch lines
+		for(i=0; i<n; i++){
+			q[i].func(q[i].gpio, q[i].value, q[i].timestamp_ns);
+		}
+		pthread_mutex_lock(&t->mutex);
+	}
+	pthread_mutex_unlock(&t->mutex);
+	return NULL;
+}
+
+/*******************************************************************************
+* void wake_thread(gpio_thread_t* t)
+*******************************************************************************/
+static void wake_thread(gpio_thread_t* t){
+	uint64_t v = 1;
+	write(t->wake_fd, &v, sizeof(v));
+}
+
+/*******************************************************************************
+* gpio_thread_t* find_line(int gpio)
+*
+* returns the thread watching gpio or NULL, call with threads_mutex held
+*******************************************************************************/
+static gpio_thread_t* find_line(int gpio){
+	int i, j, found;
+	for(i=0; i<num_threads; i++){
+		pthread_mutex_lock(&threads[i].mutex);
+		found = 0;
+		for(j=0; j<threads[i].num_lines; j++){
+			if(threads[i].lines[j].gpio==gpio && !threads[i].lines[j].remove){
+				found = 1;
+			}
+		}
+		pthread_mutex_unlock(&threads[i].mutex);
+		if(found) return &threads[i];
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* gpio_thread_t* get_thread(int priority)
+*
+* Returns the thread serving priority, starting a new one if there isn't one
+* yet. Priority 0 runs as a normal thread, anything else as SCHED_FIFO. Call
+* with threads_mutex held. Returns NULL on failure.
+*******************************************************************************/
+static gpio_thread_t* get_thread(int priority){
+	struct sched_param params;
+	gpio_thread_t* t;
+	int i;
+
+	for(i=0; i<num_threads; i++){
+		if(threads[i].priority==priority) return &threads[i];
+	}
+	if(num_threads>=MAX_EVENT_THREADS){
+		fprintf(stderr,"ERROR in rc_gpio_event_watch, too many priorities in use\n");
+		return NULL;
+	}
+	t = &threads[num_threads];
+	memset(t, 0, sizeof(gpio_thread_t));
+	t->priority = priority;
+	t->wake_fd = eventfd(0, EFD_NONBLOCK);
+	if(t->wake_fd<0){
+		fprintf(stderr,"ERROR in rc_gpio_event_watch, can't create eventfd\n");
+		return NULL;
+	}
+	pthread_mutex_init(&t->mutex, NULL);
+	pthread_cond_init(&t->cond, NULL);
+	if(pthread_create(&t->thread, NULL, gpio_event_handler, t)){
+		close(t->wake_fd);
+		pthread_mutex_destroy(&t->mutex);
+		pthread_cond_destroy(&t->cond);
+		fprintf(stderr,"ERROR in rc_gpio_event_watch, can't start thread\n");
+		return NULL;
+	}
+	if(priority){
+		params.sched_priority = priority;
+		if(pthread_setschedparam(t->thread, SCHED_FIFO, &params)){
+			#ifdef DEBUG
+			printf("failed to set gpio event thread priority to %d\n", priority);
+			#endif
+		}
+	}
+	num_threads++;
+	return t;
+}
+
+/*******************************************************************************
+* int rc_gpio_event_watch(int gpio, rc_pin_edge_t edge, int debounce_us,
+*								int priority, rc_gpio_event_func_t func)
+*
+* Starts watching a gpio pin and calls func for each edge matching edge from
+* the event thread for priority. With debounce_us>0 the pin must hold its new
+* level for that long before func is called. priority is the SCHED_FIFO
+* priority of that thread, 0 leaves it as a normal thread.
+*******************************************************************************/
+int rc_gpio_event_watch(int gpio, rc_pin_edge_t edge, int debounce_us,\
+							int priority, rc_gpio_event_func_t func){
+	gpio_line_t line;
+	gpio_thread_t* t;
+	int ret;
+
+	if(unlikely(gpio<0 || gpio>127)){
+		fprintf(stderr,"ERROR in rc_gpio_event_watch, invalid gpio pin\n");
+		return -1;
+	}
+	if(unlikely(func==NULL || edge==EDGE_NONE || debounce_us<0 || priority<0)){
+		fprintf(stderr,"ERROR in rc_gpio_event_watch, invalid argument\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&threads_mutex);
+	if(find_line(gpio)!=NULL){
+		pthread_mutex_unlock(&threads_mutex);
+		fprintf(stderr,"ERROR in rc_gpio_event_watch, gpio %d already watched\n", gpio);
+		return -1;
+	}
+	t = get_thread(priority);
+	if(t==NULL){
+		pthread_mutex_unlock(&threads_mutex);
+		return -1;
+	}
+	pthread_mutex_lock(&t->mutex);
+	if(t->num_lines>=MAX_WATCHED_LINES){
+		pthread_mutex_unlock(&t->mutex);
+		pthread_mutex_unlock(&threads_mutex);
+		fprintf(stderr,"ERROR in rc_gpio_event_watch, too many lines watched\n");
+		return -1;
+	}
+	pthread_mutex_unlock(&t->mutex);
+
+	memset(&line, 0, sizeof(line));
+	line.gpio = gpio;
+	line.edge = edge;
+	line.debounce_ns = (uint64_t)debounce_us*1000;
+	line.func = func;
+	ret = request_chardev_line(&line);
+	if(ret==-1) ret = request_sysfs_line(&line);
+	if(ret<0){
+		pthread_mutex_unlock(&threads_mutex);
+		fprintf(stderr,"ERROR in rc_gpio_event_watch, can't get events for gpio %d\n", gpio);
+		return -1;
+	}
+	#ifdef DEBUG
+	printf("watching gpio %d through %s\n", gpio, line.chardev?"chardev":"sysfs");
+	#endif
+
+	pthread_mutex_lock(&t->mutex);
+	t->lines[t->num_lines] = line;
+	t->num_lines++;
+	wake_thread(t);
+	pthread_mutex_unlock(&t->mutex);
+	pthread_mutex_unlock(&threads_mutex);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_gpio_event_unwatch(int gpio)
+*
+* Stops watching a pin. Once this returns its callback won't be called again,
+* except when called from a callback on the same thread where removal happens
+* right after.
+*******************************************************************************/
+int rc_gpio_event_unwatch(int gpio){
+	gpio_thread_t* t;
+	int i;
+
+	pthread_mutex_lock(&threads_mutex);
+	t = find_line(gpio);
+	if(t==NULL){
+		pthread_mutex_unlock(&threads_mutex);
+		return -1;
+	}
+	pthread_mutex_lock(&t->mutex);
+	pthread_mutex_unlock(&threads_mutex);
+	for(i=0; i<t->num_lines; i++){
+		if(t->lines[i].gpio==gpio) t->lines[i].remove = 1;
+	}
+	wake_thread(t);
+	// threads are only freed by stop_gpio_event_thread so t stays valid
+	if(!pthread_equal(pthread_self(), t->thread)){
+		while(1){
+			for(i=0; i<t->num_lines && t->lines[i].gpio!=gpio; i++);
+			if(i==t->num_lines || t->shutdown) break;
+			pthread_cond_wait(&t->cond, &t->mutex);
+		}
+	}
+	pthread_mutex_unlock(&t->mutex);
+	return 0;
+}
+
+/*******************************************************************************
+* int stop_gpio_event_thread()
+*
+* stops the event threads and releases all watched lines, called by rc_cleanup
+*******************************************************************************/
+int stop_gpio_event_thread(){
+	struct timespec thread_timeout;
+	gpio_thread_t* t;
+	int i, j, ret = 0;
+
+	pthread_mutex_lock(&threads_mutex);
+	for(i=0; i<num_threads; i++){
+		t = &threads[i];
+		pthread_mutex_lock(&t->mutex);
+		t->shutdown = 1;
+		wake_thread(t);
+		pthread_cond_broadcast(&t->cond);
+		pthread_mutex_unlock(&t->mutex);
+	}
+
+	//allow up to 3 seconds for thread cleanup
+	clock_gettime(CLOCK_REALTIME, &thread_timeout);
+	thread_timeout.tv_sec += JOIN_TIMEOUT_S;
+	for(i=0; i<num_threads; i++){
+		t = &threads[i];
+		if(pthread_timedjoin_np(t->thread, NULL, &thread_timeout)==ETIMEDOUT){
+			printf("WARNING: gpio event thread exit timeout\n");
+			ret = -1;
+			continue;
+		}
+		for(j=0; j<t->num_lines; j++) close(t->lines[j].fd);
+		t->num_lines = 0;
+		close(t->wake_fd);
+	}
+	// a thread that didn't exit still points at its slot so keep them all
+	if(ret==0) num_threads = 0;
+	pthread_mutex_unlock(&threads_mutex);
+	return ret;
+}
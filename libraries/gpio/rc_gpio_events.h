@@ -0,0 +1,8 @@
+/*******************************************************************************
+* rc_gpio_events.h
+*
+* internal control of the gpio event thread, the watch functions for the user
+* are in roboticscape.h
+*******************************************************************************/
+
+int stop_gpio_event_thread();
@@ -1,6 +1,9 @@
 /*******************************************************************************
 * rc_gpio_setup.c
 * functions for initial setup of gpio pins. Not for use by the user.
+*
+* Pins are usually still exported and configured from the last run so each
+* one's current state is checked first and only what differs is written.
 *******************************************************************************/
 #include <stdio.h>
 #include "../rc_defs.h"
@@ -9,38 +12,141 @@
 #include <stdlib.h> // for system()
 #include <unistd.h>	
 #include <string.h> // for strcat()
+#include <fcntl.h>
 
 
-int setup_output_pin(int pin, int val){
+#define SYSFS_GPIO_DIR "/sys/class/gpio"
+#define MAX_BUF 64
 
-	if(rc_gpio_export(pin)){
-		fprintf(stderr,"ERROR: Failed to export gpio pin %d\n", pin);
-		return -1;
-	}
-	if(rc_gpio_set_dir(pin, OUTPUT_PIN)){
-		fprintf(stderr,"ERROR: Failed to set gpio pin %d as output\n", pin);
+// Output pins that were already exported as outputs only need their value
+// cleared, these are collected per bank and cleared in one register write.
+static uint32_t clear_mask[4];
+
+/*******************************************************************************
+* static int export_pin(int pin, int quiet)
+*
+* exports the pin unless it already is, quiet pins don't print errors
+*******************************************************************************/
+static int export_pin(int pin, int quiet){
+	int fd, len, ret;
+	char buf[MAX_BUF];
+
+	snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d", pin);
+	if(access(buf, F_OK)==0) return 0;
+	fd = open(SYSFS_GPIO_DIR "/export", O_WRONLY);
+	if(fd<0){
+		if(!quiet) perror("gpio/export");
 		return -1;
 	}
-	if(rc_gpio_set_value(pin, val)){
-		fprintf(stderr, "ERROR: Failed to set gpio pin %d value\n", pin);
+	len = snprintf(buf, sizeof(buf), "%d", pin);
+	ret = write(fd, buf, len);
+	close(fd);
+	if(ret!=len){
+		if(!quiet) fprintf(stderr,"ERROR: Failed to export gpio pin %d\n", pin);
 		return -1;
 	}
 	return 0;
 }
 
-int setup_input_pin(int pin){
+/*******************************************************************************
+* static int read_dir(int pin)
+*
+* returns OUTPUT_PIN or INPUT_PIN, -1 if the direction can't be read
+*******************************************************************************/
+static int read_dir(int pin){
+	int fd, len;
+	char buf[MAX_BUF];
+
+	snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/direction", pin);
+	fd = open(buf, O_RDONLY);
+	if(fd<0) return -1;
+	len = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	if(len<2) return -1;
+	if(strncmp(buf, "out", 3)==0) return OUTPUT_PIN;
+	if(strncmp(buf, "in", 2)==0) return INPUT_PIN;
+	return -1;
+}
 
-	if(rc_gpio_export(pin)){
-		fprintf(stderr,"ERROR: Failed to export gpio pin %d\n", pin);
+/*******************************************************************************
+* static int write_dir(int pin, const char* dir, int quiet)
+*******************************************************************************/
+static int write_dir(int pin, const char* dir, int quiet){
+	int fd, len, ret;
+	char buf[MAX_BUF];
+
+	snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/direction", pin);
+	fd = open(buf, O_WRONLY);
+	if(fd<0){
+		if(!quiet) perror("gpio/direction");
 		return -1;
 	}
-	if(rc_gpio_set_dir(pin, INPUT_PIN)){
-		fprintf(stderr,"ERROR: Failed to set gpio pin %d as output\n", pin);
+	len = strlen(dir);
+	ret = write(fd, dir, len);
+	close(fd);
+	if(ret!=len){
+		if(!quiet) fprintf(stderr,"ERROR: Failed to set gpio pin %d direction\n", pin);
 		return -1;
 	}
 	return 0;
 }
 
+/*******************************************************************************
+* static int setup_output_pin_ex(int pin, int val, int quiet)
+*
+* Exports the pin and makes it an output driving val. Pins which are already
+* outputs are left alone when val is HIGH or queued in clear_mask when LOW,
+* otherwise writing "high" or "low" sets the direction and value at once.
+*******************************************************************************/
+static int setup_output_pin_ex(int pin, int val, int quiet){
+	if(export_pin(pin, quiet)) return -1;
+	if(read_dir(pin)==OUTPUT_PIN){
+		if(val) return rc_gpio_set_value(pin, val);
+		clear_mask[pin/32] |= 1u<<(pin%32);
+		return 0;
+	}
+	return write_dir(pin, val ? "high" : "low", quiet);
+}
+
+int setup_output_pin(int pin, int val){
+	return setup_output_pin_ex(pin, val, 0);
+}
+
+/*******************************************************************************
+* int setup_input_pin(int pin)
+*******************************************************************************/
+int setup_input_pin(int pin){
+	if(export_pin(pin, 0)) return -1;
+	if(read_dir(pin)==INPUT_PIN) return 0;
+	return write_dir(pin, "in", 0);
+}
+
+/*******************************************************************************
+* static int flush_clear_mask()
+*
+* clears the queued output pins, one register write per bank with mmap or
+* one sysfs write per pin if mmap isn't available
+*******************************************************************************/
+static int flush_clear_mask(){
+	int bank, bit;
+	int ret = 0;
+	volatile uint32_t* regs;
+
+	for(bank=0; bank<4; bank++){
+		if(clear_mask[bank]==0) continue;
+		regs = rc_gpio_bank_mmap(bank);
+		if(regs!=NULL) rc_gpio_port_clear(regs, clear_mask[bank]);
+		else{
+			for(bit=0; bit<32; bit++){
+				if(!(clear_mask[bank] & (1u<<bit))) continue;
+				ret |= rc_gpio_set_value(bank*32+bit, LOW);
+			}
+		}
+		clear_mask[bank] = 0;
+	}
+	return ret;
+}
+
 
 int configure_gpio_pins(){
 	int mdir1a, mdir2b;
@@ -72,23 +178,8 @@ int configure_gpio_pins(){
 	// LEDs
 	// don't return error on these guys, might be controlled by kernel
 	// but mmap will still work. shut up errors too
-	int old_stderr;
-	FILE  *null_out;
-	// change stdout to null for this operation as the prussdrv.so
-	// functions are noisy
-	old_stderr = dup(STDERR_FILENO);
-	fflush(stderr);
-	null_out = fopen("/dev/null", "w");
-	dup2(fileno(null_out), STDERR_FILENO);
-	// configure the pins
-	setup_output_pin(RED_LED, LOW);
-	setup_output_pin(GRN_LED, LOW);
-	// put back stdout
-	fflush(stderr);
-	fclose(null_out);
-	dup2(old_stderr,STDERR_FILENO);
-	close(old_stderr);
-
+	setup_output_pin_ex(RED_LED, LOW, 1);
+	setup_output_pin_ex(GRN_LED, LOW, 1);
 
 	// MOTOR Direction and Standby pins
 	ret |= setup_output_pin(mdir1a, LOW);
@@ -107,14 +198,9 @@ int configure_gpio_pins(){
 	// servo power
 	ret |= setup_output_pin(SERVO_PWR, LOW);
 
-	// buttons
-	ret |= setup_input_pin(MODE_BTN); 
-	ret |= setup_input_pin(PAUSE_BTN);
-	rc_gpio_set_edge(MODE_BTN, EDGE_BOTH);
-	rc_gpio_set_edge(PAUSE_BTN, EDGE_BOTH);
-
-	// IMU
-	ret |= setup_input_pin(IMU_INTERRUPT_PIN);
+	// buttons and the IMU interrupt pin are requested by the gpio event
+	// threads from the character device, exporting them here would stop
+	// that and leave them on the slower sysfs path
 
 	// UART1, GPS, and SPI pins
 	// ret |= setup_input_pin(GPS_HEADER_PIN_3); 
@@ -125,6 +211,7 @@ int configure_gpio_pins(){
 	// ret |= setup_input_pin(SPI_HEADER_PIN_4);
 	// ret |= setup_input_pin(SPI_HEADER_PIN_5);
 
+	ret |= flush_clear_mask();
 
 	if(ret){
 		printf("WARNING: Failed to configure all gpio pins\n");
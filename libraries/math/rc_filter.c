@@ -205,6 +205,7 @@ float rc_march_filter(rc_filter_t* f, float new_input){
 		printf("ERROR in rc_march_filter, filter uninitialized\n");
 		return -1.0f;
 	}
+	RC_TRACE_BEGIN("rc_march_filter");
 	// log new input
 	rc_insert_new_ringbuf_value(&f->in_buf, new_input);
 	f->newest_input = new_input;
@@ -244,6 +245,7 @@ float rc_march_filter(rc_filter_t* f, float new_input){
 	rc_insert_new_ringbuf_value(&f->out_buf, new_out);
 	// increment steps
 	f->step++;
+	RC_TRACE_END("rc_march_filter");
 	return new_out;
 }
 
@@ -2,9 +2,11 @@
 * rc_mmap_gpio_adc.c
 *******************************************************************************/
 
+#include "../roboticscape.h"
 #include "rc_mmap_gpio_adc.h"
 #include "rc_mmap_gpio_adc_defs.h"
 #include "../preprocessor_macros.h"
+#include "../rc_defs.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,26 +17,63 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 
 
 volatile uint32_t *map; // pointer to /dev/mem
 int mapped = 0; // boolean to check if mem mapped
 int gpio_initialized = 0;
+volatile uint32_t* gpio_bank[4]; // register base of each gpio bank in map
+
+// continuous ADC sampling, see mmap_adc_start_continuous()
+typedef struct adc_ring_t{
+	uint16_t raw[ADC_RING_LEN];
+	uint64_t ts[ADC_RING_LEN];	// rc_nanos_since_boot() time of each sample
+	volatile uint32_t head;		// total samples written, only the thread writes
+} adc_ring_t;
+// filtered, decimated and scaled output of each channel
+typedef struct adc_out_ring_t{
+	float value[ADC_RING_LEN];
+	uint64_t ts[ADC_RING_LEN];
+	volatile uint32_t head;
+} adc_out_ring_t;
+static adc_ring_t adc_ring[ADC_CHANNELS];
+static adc_out_ring_t adc_out[ADC_CHANNELS];
+static rc_adc_channel_config_t adc_conf[ADC_CHANNELS];
+static int adc_conf_initialized = 0;
+static int adc_decim_count[ADC_CHANNELS];
+static int adc_step_ch[ADC_CHANNELS];	// channel converted by each step
+static uint64_t adc_period_ns;			// time between samples of one channel
+static volatile uint32_t adc_overruns;
+static volatile int adc_continuous_running = 0;
+static pthread_t adc_thread;
+static rc_loop_t adc_loop;
+static rc_loop_config_t adc_loop_config;
+static uint8_t adc_last_mask;			// settings to restart with
+static int adc_last_rate, adc_last_priority;
 int adc_initialized = 0;
 
 /*******************************************************************************
 *   Shared Map Function
 *******************************************************************************/
-// map /dev/mem if it hasn't been done already
+// map /dev/mem if it hasn't been done already, the gpio and adc may be
+// initialized from different threads at the same time
+static pthread_mutex_t map_mutex = PTHREAD_MUTEX_INITIALIZER;
 int init_mmap() {
 	if(mapped){
 		return 0;
 	}
+	pthread_mutex_lock(&map_mutex);
+	if(mapped){
+		pthread_mutex_unlock(&map_mutex);
+		return 0;
+	}
 	int fd = open("/dev/mem", O_RDWR);
 	errno=0;
 	if(unlikely(fd==-1)){
 		printf("Unable to open /dev/mem\n");
 		if(unlikely(errno==EPERM)) printf("Insufficient privileges\n");
+		pthread_mutex_unlock(&map_mutex);
 		return -1;
 	}
 	map = (uint32_t*)mmap(NULL, MMAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,\
@@ -42,9 +81,12 @@ int init_mmap() {
 	if(map == MAP_FAILED) {
 		close(fd);
 		printf("Unable to map /dev/mem\n");
+		pthread_mutex_unlock(&map_mutex);
 		return -1;
 	}
+	__sync_synchronize();
 	mapped = TRUE;
+	pthread_mutex_unlock(&map_mutex);
 	return 0;
 }
 
@@ -105,76 +147,72 @@ int initialize_mmap_gpio(){
 	len = snprintf(buf, sizeof(buf), "%d", 113);
 	write(fd, buf, len);
 	close(fd);
+
+	// look up the bank pointers once so the per-pin functions don't have to
+	gpio_bank[0] = map + (GPIO0-MMAP_OFFSET)/4;
+	gpio_bank[1] = map + (GPIO1-MMAP_OFFSET)/4;
+	gpio_bank[2] = map + (GPIO2-MMAP_OFFSET)/4;
+	gpio_bank[3] = map + (GPIO3-MMAP_OFFSET)/4;
 	
 	gpio_initialized=1;
 	return 0;
 }
 
+// returns a pointer to the registers of gpio bank 0-3 for the inline
+// rc_gpio_port_* functions in roboticscape.h
+volatile uint32_t* rc_gpio_bank_mmap(int bank){
+	if(unlikely(bank<0 || bank>3)){
+		printf("invalid gpio bank\n");
+		return NULL;
+	}
+	if(unlikely(initialize_mmap_gpio())){
+		return NULL;
+	}
+	return gpio_bank[bank];
+}
+
+// fill in a pin handle for the inline rc_gpio_pin_* functions
+int rc_gpio_pin_init(rc_gpio_pin_t* pin, int gpio){
+	if(unlikely(pin==NULL)){
+		printf("ERROR in rc_gpio_pin_init, received NULL pointer\n");
+		return -1;
+	}
+	if(unlikely(gpio<0 || gpio>127)){
+		printf("invalid gpio pin\n");
+		return -1;
+	}
+	pin->bank = rc_gpio_bank_mmap(gpio/32);
+	if(pin->bank==NULL) return -1;
+	pin->mask = 1u<<(gpio%32);
+	return 0;
+}
+
 // write HIGH or LOW to a pin
 // pinMUX must already be configured for output
 int rc_gpio_set_value_mmap(int pin, int state) {
-	if(initialize_mmap_gpio()){
+	if(unlikely(pin<0 || pin>127)){
+		printf("invalid gpio pin\n");
 		return -1;
 	}
-	if(pin<0 || pin>128){
-		printf("invalid gpio pin\n");
+	if(unlikely(!gpio_initialized) && initialize_mmap_gpio()){
 		return -1;
 	}
-	int bank = pin/32;
-	int id = pin - bank*32;
-	int bank_offset;
-	switch(bank){
-		case 0: 
-			bank_offset=GPIO0;
-			break;
-		case 1: 
-			bank_offset=GPIO1;
-			break;
-		case 2: 
-			bank_offset=GPIO2;
-			break;
-		case 3: 
-			bank_offset=GPIO3;
-			break;
-		default:
-			return -1;
-	}
-	//map[(bank_offset-MMAP_OFFSET+GPIO_OE)/4] &= ~(1<<p.bank_id);
-	if(state) map[(bank_offset-MMAP_OFFSET+GPIO_DATAOUT)/4] |= (1<<id);
-	else map[(bank_offset-MMAP_OFFSET+GPIO_DATAOUT)/4] &= ~(1<<id);
+	if(state) rc_gpio_port_set(gpio_bank[pin/32], 1u<<(pin%32));
+	else rc_gpio_port_clear(gpio_bank[pin/32], 1u<<(pin%32));
 	return 0;
 }
 
 // returns 1 or 0 for HIGH or LOW
 // pinMUX must already be configured for input
 int rc_gpio_get_value_mmap(int pin) {
-	if(initialize_mmap_gpio()){
+	if(unlikely(pin<0 || pin>127)){
+		printf("invalid gpio pin\n");
 		return -1;
 	}
-	if(pin<0 || pin>128){
-		printf("invalid gpio pin\n");
+	if(unlikely(!gpio_initialized) && initialize_mmap_gpio()){
 		return -1;
 	}
-	int bank = pin/32;
-	int id = pin - bank*32;
-	int bank_offset;
-	switch(bank){
-		case 0: 
-			bank_offset=GPIO0;
-			break;
-		case 1: 
-			bank_offset=GPIO1;
-			break;
-		case 2: 
-			bank_offset=GPIO2;
-			break;
-		case 3: 
-			bank_offset=GPIO3;
-			break;
-		default:
-			return -1;
-	}
-	return (map[(bank_offset-MMAP_OFFSET+GPIO_DATAIN)/4] & (1<<id))>>id;
+	return (rc_gpio_port_read(gpio_bank[pin/32])>>(pin%32)) & 1;
 }
 
 
@@ -255,8 +293,18 @@ int initialize_mmap_adc() {
 }
 
 
-// Read in from an analog pin with oneshot mode
+// Read in from an analog pin with oneshot mode, or return the latest sample
+// if continuous sampling is running. That fails for a channel which isn't
+// being sampled or has no sample yet.
 int mmap_adc_read_raw(int ch) {
+	if(unlikely(!adc_initialized) && initialize_mmap_adc()){
+		return -1;
+	}
+	if(adc_continuous_running){
+		int raw;
+		if(mmap_adc_latest(ch, &raw, NULL)==0) return raw;
+		return -1;
+	}
 		  
 	// clear the FIFO buffer just in case it's not empty
 	int output;
@@ -276,3 +324,369 @@ int mmap_adc_read_raw(int ch) {
 	return output;
 }
 
+
+
+/*******************************************************************************
+*   Continuous ADC sampling
+*
+* The step sequencer converts each requested channel in turn with every step
+* in SW continuous mode so it starts over as soon as the last step finishes.
+* The open delay of each step stretches the sequence out to the requested
+* rate. Samples are tagged with their step ID in FIFO0 which is drained by a
+* thread into a ring buffer per channel. The FIFO threshold interrupt can't
+* reach userspace through /dev/mem so the thread instead wakes up in the time
+* it takes the FIFO to get half full.
+*******************************************************************************/
+
+// drain the FIFO into the ring buffers, only called from the adc thread
+static void adc_drain_fifo(){
+	uint32_t buf[ADC_FIFO_LEN];
+	int n_ch[ADC_CHANNELS] = {0};
+	int k_ch[ADC_CHANNELS] = {0};
+	int k_out[ADC_CHANNELS] = {0};
+	uint64_t now, ts;
+	int i, n, ch, step;
+	uint32_t head;
+	adc_ring_t* r;
+	adc_out_ring_t* o;
+	rc_adc_channel_config_t* c;
+	float v;
+
+	// overrun means samples were lost, count it and clear the flag
+	if(map[(ADC_IRQSTATUS_RAW-MMAP_OFFSET)/4] & ADC_IRQ_FIFO0_OVERRUN){
+		adc_overruns++;
+		map[(ADC_IRQSTATUS-MMAP_OFFSET)/4] = ADC_IRQ_FIFO0_OVERRUN;
+	}
+	n = map[(FIFO0COUNT-MMAP_OFFSET)/4] & FIFO_COUNT_MASK;
+	if(n>ADC_FIFO_LEN) n = ADC_FIFO_LEN;
+	now = rc_nanos_since_boot();
+	for(i=0; i<n; i++){
+		buf[i] = map[(ADC_FIFO0DATA-MMAP_OFFSET)/4];
+		step = (buf[i]>>ADC_FIFO_ID_SHIFT) & ADC_FIFO_ID_MASK;
+		if(step<ADC_CHANNELS) n_ch[adc_step_ch[step]]++;
+	}
+	// the newest sample of each channel was taken about now and the ones
+	// before it one sample period apart
+	for(i=0; i<n; i++){
+		step = (buf[i]>>ADC_FIFO_ID_SHIFT) & ADC_FIFO_ID_MASK;
+		if(step>=ADC_CHANNELS) continue;
+		ch = adc_step_ch[step];
+		r = &adc_ring[ch];
+		head = r->head + k_ch[ch];
+		ts = now - (n_ch[ch]-1-k_ch[ch])*adc_period_ns;
+		r->raw[head%ADC_RING_LEN] = buf[i] & ADC_FIFO_MASK;
+		r->ts[head%ADC_RING_LEN] = ts;
+
+		// filter every sample then keep one in every decimation
+		c = &adc_conf[ch];
+		v = (buf[i] & ADC_FIFO_MASK) * 1.8f / 4095.0f;
+		if(c->filter!=NULL) v = rc_march_filter(c->filter, v);
+		if(++adc_decim_count[ch] >= c->decimation){
+			adc_decim_count[ch] = 0;
+			o = &adc_out[ch];
+			head = o->head + k_out[ch];
+			o->value[head%ADC_RING_LEN] = (v*c->scale) + c->offset;
+			o->ts[head%ADC_RING_LEN] = ts;
+			k_out[ch]++;
+		}
+		k_ch[ch]++;
+	}
+	__sync_synchronize();
+	for(ch=0; ch<ADC_CHANNELS; ch++){
+		if(k_ch[ch]) adc_ring[ch].head += k_ch[ch];
+		if(k_out[ch]) adc_out[ch].head += k_out[ch];
+	}
+}
+
+// thread draining the FIFO at adc_loop_config.rate_hz, its priority was
+// already set when it was created
+static void* adc_drain_loop(__attribute__ ((unused)) void* ptr){
+	if(rc_loop_init(&adc_loop, adc_loop_config)) return NULL;
+	while(adc_continuous_running){
+		adc_drain_fifo();
+		rc_loop_wait(&adc_loop);
+	}
+	return NULL;
+}
+
+// default pipeline settings, the battery and DC jack channels are scaled by
+// their voltage dividers
+rc_adc_channel_config_t mmap_adc_default_config(int ch){
+	rc_adc_channel_config_t conf;
+	conf.hw_avg = 8;
+	conf.decimation = 1;
+	conf.filter = NULL;
+	conf.scale = 1.0f;
+	conf.offset = 0.0f;
+	if(ch==LIPO_ADC_CH){
+		conf.scale = V_DIV_RATIO;
+		conf.offset = LIPO_OFFSET;
+	}
+	else if(ch==DC_JACK_ADC_CH){
+		conf.scale = V_DIV_RATIO;
+		conf.offset = DC_JACK_OFFSET;
+	}
+	return conf;
+}
+
+static void init_adc_conf(){
+	int ch;
+	if(adc_conf_initialized) return;
+	for(ch=0; ch<ADC_CHANNELS; ch++) adc_conf[ch] = mmap_adc_default_config(ch);
+	adc_conf_initialized = 1;
+}
+
+// hardware averaging count to STEPCONFIG bits, -1 if not a valid count
+static int adc_avg_bits(int avg){
+	switch(avg){
+	case 1:  return ADC_AVG1;
+	case 2:  return ADC_AVG2;
+	case 4:  return ADC_AVG4;
+	case 8:  return ADC_AVG8;
+	case 16: return ADC_AVG16;
+	default: return -1;
+	}
+}
+
+// Set the pipeline for one channel. Takes effect immediately by restarting
+// continuous sampling if it's running.
+int mmap_adc_set_config(int ch, rc_adc_channel_config_t conf){
+	if(unlikely(ch<0 || ch>=ADC_CHANNELS)) return -1;
+	if(adc_avg_bits(conf.hw_avg)<0){
+		printf("ERROR in mmap_adc_set_config, hw_avg must be 1,2,4,8, or 16\n");
+		return -1;
+	}
+	if(conf.decimation<1){
+		printf("ERROR in mmap_adc_set_config, decimation must be >=1\n");
+		return -1;
+	}
+	if(conf.filter!=NULL && conf.filter->initialized!=1){
+		printf("ERROR in mmap_adc_set_config, filter not initialized\n");
+		return -1;
+	}
+	init_adc_conf();
+	if(!adc_continuous_running){
+		adc_conf[ch] = conf;
+		return 0;
+	}
+	mmap_adc_stop_continuous();
+	adc_conf[ch] = conf;
+	return mmap_adc_start_continuous(adc_last_mask, adc_last_rate,\
+														adc_last_priority);
+}
+
+// Put the step sequencer in continuous mode converting every channel in
+// ch_mask (bit n for AIN n) rate_hz times per second each, and start the
+// drain thread at SCHED_FIFO priority if priority>0.
+int mmap_adc_start_continuous(uint8_t ch_mask, int rate_hz, int priority){
+	static uint64_t drain_ns;
+	pthread_attr_t attr;
+	struct sched_param params;
+	int steps = 0;
+	int i, ch;
+	uint32_t round_clks, conv_clks = 0, open_delay, out;
+
+	if(adc_continuous_running) mmap_adc_stop_continuous();
+	if(initialize_mmap_adc()) return -1;
+	init_adc_conf();
+	for(ch=0; ch<ADC_CHANNELS; ch++){
+		if(ch_mask & (1<<ch)){
+			adc_step_ch[steps++] = ch;
+			conv_clks += adc_conf[ch].hw_avg*ADC_CLKS_PER_SAMPLE;
+		}
+	}
+	if(steps==0 || rate_hz<1){
+		printf("ERROR in mmap_adc_start_continuous, invalid channels or rate\n");
+		return -1;
+	}
+	// each step takes its open delay plus ADC_CLKS_PER_SAMPLE per average,
+	// spread the time left over in each round evenly across the steps
+	round_clks = ADC_CLK_HZ/(uint32_t)rate_hz;
+	if(round_clks < conv_clks){
+		printf("ERROR in mmap_adc_start_continuous, %dhz too fast for %d channels\n",\
+															rate_hz, steps);
+		return -1;
+	}
+	open_delay = (round_clks-conv_clks)/steps;
+	if(open_delay>ADC_OPEN_DELAY_MAX){
+		printf("ERROR in mmap_adc_start_continuous, %dhz too slow\n", rate_hz);
+		return -1;
+	}
+	adc_period_ns = ((uint64_t)(open_delay*steps+conv_clks)*1000000000)/ADC_CLK_HZ;
+	adc_last_mask = ch_mask;
+	adc_last_rate = rate_hz;
+	adc_last_priority = priority;
+
+	// reconfigure with the ADC disabled
+	map[(ADC_CTRL-MMAP_OFFSET)/4] &= ~ADC_CTRL_ENABLE;
+	map[(ADC_CTRL-MMAP_OFFSET)/4] |= ADC_STEPCONFIG_WRITE_PROTECT_OFF | \
+															ADC_STEP_ID_TAG;
+	map[(ADC_CLKDIV-MMAP_OFFSET)/4] = (ADC_INPUT_CLK_HZ/ADC_CLK_HZ)-1;
+	for(i=0; i<steps; i++){
+		map[(ADCSTEPCONFIG(i)-MMAP_OFFSET)/4] = \
+			adc_step_ch[i]<<ADC_SEL_INP_SHIFT | \
+			adc_avg_bits(adc_conf[adc_step_ch[i]].hw_avg) | ADC_SW_CONTINUOUS;
+		map[(ADCSTEPDELAY(i)-MMAP_OFFSET)/4] = open_delay;
+	}
+	// clear out old samples and the overrun flag
+	while(map[(FIFO0COUNT-MMAP_OFFSET)/4] & FIFO_COUNT_MASK){
+		out = map[(ADC_FIFO0DATA-MMAP_OFFSET)/4];
+	}
+	(void)out;
+	map[(ADC_IRQSTATUS-MMAP_OFFSET)/4] = ADC_IRQ_FIFO0_OVERRUN;
+	for(ch=0; ch<ADC_CHANNELS; ch++){
+		adc_ring[ch].head = 0;
+		adc_out[ch].head = 0;
+		adc_decim_count[ch] = 0;
+		if(adc_conf[ch].filter!=NULL) rc_reset_filter(adc_conf[ch].filter);
+	}
+	adc_overruns = 0;
+
+	// steps are bits 1-n of STEPENABLE, bit 0 is the touchscreen charge step
+	map[(ADC_STEPENABLE-MMAP_OFFSET)/4] = ((1<<steps)-1)<<1;
+	map[(ADC_CTRL-MMAP_OFFSET)/4] |= ADC_CTRL_ENABLE;
+
+	// wake up when the FIFO should be half full but at least every 20ms so
+	// the latest values stay fresh
+	drain_ns = ((uint64_t)(ADC_FIFO_LEN/2))*adc_period_ns/steps;
+	if(drain_ns>ADC_DRAIN_MAX_NS) drain_ns = ADC_DRAIN_MAX_NS;
+	if(drain_ns<ADC_DRAIN_MIN_NS) drain_ns = ADC_DRAIN_MIN_NS;
+
+	adc_loop_config = rc_loop_default_config();
+	adc_loop_config.rate_hz = 1000000000.0f/drain_ns;
+	adc_continuous_running = 1;
+	pthread_attr_init(&attr);
+	if(priority>0){
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		params.sched_priority = priority;
+		pthread_attr_setschedparam(&attr, &params);
+	}
+	if(pthread_create(&adc_thread, &attr, adc_drain_loop, NULL)){
+		printf("ERROR in mmap_adc_start_continuous, failed to start thread\n");
+		pthread_attr_destroy(&attr);
+		adc_continuous_running = 0;
+		mmap_adc_stop_continuous();
+		return -1;
+	}
+	pthread_attr_destroy(&attr);
+	#ifdef DEBUG
+	printf("adc continuous: %d steps, open delay %d, drain every %lluns\n",\
+				steps, open_delay, (unsigned long long)drain_ns);
+	#endif
+	return 0;
+}
+
+// stop the drain thread and put every step back in one-shot mode
+int mmap_adc_stop_continuous(){
+	int i, out;
+	if(adc_continuous_running){
+		adc_continuous_running = 0;
+		pthread_join(adc_thread, NULL);
+	}
+	if(!adc_initialized) return 0;
+	map[(ADC_CTRL-MMAP_OFFSET)/4] &= ~ADC_CTRL_ENABLE;
+	map[(ADC_STEPENABLE-MMAP_OFFSET)/4] = 0;
+	map[(ADC_CTRL-MMAP_OFFSET)/4] &= ~ADC_STEP_ID_TAG;
+	for(i=0; i<ADC_CHANNELS; i++){
+		map[(ADCSTEPCONFIG(i)-MMAP_OFFSET)/4] = i<<ADC_SEL_INP_SHIFT | \
+											ADC_AVG8 | ADC_SW_ONESHOT;
+		map[(ADCSTEPDELAY(i)-MMAP_OFFSET)/4] = 0;
+	}
+	map[(ADC_CTRL-MMAP_OFFSET)/4] |= ADC_CTRL_ENABLE;
+	while(map[(FIFO0COUNT-MMAP_OFFSET)/4] & FIFO_COUNT_MASK){
+		out = map[(ADC_FIFO0DATA-MMAP_OFFSET)/4];
+	}
+	(void)out;
+	return 0;
+}
+
+// latest raw sample and its timestamp, never blocks. Returns -1 if the
+// channel has no samples yet or continuous sampling is stopped.
+int mmap_adc_latest(int ch, int* raw, uint64_t* timestamp_ns){
+	uint32_t head;
+	adc_ring_t* r;
+	if(unlikely(ch<0 || ch>=ADC_CHANNELS || !adc_continuous_running)) return -1;
+	r = &adc_ring[ch];
+	do{
+		head = r->head;
+		if(head==0) return -1;
+		__sync_synchronize();
+		*raw = r->raw[(head-1)%ADC_RING_LEN];
+		if(timestamp_ns!=NULL) *timestamp_ns = r->ts[(head-1)%ADC_RING_LEN];
+		__sync_synchronize();
+	// the slot is only reused after a full lap of the ring
+	}while(r->head-head >= ADC_RING_LEN-1);
+	return 0;
+}
+
+// copy up to n of the newest samples, oldest first. Returns how many were
+// copied.
+int mmap_adc_read_buffer(int ch, int* raw, uint64_t* timestamp_ns, int n){
+	uint32_t head, start, i;
+	adc_ring_t* r;
+	if(unlikely(ch<0 || ch>=ADC_CHANNELS || n<0 || !adc_continuous_running)){
+		return -1;
+	}
+	if(n>ADC_RING_LEN/2) n = ADC_RING_LEN/2;
+	r = &adc_ring[ch];
+	do{
+		head = r->head;
+		if((uint32_t)n>head) n = head;
+		start = head-n;
+		__sync_synchronize();
+		for(i=0; i<(uint32_t)n; i++){
+			raw[i] = r->raw[(start+i)%ADC_RING_LEN];
+			if(timestamp_ns!=NULL) timestamp_ns[i] = r->ts[(start+i)%ADC_RING_LEN];
+		}
+		__sync_synchronize();
+	// retry if the thread lapped the part we copied
+	}while(r->head-head >= (uint32_t)(ADC_RING_LEN-n));
+	return n;
+}
+
+// latest output of a channel's pipeline, never blocks. Returns -1 if there
+// is no output yet or continuous sampling is stopped.
+int mmap_adc_get_value(int ch, float* value, uint64_t* timestamp_ns){
+	uint32_t head;
+	adc_out_ring_t* o;
+	if(unlikely(ch<0 || ch>=ADC_CHANNELS || !adc_continuous_running)) return -1;
+	o = &adc_out[ch];
+	do{
+		head = o->head;
+		if(head==0) return -1;
+		__sync_synchronize();
+		*value = o->value[(head-1)%ADC_RING_LEN];
+		if(timestamp_ns!=NULL) *timestamp_ns = o->ts[(head-1)%ADC_RING_LEN];
+		__sync_synchronize();
+	}while(o->head-head >= ADC_RING_LEN-1);
+	return 0;
+}
+
+// copy up to n of the newest pipeline outputs, oldest first
+int mmap_adc_read_values(int ch, float* value, uint64_t* timestamp_ns, int n){
+	uint32_t head, start, i;
+	adc_out_ring_t* o;
+	if(unlikely(ch<0 || ch>=ADC_CHANNELS || n<0 || !adc_continuous_running)){
+		return -1;
+	}
+	if(n>ADC_RING_LEN/2) n = ADC_RING_LEN/2;
+	o = &adc_out[ch];
+	do{
+		head = o->head;
+		if((uint32_t)n>head) n = head;
+		start = head-n;
+		__sync_synchronize();
+		for(i=0; i<(uint32_t)n; i++){
+			value[i] = o->value[(start+i)%ADC_RING_LEN];
+			if(timestamp_ns!=NULL) timestamp_ns[i] = o->ts[(start+i)%ADC_RING_LEN];
+		}
+		__sync_synchronize();
+	}while(o->head-head >= (uint32_t)(ADC_RING_LEN-n));
+	return n;
+}
+
+// number of times the FIFO overflowed since continuous sampling started
+int mmap_adc_get_overruns(){
+	return adc_overruns;
+}
@@ -17,14 +17,34 @@ Big thanks to Ethan Hayon for the GPIO code
 #define HIGH 1
 #define LOW  0 
 
+#include <stdint.h>
+#include "../roboticscape.h"
+
 
 // GPIO
 int initialize_mmap_gpio();
 
 
 // ADC
+#define ADC_CHANNELS		8
+#define ADC_RING_LEN		256		// samples kept per channel
+#define ADC_INPUT_CLK_HZ	24000000
+#define ADC_CLK_HZ			3000000	// max ADC clock from the datasheet
+#define ADC_CLKS_PER_SAMPLE	15		// 1 sample + 13 conversion + 1 clock
+#define ADC_DRAIN_MIN_NS	1000000
+#define ADC_DRAIN_MAX_NS	20000000
+
 int initialize_mmap_adc();
 int mmap_adc_read_raw(int ch);
+int mmap_adc_start_continuous(uint8_t ch_mask, int rate_hz, int priority);
+int mmap_adc_stop_continuous();
+int mmap_adc_latest(int ch, int* raw, uint64_t* timestamp_ns);
+int mmap_adc_read_buffer(int ch, int* raw, uint64_t* timestamp_ns, int n);
+int mmap_adc_get_overruns();
+rc_adc_channel_config_t mmap_adc_default_config(int ch);
+int mmap_adc_set_config(int ch, rc_adc_channel_config_t conf);
+int mmap_adc_get_value(int ch, float* value, uint64_t* timestamp_ns);
+int mmap_adc_read_values(int ch, float* value, uint64_t* timestamp_ns, int n);
 
 
 #endif
@@ -58,12 +58,28 @@
 #define ADC_AVG16 (0b100 << 2)
 
 #define ADC_SW_ONESHOT 0b00
+#define ADC_SW_CONTINUOUS 0b01
 #define FIFO0COUNT (ADC_TSC+0xE4)
 #define FIFO_COUNT_MASK 0b01111111
 
 #define ADC_FIFO0DATA (ADC_TSC+0x100)
 #define ADC_FIFO_MASK (0xFFF)
 
+// continuous sampling
+#define ADC_IRQSTATUS_RAW (ADC_TSC+0x24)
+#define ADC_IRQSTATUS (ADC_TSC+0x28)
+#define ADC_IRQ_FIFO0_OVERRUN (0x01<<3)
+#define ADC_CLKDIV (ADC_TSC+0x4C)
+#define ADC_CTRL_ENABLE (0x01)
+#define ADC_STEP_ID_TAG (0x01<<1)
+#define ADCSTEPCONFIG(n) (ADCSTEPCONFIG1+(n)*8)	// n is 0 for step 1
+#define ADCSTEPDELAY(n)  (ADCSTEPDELAY1+(n)*8)
+#define ADC_SEL_INP_SHIFT 19
+#define ADC_FIFO_ID_SHIFT 16
+#define ADC_FIFO_ID_MASK (0xF)
+#define ADC_FIFO_LEN 64
+#define ADC_OPEN_DELAY_MAX (0x3FFFF)
+
 #define TRUE 1
 #define FALSE 0
 
@@ -5,6 +5,7 @@
 #include "rc_mmap_pwmss.h"
 #include "rc_tipwmss.h"
 #include "../preprocessor_macros.h"
+#include "../roboticscape.h"	// for rc_nanos_since_boot
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,6 +17,7 @@
 #include <unistd.h>
 #include <math.h>
 #include <errno.h>
+#include <pthread.h>
 
 volatile char *cm_per_base;
 int cm_per_mapped=0;
@@ -24,21 +26,45 @@ int pwmss_mapped[3] = {0,0,0}; // to record which subsystems have been mapped
 int eqep_initialized[3] = {0,0,0};
 int pwm_initialized[3] = {0,0,0};
 
+// eQEP velocity defaults. Capture timer ticks every 1.28us and overflows after
+// 84ms, the capture period spans one full quadrature cycle of 4 counts.
+#define EQEP_SYSCLK_HZ			100000000
+#define EQEP_DEFAULT_UNIT_US	10000
+#define EQEP_DEFAULT_CCPS		7
+#define EQEP_DEFAULT_UPPS		2
+// capture periods shorter than this lose resolution, use position instead
+#define EQEP_MIN_CAPTURE_TICKS	100
+// QEPSTS bits
+#define QEPSTS_UPEVNT	(0x0001 << 7)
+#define QEPSTS_QDF		(0x0001 << 5)
+#define QEPSTS_COEF		(0x0001 << 3)
+#define QEPSTS_CDEF		(0x0001 << 2)
+
+// eHRPWM time base is clocked from the 100mhz SYSCLKOUT through two dividers
+#define PWM_SYSCLK_HZ			100000000
+#define PWM_MAX_PRD				0xFFFF
+// dual channel updates wait if the counter is this close to wrapping
+#define PWM_ATOMIC_MARGIN_NS	2000
+#define PWM_REG(ss,reg)	(*(volatile uint16_t*)(pwm_base[ss]+PWM_OFFSET+(reg)))
+
+static int pwm_tbclk_hz[3] = {0,0,0};
+
+static eqep_config_t eqep_config[3];
+// per-channel state for velocity measurement
+static int eqep_cap_valid[3] = {0,0,0};
+static int eqep_last_latch_pos[3];
+static uint64_t eqep_last_latch_ns[3] = {0,0,0};
+static float eqep_unit_velocity[3] = {0,0,0};
+static int eqep_unit_timers_synced = 0;
+static uint64_t eqep_unit_sync_ns;
+
 /********************************************
 *  PWMSS Mapping
 *********************************************/
 // maps the base of each PWM subsystem into an array
 // this is used by eQEP and PWM
 // returns immediately if this has already been done 
-int map_pwmss(int ss){
-	if(ss>2 || ss<0){
-		printf("error: PWM subsystem must be 0, 1, or 2\n");
-		return -1;
-	}
-	//return 0 if it's already been mapped.
-	if(pwmss_mapped[ss]){
-		return 0;
-	}
+static int map_pwmss_locked(int ss){
 	
 	//open /dev/mem file pointer for mmap
 	#ifdef DEBUG
@@ -113,10 +139,11 @@ int map_pwmss(int ss){
 		printf("Unable to mmap pwm \n");
 		return -1;
 	}
-	pwmss_mapped[ss]=1;
 	
 	// enable clock from PWMSS
 	*(uint32_t*)(pwm_base[ss]+PWMSS_CLKCONFIG) |= 0x010;
+	__sync_synchronize();
+	pwmss_mapped[ss]=1;
 	
 	close(dev_mem);
 	#ifdef DEBUG
@@ -125,22 +152,98 @@ int map_pwmss(int ss){
 	return 0;
 }
 
+// the encoders and motors can be initialized from different threads, the
+// CM_PER mapping and clock enable must only be done by one at a time
+static pthread_mutex_t pwmss_mutex = PTHREAD_MUTEX_INITIALIZER;
+int map_pwmss(int ss){
+	int ret;
+	if(ss>2 || ss<0){
+		printf("error: PWM subsystem must be 0, 1, or 2\n");
+		return -1;
+	}
+	//return 0 if it's already been mapped.
+	if(pwmss_mapped[ss]){
+		return 0;
+	}
+	pthread_mutex_lock(&pwmss_mutex);
+	if(pwmss_mapped[ss]) ret = 0;
+	else ret = map_pwmss_locked(ss);
+	pthread_mutex_unlock(&pwmss_mutex);
+	return ret;
+}
+
 /********************************************
 *  eQEP
 *********************************************/
 
+// writes the unit timer period and capture prescalers from eqep_config[ss]
+// and resets the velocity measurement state
+static void config_eqep_velocity(int ss){
+	// unit timer latches QPOSLAT, QCPRDLAT and QCTMRLAT every unit period
+	*(uint32_t*)(pwm_base[ss]+EQEP_OFFSET+QUPRD) = \
+				eqep_config[ss].unit_period_us*(EQEP_SYSCLK_HZ/1000000);
+	// capture unit must be disabled while changing prescalers
+	*(uint16_t*)(pwm_base[ss]+EQEP_OFFSET+QCAPCTL) = 0;
+	*(uint16_t*)(pwm_base[ss]+EQEP_OFFSET+QCAPCTL) = \
+				(eqep_config[ss].capture_prescaler<<4) | \
+				eqep_config[ss].event_prescaler;
+	*(uint16_t*)(pwm_base[ss]+EQEP_OFFSET+QCAPCTL) |= CEN;
+	// clear sticky capture status, first period after this is not valid
+	*(uint16_t*)(pwm_base[ss]+EQEP_OFFSET+QEPSTS) = \
+				QEPSTS_UPEVNT|QEPSTS_COEF|QEPSTS_CDEF;
+	eqep_cap_valid[ss] = 0;
+	eqep_last_latch_ns[ss] = 0;
+	eqep_unit_velocity[ss] = 0.0f;
+	eqep_unit_timers_synced = 0;
+}
+
 // init_eqep takes care of sanity checks and returns quickly
 // if nothing is to be initialized.
 int init_eqep(int ss){
+	return init_eqep_config(ss, NULL);
+}
+
+// same as init_eqep but also sets up the unit timer and capture unit used
+// for velocity measurement. A NULL config uses the defaults above on first
+// initialization. If the eQEP is already running a non-NULL config is
+// applied without touching the position counter.
+int init_eqep_config(int ss, eqep_config_t* config){
+	eqep_config_t def;
 	// range sanity check
 	if(ss>2 || ss<0){
 		printf("error: PWM subsystem must be 0, 1, or 2\n");
 		return -1;
 	}
+	// sanity check the velocity config
+	if(config!=NULL){
+		if(config->unit_period_us<1 || \
+			config->unit_period_us>(int)(0xFFFFFFFFu/(EQEP_SYSCLK_HZ/1000000))){
+			printf("error: eQEP unit period out of range\n");
+			return -1;
+		}
+		if(config->capture_prescaler<0 || config->capture_prescaler>7){
+			printf("error: eQEP capture prescaler must be 0-7\n");
+			return -1;
+		}
+		if(config->event_prescaler<0 || config->event_prescaler>11){
+			printf("error: eQEP event prescaler must be 0-11\n");
+			return -1;
+		}
+	}
 	// see if eQEP already got initialized
 	if(eqep_initialized[ss]){
+		if(config==NULL) return 0;
+		eqep_config[ss] = *config;
+		config_eqep_velocity(ss);
 		return 0;
 	}
+	if(config==NULL){
+		def.unit_period_us		= EQEP_DEFAULT_UNIT_US;
+		def.capture_prescaler	= EQEP_DEFAULT_CCPS;
+		def.event_prescaler		= EQEP_DEFAULT_UPPS;
+		config = &def;
+	}
+	eqep_config[ss] = *config;
 
 	// check ti-eqep driver is up
 	switch(ss){
@@ -181,11 +284,10 @@ int init_eqep(int ss){
 	*(uint16_t*)(pwm_base[ss]+EQEP_OFFSET+QDECCTL) = 0;
 	// set maximum position to two's compliment of -1, aka UINT_MAX
 	*(uint32_t*)(pwm_base[ss]+EQEP_OFFSET+QPOSMAX)=-1;
-	// Enable interrupt
-	*(uint16_t*)(pwm_base[ss]+EQEP_OFFSET+QEINT) = UTOF;
-	// set unit period register
-	*(uint32_t*)(pwm_base[ss]+EQEP_OFFSET+QUPRD)=0x5F5E100;
-	// enable counter in control register
+	// nothing services eQEP interrupts, leave them all disabled
+	*(uint16_t*)(pwm_base[ss]+EQEP_OFFSET+QEINT) = 0;
+	// enable counter in control register, position and capture values are
+	// latched together on unit time out (QCLM=1) so they are coherent
 	*(uint16_t*)(pwm_base[ss]+EQEP_OFFSET+QEPCTL) = PHEN|IEL0|SWI|UTE|QCLM;
 	//enable clock from PWMSS
 	*(uint32_t*)(pwm_base[ss]+PWMSS_CLKCONFIG) |= PWMSS_EQEPCLK_EN;
@@ -199,6 +301,8 @@ int init_eqep(int ss){
 		printf("successfully tested eQEP write\n");
 	#endif
 	eqep_initialized[ss] = 1;
+
+	config_eqep_velocity(ss);
 	return 0;
 }
 
@@ -212,6 +316,149 @@ int read_eqep(int ch){
 int write_eqep(int ch, int val){
 	if(init_eqep(ch)) return -1;
 	*(int*)(pwm_base[ch] + EQEP_OFFSET +QPOSCNT) = val;
+	eqep_last_latch_ns[ch] = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int read_eqep_velocity(int ch, float* velocity, uint64_t* last_event_ns)
+*
+* Velocity in counts per second measured by the eQEP hardware. At low speed the
+* capture unit gives the period of the last 2^event_prescaler counts, and the
+* time since the last event bounds it from above so velocity decays when the
+* encoder stops. At high speed where the captured period gets short, and
+* whenever the capture is invalid due to an overflow or direction change, the
+* change in the position latched by the unit timer is used instead. The unit
+* timer latches position, capture period and capture timer together so both
+* paths lag by up to one unit period. Latches are timestamped with QUTMR so a
+* missed latch doesn't matter. last_event_ns is the rc_nanos_since_boot() time
+* of the last unit position event, or of the last unit latch if the capture
+* is invalid.
+*******************************************************************************/
+int read_eqep_velocity(int ch, float* velocity, uint64_t* last_event_ns){
+	volatile char* eqep;
+	uint16_t sts, cap_prd, cap_tmr;
+	uint32_t utmr1, utmr2, prd;
+	int latch_pos, dpos;
+	uint64_t now_ns, latch_ns;
+	float tick_s;
+
+	if(init_eqep(ch)) return -1;
+	eqep = pwm_base[ch] + EQEP_OFFSET;
+
+	sts = *(volatile uint16_t*)(eqep+QEPSTS);
+
+	// values latched by the unit timer with the time they were latched,
+	// retry if a latch happened while reading
+	do{
+		utmr1		= *(volatile uint32_t*)(eqep+QUTMR);
+		latch_pos	= *(volatile int32_t*)(eqep+QPOSLAT);
+		cap_prd		= *(volatile uint16_t*)(eqep+QCPRDLAT);
+		cap_tmr		= *(volatile uint16_t*)(eqep+QCTMRLAT);
+		now_ns		= rc_nanos_since_boot();
+		utmr2		= *(volatile uint32_t*)(eqep+QUTMR);
+	}while(utmr2<utmr1);
+	latch_ns = now_ns - ((uint64_t)utmr1*(1000000000/EQEP_SYSCLK_HZ));
+
+	// new unit latch, update position based velocity
+	if(latch_ns-eqep_last_latch_ns[ch] > \
+					(uint64_t)eqep_config[ch].unit_period_us*500){
+		if(eqep_last_latch_ns[ch]!=0){
+			dpos = latch_pos - eqep_last_latch_pos[ch];
+			eqep_unit_velocity[ch] = dpos*1000000000.0f / \
+									(latch_ns-eqep_last_latch_ns[ch]);
+		}
+		eqep_last_latch_pos[ch] = latch_pos;
+		eqep_last_latch_ns[ch] = latch_ns;
+	}
+
+	// capture status flags are sticky, a new period is only trusted after an
+	// event with no overflow or direction change since the last clear
+	if(sts&(QEPSTS_COEF|QEPSTS_CDEF)){
+		eqep_cap_valid[ch] = 0;
+		if(sts&QEPSTS_UPEVNT){
+			*(volatile uint16_t*)(eqep+QEPSTS) = \
+						QEPSTS_UPEVNT|QEPSTS_COEF|QEPSTS_CDEF;
+		}
+	}
+	else if(sts&QEPSTS_UPEVNT){
+		eqep_cap_valid[ch] = 1;
+		*(volatile uint16_t*)(eqep+QEPSTS) = QEPSTS_UPEVNT;
+	}
+
+	tick_s = (float)(1<<eqep_config[ch].capture_prescaler)/EQEP_SYSCLK_HZ;
+	prd = cap_prd;
+	if(cap_tmr>prd) prd = cap_tmr;
+	if(eqep_cap_valid[ch] && prd>=EQEP_MIN_CAPTURE_TICKS){
+		*velocity = (1<<eqep_config[ch].event_prescaler)/(prd*tick_s);
+		if(!(sts&QEPSTS_QDF)) *velocity = -*velocity;
+		if(last_event_ns!=NULL){
+			*last_event_ns = latch_ns - (uint64_t)(cap_tmr*tick_s*1e9f);
+		}
+	}
+	else{
+		*velocity = eqep_unit_velocity[ch];
+		if(last_event_ns!=NULL) *last_event_ns = eqep_last_latch_ns[ch];
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int read_eqep_all(int pos[3])
+*
+* reads all 3 eQEP position counters back to back with nothing in between so
+* they are sampled as close together as possible.
+*******************************************************************************/
+int read_eqep_all(int pos[3]){
+	if(init_eqep(0) || init_eqep(1) || init_eqep(2)) return -1;
+	pos[0] = *(volatile int*)(pwm_base[0] + EQEP_OFFSET + QPOSCNT);
+	pos[1] = *(volatile int*)(pwm_base[1] + EQEP_OFFSET + QPOSCNT);
+	pos[2] = *(volatile int*)(pwm_base[2] + EQEP_OFFSET + QPOSCNT);
+	return 0;
+}
+
+/*******************************************************************************
+* int read_eqep_latched_all(int pos[3], uint64_t* latch_ns)
+*
+* Reads the positions latched by the unit timers of all 3 eQEPs which latch
+* at the same instant once their unit timers are synchronized. All 3 unit
+* timers run from the same 100mhz clock so zeroing them back to back once keeps
+* them aligned to within a few clock cycles as long as they share a period.
+* latch_ns is the rc_nanos_since_boot() time of the latch. Returns -1 without
+* waiting until one unit period has passed since the timers were synchronized,
+* which includes the first call.
+*******************************************************************************/
+int read_eqep_latched_all(int pos[3], uint64_t* latch_ns){
+	uint32_t utmr1, utmr2;
+	uint64_t now_ns;
+	int i;
+
+	if(init_eqep(0) || init_eqep(1) || init_eqep(2)) return -1;
+	if(!eqep_unit_timers_synced){
+		if(eqep_config[0].unit_period_us != eqep_config[1].unit_period_us || \
+			eqep_config[0].unit_period_us != eqep_config[2].unit_period_us){
+			fprintf(stderr,"ERROR: eQEP unit periods must match to latch together\n");
+			return -1;
+		}
+		*(volatile uint32_t*)(pwm_base[0] + EQEP_OFFSET + QUTMR) = 0;
+		*(volatile uint32_t*)(pwm_base[1] + EQEP_OFFSET + QUTMR) = 0;
+		*(volatile uint32_t*)(pwm_base[2] + EQEP_OFFSET + QUTMR) = 0;
+		eqep_unit_sync_ns = rc_nanos_since_boot();
+		eqep_unit_timers_synced = 1;
+	}
+	// the positions are not latched together until the first time out
+	if(rc_nanos_since_boot()-eqep_unit_sync_ns <= \
+				(uint64_t)eqep_config[0].unit_period_us*1000) return -1;
+	// retry if a latch happened while reading
+	do{
+		utmr1 = *(volatile uint32_t*)(pwm_base[0] + EQEP_OFFSET + QUTMR);
+		for(i=0;i<3;i++){
+			pos[i] = *(volatile int*)(pwm_base[i] + EQEP_OFFSET + QPOSLAT);
+		}
+		now_ns = rc_nanos_since_boot();
+		utmr2 = *(volatile uint32_t*)(pwm_base[0] + EQEP_OFFSET + QUTMR);
+	}while(utmr2<utmr1);
+	*latch_ns = now_ns - ((uint64_t)utmr1*(1000000000/EQEP_SYSCLK_HZ));
 	return 0;
 }
 
@@ -242,7 +489,7 @@ int rc_pwm_set_duty_mmap(int ss, char ch, float duty){
 	}
 	
 	// duty ranges from 0 to TBPRD+1 for 0-100% PWM duty
-	uint16_t period = *(uint16_t*)(pwm_base[ss]+PWM_OFFSET+TBPRD);
+	uint16_t period = PWM_REG(ss,TBPRD);
 	uint16_t new_duty = (uint16_t)lroundf(duty * (period+1));
 	
 	#ifdef DEBUG
@@ -253,10 +500,10 @@ int rc_pwm_set_duty_mmap(int ss, char ch, float duty){
 	// change appropriate compare register
 	switch(ch){
 	case 'A':
-		*(uint16_t*)(pwm_base[ss]+PWM_OFFSET+CMPA) = new_duty;
+		PWM_REG(ss,CMPA) = new_duty;
 		break;
 	case 'B':
-		*(uint16_t*)(pwm_base[ss]+PWM_OFFSET+CMPB) = new_duty;
+		PWM_REG(ss,CMPB) = new_duty;
 		break;
 	default:
 		fprintf(stderr,"ERROR in rc_pwm_set_duty_mmap, pwm channel must be 'A' or 'B'\n");
@@ -265,3 +512,172 @@ int rc_pwm_set_duty_mmap(int ss, char ch, float duty){
 	
 	return 0;
 }
+
+
+/*******************************************************************************
+* static int pwm_time_base(int frequency, uint16_t* div_bits, uint16_t* prd)
+*
+* Picks the smallest CLKDIV and HSPCLKDIV combination that lets one period at
+* the requested frequency fit in the 16 bit TBPRD register, which keeps the
+* duty resolution as high as possible. Returns the resulting TBCLK frequency
+* or -1 if the frequency can't be generated.
+*******************************************************************************/
+static int pwm_time_base(int frequency, uint16_t* div_bits, uint16_t* prd){
+	int clkdiv, hspdiv, div, best_div = 0, counts;
+	uint16_t best_bits = 0;
+
+	if(frequency<1 || frequency>PWM_SYSCLK_HZ/2) return -1;
+	// CLKDIV divides by 2^n, HSPCLKDIV by 2n or 1 when n is 0
+	for(clkdiv=0; clkdiv<8; clkdiv++){
+		for(hspdiv=0; hspdiv<8; hspdiv++){
+			div = (1<<clkdiv) * (hspdiv ? 2*hspdiv : 1);
+			if(best_div && div>=best_div) continue;
+			if((PWM_SYSCLK_HZ/div)/frequency - 1 > PWM_MAX_PRD) continue;
+			best_div = div;
+			best_bits = (clkdiv<<10) | (hspdiv<<7);
+		}
+	}
+	if(!best_div) return -1;
+	counts = (PWM_SYSCLK_HZ/best_div)/frequency;
+	if(counts<2) return -1;
+	*div_bits = best_bits;
+	*prd = counts-1;
+	return PWM_SYSCLK_HZ/best_div;
+}
+
+/*******************************************************************************
+* int init_pwm_mmap(int ss, int frequency)
+*
+* Sets up the whole eHRPWM module through the registers: up-count time base
+* at the requested frequency, both compare registers shadowed and loaded at
+* counter zero so a new duty never cuts a period short, normal polarity, and
+* 0 duty. The sysfs driver is still used once by rc_pwm_init to export and
+* enable the channels since it owns the pinmux and clock gating.
+*******************************************************************************/
+int init_pwm_mmap(int ss, int frequency){
+	uint16_t div_bits, prd;
+	int tbclk;
+
+	if(unlikely(map_pwmss(ss))){
+		fprintf(stderr,"ERROR in init_pwm_mmap, failed to map PWMSS %d\n", ss);
+		return -1;
+	}
+	tbclk = pwm_time_base(frequency, &div_bits, &prd);
+	if(tbclk<0){
+		fprintf(stderr,"ERROR in init_pwm_mmap, can't generate %dhz\n", frequency);
+		return -1;
+	}
+	*(volatile uint32_t*)(pwm_base[ss]+PWMSS_CLKCONFIG) |= PWMSS_EPWMCLK_EN;
+
+	// load the period immediately this once so a counter above the new
+	// period doesn't have to run all the way to 0xFFFF
+	PWM_REG(ss,TBCTL) = TB_COUNT_UP | TB_IMMEDIATE | TB_DISABLE | \
+												TB_SYNC_DISABLE | div_bits;
+	PWM_REG(ss,TBPRD) = prd;
+	PWM_REG(ss,TBCTL) = TB_COUNT_UP | TB_SHADOW | TB_DISABLE | \
+												TB_SYNC_DISABLE | div_bits;
+	PWM_REG(ss,CMPCTL) = CC_SHADOW_A | CC_SHADOW_B | CC_CTR_ZERO_A | \
+												CC_CTR_ZERO_B;
+	PWM_REG(ss,CMPA) = 0;
+	PWM_REG(ss,CMPB) = 0;
+	PWM_REG(ss,AQ_CTLA) = AQ_ZRO_SET | AQ_CAU_CLEAR;
+	PWM_REG(ss,AQ_CTLB) = AQ_ZRO_SET | AQ_CBU_CLEAR;
+	PWM_REG(ss,AQ_CSFRC) = 0;	// no continuous software force
+
+	pwm_tbclk_hz[ss] = tbclk;
+	pwm_initialized[ss] = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int set_pwm_freq_mmap(int ss, int frequency)
+*
+* Changes the frequency while running. The new period and the compare values,
+* rescaled so both channels keep their duty, are shadowed and take effect
+* together at the next counter zero. The clock dividers have no shadow so if
+* they change the period in progress is stretched or shortened once.
+*******************************************************************************/
+int set_pwm_freq_mmap(int ss, int frequency){
+	uint16_t div_bits, prd, old_prd;
+	uint32_t a, b;
+	int tbclk;
+
+	if(unlikely(ss<0 || ss>2 || !pwm_initialized[ss])){
+		fprintf(stderr,"ERROR in set_pwm_freq_mmap, PWMSS %d not initialized\n", ss);
+		return -1;
+	}
+	tbclk = pwm_time_base(frequency, &div_bits, &prd);
+	if(tbclk<0){
+		fprintf(stderr,"ERROR in set_pwm_freq_mmap, can't generate %dhz\n", frequency);
+		return -1;
+	}
+	old_prd = PWM_REG(ss,TBPRD);
+	a = ((uint32_t)PWM_REG(ss,CMPA)*(prd+1))/(old_prd+1);
+	b = ((uint32_t)PWM_REG(ss,CMPB)*(prd+1))/(old_prd+1);
+	PWM_REG(ss,TBCTL) = TB_COUNT_UP | TB_SHADOW | TB_DISABLE | \
+												TB_SYNC_DISABLE | div_bits;
+	PWM_REG(ss,TBPRD) = prd;
+	PWM_REG(ss,CMPA) = a;
+	PWM_REG(ss,CMPB) = b;
+	pwm_tbclk_hz[ss] = tbclk;
+	return 0;
+}
+
+/*******************************************************************************
+* int set_pwm_polarity_mmap(int ss, char ch, int inverted)
+*
+* Normal polarity sets the output at counter zero and clears it on the compare
+* match, inverted does the opposite. The action qualifier takes the compare
+* event over the zero event when both happen so 0 duty stays fully off.
+*******************************************************************************/
+int set_pwm_polarity_mmap(int ss, char ch, int inverted){
+	if(unlikely(ss<0 || ss>2 || !pwm_initialized[ss])){
+		fprintf(stderr,"ERROR in set_pwm_polarity_mmap, PWMSS %d not initialized\n", ss);
+		return -1;
+	}
+	switch(ch){
+	case 'A':
+		if(inverted) PWM_REG(ss,AQ_CTLA) = AQ_ZRO_CLEAR | AQ_CAU_SET;
+		else PWM_REG(ss,AQ_CTLA) = AQ_ZRO_SET | AQ_CAU_CLEAR;
+		break;
+	case 'B':
+		if(inverted) PWM_REG(ss,AQ_CTLB) = AQ_ZRO_CLEAR | AQ_CBU_SET;
+		else PWM_REG(ss,AQ_CTLB) = AQ_ZRO_SET | AQ_CBU_CLEAR;
+		break;
+	default:
+		fprintf(stderr,"ERROR in set_pwm_polarity_mmap, pwm channel must be 'A' or 'B'\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_pwm_set_duty_ab_mmap(int ss, float duty_a, float duty_b)
+*
+* Both compare registers are shadowed and load at counter zero, so writing
+* both within one period makes them change in the same period. If the counter
+* is within PWM_ATOMIC_MARGIN_NS of wrapping, wait for it to wrap first so the
+* zero can't land between the two writes.
+*******************************************************************************/
+int rc_pwm_set_duty_ab_mmap(int ss, float duty_a, float duty_b){
+	uint16_t prd, a, b, margin;
+
+	if(unlikely(ss<0 || ss>2 || !pwm_initialized[ss])){
+		fprintf(stderr,"ERROR in rc_pwm_set_duty_ab_mmap, PWMSS %d not initialized\n", ss);
+		return -1;
+	}
+	if(unlikely(duty_a>1.0f || duty_a<0.0f || duty_b>1.0f || duty_b<0.0f)){
+		fprintf(stderr,"ERROR in rc_pwm_set_duty_ab_mmap, duty must be between 0.0f & 1.0f\n");
+		return -1;
+	}
+	prd = PWM_REG(ss,TBPRD);
+	a = (uint16_t)lroundf(duty_a * (prd+1));
+	b = (uint16_t)lroundf(duty_b * (prd+1));
+	margin = ((uint64_t)pwm_tbclk_hz[ss]*PWM_ATOMIC_MARGIN_NS)/1000000000;
+	if(margin>prd/2) margin = prd/2;
+
+	while(PWM_REG(ss,TBCNT) > prd-margin);
+	PWM_REG(ss,CMPA) = a;
+	PWM_REG(ss,CMPB) = b;
+	return 0;
+}
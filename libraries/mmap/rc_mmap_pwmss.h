@@ -8,17 +8,36 @@ depending on the exact function.
 Note that a device tree overlay is still necessary to configure the
 pin multiplexer and enable clock signal to each subsystem.
 
-the pwm driver is still needed to set up pwm output. This can
-be done through /sys/class/pwm or with simple_pwm.c
+the pwm driver is still needed to export and enable pwm output. This is
+done once through /sys/class/pwm by rc_pwm_init, after which the period,
+polarity, and duty are all set here.
 */
 
 #ifndef MMAP_PWMSS
 #define MMAP_PWMSS
 
+#include <stdint.h>
+
+// eQEP velocity measurement settings, see init_eqep_config()
+typedef struct eqep_config_t{
+	int unit_period_us;		// position latch period for high speed velocity
+	int capture_prescaler;	// 0-7, capture timer runs at 100mhz/2^n
+	int event_prescaler;	// 0-11, capture period spans 2^n counts
+} eqep_config_t;
+
+// ePWM
+int init_pwm_mmap(int ss, int frequency);
+int set_pwm_freq_mmap(int ss, int frequency);
+int set_pwm_polarity_mmap(int ss, char ch, int inverted);
+
 // eQEP
 int init_eqep(int ss);
+int init_eqep_config(int ss, eqep_config_t* config);
 int read_eqep(int ch);
 int write_eqep(int ch, int val);
+int read_eqep_velocity(int ch, float* velocity, uint64_t* last_event_ns);
+int read_eqep_all(int pos[3]);
+int read_eqep_latched_all(int pos[3], uint64_t* latch_ns);
 
 
 #endif
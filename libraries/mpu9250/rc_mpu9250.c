@@ -12,13 +12,15 @@
 #include "rc_mpu9250_defs.h"
 #include "dmp_firmware.h"
 #include "dmpKey.h"
+#include "rc_mpu9250.h"
+#include "../other/rc_vertical.h"
+#include "../other/rc_hub.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <math.h>
 #include <string.h>
 #include <unistd.h>
-#include <poll.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <errno.h>
@@ -55,9 +57,8 @@ rc_imu_config_t config;
 int bypass_en;  
 int dmp_en;
 int packet_len;
-pthread_t imu_interrupt_thread;
-int thread_running_flag;
-struct sched_param params;
+int interrupt_watched; // 1 while IMU_INTERRUPT_PIN is watched for events
+int first_interrupt;
 void (*imu_interrupt_func)(); // pointer to user's interrupt function
 int interrupt_func_set;
 float mag_factory_adjust[3];
@@ -67,6 +68,11 @@ int last_read_successful;
 uint64_t last_interrupt_timestamp_nanos;
 rc_imu_data_t* data_ptr;
 int shutdown_interrupt_thread = 0;
+// boot clock time of the last interrupt edge, whether its FIFO read is still
+// going, and the longest recent read, see imu_next_bus_use()
+volatile uint64_t last_edge_ns = 0;
+volatile int fifo_reading = 0;
+volatile uint32_t fifo_read_max_ns = 0;
 // for magnetometer Yaw filtering
 rc_filter_t low_pass, high_pass;
 
@@ -102,7 +108,7 @@ int data_fusion(rc_imu_data_t* data);
 int load_gyro_offets();
 int load_mag_calibration();
 int write_mag_cal_to_disk(float offsets[3], float scale[3]);
-void* imu_interrupt_handler(void* ptr);
+void imu_interrupt_event(int gpio, int value, uint64_t timestamp_ns);
 int check_quaternion_validity(unsigned char* raw, int i);
 
 
@@ -660,18 +666,13 @@ int rc_power_off_imu(){
 			return -1;
 		}
 	}
-	// wait for the interrupt thread to exit if it hasn't already
-	//allow up to 1 second for thread cleanup
-	if(thread_running_flag){
-		struct timespec thread_timeout;
-		clock_gettime(CLOCK_REALTIME, &thread_timeout);
-		thread_timeout.tv_sec += 1;
-		int thread_err = 0;
-		thread_err = pthread_timedjoin_np(imu_interrupt_thread, NULL, \
-															&thread_timeout);
-		if(thread_err == ETIMEDOUT){
-			fprintf(stderr,"WARNING: imu_interrupt_thread exit timeout\n");
-		}
+	// stop interrupt events and release anyone waiting on the next reading
+	if(interrupt_watched){
+		rc_gpio_event_unwatch(IMU_INTERRUPT_PIN);
+		interrupt_watched = 0;
+		pthread_mutex_lock( &rc_imu_read_mutex );
+		pthread_cond_broadcast( &rc_imu_read_condition );
+		pthread_mutex_unlock( &rc_imu_read_mutex );
 	}
 	return 0;
 }
@@ -709,19 +710,6 @@ int rc_initialize_imu_dmp(rc_imu_data_t *data, rc_imu_config_t conf){
 		fprintf(stderr,"rc_initialize_imu_dmp failed at rc_i2c_init\n");
 		return -1;
 	}
-	// configure the gpio interrupt pin
-	if(rc_gpio_export(IMU_INTERRUPT_PIN)<0){
-		fprintf(stderr,"ERROR: failed to export GPIO %d", IMU_INTERRUPT_PIN);
-		return -1;
-	}
-	if(rc_gpio_set_dir(IMU_INTERRUPT_PIN, INPUT_PIN)<0){
-		fprintf(stderr,"ERROR: failed to configure GPIO %d", IMU_INTERRUPT_PIN);
-		return -1;
-	}
-	if(rc_gpio_set_edge(IMU_INTERRUPT_PIN, EDGE_FALLING)<0){
-		fprintf(stderr,"ERROR: failed to configure GPIO %d", IMU_INTERRUPT_PIN);
-		return -1;
-	}
 	// claiming the bus does no guarantee other code will not interfere 
 	// with this process, but best to claim it so other code can check
 	// like we did above
@@ -831,22 +819,22 @@ int rc_initialize_imu_dmp(rc_imu_data_t *data, rc_imu_config_t conf){
 	#ifdef DEBUG
 	printf("packet_len: %d\n", packet_len);
 	#endif
-	// start the interrupt handler thread
+	// start watching the interrupt pin from the gpio event thread
 	interrupt_func_set = 1;
-	shutdown_interrupt_thread = 0;
 	rc_set_imu_interrupt_func(&rc_null_func);
-	pthread_create(&imu_interrupt_thread, NULL, \
-					imu_interrupt_handler, (void*) NULL);
-	params.sched_priority = config.dmp_interrupt_priority;
-	pthread_setschedparam(imu_interrupt_thread, SCHED_FIFO, &params);
-	thread_running_flag = 1;
-	rc_usleep(1000);
-	#ifdef DEBUG
-	int policy;
-	struct sched_param params_tmp;
-	pthread_getschedparam(imu_interrupt_thread, &policy, &params_tmp);
-	printf("new policy: %d, fifo: %d, prio: %d\n", policy, SCHED_FIFO, params_tmp.sched_priority);
-	#endif
+	if(interrupt_watched){
+		rc_gpio_event_unwatch(IMU_INTERRUPT_PIN);
+		interrupt_watched = 0;
+	}
+	mpu_reset_fifo();
+	first_interrupt = 1;
+	shutdown_interrupt_thread = 0;
+	if(rc_gpio_event_watch(IMU_INTERRUPT_PIN, EDGE_FALLING, 0, \
+			config.dmp_interrupt_priority, &imu_interrupt_event)<0){
+		fprintf(stderr,"ERROR: failed to watch GPIO %d\n", IMU_INTERRUPT_PIN);
+		return -1;
+	}
+	interrupt_watched = 1;
 	return 0;
 }
 
@@ -1387,89 +1375,140 @@ int mpu_set_dmp_state(unsigned char enable){
 }
 
 /*******************************************************************************
-* void* imu_interrupt_handler(void* ptr)
+* static void record_read_time(uint64_t ns)
 *
-* Here is where the magic happens. This function runs as its own thread and 
-* monitors the gpio pin IMU_INTERRUPT_PIN with the blocking function call 
-* poll(). If a valid interrupt is received from the IMU then mark the timestamp,
-* read in the IMU data, and call the user-defined interrupt function if set.
+* keeps the longest time from an interrupt edge to the end of its FIFO read,
+* decaying by 1/64 each read so one slow read doesn't count forever
 *******************************************************************************/
-void* imu_interrupt_handler( __unused void* ptr){ 
-	struct pollfd fdset[1];
-	int ret;
-	char buf[64];
-	int first_run = 1;
-	int imu_gpio_fd = rc_gpio_fd_open(IMU_INTERRUPT_PIN);
-	if(imu_gpio_fd == -1){
-		fprintf(stderr,"ERROR: can't open IMU_INTERRUPT_PIN gpio fd\n");
-		fprintf(stderr,"aborting imu_interrupt_handler\n");
-		return NULL;
-	}
-	fdset[0].fd = imu_gpio_fd;
-	fdset[0].events = POLLPRI;
-	// keep running until the program closes
-	mpu_reset_fifo();
-	while(rc_get_state()!=EXITING && shutdown_interrupt_thread!=1) {
-		// system hangs here until IMU FIFO interrupt
-		poll(fdset, 1, IMU_POLL_TIMEOUT); 
-		if(rc_get_state()==EXITING || shutdown_interrupt_thread==1){
-			break;
-		}
-		else if (fdset[0].revents & POLLPRI) {
-			lseek(fdset[0].fd, 0, SEEK_SET);  
-			read(fdset[0].fd, buf, 64);
-			// interrupt received, mark the timestamp
-			last_interrupt_timestamp_nanos = rc_nanos_since_epoch();
-			// try to load fifo no matter the claim bus state
-			if(rc_i2c_get_in_use_state(IMU_BUS)){
-				fprintf(stderr,"WARNING: Something has claimed the I2C bus when an\n");
-				fprintf(stderr,"IMU interrupt was received. Reading IMU anyway.\n");
-			}
-
-			// aquires bus
-			rc_i2c_claim_bus(IMU_BUS);
+static void record_read_time(uint64_t ns){
+	uint32_t max = fifo_read_max_ns;
+	if(ns>0xFFFFFFFF) ns = 0xFFFFFFFF;
+	max -= max>>6;
+	if(ns>max) max = ns;
+	fifo_read_max_ns = max;
+}
 
-			// aquires mutex
-			pthread_mutex_lock( &rc_imu_read_mutex );
+/*******************************************************************************
+* int imu_next_bus_use(uint64_t* start_ns, uint64_t* duration_ns)
+*
+* Predicts when the interrupt thread will next use the bus and for how long
+* from the DMP rate and the recent read times. start_ns is on the boot clock
+* and is now if a read is underway. Returns -1 if the DMP isn't running or
+* hasn't interrupted yet, then the bus is only used on demand.
+*******************************************************************************/
+int imu_next_bus_use(uint64_t* start_ns, uint64_t* duration_ns){
+	uint64_t now, next, period, edge;
+
+	edge = last_edge_ns;
+	if(!interrupt_watched || edge==0 || config.dmp_sample_rate<=0) return -1;
+	now = rc_nanos_since_boot();
+	period = 1000000000/config.dmp_sample_rate;
+	*duration_ns = fifo_read_max_ns;
+	if(fifo_reading){
+		*start_ns = now;
+		return 0;
+	}
+	next = edge + period;
+	if(next<now) next += ((now-next)/period + 1)*period;
+	*start_ns = next;
+	return 0;
+}
 
-			// read data
-			ret = read_dmp_fifo(data_ptr);
+/*******************************************************************************
+* int imu_dmp_orientation()
+*
+* orientation scalar given to the DMP, the quaternion is in this frame while
+* the FIFO accel and gyro data stay in the sensor frame
+*******************************************************************************/
+int imu_dmp_orientation(){
+	return config.orientation;
+}
 
-			// record if it was successful or not
-			if (ret==0) {
-			  last_read_successful=1;
-			  // signals that a measurement is available
-			  pthread_cond_broadcast( &rc_imu_read_condition );
-			}
-			else
-			  last_read_successful=0;
-  
-			// releases mutex
-			pthread_mutex_unlock( &rc_imu_read_mutex );
+/*******************************************************************************
+* int imu_dmp_running()
+*
+* 1 while the IMU is in DMP mode and its interrupt is being watched
+*******************************************************************************/
+int imu_dmp_running(){
+	return dmp_en && interrupt_watched;
+}
 
-			// releases bus
-			rc_i2c_release_bus(IMU_BUS);
-			
-			// call the user function if not the first run
-			if(first_run == 1){
-				first_run = 0;
-			}
-			else if(interrupt_func_set && last_read_successful){
-				imu_interrupt_func(); 
-			}
-		}
+/*******************************************************************************
+* void imu_interrupt_event(int gpio, int value, uint64_t timestamp_ns)
+*
+* Here is where the magic happens. This is called from the gpio event thread
+* on each falling edge of IMU_INTERRUPT_PIN. Mark the timestamp, read in the
+* IMU data, and call the user-defined interrupt function if set.
+*******************************************************************************/
+void imu_interrupt_event(__unused int gpio, __unused int value, \
+											uint64_t timestamp_ns){
+	int ret;
+	// ignore interrupts while the IMU is being reset
+	if(shutdown_interrupt_thread==1 || rc_get_state()==EXITING) return;
+
+	// the edge was timestamped on the boot clock, move it to the epoch
+	last_edge_ns = timestamp_ns;
+	fifo_reading = 1;
+	last_interrupt_timestamp_nanos = rc_nanos_since_epoch() - \
+								(rc_nanos_since_boot() - timestamp_ns);
+	// try to load fifo no matter the claim bus state
+	if(rc_i2c_get_in_use_state(IMU_BUS)){
+		fprintf(stderr,"WARNING: Something has claimed the I2C bus when an\n");
+		fprintf(stderr,"IMU interrupt was received. Reading IMU anyway.\n");
 	}
-	
+
+	// aquires bus
+	rc_i2c_claim_bus(IMU_BUS);
+
 	// aquires mutex
 	pthread_mutex_lock( &rc_imu_read_mutex );
-	// /releases other threads
-	pthread_cond_broadcast( &rc_imu_read_condition );
+
+	// read data
+	RC_TRACE_BEGIN("read_dmp_fifo");
+	ret = read_dmp_fifo(data_ptr);
+	RC_TRACE_END("read_dmp_fifo");
+
+	// record if it was successful or not
+	if (ret==0) {
+	  last_read_successful=1;
+	  // signals that a measurement is available
+	  pthread_cond_broadcast( &rc_imu_read_condition );
+	}
+	else
+	  last_read_successful=0;
+
 	// releases mutex
 	pthread_mutex_unlock( &rc_imu_read_mutex );
 
-	rc_gpio_fd_close(imu_gpio_fd);
-	thread_running_flag = 0;
-	return 0;
+	// releases bus
+	rc_i2c_release_bus(IMU_BUS);
+	fifo_reading = 0;
+	record_read_time(rc_nanos_since_boot()-timestamp_ns);
+
+	// update the vertical estimate so the user function sees it
+	if(vertical_running && last_read_successful){
+		RC_TRACE_BEGIN("vertical_imu_step");
+		vertical_imu_step(data_ptr, timestamp_ns);
+		RC_TRACE_END("vertical_imu_step");
+	}
+
+	// publish to the sensor hub before the user function so clients never
+	// wait on it
+	if(hub_imu_running && last_read_successful){
+		RC_TRACE_BEGIN("hub_publish_imu");
+		hub_publish_imu(data_ptr, timestamp_ns);
+		RC_TRACE_END("hub_publish_imu");
+	}
+	
+	// call the user function if not the first run
+	if(first_interrupt == 1){
+		first_interrupt = 0;
+	}
+	else if(interrupt_func_set && last_read_successful){
+		RC_TRACE_BEGIN("imu_interrupt_func");
+		imu_interrupt_func(); 
+		RC_TRACE_END("imu_interrupt_func");
+	}
 }
 
 /*******************************************************************************
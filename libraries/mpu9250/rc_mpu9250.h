@@ -0,0 +1,12 @@
+/*******************************************************************************
+* rc_mpu9250.h
+*
+* internal timing of the IMU's bus use so the other device on the bus can stay
+* out of the way and the DMP settings other modules need, the IMU functions
+* for the user are in roboticscape.h
+*******************************************************************************/
+#include <stdint.h>
+
+int imu_next_bus_use(uint64_t* start_ns, uint64_t* duration_ns);
+int imu_dmp_orientation();
+int imu_dmp_running();
@@ -0,0 +1,194 @@
+/*******************************************************************************
+* rc_battery.c
+*
+* Shared memory between the rc_battery_monitor service and everyone else. The
+* service is the only writer and publishes through a seqlock. Readers map the
+* segment read only so they never need root and can't disturb the service.
+*******************************************************************************/
+#define _GNU_SOURCE
+#include "../roboticscape.h"
+#include "rc_battery.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BATT_SHM_NAME	"/roboticscape_battery"
+#define BATT_MAGIC		0x52434254	// "RCBT"
+// a reader gives up rather than spin forever on a service that died mid write
+#define BATT_TRIES		1000
+
+typedef struct batt_region_t{
+	volatile uint32_t magic;
+	volatile uint32_t seq;		// odd while state is being written
+	volatile int32_t pid;		// monitor process, 0 once it exits
+	uint32_t size;
+	rc_battery_state_t state;
+} batt_region_t;
+
+/*******************************************************************************
+* Local Global Variables
+*******************************************************************************/
+static batt_region_t* writer = NULL;
+static batt_region_t* reader = NULL;
+static pthread_mutex_t reader_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*******************************************************************************
+* int battery_shm_open()
+*
+* Creates the segment, or reuses the one a previous instance left so readers
+* that already mapped it keep working.
+*******************************************************************************/
+int battery_shm_open(){
+	batt_region_t* r;
+	int fd;
+
+	if(writer!=NULL) return 0;
+	fd = shm_open(BATT_SHM_NAME, O_RDWR|O_CREAT, 0644);
+	if(fd<0){
+		perror("ERROR: failed to open battery shared memory");
+		return -1;
+	}
+	// open() was subject to umask, readers need to be able to open it
+	fchmod(fd, 0644);
+	if(ftruncate(fd, sizeof(batt_region_t))){
+		perror("ERROR: failed to size battery shared memory");
+		close(fd);
+		return -1;
+	}
+	r = mmap(NULL, sizeof(batt_region_t), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(r==MAP_FAILED){
+		perror("ERROR: failed to map battery shared memory");
+		return -1;
+	}
+	if(r->magic!=BATT_MAGIC || r->size!=sizeof(batt_region_t)){
+		r->magic = 0;
+		__sync_synchronize();
+		memset((void*)r, 0, sizeof(batt_region_t));
+		r->size = sizeof(batt_region_t);
+		__sync_synchronize();
+		r->magic = BATT_MAGIC;
+	}
+	// clear the last instance's state as a write so readers retry rather
+	// than copy it half cleared, a crash while publishing left seq odd
+	if(!(r->seq&1)) r->seq++;
+	__sync_synchronize();
+	memset(&r->state, 0, sizeof(r->state));
+	__sync_synchronize();
+	r->seq++;
+	__sync_synchronize();
+	r->pid = getpid();
+	writer = r;
+	return 0;
+}
+
+/*******************************************************************************
+* int battery_shm_publish(rc_battery_state_t* state)
+*
+* timestamp_ns and updates are filled in here
+*******************************************************************************/
+int battery_shm_publish(rc_battery_state_t* state){
+	uint64_t updates;
+	if(writer==NULL){
+		fprintf(stderr,"ERROR: in battery_shm_publish, call battery_shm_open first\n");
+		return -1;
+	}
+	updates = writer->state.updates;
+	writer->seq++;
+	__sync_synchronize();
+	writer->state = *state;
+	writer->state.timestamp_ns = rc_nanos_since_boot();
+	writer->state.updates = updates+1;
+	__sync_synchronize();
+	writer->seq++;
+	return 0;
+}
+
+/*******************************************************************************
+* int battery_shm_close()
+*
+* marks the monitor as gone, the segment stays for the next instance
+*******************************************************************************/
+int battery_shm_close(){
+	if(writer==NULL) return 0;
+	writer->pid = 0;
+	__sync_synchronize();
+	munmap((void*)writer, sizeof(batt_region_t));
+	writer = NULL;
+	return 0;
+}
+
+/*******************************************************************************
+* static int map_reader()
+*
+* Maps the segment the first time it's found. Until the monitor has created
+* it each call tries again.
+*******************************************************************************/
+static int map_reader(){
+	struct stat st;
+	batt_region_t* r;
+	int fd;
+
+	if(reader!=NULL) return 0;
+	pthread_mutex_lock(&reader_mutex);
+	if(reader!=NULL){
+		pthread_mutex_unlock(&reader_mutex);
+		return 0;
+	}
+	fd = shm_open(BATT_SHM_NAME, O_RDONLY, 0);
+	if(fd<0){
+		pthread_mutex_unlock(&reader_mutex);
+		return -1;
+	}
+	if(fstat(fd, &st) || (size_t)st.st_size!=sizeof(batt_region_t)){
+		close(fd);
+		pthread_mutex_unlock(&reader_mutex);
+		return -1;
+	}
+	r = mmap(NULL, sizeof(batt_region_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(r==MAP_FAILED){
+		pthread_mutex_unlock(&reader_mutex);
+		return -1;
+	}
+	reader = r;
+	pthread_mutex_unlock(&reader_mutex);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_get_battery_state(rc_battery_state_t* state)
+*
+* copies the monitor's latest reading, see roboticscape.h
+*******************************************************************************/
+int rc_get_battery_state(rc_battery_state_t* state){
+	unsigned int seq;
+	pid_t pid;
+	int i;
+
+	if(state==NULL){
+		fprintf(stderr,"ERROR: in rc_get_battery_state, received NULL pointer\n");
+		return -1;
+	}
+	if(map_reader()) return -1;
+	if(reader->magic!=BATT_MAGIC) return -1;
+	pid = reader->pid;
+	if(pid==0) return -1;
+	if(kill(pid, 0) && errno==ESRCH) return -1;
+	for(i=0; i<BATT_TRIES; i++){
+		seq = reader->seq;
+		if(seq&1) continue;
+		__sync_synchronize();
+		*state = reader->state;
+		__sync_synchronize();
+		if(seq==reader->seq) break;
+	}
+	if(i==BATT_TRIES || state->updates==0) return -1;
+	return 0;
+}
@@ -0,0 +1,10 @@
+/*******************************************************************************
+* rc_battery.h
+*
+* publishing side of the battery monitor's shared memory for the
+* rc_battery_monitor service, programs read it with rc_get_battery_state()
+*******************************************************************************/
+
+int battery_shm_open();
+int battery_shm_publish(rc_battery_state_t* state);
+int battery_shm_close();
@@ -6,6 +6,8 @@
 #include "../rc_defs.h"
 #include "../preprocessor_macros.h"
 #include "../mmap/rc_mmap_gpio_adc.h"
+#include "rc_dsm.h"
+#include "rc_hub.h"
 #include <stdio.h>
 #include <pthread.h>
 #include <string.h>
@@ -39,6 +41,7 @@ pthread_t serial_parser_thread;
 int listening; // for calibration routine only
 void (*dsm_ready_func)();
 int rc_is_dsm_active_flag; 
+static uint64_t hub_dsm_seen_ns; // hub client's last packet read for rc_is_new_dsm_data
 
 /*******************************************************************************
 * Local Function Declarations
@@ -137,6 +140,47 @@ int rc_stop_dsm_service(){
 	return ret;
 }
 
+/*******************************************************************************
+* static float normalize(int i)
+*
+* channel i from 0 scaled to -1 to 1 by the calibration, 0 if not sent
+*******************************************************************************/
+static float normalize(int i){
+	float range = rc_maxes[i]-rc_mins[i];
+	if(range!=0 && rc_channels[i]!=0) {
+		float center = (rc_maxes[i]+rc_mins[i])/2;
+		return 2*(rc_channels[i]-center)/range;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* static void hub_dsm(rc_hub_dsm_t* d)
+*
+* latest frame from the sensor hub for a client, zeros if there isn't one
+*******************************************************************************/
+static void hub_dsm(rc_hub_dsm_t* d){
+	if(rc_hub_latest(RC_HUB_DSM, d)) memset(d, 0, sizeof(*d));
+}
+
+/*******************************************************************************
+* int dsm_get_frame(rc_hub_dsm_t* f)
+*
+* copies the channels for the sensor hub without clearing new_dsm_flag
+*******************************************************************************/
+int dsm_get_frame(rc_hub_dsm_t* f){
+	int i;
+	f->packet_ns = last_time;
+	f->active = rc_is_dsm_active_flag;
+	f->channels = num_channels;
+	f->resolution = resolution;
+	for(i=0; i<MAX_DSM_CHANNELS; i++){
+		f->raw[i] = rc_channels[i];
+		f->normalized[i] = normalize(i);
+	}
+	return 0;
+}
+
 /*******************************************************************************
 * @ int rc_get_dsm_ch_raw(int ch)
 * 
@@ -151,6 +195,12 @@ int rc_get_dsm_ch_raw(int ch){
 		printf("please enter a channel between 1 & %d",MAX_DSM_CHANNELS);
 		return -1;
 	}
+	else if(hub_client){
+		rc_hub_dsm_t d;
+		hub_dsm(&d);
+		hub_dsm_seen_ns = d.packet_ns;
+		return d.raw[ch-1];
+	}
 	else{
 		new_dsm_flag = 0;
 		return rc_channels[ch-1];
@@ -170,11 +220,16 @@ float rc_get_dsm_ch_normalized(int ch){
 		printf("please enter a channel between 1 & %d",MAX_DSM_CHANNELS);
 		return -1;
 	}
+	if(hub_client){
+		rc_hub_dsm_t d;
+		hub_dsm(&d);
+		hub_dsm_seen_ns = d.packet_ns;
+		return d.normalized[ch-1];
+	}
 	float range = rc_maxes[ch-1]-rc_mins[ch-1];
 	if(range!=0 && rc_channels[ch-1]!=0) {
 		new_dsm_flag = 0;
-		float center = (rc_maxes[ch-1]+rc_mins[ch-1])/2;
-		return 2*(rc_channels[ch-1]-center)/range;
+		return normalize(ch-1);
 	}
 	else{
 		return 0;
@@ -188,6 +243,11 @@ float rc_get_dsm_ch_normalized(int ch){
 * otherwise returns 0
 *******************************************************************************/
 int rc_is_new_dsm_data(){
+	if(hub_client){
+		rc_hub_dsm_t d;
+		hub_dsm(&d);
+		return d.packet_ns!=0 && d.packet_ns!=hub_dsm_seen_ns;
+	}
 	return new_dsm_flag;
 }
 
@@ -212,6 +272,12 @@ int rc_set_dsm_data_func(void (*func)(void)){
 * if no packet has ever been received, return -1;
 *******************************************************************************/
 uint64_t rc_nanos_since_last_dsm_packet(){
+	if(hub_client){
+		rc_hub_dsm_t d;
+		hub_dsm(&d);
+		if(d.packet_ns==0) return UINT64_MAX;
+		return rc_nanos_since_epoch()-d.packet_ns;
+	}
 	// if global variable last_time ==0 then no packet must have arrived yet
 	if (last_time==0){
 		return UINT64_MAX;
@@ -226,6 +292,11 @@ uint64_t rc_nanos_since_last_dsm_packet(){
 * returns a 0 if no packet has been received yet
 *******************************************************************************/
 int rc_get_dsm_resolution(){
+	if(hub_client){
+		rc_hub_dsm_t d;
+		hub_dsm(&d);
+		return d.resolution;
+	}
 	return resolution;
 }
 
@@ -236,6 +307,11 @@ int rc_get_dsm_resolution(){
 * returns 0 if no packets have been received yet.
 *******************************************************************************/
 int rc_num_dsm_channels(){
+	if(hub_client){
+		rc_hub_dsm_t d;
+		hub_dsm(&d);
+		return d.channels;
+	}
 	return num_channels;
 }
 
@@ -246,6 +322,11 @@ int rc_num_dsm_channels(){
 * returns 0 otherwise.
 *******************************************************************************/
 int rc_is_dsm_active(){
+	if(hub_client){
+		rc_hub_dsm_t d;
+		hub_dsm(&d);
+		return d.active;
+	}
 	return rc_is_dsm_active_flag;
 }
 
@@ -446,9 +527,11 @@ START_NORMAL_LOOP:
 		}
 		else{
 			// got out of sync, flush and try again
+			RC_TRACE_INSTANT("dsm_resync");
 			rc_uart_flush(DSM_UART_BUS); // flush
 			continue;
 		}
+		RC_TRACE_INSTANT("dsm_packet");
 
 		// raw debug mode spits out all ones and zeros
 		#ifdef DEBUG
@@ -531,7 +614,9 @@ START_NORMAL_LOOP:
 			}
 			// run the dsm ready function.
 			// this is null unless user changed it
+			RC_TRACE_BEGIN("dsm_ready_func");
 			dsm_ready_func();
+			RC_TRACE_END("dsm_ready_func");
 		}
 		
 		#ifdef DEBUG
@@ -577,8 +662,9 @@ int rc_bind_dsm(){
 	// default to dsmx 11ms mode for most applications
 	int pulses = 9; 
 	int delay = 200000;
+	rc_gpio_pin_t pin;
 	
-	if(initialize_mmap_gpio()<0){
+	if(rc_gpio_pin_init(&pin, DSM_PIN)<0){
 		printf("ERROR: can't proceed without mmap \n");
 		return -1;
 	}
@@ -665,7 +751,7 @@ enter:
 	
 	// now set pin as output
 	rc_gpio_set_dir(DSM_PIN, OUTPUT_PIN);
-	rc_gpio_set_value_mmap(DSM_PIN, HIGH);
+	rc_gpio_pin_set(&pin);
 	rc_set_pinmux_mode(DSM_PIN, PINMUX_GPIO);
 	
 	// wait as long as possible before sending pulses
@@ -674,9 +760,9 @@ enter:
 	rc_usleep(delay); 
 	
 	for(i=0; i<pulses; i++){
-		rc_gpio_set_value_mmap(DSM_PIN, LOW);
+		rc_gpio_pin_clear(&pin);
 		rc_usleep(PAUSE);
-		rc_gpio_set_value_mmap(DSM_PIN, HIGH);
+		rc_gpio_pin_set(&pin);
 		rc_usleep(PAUSE);
 	}
 	
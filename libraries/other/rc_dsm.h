@@ -0,0 +1,8 @@
+/*******************************************************************************
+* rc_dsm.h
+*
+* internal access to the dsm state for the sensor hub, the dsm functions for
+* the user are in roboticscape.h
+*******************************************************************************/
+
+int dsm_get_frame(rc_hub_dsm_t* f);
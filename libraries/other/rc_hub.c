@@ -0,0 +1,506 @@
+/*******************************************************************************
+* rc_hub.c
+*
+* Sensor hub. One process owns the hardware and publishes each sensor stream
+* into a ring in POSIX shared memory. Each ring has a head counting samples
+* written, a reader copies a slot and then checks the head to see if the
+* writer lapped it while copying, like the trace buffer. Readers never write
+* anything the server reads except a waiter count which tells the server
+* whether a futex wake is needed, so publishing costs a copy and a barrier.
+*******************************************************************************/
+#define _GNU_SOURCE
+#include "../roboticscape.h"
+#include "../preprocessor_macros.h"
+#include "../bmp280/rc_bmp280.h"
+#include "rc_dsm.h"
+#include "rc_hub.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define HUB_SHM_NAME	"/roboticscape_hub"
+#define HUB_MAGIC		0x52434842	// "RCHB"
+#define HUB_VERSION		2
+#define HUB_STREAMS		5
+// a server is dead after this or 3 of its periods without a heartbeat,
+// whichever is longer
+#define HUB_ALIVE_MS	1000
+#define HUB_ALIVE_PERIODS	3
+#define HUB_ALIGN(x)	(((x)+63) & ~((size_t)63))
+
+// stream indices, the RC_HUB_ flags are 1<<index
+enum{HUB_IMU, HUB_ENCODERS, HUB_ADC, HUB_DSM, HUB_BARO};
+
+typedef struct hub_stream_t{
+	volatile uint32_t head;		// samples written, also the futex word
+	volatile uint32_t waiters;	// clients sleeping in rc_hub_wait
+	uint32_t size;				// bytes per sample
+	uint32_t offset;			// start of the ring from the start of the region
+} hub_stream_t;
+
+typedef struct hub_region_t{
+	volatile uint32_t magic;	// written last once the layout is filled in
+	uint32_t version;
+	uint32_t size;
+	volatile int32_t pid;		// server process, 0 while stopped
+	volatile uint32_t streams;	// RC_HUB_ flags being published
+	volatile uint32_t heartbeat_ms;	// rc_nanos_since_boot()/1000000 of the last publish
+	volatile uint32_t alive_ms;	// heartbeat age after which the server is dead
+	hub_stream_t stream[HUB_STREAMS];
+} hub_region_t;
+
+/*******************************************************************************
+* Local Global Variables
+*******************************************************************************/
+volatile int hub_client = 0;
+volatile int hub_imu_running = 0;
+static hub_region_t* hub = NULL;
+static size_t hub_size;
+static int server_running = 0;
+static unsigned int server_streams;
+static rc_loop_t hub_loop;
+static uint64_t last_baro_samples;
+static uint64_t last_dsm_packet_ns;
+static int last_dsm_active;
+static const uint32_t sample_size[HUB_STREAMS] = {
+	sizeof(rc_hub_imu_t),
+	sizeof(rc_encoder_snapshot_t),
+	sizeof(rc_hub_adc_t),
+	sizeof(rc_hub_dsm_t),
+	sizeof(rc_bmp_data_t)
+};
+
+/*******************************************************************************
+* static size_t region_size()
+*
+* header followed by each ring, cache line aligned
+*******************************************************************************/
+static size_t region_size(){
+	size_t size = HUB_ALIGN(sizeof(hub_region_t));
+	int i;
+	for(i=0; i<HUB_STREAMS; i++){
+		size = HUB_ALIGN(size + (size_t)sample_size[i]*RC_HUB_RING_LEN);
+	}
+	return size;
+}
+
+/*******************************************************************************
+* static int stream_index(unsigned int stream)
+*
+* index of a single RC_HUB_ flag, -1 if it isn't one
+*******************************************************************************/
+static int stream_index(unsigned int stream){
+	if(stream==0 || (stream&(stream-1)) || (stream&~RC_HUB_ALL)) return -1;
+	return __builtin_ctz(stream);
+}
+
+static inline void* slot(int i, uint32_t n){
+	return (char*)hub + hub->stream[i].offset + \
+				(size_t)(n%RC_HUB_RING_LEN)*hub->stream[i].size;
+}
+
+static inline long futex(volatile uint32_t* addr, int op, uint32_t val,\
+											const struct timespec* timeout){
+	return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+/*******************************************************************************
+* static void commit(int i)
+*
+* makes the sample written to slot(i, head) visible and wakes any waiters.
+* Only one thread writes each stream.
+*******************************************************************************/
+static void commit(int i){
+	hub_stream_t* s = &hub->stream[i];
+	__sync_synchronize();
+	s->head++;
+	__sync_synchronize();
+	if(s->waiters) futex(&s->head, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+static void publish(int i, const void* sample){
+	memcpy(slot(i, hub->stream[i].head), sample, hub->stream[i].size);
+	commit(i);
+}
+
+/*******************************************************************************
+* static int open_region(int server)
+*
+* The server creates the region or reuses the one a previous server left so
+* clients stay connected and keep their cursors. Clients only open it.
+*******************************************************************************/
+static int open_region(int server){
+	struct stat st;
+	hub_region_t* r;
+	size_t offset;
+	int fd, i;
+
+	if(hub!=NULL) return 0;
+	hub_size = region_size();
+	if(server) fd = shm_open(HUB_SHM_NAME, O_RDWR|O_CREAT, 0644);
+	else fd = shm_open(HUB_SHM_NAME, O_RDWR, 0);
+	if(fd<0){
+		if(!server && errno==ENOENT){
+			fprintf(stderr,"ERROR: no sensor hub, start a server with rc_hub_start_server\n");
+		}
+		else perror("ERROR: failed to open sensor hub shared memory, are you root?");
+		return -1;
+	}
+	if(fstat(fd, &st)){
+		perror("ERROR: failed to stat sensor hub shared memory");
+		close(fd);
+		return -1;
+	}
+	if((size_t)st.st_size!=hub_size){
+		// an empty new region or one from a different library version
+		if(!server){
+			fprintf(stderr,"ERROR: sensor hub was started by a different library version\n");
+			close(fd);
+			return -1;
+		}
+		if(ftruncate(fd, hub_size)){
+			perror("ERROR: failed to size sensor hub shared memory");
+			close(fd);
+			return -1;
+		}
+	}
+	r = mmap(NULL, hub_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(r==MAP_FAILED){
+		perror("ERROR: failed to map sensor hub shared memory");
+		return -1;
+	}
+
+	if(r->magic!=HUB_MAGIC || r->version!=HUB_VERSION || r->size!=hub_size){
+		if(!server){
+			fprintf(stderr,"ERROR: sensor hub shared memory not set up\n");
+			munmap(r, hub_size);
+			return -1;
+		}
+		r->magic = 0;
+		__sync_synchronize();
+		memset((void*)r, 0, hub_size);
+		offset = HUB_ALIGN(sizeof(hub_region_t));
+		for(i=0; i<HUB_STREAMS; i++){
+			r->stream[i].size = sample_size[i];
+			r->stream[i].offset = offset;
+			offset = HUB_ALIGN(offset + (size_t)sample_size[i]*RC_HUB_RING_LEN);
+		}
+		r->version = HUB_VERSION;
+		r->size = hub_size;
+		__sync_synchronize();
+		r->magic = HUB_MAGIC;
+	}
+	hub = r;
+	return 0;
+}
+
+/*******************************************************************************
+* void hub_publish_imu(rc_imu_data_t* data, uint64_t timestamp_ns)
+*
+* called from the IMU interrupt after each successful FIFO read, writes
+* straight into the ring to avoid another copy
+*******************************************************************************/
+void hub_publish_imu(rc_imu_data_t* data, uint64_t timestamp_ns){
+	rc_hub_imu_t* s = slot(HUB_IMU, hub->stream[HUB_IMU].head);
+	s->timestamp_ns = timestamp_ns;
+	s->data = *data;
+	commit(HUB_IMU);
+}
+
+/*******************************************************************************
+* static void hub_func(void* arg)
+*
+* publishes the polled streams and the heartbeat every period
+*******************************************************************************/
+static void hub_func(__unused void* arg){
+	rc_encoder_snapshot_t enc;
+	rc_hub_adc_t adc;
+	rc_hub_dsm_t dsm;
+	rc_bmp_data_t baro;
+	int i;
+
+	if(server_streams&RC_HUB_ENCODERS){
+		if(rc_get_encoder_snapshot(&enc)==0) publish(HUB_ENCODERS, &enc);
+	}
+	if(server_streams&RC_HUB_ADC){
+		adc.timestamp_ns = rc_nanos_since_boot();
+		for(i=0; i<7; i++) adc.volt[i] = rc_adc_volt(i);
+		adc.battery_v = rc_battery_voltage();
+		adc.jack_v = rc_dc_jack_voltage();
+		publish(HUB_ADC, &adc);
+	}
+	// only publish dsm frames when something changed so the ring holds
+	// packets rather than repeats
+	if(server_streams&RC_HUB_DSM){
+		dsm_get_frame(&dsm);
+		if(dsm.packet_ns!=last_dsm_packet_ns || dsm.active!=last_dsm_active){
+			dsm.timestamp_ns = rc_nanos_since_boot();
+			publish(HUB_DSM, &dsm);
+			last_dsm_packet_ns = dsm.packet_ns;
+			last_dsm_active = dsm.active;
+		}
+	}
+	// never spin on the sampler's seqlock, a missed sample is published next
+	// period if a newer one hasn't replaced it
+	if(server_streams&RC_HUB_BARO){
+		if(bmp_try_get_data(&baro)==0 && baro.samples!=last_baro_samples){
+			publish(HUB_BARO, &baro);
+			last_baro_samples = baro.samples;
+		}
+	}
+	hub->heartbeat_ms = rc_nanos_since_boot()/1000000;
+}
+
+/*******************************************************************************
+* int rc_hub_start_server(unsigned int streams, int rate_hz, int priority)
+*
+* publishes the given streams, see roboticscape.h
+*******************************************************************************/
+int rc_hub_start_server(unsigned int streams, int rate_hz, int priority){
+	rc_loop_config_t conf;
+
+	if(server_running){
+		fprintf(stderr,"ERROR: sensor hub server already running\n");
+		return -1;
+	}
+	if(hub_client){
+		fprintf(stderr,"ERROR: can't start a sensor hub server while connected as a client\n");
+		return -1;
+	}
+	if(streams==0 || (streams&~RC_HUB_ALL)){
+		fprintf(stderr,"ERROR: invalid sensor hub streams\n");
+		return -1;
+	}
+	if(rate_hz<1){
+		fprintf(stderr,"ERROR: sensor hub rate must be >=1hz\n");
+		return -1;
+	}
+	if(open_region(1)) return -1;
+
+	server_streams = streams;
+	last_baro_samples = 0;
+	last_dsm_packet_ns = 0;
+	last_dsm_active = -1;
+	hub->streams = streams;
+	hub->alive_ms = HUB_ALIVE_MS;
+	if(HUB_ALIVE_PERIODS*1000/rate_hz > HUB_ALIVE_MS){
+		hub->alive_ms = HUB_ALIVE_PERIODS*1000/rate_hz;
+	}
+	hub->heartbeat_ms = rc_nanos_since_boot()/1000000;
+	__sync_synchronize();
+	hub->pid = getpid();
+
+	conf = rc_loop_default_config();
+	conf.rate_hz = rate_hz;
+	conf.priority = priority;
+	server_running = 1;
+	if(rc_loop_start(&hub_loop, conf, hub_func, NULL)){
+		server_running = 0;
+		hub->pid = 0;
+		return -1;
+	}
+	if(streams&RC_HUB_IMU) hub_imu_running = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_hub_stop_server()
+*
+* The region stays mapped since the IMU interrupt may still be publishing,
+* and stays in shared memory for clients and the next server.
+*******************************************************************************/
+int rc_hub_stop_server(){
+	int ret, i;
+	if(!server_running) return 0;
+	hub_imu_running = 0;
+	server_running = 0;
+	ret = rc_loop_stop(&hub_loop);
+	hub->streams = 0;
+	hub->pid = 0;
+	__sync_synchronize();
+	// let waiting clients see the server is gone
+	for(i=0; i<HUB_STREAMS; i++){
+		if(hub->stream[i].waiters) futex(&hub->stream[i].head, FUTEX_WAKE, INT_MAX, NULL);
+	}
+	return ret;
+}
+
+/*******************************************************************************
+* int rc_hub_connect()
+*
+* maps the region and routes the getters to it, see roboticscape.h
+*******************************************************************************/
+int rc_hub_connect(){
+	if(hub_client) return 0;
+	if(server_running){
+		fprintf(stderr,"ERROR: can't connect to the sensor hub while serving it\n");
+		return -1;
+	}
+	if(open_region(0)) return -1;
+	if(!rc_hub_server_alive()){
+		fprintf(stderr,"WARNING: sensor hub server isn't running, values will be stale\n");
+	}
+	hub_client = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_hub_disconnect()
+*******************************************************************************/
+int rc_hub_disconnect(){
+	if(!hub_client) return 0;
+	hub_client = 0;
+	__sync_synchronize();
+	munmap((void*)hub, hub_size);
+	hub = NULL;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_hub_server_alive()
+*******************************************************************************/
+int rc_hub_server_alive(){
+	uint32_t now_ms;
+	pid_t pid;
+	if(hub==NULL) return 0;
+	pid = hub->pid;
+	if(pid==0) return 0;
+	if(kill(pid, 0) && errno==ESRCH) return 0;
+	now_ms = rc_nanos_since_boot()/1000000;
+	if(now_ms - hub->heartbeat_ms > hub->alive_ms) return 0;
+	return 1;
+}
+
+/*******************************************************************************
+* int rc_hub_latest(unsigned int stream, void* sample)
+*
+* copies the newest sample, again if the writer lapped it while copying
+*******************************************************************************/
+int rc_hub_latest(unsigned int stream, void* sample){
+	hub_stream_t* s;
+	uint32_t h;
+	int i = stream_index(stream);
+
+	if(i<0){
+		fprintf(stderr,"ERROR: in rc_hub_latest, stream must be one RC_HUB_ flag\n");
+		return -1;
+	}
+	if(sample==NULL){
+		fprintf(stderr,"ERROR: in rc_hub_latest, received NULL pointer\n");
+		return -1;
+	}
+	if(hub==NULL){
+		fprintf(stderr,"ERROR: in rc_hub_latest, not connected to the sensor hub\n");
+		return -1;
+	}
+	s = &hub->stream[i];
+	do{
+		h = s->head;
+		if(h==0) return -1;
+		__sync_synchronize();
+		memcpy(sample, slot(i, h-1), s->size);
+		__sync_synchronize();
+	}while(s->head-(h-1) >= RC_HUB_RING_LEN);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_hub_read(unsigned int stream, uint32_t* cursor, void* samples, int n)
+*
+* A writer publishing sample head overwrites sample head-RC_HUB_RING_LEN, so
+* a copy is only good if the head is still less than RC_HUB_RING_LEN past the
+* oldest sample copied once it's done.
+*******************************************************************************/
+int rc_hub_read(unsigned int stream, uint32_t* cursor, void* samples, int n){
+	hub_stream_t* s;
+	uint32_t h, oldest, count, k;
+	int i = stream_index(stream);
+
+	if(i<0){
+		fprintf(stderr,"ERROR: in rc_hub_read, stream must be one RC_HUB_ flag\n");
+		return -1;
+	}
+	if(cursor==NULL || samples==NULL){
+		fprintf(stderr,"ERROR: in rc_hub_read, received NULL pointer\n");
+		return -1;
+	}
+	if(hub==NULL){
+		fprintf(stderr,"ERROR: in rc_hub_read, not connected to the sensor hub\n");
+		return -1;
+	}
+	if(n<1) return 0;
+	s = &hub->stream[i];
+	do{
+		h = s->head;
+		oldest = h<RC_HUB_RING_LEN ? 0 : h-(RC_HUB_RING_LEN-1);
+		// skip ahead if lapped, or start over if the cursor is from nowhere
+		if(*cursor-oldest > h-oldest) *cursor = oldest;
+		count = h - *cursor;
+		if(count>(uint32_t)n) count = n;
+		__sync_synchronize();
+		for(k=0; k<count; k++){
+			memcpy((char*)samples + k*s->size, slot(i, *cursor+k), s->size);
+		}
+		__sync_synchronize();
+	}while(s->head-*cursor >= RC_HUB_RING_LEN);
+	*cursor += count;
+	return count;
+}
+
+/*******************************************************************************
+* int rc_hub_wait(unsigned int stream, uint32_t cursor, int timeout_ms)
+*
+* Sleeps on the stream head. Sleeps are limited to the heartbeat timeout so
+* a server that died without stopping is noticed, returns -1 then.
+*******************************************************************************/
+int rc_hub_wait(unsigned int stream, uint32_t cursor, int timeout_ms){
+	hub_stream_t* s;
+	struct timespec ts;
+	uint64_t now, deadline = 0, sleep_ns;
+	int i = stream_index(stream);
+
+	if(i<0){
+		fprintf(stderr,"ERROR: in rc_hub_wait, stream must be one RC_HUB_ flag\n");
+		return -1;
+	}
+	if(hub==NULL){
+		fprintf(stderr,"ERROR: in rc_hub_wait, not connected to the sensor hub\n");
+		return -1;
+	}
+	s = &hub->stream[i];
+	if(timeout_ms>=0) deadline = rc_nanos_since_boot() + (uint64_t)timeout_ms*1000000;
+	while(s->head==cursor){
+		if(!rc_hub_server_alive()) return -1;
+		sleep_ns = hub->alive_ms*1000000ULL;
+		if(timeout_ms>=0){
+			now = rc_nanos_since_boot();
+			if(now>=deadline) return 1;
+			if(deadline-now < sleep_ns) sleep_ns = deadline-now;
+		}
+		ts.tv_sec = sleep_ns/1000000000;
+		ts.tv_nsec = sleep_ns%1000000000;
+		__sync_fetch_and_add(&s->waiters, 1);
+		futex(&s->head, FUTEX_WAIT, cursor, &ts);
+		__sync_fetch_and_sub(&s->waiters, 1);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* uint32_t rc_hub_cursor(unsigned int stream)
+*******************************************************************************/
+uint32_t rc_hub_cursor(unsigned int stream){
+	int i = stream_index(stream);
+	if(i<0 || hub==NULL) return 0;
+	return hub->stream[i].head;
+}
@@ -0,0 +1,13 @@
+/*******************************************************************************
+* rc_hub.h
+*
+* internal hooks for the sensor hub, the hub functions for the user are in
+* roboticscape.h
+*******************************************************************************/
+#include <stdint.h>
+
+// set while this process is a hub client, getters read from the hub
+extern volatile int hub_client;
+// set while this process is a hub server publishing the IMU
+extern volatile int hub_imu_running;
+void hub_publish_imu(rc_imu_data_t* data, uint64_t timestamp_ns);
@@ -0,0 +1,334 @@
+/*******************************************************************************
+* rc_loop.c
+*
+* Periodic loops that sleep to absolute deadlines on CLOCK_MONOTONIC so the
+* rate doesn't drift, with overrun handling and jitter and execution time
+* statistics. Statistics are only written by the loop's own thread and
+* published through a seqlock so other threads can read them without making
+* the loop wait.
+*******************************************************************************/
+#define _GNU_SOURCE
+#include "../roboticscape.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+
+/*******************************************************************************
+* Local Function Declarations
+*******************************************************************************/
+static void* loop_thread(void* ptr);
+
+/*******************************************************************************
+* rc_loop_config_t rc_loop_default_config()
+*******************************************************************************/
+rc_loop_config_t rc_loop_default_config(){
+	rc_loop_config_t conf;
+	conf.rate_hz = 100;
+	conf.priority = 0;
+	conf.cpu = -1;
+	conf.overrun = RC_LOOP_SKIP;
+	return conf;
+}
+
+/*******************************************************************************
+* static int check_config(rc_loop_config_t* config)
+*******************************************************************************/
+static int check_config(rc_loop_config_t* config){
+	if(config->rate_hz<=0){
+		fprintf(stderr,"ERROR: loop rate must be >0\n");
+		return -1;
+	}
+	if(config->priority<0 || \
+			config->priority>sched_get_priority_max(SCHED_FIFO)){
+		fprintf(stderr,"ERROR: loop priority must be from 0 to %d\n",\
+									sched_get_priority_max(SCHED_FIFO));
+		return -1;
+	}
+	if(config->overrun!=RC_LOOP_SKIP && config->overrun!=RC_LOOP_CATCH_UP){
+		fprintf(stderr,"ERROR: invalid loop overrun policy\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* static void setup_timing(rc_loop_t* loop, rc_loop_config_t config)
+*
+* first deadline is one period from now
+*******************************************************************************/
+static void setup_timing(rc_loop_t* loop, rc_loop_config_t config){
+	loop->config = config;
+	loop->period_ns = (uint64_t)(1000000000.0/config.rate_hz);
+	if(loop->period_ns==0) loop->period_ns = 1;
+	memset(&loop->stats, 0, sizeof(loop->stats));
+	loop->seq = 0;
+	loop->reset_flag = 0;
+	loop->wake_ns = rc_nanos_since_boot();
+	loop->next_ns = loop->wake_ns;
+	loop->initialized = 1;
+}
+
+/*******************************************************************************
+* static int hist_bin(uint64_t ns)
+*
+* bin 0 is under 1us, bin n is 2^(n-1) to 2^n us
+*******************************************************************************/
+static int hist_bin(uint64_t ns){
+	uint64_t us = ns/1000;
+	int bin = 0;
+	while(us && bin<RC_LOOP_HIST_BINS-1){
+		us >>= 1;
+		bin++;
+	}
+	return bin;
+}
+
+/*******************************************************************************
+* int rc_loop_init(rc_loop_t* loop, rc_loop_config_t config)
+*
+* sets up a loop to be paced by rc_loop_wait from the calling thread
+*******************************************************************************/
+int rc_loop_init(rc_loop_t* loop, rc_loop_config_t config){
+	struct sched_param params;
+	cpu_set_t cpus;
+
+	if(loop==NULL){
+		fprintf(stderr,"ERROR: in rc_loop_init, received NULL pointer\n");
+		return -1;
+	}
+	if(check_config(&config)) return -1;
+	if(config.priority>0){
+		params.sched_priority = config.priority;
+		if(pthread_setschedparam(pthread_self(), SCHED_FIFO, &params)){
+			fprintf(stderr,"WARNING: failed to set loop priority, are you root?\n");
+		}
+	}
+	if(config.cpu>=0){
+		CPU_ZERO(&cpus);
+		CPU_SET(config.cpu, &cpus);
+		if(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)){
+			fprintf(stderr,"WARNING: failed to set loop affinity to cpu %d\n",\
+																config.cpu);
+		}
+	}
+	loop->running = 0;
+	loop->joinable = 0;
+	setup_timing(loop, config);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_loop_wait(rc_loop_t* loop)
+*
+* Ends one iteration. Records its execution time, sleeps until the next
+* deadline, and records how late the wakeup was. Returns the number of
+* deadlines missed, 0 if on time.
+*******************************************************************************/
+int rc_loop_wait(rc_loop_t* loop){
+	struct timespec t;
+	uint64_t now, exec, jitter, deadline;
+	int missed = 0;
+	rc_loop_stats_t* s;
+
+	if(loop==NULL || !loop->initialized){
+		fprintf(stderr,"ERROR: in rc_loop_wait, loop not initialized\n");
+		return -1;
+	}
+	s = &loop->stats;
+	now = rc_nanos_since_boot();
+	exec = now - loop->wake_ns;
+	loop->next_ns += loop->period_ns;
+
+	// finished after the next deadline already passed
+	if(now > loop->next_ns){
+		missed = 1 + (now - loop->next_ns)/loop->period_ns;
+		if(loop->config.overrun==RC_LOOP_SKIP){
+			loop->next_ns += (uint64_t)missed*loop->period_ns;
+		}
+	}
+	deadline = loop->next_ns;
+	if(deadline > now){
+		t.tv_sec = deadline/1000000000;
+		t.tv_nsec = deadline%1000000000;
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL)==EINTR);
+		now = rc_nanos_since_boot();
+	}
+	jitter = now - deadline;
+	loop->wake_ns = now;
+
+	// publish the stats, readers retry if seq changed under them
+	loop->seq++;
+	__sync_synchronize();
+	if(loop->reset_flag){
+		memset(s, 0, sizeof(*s));
+		loop->reset_flag = 0;
+	}
+	else{
+		s->iterations++;
+		s->exec_sum_ns += exec;
+		if(exec>s->exec_max_ns) s->exec_max_ns = exec;
+		s->exec_hist[hist_bin(exec)]++;
+		s->jitter_sum_ns += jitter;
+		if(jitter>s->jitter_max_ns) s->jitter_max_ns = jitter;
+		s->jitter_hist[hist_bin(jitter)]++;
+		if(missed){
+			s->overruns++;
+			if(loop->config.overrun==RC_LOOP_SKIP) s->skipped += missed;
+		}
+	}
+	__sync_synchronize();
+	loop->seq++;
+	return missed;
+}
+
+/*******************************************************************************
+* static void* loop_thread(void* ptr)
+*******************************************************************************/
+static void* loop_thread(void* ptr){
+	rc_loop_t* loop = (rc_loop_t*)ptr;
+	setup_timing(loop, loop->config);
+	while(loop->running && rc_get_state()!=EXITING){
+		loop->func(loop->arg);
+		rc_loop_wait(loop);
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* int rc_loop_start(rc_loop_t* loop, rc_loop_config_t config,
+*										void (*func)(void*), void* arg)
+*
+* starts a thread calling func(arg) every period
+*******************************************************************************/
+int rc_loop_start(rc_loop_t* loop, rc_loop_config_t config,\
+									void (*func)(void*), void* arg){
+	pthread_attr_t attr;
+	struct sched_param params;
+	cpu_set_t cpus;
+
+	if(loop==NULL || func==NULL){
+		fprintf(stderr,"ERROR: in rc_loop_start, received NULL pointer\n");
+		return -1;
+	}
+	if(check_config(&config)) return -1;
+	if(loop->joinable){
+		fprintf(stderr,"ERROR: in rc_loop_start, loop thread still running\n");
+		return -1;
+	}
+	loop->config = config;
+	loop->func = func;
+	loop->arg = arg;
+	loop->initialized = 0;
+	loop->running = 1;
+
+	pthread_attr_init(&attr);
+	if(config.priority>0){
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		params.sched_priority = config.priority;
+		pthread_attr_setschedparam(&attr, &params);
+	}
+	if(config.cpu>=0){
+		CPU_ZERO(&cpus);
+		CPU_SET(config.cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+	if(pthread_create(&loop->thread, &attr, loop_thread, loop)){
+		fprintf(stderr,"ERROR: failed to start loop thread\n");
+		pthread_attr_destroy(&attr);
+		loop->running = 0;
+		return -1;
+	}
+	pthread_attr_destroy(&attr);
+	loop->joinable = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_loop_stop(rc_loop_t* loop)
+*
+* Signals a thread from rc_loop_start to stop and waits up to one period plus
+* 0.5s for the current iteration to finish. If it times out the thread is
+* still joinable and calling this again waits again.
+*******************************************************************************/
+int rc_loop_stop(rc_loop_t* loop){
+	timespec thread_timeout;
+	int thread_err;
+
+	if(loop==NULL || !loop->joinable) return 0;
+	loop->running = 0;
+	clock_gettime(CLOCK_REALTIME, &thread_timeout);
+	rc_timespec_add(&thread_timeout, 0.5+(1.0/loop->config.rate_hz));
+	thread_err = pthread_timedjoin_np(loop->thread, NULL, &thread_timeout);
+	if(thread_err == ETIMEDOUT){
+		printf("WARNING: loop thread exit timeout\n");
+		return -1;
+	}
+	loop->joinable = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_loop_get_stats(rc_loop_t* loop, rc_loop_stats_t* stats)
+*
+* copies the stats, retrying if the loop published while copying
+*******************************************************************************/
+int rc_loop_get_stats(rc_loop_t* loop, rc_loop_stats_t* stats){
+	unsigned int seq;
+	if(loop==NULL || stats==NULL){
+		fprintf(stderr,"ERROR: in rc_loop_get_stats, received NULL pointer\n");
+		return -1;
+	}
+	do{
+		while((seq=loop->seq)&1);
+		__sync_synchronize();
+		*stats = loop->stats;
+		__sync_synchronize();
+	}while(seq!=loop->seq);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_loop_reset_stats(rc_loop_t* loop)
+*
+* the loop thread clears its own stats at the end of its next iteration
+*******************************************************************************/
+int rc_loop_reset_stats(rc_loop_t* loop){
+	if(loop==NULL){
+		fprintf(stderr,"ERROR: in rc_loop_reset_stats, received NULL pointer\n");
+		return -1;
+	}
+	loop->reset_flag = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_loop_print_stats(rc_loop_t* loop, const char* name)
+*******************************************************************************/
+int rc_loop_print_stats(rc_loop_t* loop, const char* name){
+	rc_loop_stats_t s;
+	int i;
+	if(rc_loop_get_stats(loop, &s)) return -1;
+	printf("%s: %.1fhz, %llu iterations, %llu overruns, %llu skipped\n",\
+			name!=NULL ? name : "loop", loop->config.rate_hz,\
+			(unsigned long long)s.iterations, (unsigned long long)s.overruns,\
+			(unsigned long long)s.skipped);
+	if(s.iterations==0) return 0;
+	printf("  jitter avg %6lluns max %6lluns\n",\
+			(unsigned long long)(s.jitter_sum_ns/s.iterations),\
+			(unsigned long long)s.jitter_max_ns);
+	printf("  exec   avg %6lluns max %6lluns\n",\
+			(unsigned long long)(s.exec_sum_ns/s.iterations),\
+			(unsigned long long)s.exec_max_ns);
+	printf("  <us     jitter       exec\n");
+	for(i=0; i<RC_LOOP_HIST_BINS; i++){
+		if(s.jitter_hist[i]==0 && s.exec_hist[i]==0) continue;
+		if(i==RC_LOOP_HIST_BINS-1) printf("  >%-5d", 1<<(i-1));
+		else printf("  %-6d", 1<<i);
+		printf(" %10u %10u\n", s.jitter_hist[i], s.exec_hist[i]);
+	}
+	return 0;
+}
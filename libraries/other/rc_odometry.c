@@ -0,0 +1,246 @@
+/*******************************************************************************
+* rc_odometry.c
+*
+* Differential drive odometry. A background thread takes encoder snapshots at
+* a fixed rate, integrates the robot pose, and publishes it through a seqlock
+* so any thread can read a coherent pose without blocking the integrator.
+*******************************************************************************/
+#define _GNU_SOURCE
+#include "../roboticscape.h"
+#include "../rc_defs.h"
+#include <stdio.h>
+#include <math.h>
+
+#ifndef PI
+#define PI (float)M_PI
+#endif
+
+/*******************************************************************************
+* Local Global Variables
+*******************************************************************************/
+static rc_odometry_config_t odo_config;
+static int odometry_running = 0;
+static volatile int odometry_reset_flag = 0;
+// published pose, odo_seq is odd while odo_pose is being written
+static rc_odometry_t odo_pose;
+static volatile unsigned int odo_seq = 0;
+static rc_loop_t odo_loop;
+// integrator state, only touched by the loop thread
+static rc_odometry_t pose;
+static uint64_t last_ns;
+static int last_l, last_r;
+static float last_yaw, m_per_count;
+
+/*******************************************************************************
+* Local Function Declarations
+*******************************************************************************/
+static void odometry_step(void* ptr);
+
+/*******************************************************************************
+* rc_odometry_config_t rc_default_odometry_config()
+*
+* defaults match the eduMiP wheels used by rc_balance
+*******************************************************************************/
+rc_odometry_config_t rc_default_odometry_config(){
+	rc_odometry_config_t conf;
+	conf.left_ch = 3;
+	conf.right_ch = 2;
+	conf.left_polarity = 1;
+	conf.right_polarity = -1;
+	conf.counts_per_rev = 35.577*60;
+	conf.wheel_radius_m = 0.034;
+	conf.track_width_m = 0.035;
+	conf.rate_hz = 500;
+	conf.priority = 0;
+	conf.imu_data = NULL;
+	conf.imu_polarity = 1;
+	conf.imu_weight = 0.98;
+	return conf;
+}
+
+/*******************************************************************************
+* int rc_initialize_odometry(rc_odometry_config_t config)
+*
+* checks the config, zeros the pose, and starts the integrator thread
+*******************************************************************************/
+int rc_initialize_odometry(rc_odometry_config_t config){
+	rc_loop_config_t loop_conf = rc_loop_default_config();
+
+	if(odometry_running){
+		fprintf(stderr,"ERROR: odometry already running\n");
+		return -1;
+	}
+	if(config.left_ch<1 || config.left_ch>4 || \
+					config.right_ch<1 || config.right_ch>4){
+		fprintf(stderr,"ERROR: odometry encoder channels must be 1-4\n");
+		return -1;
+	}
+	if(config.counts_per_rev<=0 || config.wheel_radius_m<=0 || \
+											config.track_width_m<=0){
+		fprintf(stderr,"ERROR: odometry geometry must be positive\n");
+		return -1;
+	}
+	if(config.rate_hz<1){
+		fprintf(stderr,"ERROR: odometry rate must be >=1hz\n");
+		return -1;
+	}
+	if(config.imu_weight<0.0 || config.imu_weight>1.0){
+		fprintf(stderr,"ERROR: odometry imu_weight must be from 0 to 1\n");
+		return -1;
+	}
+	odo_config = config;
+	m_per_count = 2.0*PI*config.wheel_radius_m/config.counts_per_rev;
+	odometry_reset_flag = 1;
+
+	loop_conf.rate_hz = config.rate_hz;
+	loop_conf.priority = config.priority;
+	if(rc_loop_start(&odo_loop, loop_conf, odometry_step, NULL)){
+		fprintf(stderr,"ERROR: failed to start odometry thread\n");
+		return -1;
+	}
+	odometry_running = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_stop_odometry()
+*
+* Stops the integrator thread, waiting up to one period plus 0.5s for it to
+* exit. Odometry only counts as stopped once it has, so it can't be started
+* again on top of a thread that's still publishing.
+*******************************************************************************/
+int rc_stop_odometry(){
+	if(!odometry_running) return 0;
+	if(rc_loop_stop(&odo_loop)) return -1;
+	odometry_running = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_reset_odometry()
+*
+* zeros the pose on the next integrator step
+*******************************************************************************/
+int rc_reset_odometry(){
+	if(!odometry_running){
+		fprintf(stderr,"ERROR: odometry not running\n");
+		return -1;
+	}
+	odometry_reset_flag = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_get_odometry(rc_odometry_t* pose)
+*
+* Copies the latest pose. The writer never waits on readers, the copy is just
+* retried if the integrator published while it was being made.
+*******************************************************************************/
+int rc_get_odometry(rc_odometry_t* pose){
+	unsigned int seq;
+	if(pose==NULL){
+		fprintf(stderr,"ERROR: in rc_get_odometry, received NULL pointer\n");
+		return -1;
+	}
+	if(!odometry_running){
+		fprintf(stderr,"ERROR: odometry not running\n");
+		return -1;
+	}
+	do{
+		while((seq=odo_seq)&1);
+		__sync_synchronize();
+		*pose = odo_pose;
+		__sync_synchronize();
+	}while(seq!=odo_seq);
+	return 0;
+}
+
+/*******************************************************************************
+* static void publish_pose(rc_odometry_t* pose)
+*
+* seqlock write side, only called from the integrator thread
+*******************************************************************************/
+static void publish_pose(rc_odometry_t* pose){
+	odo_seq++;
+	__sync_synchronize();
+	odo_pose = *pose;
+	__sync_synchronize();
+	odo_seq++;
+}
+
+/*******************************************************************************
+* static float wrap_angle(float a)
+*
+* wraps an angle difference into -PI to PI
+*******************************************************************************/
+static float wrap_angle(float a){
+	while(a>PI) a -= 2*PI;
+	while(a<-PI) a += 2*PI;
+	return a;
+}
+
+/*******************************************************************************
+* static void odometry_step(void* ptr)
+*
+* Called by odo_loop at rate_hz. Integrates the pose using the midpoint
+* heading of each step. Wheel travel comes from encoder snapshots so both
+* wheels are sampled at the same instant and dt comes from the snapshot
+* timestamps rather than the nominal period. When IMU data is given the heading change is blended with
+* the change in DMP yaw which doesn't suffer from wheel slip.
+*******************************************************************************/
+static void odometry_step(__attribute__ ((unused)) void* ptr){
+	rc_encoder_snapshot_t snap;
+	float yaw, dl, dr, ds, dtheta, dt;
+
+	if(rc_get_encoder_snapshot(&snap)==0){
+		if(odometry_reset_flag){
+			pose.x = 0;
+			pose.y = 0;
+			pose.theta = 0;
+			pose.v = 0;
+			pose.omega = 0;
+			pose.left_m = 0;
+			pose.right_m = 0;
+			pose.timestamp_ns = snap.timestamp_ns;
+			last_l = snap.pos[odo_config.left_ch-1];
+			last_r = snap.pos[odo_config.right_ch-1];
+			last_ns = snap.timestamp_ns;
+			if(odo_config.imu_data!=NULL){
+				last_yaw = odo_config.imu_polarity * \
+							odo_config.imu_data->dmp_TaitBryan[TB_YAW_Z];
+			}
+			odometry_reset_flag = 0;
+			publish_pose(&pose);
+		}
+		else if(snap.timestamp_ns>last_ns){
+			dl = odo_config.left_polarity*m_per_count* \
+					(snap.pos[odo_config.left_ch-1]-last_l);
+			dr = odo_config.right_polarity*m_per_count* \
+					(snap.pos[odo_config.right_ch-1]-last_r);
+			last_l = snap.pos[odo_config.left_ch-1];
+			last_r = snap.pos[odo_config.right_ch-1];
+			dt = (snap.timestamp_ns-last_ns)/1000000000.0f;
+			last_ns = snap.timestamp_ns;
+
+			ds = (dl+dr)/2.0f;
+			dtheta = (dr-dl)/odo_config.track_width_m;
+			if(odo_config.imu_data!=NULL){
+				yaw = odo_config.imu_polarity * \
+							odo_config.imu_data->dmp_TaitBryan[TB_YAW_Z];
+				dtheta = (odo_config.imu_weight*wrap_angle(yaw-last_yaw)) \
+						+ ((1.0f-odo_config.imu_weight)*dtheta);
+				last_yaw = yaw;
+			}
+
+			pose.x += ds*cosf(pose.theta+(dtheta/2.0f));
+			pose.y += ds*sinf(pose.theta+(dtheta/2.0f));
+			pose.theta = wrap_angle(pose.theta+dtheta);
+			pose.v = ds/dt;
+			pose.omega = dtheta/dt;
+			pose.left_m += dl;
+			pose.right_m += dr;
+			pose.timestamp_ns = snap.timestamp_ns;
+			publish_pose(&pose);
+		}
+	}
+}
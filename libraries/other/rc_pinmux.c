@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <fcntl.h> // for open
 #include <unistd.h> // for close
+#include <string.h>
 
 // P9_11 used for DSM2 radio and not exposed to user
 #define P9_11_PATH "/sys/devices/platform/ocp/ocp:P9_11_pinmux/state"
@@ -43,6 +44,83 @@
 #define J15_PATH "/sys/devices/platform/ocp/ocp:J15_pinmux/state"
 #define H17_PATH "/sys/devices/platform/ocp/ocp:H17_pinmux/state"
 
+#define STATE_BUF 16
+
+// state names used by the pinmux helper, indexed by rc_pinmux_mode_t
+static const char* mode_names[] = {"gpio", "gpio_pu", "gpio_pd", "pwm", \
+													"spi", "uart", "can"};
+#define NUM_MODES ((int)(sizeof(mode_names)/sizeof(mode_names[0])))
+
+// Last known mode of each pin indexed by gpio number. Each helper's state is
+// read the first time its pin is touched and kept up to date as we write it,
+// so pins already in the requested mode are never written again. Writing a
+// state makes the kernel reprogram the pad even if nothing changes.
+static int mode_known[128];
+static rc_pinmux_mode_t known_mode[128];
+
+/*******************************************************************************
+* static void read_pinmux_state(int pin, const char* path)
+*
+* fills in the cache from the helper's current state, leaves it unknown if the
+* state can't be read or isn't one of ours (eg "default")
+*******************************************************************************/
+static void read_pinmux_state(int pin, const char* path){
+	char buf[STATE_BUF];
+	int fd, len, i;
+
+	fd = open(path, O_RDONLY);
+	if(fd==-1) return;
+	len = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	if(len<=0) return;
+	buf[len] = 0;
+	if(buf[len-1]=='\n') buf[len-1] = 0;
+	for(i=0; i<NUM_MODES; i++){
+		if(strcmp(buf, mode_names[i])==0){
+			known_mode[pin] = (rc_pinmux_mode_t)i;
+			mode_known[pin] = 1;
+			return;
+		}
+	}
+}
+
+/*******************************************************************************
+* static int write_pinmux_state(int pin, const char* path, rc_pinmux_mode_t mode)
+*
+* writes the new state unless the pin is already known to be in it
+*******************************************************************************/
+static int write_pinmux_state(int pin, const char* path, rc_pinmux_mode_t mode){
+	int fd, ret, len;
+
+	if(mode<0 || (int)mode>=NUM_MODES){
+		printf("ERROR: unknown PINMUX mode\n");
+		return -1;
+	}
+	if(!mode_known[pin]) read_pinmux_state(pin, path);
+	if(mode_known[pin] && known_mode[pin]==mode) return 0;
+
+	// open pin state fd
+	errno=0;
+	fd = open(path, O_WRONLY);
+	if(unlikely(fd==-1)){
+		printf("can't open: ");
+		printf(path);
+		printf("\n");
+		perror("Pinmux");
+		return -1;
+	}
+	len = strlen(mode_names[mode]);
+	ret = write(fd, mode_names[mode], len);
+	close(fd);
+	if(ret<0){
+		printf("ERROR: failed to write to pinmux driver\n");
+		mode_known[pin] = 0;
+		return -1;
+	}
+	known_mode[pin] = mode;
+	mode_known[pin] = 1;
+	return 0;
+}
 
 
 /*******************************************************************************
@@ -52,8 +130,7 @@
 * a blue or cape. Returns -1 on failure, 0 on success.
 *******************************************************************************/
 int rc_set_pinmux_mode(int pin, rc_pinmux_mode_t mode){
-	int fd, ret;
-	char* path;
+	const char* path;
 
 	// flag set when parsing pin switch case
 	int blue_only = 0;
@@ -291,54 +368,7 @@ int rc_set_pinmux_mode(int pin, rc_pinmux_mode_t mode){
 		return -1;
 	}
 
-	// open pin state fd
-	errno=0;
-	fd = open(path, O_WRONLY);
-	if(unlikely(fd==-1)){
-		printf("can't open: ");
-		printf(path);
-		printf("\n");
-		perror("Pinmux");
-		return -1;
-	}
-
-
-	switch(mode){
-	case PINMUX_GPIO:
-		ret = write(fd, "gpio", 4);
-		break;
-	case PINMUX_GPIO_PU:
-		ret = write(fd, "gpio_pu", 7);
-		break;
-	case PINMUX_GPIO_PD:
-		ret = write(fd, "gpio_pd", 7);
-		break;
-	case PINMUX_PWM:
-		ret = write(fd, "pwm", 3);
-		break;
-	case PINMUX_SPI:
-		ret = write(fd, "spi", 3);
-		break;
-	case PINMUX_UART:
-		ret = write(fd, "uart", 4);
-		break;
-	case PINMUX_CAN:
-		ret = write(fd, "can", 3);
-		break;
-	default:
-		printf("ERROR: unknown PINMUX mode\n");
-		close(fd);
-		return -1;
-	}
-
-	if(ret<0){
-		printf("ERROR: failed to write to pinmux driver\n");
-		close(fd);
-		return -1;
-	}
-
-	close(fd);
-	return 0;
+	return write_pinmux_state(pin, path, mode);
 }
 
 
@@ -346,7 +376,8 @@ int rc_set_pinmux_mode(int pin, rc_pinmux_mode_t mode){
 /*******************************************************************************
 * int rc_set_default_pinmux()
 *
-* puts everything back to standard and is used by initialize_cape
+* puts everything back to standard and is used by initialize_cape, only pins
+* not already in their standard mode are written
 *******************************************************************************/
 int rc_set_default_pinmux(){
 	int ret = 0;
@@ -7,11 +7,15 @@
 #include "../roboticscape.h"
 #include "../rc_defs.h"
 #include "rc_pru.h"
+#include "rc_pru_defs.h"
+#include "../rc_lazy_init.h"
 #include <stdio.h>
 #include <fcntl.h> // for open
 #include <unistd.h> // for close
 #include <sys/mman.h>	// mmap
 #include <string.h>
+#include <stdlib.h>	// getenv
+#include <sched.h>	// sched_yield
 
 #define PRU_UNBIND_PATH "/sys/bus/platform/drivers/pru-rproc/unbind"
 #define PRU_BIND_PATH "/sys/bus/platform/drivers/pru-rproc/bind"
@@ -24,54 +28,210 @@
 #define PRU_ADDR		0x4A300000		// Start of PRU memory Page 184 am335x TRM
 #define PRU_LEN			0x80000			// Length of PRU memory
 #define PRU_SHAREDMEM	0x10000			// Offset to shared memory
-#define CNT_OFFSET 		64
+#define PRU_IEP			0x2E000			// Offset to the IEP timer
+#define IEP_COUNT		0x0C
+#define IEP_NS_PER_TICK	5				// IEP runs from the 200mhz clock
+#define PRU_CYCLES_PER_US	200
+#define PRU_HEADER_TIMEOUT_MS	100		// time for a new firmware to start
+#define PRU_CMD_TIMEOUT_US		10000
+
+// r30 bit used by each servo channel, see pru1-servo.asm
+static const int dshot_pin_bit[SERVO_CHANNELS] = {8,10,9,11,6,7,4,5};
 
 static unsigned int *prusharedMem_32int_ptr;
+static volatile unsigned int *iep_count_ptr;
+static int dshot_running = 0;
+// header and ring offset of each core, and features found by initialize_pru
+static const int pru_hdr_offset[2] = {PRU0_HDR, PRU1_HDR};
+static const int pru_ring_offset[2] = {PRU0_EVT_RING, PRU1_EVT_RING};
+static int pru_features[2] = {-1, -1};
 
 
 /*******************************************************************************
-* int initialize_pru()
-* 
-* Enables the PRU and gets a pointer to the PRU shared memory which is used by 
-* the servo and encoder functions in this C file.
+* static int pru_command(int core, unsigned int cmd, unsigned int arg,
+*												unsigned int* result)
+*
+* Writes the argument then the command to a core's command slot and waits for
+* the PRU to clear the command, which it does after writing the result.
 *******************************************************************************/
-int initialize_pru(){
-	int  bind_fd;
-	unsigned int	*pru;		// Points to start of PRU memory.
-	int	fd;
-	
-	// reset memory pointer to NULL so if init fails it doesn't point somewhere bad
-	prusharedMem_32int_ptr = NULL;
+static int pru_command(int core, unsigned int cmd, unsigned int arg, \
+												unsigned int* result){
+	volatile unsigned int* hdr = prusharedMem_32int_ptr + pru_hdr_offset[core]/4;
+	uint64_t deadline;
 
-	// open file descriptors for pru rproc driver
-	bind_fd = open(PRU_BIND_PATH, O_WRONLY);
-	if(bind_fd == -1){
-		printf("ERROR: pru-rproc driver missing\n");
+	if(hdr[HDR_CMD/4]!=PRU_CMD_NONE){
+		printf("ERROR: PRU%d command slot busy\n", core);
 		return -1;
 	}
+	hdr[HDR_CMD_ARG/4] = arg;
+	__sync_synchronize();
+	hdr[HDR_CMD/4] = cmd;
+	deadline = rc_nanos_since_boot() + (PRU_CMD_TIMEOUT_US*1000);
+	while(hdr[HDR_CMD/4]!=PRU_CMD_NONE){
+		if(rc_nanos_since_boot()>deadline){
+			hdr[HDR_CMD/4] = PRU_CMD_NONE;
+			return -1;
+		}
+		// lets the emulator thread run when there is no real PRU
+		sched_yield();
+	}
+	__sync_synchronize();
+	if(result!=NULL) *result = hdr[HDR_CMD_RESULT/4];
+	return 0;
+}
 
-	// if pru0 is not loaded, load it
-	if(access(PRU0_UEVENT, F_OK)!=0){
-		if(write(bind_fd, PRU0_NAME, PRU_NAME_LEN)<0){
-			printf("ERROR: pru0 bind failed\n");
+/*******************************************************************************
+* static int check_pru_header(int core)
+*
+* Waits briefly for a core's firmware to publish its header then checks the
+* magic number and version. Firmware with command support must also answer a
+* ping since a stopped core leaves its old header in shared memory. Records
+* the feature bits and returns 0 if the firmware is usable, otherwise -1.
+*******************************************************************************/
+static int check_pru_header(int core){
+	volatile unsigned int* hdr = prusharedMem_32int_ptr + pru_hdr_offset[core]/4;
+	unsigned int result;
+	int i;
+
+	pru_features[core] = -1;
+	for(i=0; hdr[HDR_MAGIC/4]!=PRU_MAILBOX_MAGIC; i++){
+		if(i>=PRU_HEADER_TIMEOUT_MS){
+			printf("ERROR: PRU%d firmware header missing\n", core);
 			return -1;
 		}
+		rc_usleep(1000);
 	}
-	// if pru1 is not loaded, load it
-	if(access(PRU1_UEVENT, F_OK)!=0){
-		if(write(bind_fd, PRU1_NAME, PRU_NAME_LEN)<0){
-			printf("ERROR: pru1 bind failed\n");
+	if(hdr[HDR_VERSION/4]!=PRU_FW_VERSION){
+		printf("ERROR: PRU%d firmware version %u, expected %d\n", core, \
+							hdr[HDR_VERSION/4], PRU_FW_VERSION);
+		return -1;
+	}
+	pru_features[core] = hdr[HDR_FEATURES/4];
+	if(pru_features[core]&PRU_FEAT_COMMANDS){
+		if(pru_command(core, PRU_CMD_PING, 0, &result)<0 || \
+									result!=PRU_FW_VERSION){
+			printf("ERROR: PRU%d firmware not responding\n", core);
+			pru_features[core] = -1;
 			return -1;
 		}
 	}
+	// start with events off and an empty ring
+	hdr[HDR_EVENT_MASK/4] = 0;
+	hdr[HDR_EVT_TAIL/4] = hdr[HDR_EVT_HEAD/4];
+	return 0;
+}
 
+/*******************************************************************************
+* static int pru_firmware_current(int core)
+*
+* Quick check used at startup, returns 1 if the core is bound and its header
+* shows the current firmware version running the default program, otherwise 0.
+* Firmware that takes commands must also answer a ping to prove it is running
+* and not just a header left behind by a stopped core. Prints nothing.
+*******************************************************************************/
+static int pru_firmware_current(int core){
+	volatile unsigned int* hdr = prusharedMem_32int_ptr + pru_hdr_offset[core]/4;
+	const char* uevent = core ? PRU1_UEVENT : PRU0_UEVENT;
+	unsigned int features, result;
+
+	if(access(uevent, F_OK)!=0) return 0;
+	if(hdr[HDR_MAGIC/4]!=PRU_MAILBOX_MAGIC) return 0;
+	if(hdr[HDR_VERSION/4]!=PRU_FW_VERSION) return 0;
+	features = hdr[HDR_FEATURES/4];
+	if(core==0 && !(features&PRU_FEAT_ENCODER)) return 0;
+	if(core==1 && !(features&PRU_FEAT_SERVO)) return 0;
+	if(features&PRU_FEAT_COMMANDS){
+		if(pru_command(core, PRU_CMD_PING, 0, &result)<0) return 0;
+		if(result!=PRU_FW_VERSION) return 0;
+	}
+	return 1;
+}
+
+/*******************************************************************************
+* static int rebind_pru(int core)
+*
+* Unbinds the core from the pru-rproc driver if it is bound then binds it
+* again which reloads and starts its firmware. The old header is cleared first
+* so it can't be mistaken for the new firmware's.
+*******************************************************************************/
+static int rebind_pru(int core){
+	int unbind_fd, bind_fd;
+	const char* name = core ? PRU1_NAME : PRU0_NAME;
+	const char* uevent = core ? PRU1_UEVENT : PRU0_UEVENT;
+
+	unbind_fd = open(PRU_UNBIND_PATH, O_WRONLY);
+	if(unbind_fd == -1){
+		printf("ERROR: pru-rproc driver missing\n");
+		return -1;
+	}
+	bind_fd = open(PRU_BIND_PATH, O_WRONLY);
+	if(bind_fd == -1){
+		printf("ERROR: pru-rproc driver missing\n");
+		close(unbind_fd);
+		return -1;
+	}
+	if(access(uevent, F_OK)==0){
+		if(write(unbind_fd, name, PRU_NAME_LEN)<0){
+			printf("ERROR: pru%d unbind failed\n", core);
+			close(unbind_fd);
+			close(bind_fd);
+			return -1;
+		}
+	}
+	if(prusharedMem_32int_ptr!=NULL){
+		prusharedMem_32int_ptr[(pru_hdr_offset[core]+HDR_MAGIC)/4] = 0;
+	}
+	if(write(bind_fd, name, PRU_NAME_LEN)<0){
+		printf("ERROR: pru%d bind failed\n", core);
+		close(unbind_fd);
+		close(bind_fd);
+		return -1;
+	}
+	close(unbind_fd);
 	close(bind_fd);
+	return 0;
+}
+
+/*******************************************************************************
+* int initialize_pru()
+* 
+* Enables the PRU and gets a pointer to the PRU shared memory which is used by 
+* the servo and encoder functions in this C file.
+*
+* Shared memory is mapped first so each core's header can be checked. A core
+* already running the current firmware is left alone, which is the usual case
+* when a program is restarted, and only a core that is unbound, stale, or left
+* running DShot is reloaded through the pru-rproc driver. That keeps the PRU0
+* encoder count and avoids the slow remoteproc firmware load.
+*******************************************************************************/
+int initialize_pru(){
+	unsigned int	*pru;		// Points to start of PRU memory.
+	int	fd, core;
+	int encoder_kept = 0;
+	char* path;
+	
+	// reset memory pointer to NULL so if init fails it doesn't point somewhere bad
+	prusharedMem_32int_ptr = NULL;
+	iep_count_ptr = NULL;
+
+	// use a file in place of the real PRU if asked, see initialize_pru_fd
+	path = getenv(PRU_SHM_FILE_ENV);
+	if(path!=NULL){
+		fd = open(path, O_RDWR);
+		if(fd == -1){
+			printf("ERROR: could not open PRU shared memory file %s\n", path);
+			return -1;
+		}
+		core = initialize_pru_fd(fd);
+		close(fd);
+		return core;
+	}
 
 	// start mmaping shared memory
 	fd = open("/dev/mem", O_RDWR | O_SYNC);
 	if (fd == -1) {
 		printf ("ERROR: could not open /dev/mem.\n\n");
-		return 1;
+		return -1;
 	}
 	#ifdef DEBUG
 	printf("mmap'ing PRU shared memory\n");
@@ -79,12 +239,14 @@ int initialize_pru(){
 	pru = mmap(0, PRU_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, PRU_ADDR);
 	if (pru == MAP_FAILED) {
 		printf ("ERROR: could not map memory.\n\n");
-		return 1;
+		close(fd);
+		return -1;
 	}
 	close(fd);
 
 	// set global shared memory pointer
 	prusharedMem_32int_ptr = pru + PRU_SHAREDMEM/4;	// Points to start of shared memory
+	iep_count_ptr = pru + (PRU_IEP+IEP_COUNT)/4;	// timebase of encoder edges
 
 	// zero out the 8 servo channels and encoder channel
 	#ifdef DEBUG
@@ -92,63 +254,89 @@ int initialize_pru(){
 	#endif
 	memset(prusharedMem_32int_ptr, 0, 9*4);
 
-	// zero out 4th encoder, eQEP encoders are already zero'd previously
-	rc_set_encoder_pos(4,0);
+	// a previous program may have left PRU1 running DShot, the mode word must
+	// be cleared before a reload so PRU1 starts the servo program
+	dshot_running = 0;
+	if(!pru_firmware_current(1)) prusharedMem_32int_ptr[DSHOT_MODE/4] = 0;
+
+	// reload only the cores that need it and make sure they came up
+	for(core=0; core<2; core++){
+		if(pru_firmware_current(core)){
+			#ifdef DEBUG
+			printf("PRU%d firmware current, not reloading\n", core);
+			#endif
+			if(core==0) encoder_kept = 1;
+		}
+		else if(rebind_pru(core)<0) return -1;
+		if(check_pru_header(core)<0){
+			printf("ERROR: PRU firmware does not match this library version\n");
+			printf("reinstall the Robotics Cape package to update it\n");
+			return -1;
+		}
+	}
+
+	// zero out 4th encoder after a reload, eQEP encoders are already zero'd
+	// previously. A PRU0 that was left running keeps its count.
+	if(!encoder_kept) rc_set_encoder_pos(4,0);
 
 	return 0;
 }
 
 /*******************************************************************************
-* int restart
-* Enables the PRU and gets a pointer to the PRU shared memory which is used by 
-* the servo and encoder functions in this C file.
+* int initialize_pru_fd(int fd)
+*
+* Alternative to initialize_pru for running without PRU hardware. The file
+* holds the PRU shared memory followed by the IEP counter as laid out in
+* rc_pru.h and something else, normally the emulator in rc_pru_emulator.c,
+* must play the part of the firmware and fill in the headers. Nothing is bound
+* or reloaded. The fd may be closed after this returns.
 *******************************************************************************/
-int restart_pru(){
-	int unbind_fd, bind_fd;
+int initialize_pru_fd(int fd){
+	unsigned int* mem;
+	int core;
 
-	// open file descriptors for pru rproc driver
-	unbind_fd = open(PRU_UNBIND_PATH, O_WRONLY);
-	if(unbind_fd == -1){
-		printf("open unbind fail\n");
-		return -1;
-	}
-	bind_fd = open(PRU_BIND_PATH, O_WRONLY);
-	if(bind_fd == -1){
-		printf("open bind fail\n");
+	prusharedMem_32int_ptr = NULL;
+	iep_count_ptr = NULL;
+	mem = mmap(0, PRU_SHM_FILE_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(mem == MAP_FAILED){
+		printf("ERROR: could not map PRU shared memory file\n");
 		return -1;
 	}
-
-
-	// if pru0 is loaded, unload it
-	if(access(PRU0_UEVENT, F_OK)==0){
-		//printf("unbinding pru0\n");
-		if(write(unbind_fd, PRU0_NAME, PRU_NAME_LEN)<0){
-			printf("ERROR: pru0 unbind failed\n");
-			return -1;
-		}
-	}
-	// if pru1 is loaded, unload it
-	if(access(PRU1_UEVENT, F_OK)==0){
-		//printf("unbinding pru1\n");
-		if(write(unbind_fd, PRU1_NAME, PRU_NAME_LEN)<0){
-			printf("ERROR: pru1 unbind failed\n");
+	prusharedMem_32int_ptr = mem;
+	iep_count_ptr = mem + PRU_SHM_FILE_IEP/4;
+	memset(prusharedMem_32int_ptr, 0, 9*4);
+	dshot_running = 0;
+	for(core=0; core<2; core++){
+		if(check_pru_header(core)<0){
+			printf("ERROR: PRU shared memory file has no valid header\n");
+			munmap(mem, PRU_SHM_FILE_LEN);
+			prusharedMem_32int_ptr = NULL;
+			iep_count_ptr = NULL;
 			return -1;
 		}
 	}
+	rc_set_encoder_pos(4,0);
+	return 0;
+}
 
-	// now bind both
-	if(write(bind_fd, PRU0_NAME, PRU_NAME_LEN)<0){
-		printf("ERROR: pru0 bind failed\n");
-		return -1;
-	}
-	if(write(bind_fd, PRU1_NAME, PRU_NAME_LEN)<0){
-		printf("ERROR: pru1 bind failed\n");
-		return -1;
-	}
+/*******************************************************************************
+* int restart_pru()
+*
+* Reloads the firmware on both PRU cores regardless of what is running.
+*******************************************************************************/
+int restart_pru(){
+	if(rebind_pru(0)<0) return -1;
+	return rebind_pru(1);
+}
 
-	close(unbind_fd);
-	close(bind_fd);
-	return 0;
+/*******************************************************************************
+* int restart_pru1()
+*
+* Unloads and reloads only PRU1 so the encoder counter on PRU0 keeps running.
+* Used to switch PRU1 between the servo and DShot programs.
+*******************************************************************************/
+int restart_pru1(){
+	return rebind_pru(1);
 }
 
 
@@ -158,7 +346,7 @@ int restart_pru(){
 * returns the encoder position or -1 if there was a problem.
 *******************************************************************************/
 int get_pru_encoder_pos(){
-	if(prusharedMem_32int_ptr == NULL) return -1;
+	if(prusharedMem_32int_ptr == NULL && lazy_initialize(RC_INIT_PRU)) return -1;
 	else return (int) prusharedMem_32int_ptr[CNT_OFFSET/4];
 }
 
@@ -168,13 +356,74 @@ int get_pru_encoder_pos(){
 * Set the encoder position, return 0 on success, -1 on failure.
 *******************************************************************************/
 int set_pru_encoder_pos(int val){
-	if(prusharedMem_32int_ptr == NULL) return -1;
-	else prusharedMem_32int_ptr[CNT_OFFSET/4] = val;
+	unsigned int result;
+	if(prusharedMem_32int_ptr == NULL && lazy_initialize(RC_INIT_PRU)) return -1;
+	// ask PRU0 to set it so an edge being counted can't overwrite the value
+	if(pru_features[0]>0 && (pru_features[0]&PRU_FEAT_COMMANDS)){
+		if(pru_command(0, PRU_CMD_SET_COUNT, val, &result)<0 || result!=0){
+			printf("ERROR: PRU0 failed to set encoder position\n");
+			return -1;
+		}
+		return 0;
+	}
+	prusharedMem_32int_ptr[CNT_OFFSET/4] = val;
 	return 0;
 }
 
 
 
+/*******************************************************************************
+* int get_pru_encoder_state(rc_encoder_state_t* state)
+* 
+* PRU0 timestamps every edge with the IEP timer and publishes the count,
+* ticks between the last two edges, direction, and edge time along with a
+* sequence number that is odd while it is writing. The block is read until the
+* sequence number is even and unchanged so it is coherent. The IEP wraps every
+* 21 seconds so the edge time is converted to rc_nanos_since_boot() when a new
+* edge is first seen and kept until the next edge.
+*******************************************************************************/
+int get_pru_encoder_state(rc_encoder_state_t* state){
+	volatile unsigned int* mem = prusharedMem_32int_ptr;
+	static unsigned int last_seq = 0;
+	static uint64_t last_edge_ns = 0;
+	unsigned int seq, count, period, edge, now_ticks;
+	int dir, tries;
+	uint64_t now_ns, dt_ns;
+
+	if(mem == NULL || iep_count_ptr == NULL) return -1;
+	for(tries=0; ; tries++){
+		if(tries>100){
+			printf("ERROR: failed to read PRU encoder state\n");
+			return -1;
+		}
+		seq = mem[ENC_SEQ_OFFSET/4];
+		if(seq&1) continue;
+		count	= mem[CNT_OFFSET/4];
+		period	= mem[PERIOD_OFFSET/4];
+		dir		= (int)mem[DIR_OFFSET/4];
+		edge	= mem[EDGE_OFFSET/4];
+		now_ticks = *iep_count_ptr;
+		now_ns	= rc_nanos_since_boot();
+		if(mem[ENC_SEQ_OFFSET/4] == seq) break;
+	}
+
+	if(seq != last_seq){
+		last_edge_ns = now_ns - ((uint64_t)(now_ticks-edge)*IEP_NS_PER_TICK);
+		last_seq = seq;
+	}
+	state->pos = (int)count;
+	state->last_edge_ns = last_edge_ns;
+
+	// need two edges for a period. Between edges the velocity can be no more
+	// than one count over the time since the last edge so decay towards 0.
+	dt_ns = (uint64_t)period*IEP_NS_PER_TICK;
+	if(now_ns-last_edge_ns > dt_ns) dt_ns = now_ns-last_edge_ns;
+	if(seq<4 || dt_ns==0 || dt_ns>ENCODER_STOPPED_NS) state->velocity = 0.0f;
+	else state->velocity = dir*(1000000000.0f/dt_ns);
+	return 0;
+}
+
+
 /*******************************************************************************
 * int rc_send_servo_pulse_us(int ch, int us)
 * 
@@ -189,9 +438,12 @@ int rc_send_servo_pulse_us(int ch, int us){
 	if(ch<1 || ch>SERVO_CHANNELS){
 		printf("ERROR: Servo Channel must be between 1&%d\n", SERVO_CHANNELS);
 		return -2;
-	} if(prusharedMem_32int_ptr == NULL){
+	} if(prusharedMem_32int_ptr == NULL && lazy_initialize(RC_INIT_PRU)){
 		printf("ERROR: PRU servo Controller not initialized\n");
 		return -2;
+	} if(dshot_running){
+		printf("ERROR: PRU1 is running DShot, call rc_stop_dshot first\n");
+		return -2;
 	}
 
 	// first check to make sure no pulse is currently being sent
@@ -204,6 +456,7 @@ int rc_send_servo_pulse_us(int ch, int us){
 	unsigned int num_loops = ((us*200.0)/PRU_SERVO_LOOP_INSTRUCTIONS); 
 	// write to PRU shared memory
 	prusharedMem_32int_ptr[ch-1] = num_loops;
+	RC_TRACE_INSTANT("rc_send_servo_pulse_us");
 	return 0;
 }
 
@@ -328,3 +581,264 @@ int rc_send_oneshot_pulse_normalized_all(float input){
 	}
 	return ret;
 }
+
+
+/*******************************************************************************
+* static unsigned int dshot_loops(int cycles, int overhead)
+*
+* convert a duration in PRU cycles to the number of 2-instruction delay loops
+* the DShot firmware needs, accounting for the instructions around the loop.
+* The firmware requires at least one loop.
+*******************************************************************************/
+static unsigned int dshot_loops(int cycles, int overhead){
+	int loops = (cycles - overhead)/2;
+	if(loops<1) return 1;
+	return loops;
+}
+
+/*******************************************************************************
+* int rc_initialize_dshot(rc_dshot_speed_t speed)
+*
+* Restarts PRU1 running the DShot program instead of the servo program.
+* The bit timing is computed here and written to shared memory where the PRU
+* loads it at the start of every frame.
+*******************************************************************************/
+int rc_initialize_dshot(rc_dshot_speed_t speed){
+	volatile unsigned int* mem;
+	int i, bit_ns;
+	unsigned int active = 0;
+	unsigned int timing[4];
+
+	if(prusharedMem_32int_ptr == NULL) lazy_initialize(RC_INIT_PRU);
+	mem = prusharedMem_32int_ptr;
+	if(mem == NULL){
+		printf("ERROR: PRU not initialized, call rc_initialize first\n");
+		return -1;
+	}
+	if(speed!=DSHOT_150 && speed!=DSHOT_300 && speed!=DSHOT_600){
+		printf("ERROR: DShot speed must be 150, 300, or 600\n");
+		return -1;
+	}
+
+	// DShot bit is 1 at 75% and 0 at 37.5% duty
+	bit_ns = 1000000/speed;
+	for(i=0;i<SERVO_CHANNELS;i++) active |= 1<<dshot_pin_bit[i];
+	timing[0] = dshot_loops((bit_ns*3/8)*PRU_CYCLES_PER_US/1000, 3);
+	timing[1] = dshot_loops((bit_ns*3/8)*PRU_CYCLES_PER_US/1000, 2);
+	timing[2] = dshot_loops((bit_ns/4)*PRU_CYCLES_PER_US/1000, 2);
+	timing[3] = active;
+
+	// PRU1 clears DSHOT_CTRL once it is running the DShot program
+	for(i=0;i<4;i++) mem[(DSHOT_TIMING/4)+i] = timing[i];
+	mem[DSHOT_CTRL/4] = 0xFFFFFFFF;
+	mem[DSHOT_MODE/4] = DSHOT_MODE_MAGIC;
+	if(restart_pru1()<0){
+		mem[DSHOT_MODE/4] = 0;
+		return -1;
+	}
+	for(i=0; mem[DSHOT_CTRL/4]!=0; i++){
+		if(i>=1000){
+			printf("ERROR: PRU1 did not start DShot program\n");
+			mem[DSHOT_MODE/4] = 0;
+			restart_pru1();
+			return -1;
+		}
+		rc_usleep(1000);
+	}
+
+	if(check_pru_header(1)<0 || !(pru_features[1]&PRU_FEAT_DSHOT)){
+		printf("ERROR: PRU1 firmware does not support DShot\n");
+		mem[DSHOT_MODE/4] = 0;
+		restart_pru1();
+		check_pru_header(1);
+		return -1;
+	}
+
+	dshot_running = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_stop_dshot()
+*
+* puts PRU1 back to running the servo program. Does nothing if DShot is not
+* running.
+*******************************************************************************/
+int rc_stop_dshot(){
+	if(!dshot_running) return 0;
+	dshot_running = 0;
+	prusharedMem_32int_ptr[DSHOT_MODE/4] = 0;
+	memset(prusharedMem_32int_ptr, 0, SERVO_CHANNELS*4);
+	if(restart_pru1()<0) return -1;
+	return check_pru_header(1);
+}
+
+/*******************************************************************************
+* int rc_send_dshot_values_all(int values[8], int telemetry)
+*
+* Builds the 16-bit frame for each channel: 11-bit value, telemetry request bit,
+* and 4-bit checksum. The frames are
+* then transposed so the PRU can send all channels in parallel from one mask
+* per bit.
+*******************************************************************************/
+int rc_send_dshot_values_all(int values[8], int telemetry){
+	volatile unsigned int* mem = prusharedMem_32int_ptr;
+	unsigned int bits[16];
+	unsigned int packet, crc, frame;
+	int i, j;
+
+	if(!dshot_running){
+		printf("ERROR: DShot not initialized\n");
+		return -1;
+	}
+	// previous frame still being sent
+	if(mem[DSHOT_CTRL/4] != 0) return -1;
+
+	memset(bits, 0, sizeof(bits));
+	for(i=0;i<SERVO_CHANNELS;i++){
+		if(values[i]<0 || values[i]>2047){
+			printf("ERROR: DShot values must be between 0 & 2047\n");
+			return -1;
+		}
+		packet = (values[i]<<1) | (telemetry?1:0);
+		crc = (packet ^ (packet>>4) ^ (packet>>8)) & 0x0F;
+		frame = (packet<<4) | crc;
+		for(j=0;j<16;j++){
+			if(frame & (1<<(15-j))) bits[j] |= 1<<dshot_pin_bit[i];
+		}
+	}
+
+	for(j=0;j<16;j++) mem[(DSHOT_BITS/4)+j] = bits[j];
+	__sync_synchronize();
+	mem[DSHOT_CTRL/4] = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_send_dshot_throttle_all(float throttle[8])
+*
+* throttle of 0-1 maps to DShot values 48-2047, below 0 sends motor stop
+*******************************************************************************/
+int rc_send_dshot_throttle_all(float throttle[8]){
+	int values[SERVO_CHANNELS];
+	int i;
+	for(i=0;i<SERVO_CHANNELS;i++){
+		if(throttle[i]>1.0){
+			printf("ERROR: DShot throttle must be between 0 & 1\n");
+			return -1;
+		}
+		if(throttle[i]<0.0) values[i] = 0;
+		else values[i] = 48 + (int)(throttle[i]*1999.0f);
+	}
+	return rc_send_dshot_values_all(values, 0);
+}
+
+/*******************************************************************************
+* int rc_send_dshot_command_all(rc_dshot_cmd_t cmd)
+*
+* sends the command DSHOT_CMD_REPEATS times with the telemetry bit set as
+* required by the ESCs, waiting for each frame to finish before the next.
+*******************************************************************************/
+int rc_send_dshot_command_all(rc_dshot_cmd_t cmd){
+	int values[SERVO_CHANNELS];
+	int i, j;
+	if(cmd<0 || cmd>47){
+		printf("ERROR: DShot commands must be between 0 & 47\n");
+		return -1;
+	}
+	for(i=0;i<SERVO_CHANNELS;i++) values[i] = cmd;
+	for(i=0;i<DSHOT_CMD_REPEATS;i++){
+		for(j=0; rc_send_dshot_values_all(values, 1)!=0; j++){
+			if(j>=100 || !dshot_running) return -1;
+			rc_usleep(100);
+		}
+		rc_usleep(1000);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_pru_get_features(int core)
+*
+* returns the feature bits found by initialize_pru or -1 if the firmware on
+* that core was not usable.
+*******************************************************************************/
+int rc_pru_get_features(int core){
+	if(core<0 || core>1){
+		printf("ERROR: PRU core must be 0 or 1\n");
+		return -1;
+	}
+	if(prusharedMem_32int_ptr == NULL && lazy_initialize(RC_INIT_PRU)) return -1;
+	return pru_features[core];
+}
+
+/*******************************************************************************
+* int rc_pru_enable_event(int core, rc_pru_event_type_t type, int enable)
+*
+* sets or clears the event type's bit in the mask the PRU checks before
+* posting an event.
+*******************************************************************************/
+int rc_pru_enable_event(int core, rc_pru_event_type_t type, int enable){
+	volatile unsigned int* hdr;
+	if(rc_pru_get_features(core)<0 || !(pru_features[core]&PRU_FEAT_EVENTS)){
+		printf("ERROR: PRU%d firmware does not post events\n", core);
+		return -1;
+	}
+	if(type<RC_PRU_EVENT_EDGE || type>RC_PRU_EVENT_ERROR){
+		printf("ERROR: invalid PRU event type\n");
+		return -1;
+	}
+	hdr = prusharedMem_32int_ptr + pru_hdr_offset[core]/4;
+	if(enable) hdr[HDR_EVENT_MASK/4] |= 1<<type;
+	else hdr[HDR_EVENT_MASK/4] &= ~(1<<type);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_pru_read_event(int core, rc_pru_event_t* event)
+*
+* Single consumer side of the ring. The PRU writes the event before moving the
+* head so everything between the tail and head is complete. The tail is only
+* moved after the event is copied so the PRU can't overwrite it first. The
+* IEP timestamp is converted using the current IEP count, which is only
+* correct if the event is less than one 21 second IEP period old.
+*******************************************************************************/
+int rc_pru_read_event(int core, rc_pru_event_t* event){
+	volatile unsigned int *hdr, *ring;
+	unsigned int head, tail, word, ticks, now_ticks;
+	uint64_t now_ns;
+
+	if(event==NULL){
+		printf("ERROR: in rc_pru_read_event, received NULL pointer\n");
+		return -1;
+	}
+	if(rc_pru_get_features(core)<0) return -1;
+	hdr = prusharedMem_32int_ptr + pru_hdr_offset[core]/4;
+	ring = prusharedMem_32int_ptr + pru_ring_offset[core]/4;
+
+	head = hdr[HDR_EVT_HEAD/4] & (EVT_RING_LEN-1);
+	tail = hdr[HDR_EVT_TAIL/4] & (EVT_RING_LEN-1);
+	if(head==tail) return 0;
+	__sync_synchronize();
+	word  = ring[tail*(EVT_SIZE/4)];
+	ticks = ring[(tail*(EVT_SIZE/4))+1];
+	__sync_synchronize();
+	hdr[HDR_EVT_TAIL/4] = (tail+1) & (EVT_RING_LEN-1);
+
+	now_ticks = *iep_count_ptr;
+	now_ns = rc_nanos_since_boot();
+	event->type = (rc_pru_event_type_t)(word>>24);
+	event->data = ((int)(word<<8))>>8;	// sign extend the 24 bit payload
+	event->timestamp_ns = now_ns - ((uint64_t)(now_ticks-ticks)*IEP_NS_PER_TICK);
+	return 1;
+}
+
+/*******************************************************************************
+* int rc_pru_get_dropped_events(int core)
+*
+* returns the PRU's count of events lost to a full ring
+*******************************************************************************/
+int rc_pru_get_dropped_events(int core){
+	if(rc_pru_get_features(core)<0) return -1;
+	return prusharedMem_32int_ptr[(pru_hdr_offset[core]+HDR_EVT_DROPPED)/4];
+}
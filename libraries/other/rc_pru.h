@@ -4,15 +4,32 @@
 * int initialize_pru()
 * 
 * Enables the PRU and gets a pointer to the PRU shared memory which is used by 
-* the servo and encoder functions in this C file. 
+* the servo and encoder functions in this C file. Cores already running the
+* current firmware are not reloaded.
 * Return 0 on success, -1 on failure.
 *******************************************************************************/
 int initialize_pru();
 
+// Layout of the file used in place of /dev/mem by initialize_pru_fd, the
+// 12k of shared memory followed by the IEP counter. Setting the environment
+// variable below makes initialize_pru open that file instead of the PRU.
+#define PRU_SHM_FILE_ENV	"RC_PRU_SHM_FILE"
+#define PRU_SHAREDMEM_LEN	0x3000
+#define PRU_SHM_FILE_IEP	0x3000
+#define PRU_SHM_FILE_LEN	0x4000
+
+/*******************************************************************************
+* int initialize_pru_fd(int fd)
+* 
+* Maps a file or memfd laid out as above and uses it as PRU shared memory.
+* Return 0 on success, -1 on failure.
+*******************************************************************************/
+int initialize_pru_fd(int fd);
+
 /*******************************************************************************
 * int restart_pru()
 * 
-* Unloads pru binaries if loaded, then load them again.
+* Unloads pru binaries if loaded, then load them again even if current.
 *******************************************************************************/
 int restart_pru();
 
@@ -28,4 +45,18 @@ int get_pru_encoder_pos();
 * 
 * Set the encoder position, return 0 on success, -1 on failure.
 *******************************************************************************/
-int set_pru_encoder_pos(int val);
\ No newline at end of file
+int set_pru_encoder_pos(int val);
+
+/*******************************************************************************
+* int get_pru_encoder_state(rc_encoder_state_t* state)
+* 
+* Reads position, edge-timed velocity, and time of the last edge counted by
+* PRU0. Return 0 on success, -1 on failure.
+*******************************************************************************/
+int get_pru_encoder_state(rc_encoder_state_t* state);
+/*******************************************************************************
+* int restart_pru1()
+* 
+* Unloads and reloads only the PRU1 binary, PRU0 keeps running.
+*******************************************************************************/
+int restart_pru1();
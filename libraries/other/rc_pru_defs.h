@@ -0,0 +1,88 @@
+/*******************************************************************************
+* rc_pru_defs.h
+*
+* Layout of the 12kB PRU shared memory used to talk to the PRU firmware. This
+* is included by the library, by the PRU C code, and by the PRU assembly
+* through .cdecls so it must only contain simple numeric #defines. All offsets
+* are in bytes from the start of shared memory.
+*
+* Each core has a header which its firmware fills in on startup with a magic
+* number, firmware version, and the feature bits it supports. initialize_pru()
+* checks these before using the PRU. After the fixed part of the header is a
+* command slot where the ARM writes an argument then a command and the PRU
+* writes the result then clears the command. Each core also has a single
+* producer single consumer ring of events. The PRU only writes the head and
+* the ARM only writes the tail so no locking is needed.
+*******************************************************************************/
+
+#ifndef RC_PRU_DEFS
+#define RC_PRU_DEFS
+
+#define PRU_MAILBOX_MAGIC	0x52435052	// "RCPR"
+#define PRU_FW_VERSION		1
+
+// PRU local address of shared memory, the ARM sees it at 0x4A310000
+#define PRU_SHAREDMEM_LOCAL	0x00010000
+
+// feature bits reported in the header by each firmware, these and the event
+// types are repeated as RC_PRU_* in roboticscape.h for users of the library
+#define PRU_FEAT_SERVO		0x01
+#define PRU_FEAT_ENCODER	0x02
+#define PRU_FEAT_EDGE_TIME	0x04
+#define PRU_FEAT_DSHOT		0x08
+#define PRU_FEAT_COMMANDS	0x10
+#define PRU_FEAT_EVENTS		0x20
+
+// PRU1 servo pulse slots, one word per channel
+#define SERVO_OFFSET		0x000
+
+// PRU0 encoder count, time between edges, direction, edge time, sequence
+#define CNT_OFFSET			0x040
+#define PERIOD_OFFSET		0x044
+#define DIR_OFFSET			0x048
+#define EDGE_OFFSET			0x04C
+#define ENC_SEQ_OFFSET		0x050
+
+// PRU1 DShot block, DSHOT_MODE_MAGIC in DSHOT_MODE selects the DShot program
+#define DSHOT_MODE			0x100
+#define DSHOT_CTRL			0x104	// ARM sets to 1 with a new frame, PRU clears
+#define DSHOT_TIMING		0x108	// T0H, T1H, TREST loops and active mask
+#define DSHOT_BITS			0x124	// 16 bit masks, MSB first
+#define DSHOT_SEQ			0x164	// incremented after every frame
+#define DSHOT_MODE_MAGIC	0x44534854	// "DSHT"
+
+// per-core headers
+#define PRU0_HDR			0x800
+#define PRU1_HDR			0x840
+#define HDR_MAGIC			0x00
+#define HDR_VERSION			0x04
+#define HDR_FEATURES		0x08
+#define HDR_EVENT_MASK		0x0C	// ARM sets bit (1<<type) to enable events
+#define HDR_CMD				0x10	// ARM writes command, PRU clears when done
+#define HDR_CMD_ARG			0x14
+#define HDR_CMD_RESULT		0x18
+#define HDR_EVT_HEAD		0x1C	// written by PRU only
+#define HDR_EVT_TAIL		0x20	// written by ARM only
+#define HDR_EVT_DROPPED		0x24	// events lost to a full ring
+#define HDR_SIZE			0x40
+
+// event rings, 2 words per event: type<<24 | 24 bits of data, IEP timestamp
+#define PRU0_EVT_RING		0x900
+#define PRU1_EVT_RING		0xB00
+#define EVT_RING_LEN		64		// must be a power of 2
+#define EVT_SIZE			8
+
+// commands
+#define PRU_CMD_NONE		0
+#define PRU_CMD_PING		1		// result is PRU_FW_VERSION
+#define PRU_CMD_SET_COUNT	2		// set encoder count to arg
+
+// event types
+#define PRU_EVT_EDGE		1		// data is the new encoder count
+#define PRU_EVT_FRAME_DONE	2		// data is the DShot frame sequence number
+#define PRU_EVT_ERROR		3		// data is one of the error codes below
+
+// error codes
+#define PRU_ERR_ENC_SKIP	1		// both encoder channels changed at once
+
+#endif // RC_PRU_DEFS
@@ -0,0 +1,359 @@
+/*******************************************************************************
+* rc_pru_emulator.c
+*
+* Host side stand-in for the PRU firmware so servo and encoder code can run
+* on a machine without PRUs. The shared memory lives in a file or memfd laid
+* out as described in rc_pru.h and a thread plays the part of both cores: it
+* publishes the mailbox headers, consumes servo pulse slots like the PRU1
+* servo program, counts encoder 4 like the PRU0 program, and answers PRU0
+* commands. The IEP counter is derived from CLOCK_MONOTONIC.
+*******************************************************************************/
+#define _GNU_SOURCE
+#include "../roboticscape.h"
+#include "../rc_defs.h"
+#include "rc_pru.h"
+#include "rc_pru_defs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define EMU_PERIOD_NS		10000	// emulator thread tick
+#define EMU_MAX_SCRIPT		256		// lines in a script file
+#define EMU_IEP_NS			5		// IEP runs from the 200mhz clock
+#define EMU_LOOP_NS			(PRU_SERVO_LOOP_INSTRUCTIONS*EMU_IEP_NS)
+
+typedef struct emu_cmd_t{
+	uint64_t t_ns;		// time from start
+	int is_rate;		// 1 to set the rate, 0 to step
+	float value;
+} emu_cmd_t;
+
+/*******************************************************************************
+* Local Global Variables
+*******************************************************************************/
+static volatile unsigned int* emu_mem = NULL;
+static pthread_t emu_thread;
+static volatile int emu_running = 0;
+static volatile float emu_rate = 0;			// encoder counts per second
+static volatile int emu_pulses[SERVO_CHANNELS];
+static volatile int emu_width_us[SERVO_CHANNELS];
+static emu_cmd_t emu_script[EMU_MAX_SCRIPT];
+static int emu_script_len = 0;
+
+/*******************************************************************************
+* Local Function Declarations
+*******************************************************************************/
+void* pru_emulator_loop(void* ptr);
+
+/*******************************************************************************
+* static int load_script(const char* path)
+*
+* reads "<seconds> rate <counts/s>" and "<seconds> step <counts>" lines
+*******************************************************************************/
+static int load_script(const char* path){
+	FILE* f;
+	char line[128], cmd[16];
+	double t;
+	float v;
+
+	emu_script_len = 0;
+	if(path==NULL) return 0;
+	f = fopen(path, "r");
+	if(f==NULL){
+		printf("ERROR: could not open emulator script %s\n", path);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f)!=NULL){
+		if(line[0]=='#' || line[0]=='\n') continue;
+		if(sscanf(line, "%lf %15s %f", &t, cmd, &v)!=3 || t<0 || \
+				(strcmp(cmd,"rate")!=0 && strcmp(cmd,"step")!=0)){
+			printf("ERROR: bad emulator script line: %s", line);
+			fclose(f);
+			return -1;
+		}
+		if(emu_script_len>=EMU_MAX_SCRIPT){
+			printf("ERROR: emulator script longer than %d lines\n", \
+														EMU_MAX_SCRIPT);
+			fclose(f);
+			return -1;
+		}
+		emu_script[emu_script_len].t_ns = t*1000000000.0;
+		emu_script[emu_script_len].is_rate = (strcmp(cmd,"rate")==0);
+		emu_script[emu_script_len].value = v;
+		emu_script_len++;
+	}
+	fclose(f);
+	return 0;
+}
+
+/*******************************************************************************
+* static void write_headers()
+*
+* same header contents as main_pru0.c and main_pru1.c write at startup
+*******************************************************************************/
+static void write_headers(){
+	volatile unsigned int* hdr;
+	int core;
+	for(core=0; core<2; core++){
+		hdr = emu_mem + (core ? PRU1_HDR : PRU0_HDR)/4;
+		hdr[HDR_MAGIC/4] = 0;
+		hdr[HDR_EVENT_MASK/4] = 0;
+		hdr[HDR_CMD/4] = PRU_CMD_NONE;
+		hdr[HDR_EVT_HEAD/4] = 0;
+		hdr[HDR_EVT_TAIL/4] = 0;
+		hdr[HDR_EVT_DROPPED/4] = 0;
+		hdr[HDR_VERSION/4] = PRU_FW_VERSION;
+		if(core) hdr[HDR_FEATURES/4] = PRU_FEAT_SERVO;
+		else hdr[HDR_FEATURES/4] = PRU_FEAT_ENCODER | PRU_FEAT_EDGE_TIME | \
+								PRU_FEAT_COMMANDS | PRU_FEAT_EVENTS;
+		__sync_synchronize();
+		hdr[HDR_MAGIC/4] = PRU_MAILBOX_MAGIC;
+	}
+}
+
+/*******************************************************************************
+* int rc_pru_emulator_start(const char* path, const char* script)
+*
+* Creates and sizes the backing file, or a memfd when path is NULL, starts the
+* emulator thread, then hands the same file to initialize_pru_fd so the rest
+* of the library talks to the emulator.
+*******************************************************************************/
+int rc_pru_emulator_start(const char* path, const char* script){
+	int fd = -1, i;
+	void* mem;
+	char tmp[] = "/tmp/rc_pru_shm_XXXXXX";
+
+	if(emu_running){
+		printf("ERROR: PRU emulator already running\n");
+		return -1;
+	}
+	if(load_script(script)<0) return -1;
+
+	if(path!=NULL) fd = open(path, O_RDWR | O_CREAT, 0644);
+	else{
+		#ifdef SYS_memfd_create
+		fd = syscall(SYS_memfd_create, "rc_pru_shm", 0);
+		#endif
+		// older kernels without memfd get an unlinked temp file instead
+		if(fd==-1){
+			fd = mkstemp(tmp);
+			if(fd!=-1) unlink(tmp);
+		}
+	}
+	if(fd==-1){
+		printf("ERROR: could not create PRU shared memory file\n");
+		return -1;
+	}
+	if(ftruncate(fd, PRU_SHM_FILE_LEN)<0){
+		printf("ERROR: could not size PRU shared memory file\n");
+		close(fd);
+		return -1;
+	}
+	mem = mmap(0, PRU_SHM_FILE_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(mem==MAP_FAILED){
+		printf("ERROR: could not map PRU shared memory file\n");
+		close(fd);
+		return -1;
+	}
+	emu_mem = mem;
+	memset(mem, 0, PRU_SHM_FILE_LEN);
+	for(i=0;i<SERVO_CHANNELS;i++){
+		emu_pulses[i] = 0;
+		emu_width_us[i] = 0;
+	}
+	emu_rate = 0;
+	write_headers();
+
+	emu_running = 1;
+	if(pthread_create(&emu_thread, NULL, pru_emulator_loop, NULL)){
+		printf("ERROR: failed to start PRU emulator thread\n");
+		emu_running = 0;
+		munmap(mem, PRU_SHM_FILE_LEN);
+		emu_mem = NULL;
+		close(fd);
+		return -1;
+	}
+	if(initialize_pru_fd(fd)<0){
+		rc_pru_emulator_stop();
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_pru_emulator_stop()
+*
+* stops the emulator thread, the mapping is left in place since the library
+* may still hold pointers into it
+*******************************************************************************/
+int rc_pru_emulator_stop(){
+	if(!emu_running) return 0;
+	emu_running = 0;
+	pthread_join(emu_thread, NULL);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_pru_emulator_set_encoder_rate(float counts_per_sec)
+*
+* sets how fast the emulated encoder 4 counts, negative counts down
+*******************************************************************************/
+int rc_pru_emulator_set_encoder_rate(float counts_per_sec){
+	if(!emu_running){
+		printf("ERROR: PRU emulator not running\n");
+		return -1;
+	}
+	emu_rate = counts_per_sec;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_pru_emulator_get_pulses(int ch, int* width_us)
+*
+* returns the number of pulses completed on a servo channel since start
+*******************************************************************************/
+int rc_pru_emulator_get_pulses(int ch, int* width_us){
+	if(ch<1 || ch>SERVO_CHANNELS){
+		printf("ERROR: Servo Channel must be between 1&%d\n", SERVO_CHANNELS);
+		return -1;
+	}
+	if(emu_mem==NULL){
+		printf("ERROR: PRU emulator not running\n");
+		return -1;
+	}
+	if(width_us!=NULL) *width_us = emu_width_us[ch-1];
+	return emu_pulses[ch-1];
+}
+
+/*******************************************************************************
+* static void publish_edge(unsigned int count, int dir, unsigned int edge,
+*								unsigned int* last_edge, unsigned int* seq)
+*
+* writes an edge the same way PUBLISH in pru0-encoder.asm does, including the
+* odd sequence number while writing, and posts an edge event if enabled
+*******************************************************************************/
+static void publish_edge(unsigned int count, int dir, unsigned int edge, \
+									unsigned int* last_edge, unsigned int* seq){
+	volatile unsigned int* hdr = emu_mem + PRU0_HDR/4;
+	volatile unsigned int* ring = emu_mem + PRU0_EVT_RING/4;
+	unsigned int head, next;
+
+	emu_mem[ENC_SEQ_OFFSET/4] = ++(*seq);
+	__sync_synchronize();
+	emu_mem[CNT_OFFSET/4] = count;
+	emu_mem[PERIOD_OFFSET/4] = edge - *last_edge;
+	emu_mem[DIR_OFFSET/4] = (unsigned int)dir;
+	emu_mem[EDGE_OFFSET/4] = edge;
+	__sync_synchronize();
+	emu_mem[ENC_SEQ_OFFSET/4] = ++(*seq);
+	*last_edge = edge;
+
+	if(!(hdr[HDR_EVENT_MASK/4] & (1<<PRU_EVT_EDGE))) return;
+	head = hdr[HDR_EVT_HEAD/4];
+	next = (head+1) & (EVT_RING_LEN-1);
+	if(next==hdr[HDR_EVT_TAIL/4]){
+		hdr[HDR_EVT_DROPPED/4]++;
+		return;
+	}
+	ring[head*(EVT_SIZE/4)] = (PRU_EVT_EDGE<<24) | (count & 0x00FFFFFF);
+	ring[(head*(EVT_SIZE/4))+1] = edge;
+	__sync_synchronize();
+	hdr[HDR_EVT_HEAD/4] = next;
+}
+
+/*******************************************************************************
+* void* pru_emulator_loop(void* ptr)
+*
+* Runs every EMU_PERIOD_NS. A servo slot is picked up as soon as the channel
+* is idle and cleared immediately, just like the firmware, and the pulse ends
+* after the requested number of 48 instruction loops. Encoder edges owed for
+* the elapsed time are spread evenly through the tick so edge timed velocity
+* comes out right.
+*******************************************************************************/
+void* pru_emulator_loop(__attribute__ ((unused)) void* ptr){
+	volatile unsigned int* hdr0 = emu_mem + PRU0_HDR/4;
+	uint64_t start, now, last, pulse_end[SERVO_CHANNELS];
+	rc_loop_t loop;
+	rc_loop_config_t loop_config;
+	unsigned int count = 0, seq = 0, last_edge = 0, edge, loops;
+	int i, n, dir, script_i = 0;
+	double owed = 0;
+
+	for(i=0;i<SERVO_CHANNELS;i++) pulse_end[i] = 0;
+	loop_config = rc_loop_default_config();
+	loop_config.rate_hz = 1000000000.0f/EMU_PERIOD_NS;
+	if(rc_loop_init(&loop, loop_config)) return NULL;
+	start = rc_nanos_since_boot();
+	last = start;
+
+	while(emu_running){
+		now = rc_nanos_since_boot();
+		emu_mem[PRU_SHM_FILE_IEP/4] = (unsigned int)(now/EMU_IEP_NS);
+
+		// PRU1 servo slots
+		for(i=0;i<SERVO_CHANNELS;i++){
+			if(pulse_end[i] && now>=pulse_end[i]){
+				pulse_end[i] = 0;
+				emu_pulses[i]++;
+			}
+			if(!pulse_end[i] && (loops=emu_mem[(SERVO_OFFSET/4)+i])!=0){
+				emu_mem[(SERVO_OFFSET/4)+i] = 0;
+				pulse_end[i] = now + ((uint64_t)loops*EMU_LOOP_NS);
+				emu_width_us[i] = ((uint64_t)loops*EMU_LOOP_NS)/1000;
+			}
+		}
+
+		// PRU0 commands, the ARM writes the argument before the command
+		switch(hdr0[HDR_CMD/4]){
+		case PRU_CMD_NONE:
+			break;
+		case PRU_CMD_PING:
+			hdr0[HDR_CMD_RESULT/4] = PRU_FW_VERSION;
+			__sync_synchronize();
+			hdr0[HDR_CMD/4] = PRU_CMD_NONE;
+			break;
+		case PRU_CMD_SET_COUNT:
+			count = hdr0[HDR_CMD_ARG/4];
+			emu_mem[ENC_SEQ_OFFSET/4] = ++seq;
+			__sync_synchronize();
+			emu_mem[CNT_OFFSET/4] = count;
+			__sync_synchronize();
+			emu_mem[ENC_SEQ_OFFSET/4] = ++seq;
+			hdr0[HDR_CMD_RESULT/4] = 0;
+			__sync_synchronize();
+			hdr0[HDR_CMD/4] = PRU_CMD_NONE;
+			break;
+		default:
+			hdr0[HDR_CMD_RESULT/4] = 0xFFFFFFFF;
+			__sync_synchronize();
+			hdr0[HDR_CMD/4] = PRU_CMD_NONE;
+			break;
+		}
+
+		// PRU0 encoder, scripted steps land at the start of the tick
+		while(script_i<emu_script_len && emu_script[script_i].t_ns<=now-start){
+			if(emu_script[script_i].is_rate) emu_rate = emu_script[script_i].value;
+			else owed += emu_script[script_i].value;
+			script_i++;
+		}
+		owed += emu_rate*(now-last)/1000000000.0;
+		n = (int)owed;
+		owed -= n;
+		dir = (n<0) ? -1 : 1;
+		for(i=1; i<=abs(n); i++){
+			count += dir;
+			edge = (unsigned int)((last + (((now-last)*i)/abs(n)))/EMU_IEP_NS);
+			publish_edge(count, dir, edge, &last_edge, &seq);
+		}
+		last = now;
+		rc_loop_wait(&loop);
+	}
+	return NULL;
+}
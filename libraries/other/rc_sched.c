@@ -0,0 +1,279 @@
+/*******************************************************************************
+* rc_sched.c
+*
+* Rate group scheduler running every registered task from one thread, either
+* an rc_loop_t at the base rate or the IMU interrupt. Task statistics are only
+* written by whichever thread runs the ticks and are published with a seqlock
+* like the loop and odometry statistics.
+*******************************************************************************/
+#include "../roboticscape.h"
+#include <stdio.h>
+#include <string.h>
+
+#define SCHED_NAME_LEN 24
+
+typedef struct sched_task_t{
+	char name[SCHED_NAME_LEN];
+	int divisor;
+	int offset;
+	void (*func)(void*);
+	void* arg;
+	rc_sched_task_stats_t stats;
+	volatile int overrun_flag;
+} sched_task_t;
+
+/*******************************************************************************
+* Local Global Variables
+*******************************************************************************/
+static rc_loop_config_t sched_config;
+static sched_task_t tasks[RC_SCHED_MAX_TASKS];
+static int num_tasks = 0;
+static int sched_initialized = 0;
+static volatile int sched_running = 0;
+static int imu_driven = 0;
+static uint64_t tick = 0;
+static rc_loop_t sched_loop;
+// odd while task stats are being written
+static volatile unsigned int sched_seq = 0;
+
+/*******************************************************************************
+* Local Function Declarations
+*******************************************************************************/
+static void sched_tick();
+static void sched_loop_func(void* ptr);
+
+/*******************************************************************************
+* int rc_sched_init(rc_loop_config_t config)
+*******************************************************************************/
+int rc_sched_init(rc_loop_config_t config){
+	if(sched_running){
+		fprintf(stderr,"ERROR: can't initialize scheduler while it's running\n");
+		return -1;
+	}
+	if(config.rate_hz<=0){
+		fprintf(stderr,"ERROR: scheduler base rate must be >0\n");
+		return -1;
+	}
+	sched_config = config;
+	memset(tasks, 0, sizeof(tasks));
+	num_tasks = 0;
+	sched_initialized = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_sched_add_task(const char* name, int divisor, int offset,
+*						int budget_us, void (*func)(void*), void* arg)
+*******************************************************************************/
+int rc_sched_add_task(const char* name, int divisor, int offset,\
+						int budget_us, void (*func)(void*), void* arg){
+	sched_task_t* t;
+	if(!sched_initialized){
+		fprintf(stderr,"ERROR: call rc_sched_init before adding tasks\n");
+		return -1;
+	}
+	if(sched_running){
+		fprintf(stderr,"ERROR: can't add tasks while the scheduler is running\n");
+		return -1;
+	}
+	if(func==NULL){
+		fprintf(stderr,"ERROR: in rc_sched_add_task, received NULL pointer\n");
+		return -1;
+	}
+	if(num_tasks>=RC_SCHED_MAX_TASKS){
+		fprintf(stderr,"ERROR: scheduler already has %d tasks\n",\
+														RC_SCHED_MAX_TASKS);
+		return -1;
+	}
+	if(divisor<1 || offset<0 || offset>=divisor){
+		fprintf(stderr,"ERROR: task divisor must be >=1 and offset from 0 to divisor-1\n");
+		return -1;
+	}
+	if(budget_us<0){
+		fprintf(stderr,"ERROR: task budget must be >=0\n");
+		return -1;
+	}
+	t = &tasks[num_tasks];
+	memset(t, 0, sizeof(*t));
+	strncpy(t->name, name!=NULL ? name : "task", SCHED_NAME_LEN-1);
+	t->divisor = divisor;
+	t->offset = offset;
+	t->func = func;
+	t->arg = arg;
+	t->stats.budget_ns = (uint64_t)budget_us*1000;
+	num_tasks++;
+	return num_tasks-1;
+}
+
+/*******************************************************************************
+* static void sched_tick()
+*
+* runs every task due this tick in the order they were added
+*******************************************************************************/
+static void sched_tick(){
+	int i;
+	uint64_t start, end, exec;
+	sched_task_t* t;
+
+	if(!sched_running) return;
+	for(i=0; i<num_tasks; i++){
+		t = &tasks[i];
+		if((int)(tick%t->divisor)!=t->offset) continue;
+		start = rc_nanos_since_boot();
+		t->func(t->arg);
+		end = rc_nanos_since_boot();
+		exec = end-start;
+
+		sched_seq++;
+		__sync_synchronize();
+		t->stats.runs++;
+		t->stats.exec_sum_ns += exec;
+		if(exec>t->stats.exec_max_ns) t->stats.exec_max_ns = exec;
+		if(t->stats.budget_ns && exec>t->stats.budget_ns){
+			t->stats.overruns++;
+			t->overrun_flag = 1;
+		}
+		__sync_synchronize();
+		sched_seq++;
+	}
+	tick++;
+}
+
+/*******************************************************************************
+* static void sched_loop_func(void* ptr)
+*******************************************************************************/
+static void sched_loop_func(__attribute__ ((unused)) void* ptr){
+	sched_tick();
+}
+
+/*******************************************************************************
+* static int start_common()
+*******************************************************************************/
+static int start_common(){
+	int i;
+	if(!sched_initialized){
+		fprintf(stderr,"ERROR: call rc_sched_init before starting the scheduler\n");
+		return -1;
+	}
+	if(sched_running){
+		fprintf(stderr,"ERROR: scheduler already running\n");
+		return -1;
+	}
+	for(i=0; i<num_tasks; i++){
+		tasks[i].stats.runs = 0;
+		tasks[i].stats.overruns = 0;
+		tasks[i].stats.exec_sum_ns = 0;
+		tasks[i].stats.exec_max_ns = 0;
+		tasks[i].overrun_flag = 0;
+	}
+	tick = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_sched_start()
+*
+* runs the ticks from an rc_loop_t thread at the base rate
+*******************************************************************************/
+int rc_sched_start(){
+	if(start_common()) return -1;
+	imu_driven = 0;
+	sched_running = 1;
+	if(rc_loop_start(&sched_loop, sched_config, sched_loop_func, NULL)){
+		sched_running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_sched_start_imu()
+*
+* runs one tick in each IMU interrupt
+*******************************************************************************/
+int rc_sched_start_imu(){
+	if(start_common()) return -1;
+	imu_driven = 1;
+	sched_running = 1;
+	if(rc_set_imu_interrupt_func(&sched_tick)){
+		sched_running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_sched_stop()
+*******************************************************************************/
+int rc_sched_stop(){
+	if(!sched_running) return 0;
+	sched_running = 0;
+	if(imu_driven) return rc_stop_imu_interrupt_func();
+	return rc_loop_stop(&sched_loop);
+}
+
+/*******************************************************************************
+* int rc_sched_get_task_stats(int id, rc_sched_task_stats_t* stats)
+*
+* copies the stats, retrying if a tick published while copying
+*******************************************************************************/
+int rc_sched_get_task_stats(int id, rc_sched_task_stats_t* stats){
+	unsigned int seq;
+	if(stats==NULL){
+		fprintf(stderr,"ERROR: in rc_sched_get_task_stats, received NULL pointer\n");
+		return -1;
+	}
+	if(id<0 || id>=num_tasks){
+		fprintf(stderr,"ERROR: invalid scheduler task id %d\n", id);
+		return -1;
+	}
+	do{
+		while((seq=sched_seq)&1);
+		__sync_synchronize();
+		*stats = tasks[id].stats;
+		__sync_synchronize();
+	}while(seq!=sched_seq);
+	stats->overrun_flag = tasks[id].overrun_flag;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_sched_clear_overrun(int id)
+*******************************************************************************/
+int rc_sched_clear_overrun(int id){
+	if(id<0 || id>=num_tasks){
+		fprintf(stderr,"ERROR: invalid scheduler task id %d\n", id);
+		return -1;
+	}
+	tasks[id].overrun_flag = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_sched_print_stats()
+*******************************************************************************/
+int rc_sched_print_stats(){
+	int i;
+	rc_sched_task_stats_t s;
+	if(!sched_initialized){
+		fprintf(stderr,"ERROR: scheduler not initialized\n");
+		return -1;
+	}
+	printf("%-*s   rate_hz       runs  avg_us  max_us  budget  overruns\n",\
+													SCHED_NAME_LEN, "task");
+	for(i=0; i<num_tasks; i++){
+		rc_sched_get_task_stats(i, &s);
+		printf("%-*s %9.2f %10llu %7llu %7llu %7llu %9llu\n",\
+			SCHED_NAME_LEN, tasks[i].name,\
+			sched_config.rate_hz/tasks[i].divisor,\
+			(unsigned long long)s.runs,\
+			(unsigned long long)(s.runs ? s.exec_sum_ns/s.runs/1000 : 0),\
+			(unsigned long long)s.exec_max_ns/1000,\
+			(unsigned long long)s.budget_ns/1000,\
+			(unsigned long long)s.overruns);
+	}
+	if(!imu_driven && sched_loop.initialized){
+		rc_loop_print_stats(&sched_loop, "scheduler tick");
+	}
+	return 0;
+}
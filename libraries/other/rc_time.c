@@ -11,6 +11,20 @@
 #include <errno.h>
 #include <unistd.h> // for sysconf
 #include <stdint.h> // for uint64_t
+#include <signal.h>
+#include <setjmp.h>
+#include <string.h>
+#include <stdio.h>
+
+#define CYCLES_CAL_NS		10000000	// calibration interval
+#define CYCLES_OVERHEAD_RUNS	100
+
+rc_cycles_source_t rc_cycles_src = RC_CYCLES_CLOCK;
+static double ns_per_cycle = 1.0;
+static uint64_t overhead_cycles = 0;
+#if defined(__arm__)
+static sigjmp_buf probe_jmp;
+#endif
 
 /*******************************************************************************
 * @ void rc_nanosleep(uint64_t ns)
@@ -186,4 +200,117 @@ void rc_timespec_add(timespec* start, double seconds){
 	return;
 }
 
+#if defined(__arm__)
+/*******************************************************************************
+* static void probe_sigill(int sig)
+*******************************************************************************/
+static void probe_sigill(__attribute__ ((unused)) int sig){
+	siglongjmp(probe_jmp, 1);
+}
+
+/*******************************************************************************
+* static int pmu_usable()
+*
+* PMUSERENR is readable from userspace and says whether the other PMU
+* registers are. The cycle counter must also be enabled in PMCNTENSET. The
+* reads are done under a SIGILL handler in case the kernel traps them.
+*******************************************************************************/
+static int pmu_usable(){
+	struct sigaction act, old;
+	volatile int ok = 0;
+	uint32_t userenr, cntenset, a, b;
+
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = probe_sigill;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGILL, &act, &old);
+	if(sigsetjmp(probe_jmp, 1)==0){
+		__asm__ __volatile__("mrc p15, 0, %0, c9, c14, 0" : "=r"(userenr));
+		if(userenr&1){
+			__asm__ __volatile__("mrc p15, 0, %0, c9, c12, 1" : "=r"(cntenset));
+			__asm__ __volatile__("mrc p15, 0, %0, c9, c13, 0" : "=r"(a));
+			rc_nanosleep(1000);
+			__asm__ __volatile__("mrc p15, 0, %0, c9, c13, 0" : "=r"(b));
+			if((cntenset&(1u<<31)) && a!=b) ok = 1;
+		}
+	}
+	sigaction(SIGILL, &old, NULL);
+	return ok;
+}
+#endif
+
+/*******************************************************************************
+* @ int rc_cycles_init()
+*
+* Picks the counter, calibrates it over CYCLES_CAL_NS against CLOCK_MONOTONIC,
+* and measures the cost of reading it.
+*******************************************************************************/
+int rc_cycles_init(){
+	uint64_t c1, c2, t1, t2, min;
+	int i;
+
+	rc_cycles_src = RC_CYCLES_CLOCK;
+	ns_per_cycle = 1.0;
+#if defined(__arm__)
+	if(pmu_usable()) rc_cycles_src = RC_CYCLES_PMU;
+#elif defined(__x86_64__) || defined(__i386__)
+	rc_cycles_src = RC_CYCLES_TSC;
+#endif
+
+	if(rc_cycles_src!=RC_CYCLES_CLOCK){
+		t1 = rc_nanos_since_boot();
+		c1 = rc_cycles();
+		rc_nanosleep(CYCLES_CAL_NS);
+		t2 = rc_nanos_since_boot();
+		c2 = rc_cycles();
+		c2 = rc_cycles_diff(c1, c2);
+		if(c2==0){
+			rc_cycles_src = RC_CYCLES_CLOCK;
+		}
+		else ns_per_cycle = (double)(t2-t1)/c2;
+	}
+
+	min = UINT64_MAX;
+	for(i=0; i<CYCLES_OVERHEAD_RUNS; i++){
+		c1 = rc_cycles();
+		c2 = rc_cycles();
+		c2 = rc_cycles_diff(c1, c2);
+		if(c2<min) min = c2;
+	}
+	overhead_cycles = min;
+
+	#ifdef DEBUG
+	printf("cycle counter source %d, %.3fns per cycle, overhead %llu cycles\n",\
+			rc_cycles_src, ns_per_cycle, (unsigned long long)overhead_cycles);
+	#endif
+	if(rc_cycles_src==RC_CYCLES_CLOCK) return -1;
+	return 0;
+}
+
+/*******************************************************************************
+* @ uint64_t rc_cycles_to_nanos(uint64_t cycles)
+*******************************************************************************/
+uint64_t rc_cycles_to_nanos(uint64_t cycles){
+	return (uint64_t)(cycles*ns_per_cycle);
+}
+
+/*******************************************************************************
+* @ uint64_t rc_cycles_overhead()
+*******************************************************************************/
+uint64_t rc_cycles_overhead(){
+	return overhead_cycles;
+}
+
+/*******************************************************************************
+* @ rc_cycles_source_t rc_cycles_source()
+*******************************************************************************/
+rc_cycles_source_t rc_cycles_source(){
+	return rc_cycles_src;
+}
 
+/*******************************************************************************
+* @ double rc_cycles_hz()
+*******************************************************************************/
+double rc_cycles_hz(){
+	return 1000000000.0/ns_per_cycle;
+}
@@ -0,0 +1,259 @@
+/*******************************************************************************
+* rc_trace.c
+*
+* Each thread gets its own ring of events the first time it records one so
+* recording never takes a lock. Only the owning thread writes a ring; the
+* head count is bumped after the event is filled in, so a reader copying a
+* ring only has to discard the events that may have been overwritten while it
+* was copying.
+*******************************************************************************/
+#include "../roboticscape.h"
+#include "rc_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+#define TRACE_NAME_LEN	32
+#define TRACE_PATH_LEN	256
+
+typedef struct trace_event_t{
+	uint64_t cycles;
+	const char* name;
+	int64_t value;
+	char type;
+} trace_event_t;
+
+typedef struct trace_ring_t{
+	trace_event_t ev[RC_TRACE_RING_LEN];
+	volatile uint32_t head;		// number of events ever written
+	uint32_t last32;			// for extending the 32 bit PMU counter
+	uint64_t hi;
+	uint64_t anchor_ns;			// rc_nanos_since_boot() at anchor_cycles
+	uint64_t anchor_cycles;
+	int tid;
+	char name[TRACE_NAME_LEN];
+	struct trace_ring_t* next;
+} trace_ring_t;
+
+/*******************************************************************************
+* Local Global Variables
+*******************************************************************************/
+static __thread trace_ring_t* my_ring = NULL;
+static trace_ring_t* rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile int trace_enabled = 0;
+static char trace_path[TRACE_PATH_LEN];
+static int trace_path_set = 0;
+
+/*******************************************************************************
+* static trace_ring_t* new_ring()
+*
+* allocates the calling thread's ring and adds it to the list
+*******************************************************************************/
+static trace_ring_t* new_ring(){
+	trace_ring_t* r;
+	uint64_t c;
+
+	r = calloc(1, sizeof(trace_ring_t));
+	if(r==NULL) return NULL;
+	r->tid = syscall(SYS_gettid);
+	prctl(PR_GET_NAME, r->name, 0, 0, 0);
+	r->anchor_ns = rc_nanos_since_boot();
+	c = rc_cycles();
+	r->anchor_cycles = c;
+	r->last32 = c;
+
+	pthread_mutex_lock(&rings_mutex);
+	r->next = rings;
+	rings = r;
+	pthread_mutex_unlock(&rings_mutex);
+	my_ring = r;
+	return r;
+}
+
+/*******************************************************************************
+* void rc_trace_event(char type, const char* name, int64_t value)
+*
+* called through the RC_TRACE_ macros
+*******************************************************************************/
+void rc_trace_event(char type, const char* name, int64_t value){
+	trace_ring_t* r;
+	trace_event_t* e;
+	uint64_t c;
+
+	if(!trace_enabled) return;
+	r = my_ring;
+	if(r==NULL){
+		r = new_ring();
+		if(r==NULL) return;
+	}
+	c = rc_cycles();
+	if(rc_cycles_src==RC_CYCLES_PMU){
+		if((uint32_t)c < r->last32) r->hi += 1ULL<<32;
+		r->last32 = c;
+		c = r->hi | (uint32_t)c;
+	}
+	e = &r->ev[r->head%RC_TRACE_RING_LEN];
+	e->cycles = c;
+	e->name = name;
+	e->value = value;
+	e->type = type;
+	__sync_synchronize();
+	r->head++;
+}
+
+/*******************************************************************************
+* int rc_trace_enable(const char* path)
+*******************************************************************************/
+int rc_trace_enable(const char* path){
+	if(path!=NULL){
+		if(strlen(path)>=TRACE_PATH_LEN){
+			fprintf(stderr,"ERROR: trace path too long\n");
+			return -1;
+		}
+		strcpy(trace_path, path);
+		trace_path_set = 1;
+	}
+	else trace_path_set = 0;
+	trace_enabled = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_trace_disable()
+*******************************************************************************/
+int rc_trace_disable(){
+	trace_enabled = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_trace_name_thread(const char* name)
+*******************************************************************************/
+int rc_trace_name_thread(const char* name){
+	trace_ring_t* r;
+	if(name==NULL){
+		fprintf(stderr,"ERROR: in rc_trace_name_thread, received NULL pointer\n");
+		return -1;
+	}
+	r = my_ring;
+	if(r==NULL){
+		r = new_ring();
+		if(r==NULL){
+			fprintf(stderr,"ERROR: failed to allocate trace buffer\n");
+			return -1;
+		}
+	}
+	strncpy(r->name, name, TRACE_NAME_LEN-1);
+	return 0;
+}
+
+/*******************************************************************************
+* static void write_json_string(FILE* f, const char* s)
+*******************************************************************************/
+static void write_json_string(FILE* f, const char* s){
+	fputc('"', f);
+	for(; *s; s++){
+		if(*s=='"' || *s=='\\') fputc('\\', f);
+		if((unsigned char)*s>=0x20) fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+/*******************************************************************************
+* int rc_trace_write_json(const char* path)
+*
+* copies each ring then writes its valid events as Chrome trace events
+*******************************************************************************/
+int rc_trace_write_json(const char* path){
+	FILE* f;
+	trace_ring_t* r;
+	trace_event_t* copy;
+	uint32_t h1, h2, count, first, i;
+	uint64_t ns;
+	int pid = getpid();
+	int n = 0;
+
+	if(path==NULL){
+		fprintf(stderr,"ERROR: in rc_trace_write_json, received NULL pointer\n");
+		return -1;
+	}
+	copy = malloc(sizeof(trace_event_t)*RC_TRACE_RING_LEN);
+	if(copy==NULL){
+		fprintf(stderr,"ERROR: failed to allocate trace copy buffer\n");
+		return -1;
+	}
+	f = fopen(path, "w");
+	if(f==NULL){
+		fprintf(stderr,"ERROR: can't open %s for writing\n", path);
+		free(copy);
+		return -1;
+	}
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+	pthread_mutex_lock(&rings_mutex);
+	for(r=rings; r!=NULL; r=r->next){
+		if(n++) fprintf(f, ",\n");
+		fprintf(f, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,"\
+				"\"tid\":%d,\"args\":{\"name\":", pid, r->tid);
+		write_json_string(f, r->name);
+		fprintf(f, "}}");
+
+		h1 = r->head;
+		__sync_synchronize();
+		count = h1<RC_TRACE_RING_LEN ? h1 : RC_TRACE_RING_LEN;
+		for(i=0; i<count; i++){
+			copy[i] = r->ev[(h1-count+i)%RC_TRACE_RING_LEN];
+		}
+		__sync_synchronize();
+		h2 = r->head;
+		// event h2 may be half written, so anything it or earlier events
+		// wrote over while we were copying is discarded
+		first = 0;
+		if(h2+1-(h1-count) > RC_TRACE_RING_LEN){
+			first = h2+1-(h1-count)-RC_TRACE_RING_LEN;
+			if(first>count) first = count;
+		}
+
+		for(i=first; i<count; i++){
+			ns = r->anchor_ns + \
+				rc_cycles_to_nanos(copy[i].cycles - r->anchor_cycles);
+			fprintf(f, ",\n{\"ph\":\"%c\",\"name\":", copy[i].type);
+			write_json_string(f, copy[i].name);
+			fprintf(f, ",\"pid\":%d,\"tid\":%d,\"ts\":%llu.%03llu",\
+					pid, r->tid, (unsigned long long)(ns/1000),\
+					(unsigned long long)(ns%1000));
+			if(copy[i].type=='C'){
+				fprintf(f, ",\"args\":{\"value\":%lld}",\
+								(long long)copy[i].value);
+			}
+			else if(copy[i].type=='i') fprintf(f, ",\"s\":\"t\"");
+			fprintf(f, "}");
+		}
+	}
+	pthread_mutex_unlock(&rings_mutex);
+
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	free(copy);
+	return 0;
+}
+
+/*******************************************************************************
+* int write_trace_on_exit()
+*
+* called by rc_cleanup, writes the trace if a path was given to
+* rc_trace_enable
+*******************************************************************************/
+int write_trace_on_exit(){
+	if(!trace_enabled || !trace_path_set) return 0;
+	trace_enabled = 0;
+	#ifdef DEBUG
+	printf("writing trace to %s\n", trace_path);
+	#endif
+	return rc_trace_write_json(trace_path);
+}
@@ -0,0 +1,8 @@
+/*******************************************************************************
+* rc_trace.h
+*
+* internal hook for rc_cleanup, the tracing functions for the user are in
+* roboticscape.h
+*******************************************************************************/
+
+int write_trace_on_exit();
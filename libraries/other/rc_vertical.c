@@ -0,0 +1,316 @@
+/*******************************************************************************
+* rc_vertical.c
+*
+* Vertical position and velocity estimator. A 3 state Kalman filter of height,
+* vertical velocity, and accelerometer bias is predicted with earth frame
+* vertical acceleration in the IMU interrupt, before the user's interrupt
+* function runs, and corrected with barometer altitude whenever the background
+* sampler has a new sample. Everything is fixed size so nothing is allocated
+* once running. The state is published through a seqlock like odometry.
+*******************************************************************************/
+#include "../roboticscape.h"
+#include "../mpu9250/rc_mpu9250.h"
+#include "../bmp280/rc_bmp280.h"
+#include "rc_vertical.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define GRAVITY		9.80665f
+// history of predicted heights to compare late barometer samples against,
+// at 200hz this covers 320ms
+#define HIST_LEN	64
+
+/*******************************************************************************
+* Local Global Variables
+*******************************************************************************/
+volatile int vertical_running = 0;
+static rc_vertical_config_t vert_config;
+static volatile int reset_flag = 0;
+// filter state, only touched by the IMU interrupt thread
+static float x[3];			// height m, velocity m/s, accel bias m/s^2
+static float P[3][3];
+static float baro_origin_m;
+static uint64_t last_baro_samples;
+static uint64_t last_imu_ns;
+static int have_baro;
+static float hist_z[HIST_LEN];
+static uint64_t hist_ns[HIST_LEN];
+static unsigned int hist_head;
+// sensor to body axis mapping from the DMP orientation
+static int body_axis[3];
+static float body_sign[3];
+// published state, vert_seq is odd while vert_state is being written
+static rc_vertical_state_t vert_state;
+static volatile unsigned int vert_seq = 0;
+
+/*******************************************************************************
+* rc_vertical_config_t rc_default_vertical_config()
+*******************************************************************************/
+rc_vertical_config_t rc_default_vertical_config(){
+	rc_vertical_config_t conf;
+	conf.accel_std = 0.5f;
+	conf.bias_drift = 0.02f;
+	conf.baro_std_m = 0.5f;
+	conf.baro_delay_s = 0.02f;
+	return conf;
+}
+
+/*******************************************************************************
+* static void decode_orientation(int orientation)
+*
+* The DMP quaternion is of the body frame set by the orientation but the FIFO
+* accelerometer data is in the sensor frame. Each 3 bits of the orientation
+* scalar give one row of the rotation, the sensor axis and whether it's
+* negated.
+*******************************************************************************/
+static void decode_orientation(int orientation){
+	int i, row;
+	for(i=0; i<3; i++){
+		row = (orientation>>(3*i)) & 0x7;
+		body_axis[i] = row & 0x3;
+		body_sign[i] = (row & 0x4) ? -1.0f : 1.0f;
+	}
+}
+
+/*******************************************************************************
+* static float vertical_accel(rc_imu_data_t* data)
+*
+* world up component of the specific force minus gravity, the third row of
+* the body to world rotation from the DMP quaternion dotted with the
+* accelerometer reading in the body frame
+*******************************************************************************/
+static float vertical_accel(rc_imu_data_t* data){
+	float* q = data->dmp_quat;
+	float a[3];
+	int i;
+	for(i=0; i<3; i++) a[i] = body_sign[i]*data->accel[body_axis[i]];
+	return 2.0f*(q[1]*q[3] - q[0]*q[2])*a[0] + \
+			2.0f*(q[2]*q[3] + q[0]*q[1])*a[1] + \
+			(1.0f - 2.0f*(q[1]*q[1] + q[2]*q[2]))*a[2] - GRAVITY;
+}
+
+/*******************************************************************************
+* static void predict(float az, float dt)
+*
+* x = F*x + B*az with F = [1 dt -dt^2/2; 0 1 -dt; 0 0 1]
+* P = F*P*F' + Q, Q from white acceleration noise and bias random walk
+*******************************************************************************/
+static void predict(float az, float dt){
+	float a = az - x[2];
+	float dt2 = dt*dt;
+	float F[3][3] = {{1.0f, dt, -0.5f*dt2}, {0.0f, 1.0f, -dt}, {0.0f, 0.0f, 1.0f}};
+	float FP[3][3];
+	float qa = vert_config.accel_std*vert_config.accel_std;
+	float qb = vert_config.bias_drift*vert_config.bias_drift;
+	int i, j, k;
+
+	x[0] += x[1]*dt + 0.5f*a*dt2;
+	x[1] += a*dt;
+
+	for(i=0; i<3; i++){
+		for(j=0; j<3; j++){
+			FP[i][j] = 0.0f;
+			for(k=0; k<3; k++) FP[i][j] += F[i][k]*P[k][j];
+		}
+	}
+	for(i=0; i<3; i++){
+		for(j=0; j<3; j++){
+			P[i][j] = 0.0f;
+			for(k=0; k<3; k++) P[i][j] += FP[i][k]*F[j][k];
+		}
+	}
+	P[0][0] += 0.25f*dt2*dt2*qa;
+	P[0][1] += 0.5f*dt2*dt*qa;
+	P[1][0] += 0.5f*dt2*dt*qa;
+	P[1][1] += dt2*qa;
+	P[2][2] += dt*qb;
+}
+
+/*******************************************************************************
+* static float height_at(uint64_t t_ns)
+*
+* predicted height at the history entry closest to t_ns, the newest if t_ns
+* is in the future and the oldest kept if it's further back than that
+*******************************************************************************/
+static float height_at(uint64_t t_ns){
+	unsigned int i, idx;
+	for(i=0; i<HIST_LEN; i++){
+		idx = (hist_head-1-i) % HIST_LEN;
+		if(hist_ns[idx]==0) break;
+		if(hist_ns[idx]<=t_ns) return hist_z[idx];
+	}
+	if(i==0) return x[0];
+	return hist_z[(hist_head-i) % HIST_LEN];
+}
+
+/*******************************************************************************
+* static void correct(float z, uint64_t t_ns)
+*
+* Barometer update with H = [1 0 0]. The sample is late so the innovation is
+* taken against the height predicted for when it was measured and the
+* correction applied to the current state.
+*******************************************************************************/
+static void correct(float z, uint64_t t_ns){
+	float y = z - height_at(t_ns);
+	float S = P[0][0] + vert_config.baro_std_m*vert_config.baro_std_m;
+	float K[3], P0[3];
+	int i, j;
+
+	for(i=0; i<3; i++){
+		K[i] = P[i][0]/S;
+		P0[i] = P[0][i];
+	}
+	for(i=0; i<3; i++){
+		x[i] += K[i]*y;
+		for(j=0; j<3; j++) P[i][j] -= K[i]*P0[j];
+	}
+}
+
+/*******************************************************************************
+* static void reset_filter(float z0)
+*
+* starts at rest at the given barometer altitude which becomes height 0
+*******************************************************************************/
+static void reset_filter(float z0){
+	memset(x, 0, sizeof(x));
+	memset(P, 0, sizeof(P));
+	P[0][0] = vert_config.baro_std_m*vert_config.baro_std_m;
+	P[1][1] = 0.1f;
+	P[2][2] = 0.1f;
+	memset(hist_ns, 0, sizeof(hist_ns));
+	hist_head = 0;
+	baro_origin_m = z0;
+}
+
+/*******************************************************************************
+* void vertical_imu_step(rc_imu_data_t* data, uint64_t timestamp_ns)
+*
+* called from the IMU interrupt after each successful FIFO read
+*******************************************************************************/
+void vertical_imu_step(rc_imu_data_t* data, uint64_t timestamp_ns){
+	rc_bmp_data_t baro;
+	float az, dt;
+	int new_baro;
+
+	new_baro = bmp_try_get_data(&baro)==0 && baro.samples!=last_baro_samples;
+	if(new_baro) last_baro_samples = baro.samples;
+
+	// wait for the first barometer sample to set the origin
+	if(!have_baro || reset_flag){
+		if(!new_baro) return;
+		reset_filter(baro.alt_m);
+		reset_flag = 0;
+		have_baro = 1;
+		last_imu_ns = timestamp_ns;
+		new_baro = 0;
+	}
+
+	az = vertical_accel(data);
+	dt = (timestamp_ns - last_imu_ns)/1000000000.0f;
+	last_imu_ns = timestamp_ns;
+	// a missed interrupt just makes a longer step, a huge gap means the
+	// state is meaningless so start again from the next barometer sample
+	if(dt>0.5f){
+		have_baro = 0;
+		return;
+	}
+	if(dt>0.0f) predict(az, dt);
+	hist_z[hist_head%HIST_LEN] = x[0];
+	hist_ns[hist_head%HIST_LEN] = timestamp_ns;
+	hist_head++;
+
+	if(new_baro){
+		correct(baro.alt_m - baro_origin_m, baro.timestamp_ns - \
+						(uint64_t)(vert_config.baro_delay_s*1000000000.0f));
+	}
+
+	vert_seq++;
+	__sync_synchronize();
+	vert_state.z_m = x[0];
+	vert_state.vz_ms = x[1];
+	vert_state.accel_bias = x[2];
+	vert_state.az_ms2 = az - x[2];
+	vert_state.origin_alt_m = baro_origin_m;
+	vert_state.z_std_m = sqrtf(P[0][0]);
+	vert_state.timestamp_ns = timestamp_ns;
+	if(new_baro) vert_state.baro_updates++;
+	__sync_synchronize();
+	vert_seq++;
+}
+
+/*******************************************************************************
+* int rc_start_vertical_estimator(rc_vertical_config_t config)
+*
+* The estimator runs in the IMU interrupt so the IMU must be in DMP mode and
+* the barometer sampler running. Height is relative to the first barometer
+* sample.
+*******************************************************************************/
+int rc_start_vertical_estimator(rc_vertical_config_t config){
+	if(vertical_running){
+		fprintf(stderr,"ERROR: vertical estimator already running\n");
+		return -1;
+	}
+	if(config.accel_std<=0 || config.bias_drift<0 || config.baro_std_m<=0 \
+												|| config.baro_delay_s<0){
+		fprintf(stderr,"ERROR: vertical estimator noise must be >0 and delay >=0\n");
+		return -1;
+	}
+	if(!imu_dmp_running()){
+		fprintf(stderr,"ERROR: start the IMU in DMP mode before the vertical estimator\n");
+		return -1;
+	}
+	if(!bmp_sampler_running()){
+		fprintf(stderr,"ERROR: start the barometer sampler before the vertical estimator\n");
+		return -1;
+	}
+	vert_config = config;
+	decode_orientation(imu_dmp_orientation());
+	memset(&vert_state, 0, sizeof(vert_state));
+	have_baro = 0;
+	reset_flag = 0;
+	last_baro_samples = 0;
+	__sync_synchronize();
+	vertical_running = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_stop_vertical_estimator()
+*******************************************************************************/
+int rc_stop_vertical_estimator(){
+	vertical_running = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_reset_vertical_estimator()
+*
+* the IMU thread restarts the filter at the next barometer sample
+*******************************************************************************/
+int rc_reset_vertical_estimator(){
+	reset_flag = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_get_vertical_state(rc_vertical_state_t* state)
+*
+* copies the state, retrying if the IMU thread published while copying.
+* Returns -1 if there's no estimate yet.
+*******************************************************************************/
+int rc_get_vertical_state(rc_vertical_state_t* state){
+	unsigned int seq;
+	if(state==NULL){
+		fprintf(stderr,"ERROR: in rc_get_vertical_state, received NULL pointer\n");
+		return -1;
+	}
+	do{
+		while((seq=vert_seq)&1);
+		__sync_synchronize();
+		*state = vert_state;
+		__sync_synchronize();
+	}while(seq!=vert_seq);
+	if(state->timestamp_ns==0) return -1;
+	return 0;
+}
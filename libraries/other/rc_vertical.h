@@ -0,0 +1,10 @@
+/*******************************************************************************
+* rc_vertical.h
+*
+* internal hook for the IMU interrupt, the vertical estimator functions for the
+* user are in roboticscape.h
+*******************************************************************************/
+#include <stdint.h>
+
+extern volatile int vertical_running;
+void vertical_imu_step(rc_imu_data_t* data, uint64_t timestamp_ns);
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include "../roboticscape.h"
 #include "../rc_defs.h"
+#include "../rc_lazy_init.h"
 
 // global variables
 int mdir1a, mdir2b; // variable gpio pin assignments
@@ -52,7 +53,7 @@ int initialize_motors(){
 * returns 0 on success
 *******************************************************************************/
 int rc_enable_motors(){
-	if(motors_initialized==0){
+	if(motors_initialized==0 && lazy_initialize(RC_INIT_MOTORS)){
 		printf("ERROR: trying to enable motors before they have been initialized\n");
 		return -1;
 	}
@@ -67,7 +68,7 @@ int rc_enable_motors(){
 * and disables PWM output signals, returns 0 on success
 *******************************************************************************/
 int rc_disable_motors(){
-	if(motors_initialized==0){
+	if(motors_initialized==0 && lazy_initialize(RC_INIT_MOTORS)){
 		printf("ERROR: trying to disable motors before they have been initialized\n");
 		return -1;
 	}
@@ -84,7 +85,7 @@ int rc_disable_motors(){
 *******************************************************************************/
 int rc_set_motor(int motor, float duty){
 	uint8_t a,b;
-	if(motors_initialized==0){
+	if(motors_initialized==0 && lazy_initialize(RC_INIT_MOTORS)){
 		printf("ERROR: trying to rc_set_motor before they have been initialized\n");
 		return -1;
 	}
@@ -107,6 +108,7 @@ int rc_set_motor(int motor, float duty){
 	}
 	
 	// set gpio direction outputs & duty
+	RC_TRACE_INSTANT("rc_set_motor");
 	switch(motor){
 		case 1:
 			rc_gpio_set_value_mmap(mdir1a, a);
@@ -141,15 +143,81 @@ int rc_set_motor(int motor, float duty){
 * applies the same duty cycle argument to all 4 motors
 *******************************************************************************/
 int rc_set_motor_all(float duty){
+	float d[MOTOR_CHANNELS];
 	int i;
-	if(motors_initialized==0){
+	if(motors_initialized==0 && lazy_initialize(RC_INIT_MOTORS)){
 		printf("ERROR: trying to rc_set_motor_all before they have been initialized\n");
 		return -1;
 	}
-	for(i=1;i<=MOTOR_CHANNELS; i++){
-		rc_set_motor(i, duty);
+	for(i=0;i<MOTOR_CHANNELS; i++) d[i]=duty;
+	return rc_set_motors(d);
+}
+
+/*******************************************************************************
+* void add_pin(uint32_t set[4], uint32_t clear[4], int pin, int state)
+*
+* adds a pin to the per-bank set or clear masks used by rc_set_motors
+*******************************************************************************/
+static void add_pin(uint32_t set[4], uint32_t clear[4], int pin, int state){
+	if(state) set[pin/32] |= 1u<<(pin%32);
+	else clear[pin/32] |= 1u<<(pin%32);
+}
+
+/*******************************************************************************
+* int rc_set_motors(const float duty[4])
+* 
+* Sets all 4 motors at once, duty[0] is motor 1. The direction pins are
+* collected into one set and one clear mask per gpio bank so each bank takes
+* at most 2 register writes. Then both compare registers of each PWM
+* subsystem are written together so all 4 duties load on the next period.
+*******************************************************************************/
+int rc_set_motors(const float duty[4]){
+	uint32_t set[4] = {0,0,0,0};
+	uint32_t clear[4] = {0,0,0,0};
+	float d[MOTOR_CHANNELS];
+	int dir[MOTOR_CHANNELS];
+	volatile uint32_t* bank;
+	int i, ret = 0;
+
+	if(motors_initialized==0 && lazy_initialize(RC_INIT_MOTORS)){
+		printf("ERROR: trying to rc_set_motors before they have been initialized\n");
+		return -1;
 	}
-	return 0;
+	RC_TRACE_BEGIN("rc_set_motors");
+	// same saturation and direction logic as rc_set_motor
+	for(i=0;i<MOTOR_CHANNELS;i++){
+		d[i] = duty[i];
+		if(d[i]>1.0f) d[i]=1.0f;
+		else if(d[i]<-1.0f) d[i]=-1.0f;
+		if(d[i]>=0.0f) dir[i]=HIGH;
+		else{
+			dir[i]=LOW;
+			d[i]=-d[i];
+		}
+	}
+	// motors 2 and 3 are wired with A and B swapped, see rc_set_motor
+	add_pin(set, clear, mdir1a, dir[0]);
+	add_pin(set, clear, MDIR1B, !dir[0]);
+	add_pin(set, clear, MDIR2A, !dir[1]);
+	add_pin(set, clear, mdir2b, dir[1]);
+	add_pin(set, clear, MDIR3A, !dir[2]);
+	add_pin(set, clear, MDIR3B, dir[2]);
+	add_pin(set, clear, MDIR4A, dir[3]);
+	add_pin(set, clear, MDIR4B, !dir[3]);
+
+	for(i=0;i<4;i++){
+		if(set[i]==0 && clear[i]==0) continue;
+		bank = rc_gpio_bank_mmap(i);
+		if(bank==NULL){
+			ret = -1;
+			break;
+		}
+		rc_gpio_port_write(bank, set[i], clear[i]);
+	}
+	if(ret==0 && rc_pwm_set_duty_ab_mmap(1, d[0], d[1])<0) ret = -1;
+	if(ret==0 && rc_pwm_set_duty_ab_mmap(2, d[2], d[3])<0) ret = -1;
+	RC_TRACE_END("rc_set_motors");
+	return ret;
 }
 
 /*******************************************************************************
@@ -159,7 +227,7 @@ int rc_set_motor_all(float duty){
 * motor spin freely as if it wasn't connected to anything.
 *******************************************************************************/
 int rc_set_motor_free_spin(int motor){
-	if(motors_initialized==0){
+	if(motors_initialized==0 && lazy_initialize(RC_INIT_MOTORS)){
 		printf("ERROR: trying to rc_set_motor_free_spin before they have been initialized\n");
 		return -1;
 	}
@@ -197,7 +265,7 @@ int rc_set_motor_free_spin(int motor){
 *******************************************************************************/
 int rc_set_motor_free_spin_all(){
 	int i;
-	if(motors_initialized==0){
+	if(motors_initialized==0 && lazy_initialize(RC_INIT_MOTORS)){
 		printf("ERROR: trying to rc_set_motor_free_spin_all before they have been initialized\n");
 		return -1;
 	}
@@ -214,7 +282,7 @@ int rc_set_motor_free_spin_all(){
 * makes the motor fight against its own back EMF turning it into a brake.
 *******************************************************************************/
 int rc_set_motor_brake(int motor){
-	if(motors_initialized==0){
+	if(motors_initialized==0 && lazy_initialize(RC_INIT_MOTORS)){
 		printf("ERROR: trying to rc_set_motor_brake before they have been initialized\n");
 		return -1;
 	}
@@ -252,7 +320,7 @@ int rc_set_motor_brake(int motor){
 *******************************************************************************/
 int rc_set_motor_brake_all(){
 	int i;
-	if(motors_initialized==0){
+	if(motors_initialized==0 && lazy_initialize(RC_INIT_MOTORS)){
 		printf("ERROR: trying to rc_set_motor_brake_all before they have been initialized\n");
 		return -1;
 	}
@@ -7,11 +7,16 @@
 * by the user directly instead of using the motor API. PWM subsystem 0 channels
 * A and B can be accessed on the UART1 header if set up with the Pinmux API to 
 * do so. The user may have exclusive use of that subsystem.
+*
+* The sysfs driver is only used by rc_pwm_init to export and enable the
+* channels the first time. Everything after that, including frequency changes,
+* goes straight to the registers through rc_mmap_pwmss.c with no syscalls.
 *******************************************************************************/
 #include "../roboticscape.h"
 #include "rc_pwm_userspace_defs.h"
 #include "../preprocessor_macros.h"
 #include "../rc_defs.h"
+#include "../mmap/rc_mmap_pwmss.h"
 #include <stdio.h>
 #include <dirent.h>
 #include <fcntl.h>
@@ -21,7 +26,6 @@
 #define MAXBUF 64
 
 // variables
-int duty_fd[6]; 	// pointers to duty cycle file descriptor
 int period_ns[3]; 	//one period (frequency) per subsystem
 char simple_pwm_initialized[3] = {0,0,0};
 int ver; // pwm driver version, 0 or 1. automatically detected
@@ -32,6 +36,10 @@ int ver; // pwm driver version, 0 or 1. automatically detected
 * Configures subsystem 0, 1, or 2 to operate at a particular frequency. This may
 * be called at runtime to change the pwm frequency without stopping the motors
 * or pwm signal. Returns 0 on success or -1 on failure.
+*
+* The first call exports and enables both channels through sysfs then hands
+* the subsystem to init_pwm_mmap which sets the period and duty registers
+* directly. Later calls only change the frequency through the registers.
 *******************************************************************************/
 int rc_pwm_init(int ss, int frequency){
 	int export_fd;
@@ -39,8 +47,8 @@ int rc_pwm_init(int ss, int frequency){
 	int periodB_fd;
 	int enableA_fd;  // run (enable) file pointers
 	int enableB_fd;
-	int polarityA_fd;
-	int polarityB_fd;
+	int dutyA_fd;
+	int dutyB_fd;
 	char buf[MAXBUF];
 	int len;
 	
@@ -48,6 +56,17 @@ int rc_pwm_init(int ss, int frequency){
 		printf("PWM subsystem must be between 0 and 2\n");
 		return -1;
 	}
+	if(frequency<1){
+		printf("PWM frequency must be >0\n");
+		return -1;
+	}
+
+	// already running, just change the frequency
+	if(simple_pwm_initialized[ss]){
+		if(set_pwm_freq_mmap(ss, frequency)<0) return -1;
+		period_ns[ss] = 1000000000/frequency;
+		return 0;
+	}
 	
 	// check driver is loaded
 	if(access(pwm_export_path[0][ss], F_OK ) == 0) ver=0;
@@ -74,14 +93,13 @@ int rc_pwm_init(int ss, int frequency){
 	// set up file descriptors for A channel
 	enableA_fd = open(pwm_chA_enable_path[ver][ss], O_WRONLY);
 	periodA_fd = open(pwm_chA_period_path[ver][ss], O_WRONLY);
-	duty_fd[(2*ss)] = open(pwm_chA_duty_path[ver][ss], O_WRONLY);
-	polarityA_fd = open(pwm_chA_polarity_path[ver][ss], O_WRONLY);
+	dutyA_fd = open(pwm_chA_duty_path[ver][ss], O_WRONLY);
 
-	
-	// disable A channel and set polarity before period
+	// disable A channel and zero the duty before setting the period, the
+	// driver won't enable a channel without one. Polarity is set later
+	// through the registers.
 	write(enableA_fd, "0", 1);
-	write(duty_fd[(2*ss)], "0", 1); // set duty cycle to 0
-	write(polarityA_fd, "0", 1); // set the polarity
+	write(dutyA_fd, "0", 1); // set duty cycle to 0
 
 	// set the period in nanoseconds
 	period_ns[ss] = 1000000000/frequency;
@@ -102,13 +120,11 @@ int rc_pwm_init(int ss, int frequency){
 	// set up file descriptors for B channel
 	enableB_fd = open(pwm_chB_enable_path[ver][ss], O_WRONLY);
 	periodB_fd = open(pwm_chB_period_path[ver][ss], O_WRONLY);
-	duty_fd[(2*ss)+1] = open(pwm_chB_duty_path[ver][ss], O_WRONLY);
-	polarityB_fd = open(pwm_chB_polarity_path[ver][ss], O_WRONLY);
+	dutyB_fd = open(pwm_chB_duty_path[ver][ss], O_WRONLY);
 	
-	// disable and set polarity before period
+	// disable and zero duty before period
 	write(enableB_fd, "0", 1);
-	write(polarityB_fd, "0", 1);
-	write(duty_fd[(2*ss)+1], "0", 1);
+	write(dutyB_fd, "0", 1);
 	
 	// set the period to match the A channel
 	len = snprintf(buf, sizeof(buf), "%d", period_ns[ss]);
@@ -124,8 +140,14 @@ int rc_pwm_init(int ss, int frequency){
 	close(enableB_fd);
 	close(periodA_fd);
 	close(periodB_fd);
-	close(polarityA_fd);
-	close(polarityB_fd);
+	close(dutyA_fd);
+	close(dutyB_fd);
+
+	// from here on the registers are written directly
+	if(init_pwm_mmap(ss, frequency)<0){
+		fprintf(stderr,"ERROR in rc_pwm_init, failed to set up PWMSS%d registers\n", ss);
+		return -1;
+	}
 	
 	// everything successful
 	simple_pwm_initialized[ss] = 1;
@@ -176,20 +198,22 @@ int rc_pwm_close(int ss){
 /*******************************************************************************
 * int rc_pwm_set_duty(int ss, char ch, float duty)
 *
-* Updates the duty cycle through the file system userspace driver. subsystem ss
-* must be 0,1,or 2 and channel 'ch' must be A or B. Duty cycle must be bounded
+* Updates the duty cycle through direct register access. subsystem ss must be
+* 0,1,or 2 and channel 'ch' must be A or B. Duty cycle must be bounded
 * between 0.0f (off) and 1.0f(full on). Returns 0 on success or -1 on failure.
 *******************************************************************************/
 int rc_pwm_set_duty(int ss, char ch, float duty){
 	// start with sanity checks
-	if(unlikely(duty>1.0f || duty<0.0f)){
-		fprintf(stderr,"ERROR in rc_pwm_set_duty: duty must be between 0.0 & 1.0\n");
+	if(unlikely(ss<0 || ss>2)){
+		fprintf(stderr,"ERROR in rc_pwm_set_duty, PWM subsystem must be between 0 and 2\n");
 		return -1;
 	}
-	
-	// set the duty
-	int duty_ns = duty*period_ns[ss];
-	return rc_pwm_set_duty_ns(ss, ch, duty_ns);
+	// initialize subsystem if not already
+	if(simple_pwm_initialized[ss]==0){
+		printf("initializing PWMSS%d with default PWM frequency %dhz\n", ss, DEFAULT_PWM_FREQ);
+		if(rc_pwm_init(ss, DEFAULT_PWM_FREQ)<0) return -1;
+	}
+	return rc_pwm_set_duty_mmap(ss, ch, duty);
 }
 
 /*******************************************************************************
@@ -204,8 +228,6 @@ int rc_pwm_set_duty(int ss, char ch, float duty){
 * success or -1 on failure.
 *******************************************************************************/
 int rc_pwm_set_duty_ns(int ss, char ch, int duty_ns){
-	int len;
-	char buf[MAXBUF];
 	// start with sanity checks
 	if(unlikely(ss<0 || ss>2)){
 		fprintf(stderr,"ERROR in rc_pwm_set_duty_ns, PWM subsystem must be between 0 and 2\n");
@@ -214,29 +236,30 @@ int rc_pwm_set_duty_ns(int ss, char ch, int duty_ns){
 	// initialize subsystem if not already
 	if(simple_pwm_initialized[ss]==0){
 		printf("initializing PWMSS%d with default PWM frequency %dhz\n", ss, DEFAULT_PWM_FREQ);
-		rc_pwm_init(ss, DEFAULT_PWM_FREQ);
+		if(rc_pwm_init(ss, DEFAULT_PWM_FREQ)<0) return -1;
 	}
 	// boundary check
 	if(unlikely(duty_ns>period_ns[ss] || duty_ns<0)){
 		fprintf(stderr,"ERROR in rc_pwm_set_duty_ns, duty must be between 0 & %d for current frequency\n", period_ns[ss]);
 		return -1;
 	}
-	
-	// set the duty
-	len = snprintf(buf, sizeof(buf), "%d", duty_ns);
-	switch(ch){
-	case 'A':
-		write(duty_fd[(2*ss)], buf, len);
-		break;
-	case 'B':
-		write(duty_fd[(2*ss)+1], buf, len);
-		break;
-	default:
-		printf("pwm channel must be 'A' or 'B'\n");
+	return rc_pwm_set_duty_mmap(ss, ch, (float)duty_ns/period_ns[ss]);
+}
+
+/*******************************************************************************
+* int rc_pwm_set_polarity(int ss, char ch, int inverted)
+*
+* Sets a channel to normal (high for the duty) or inverted (low for the duty)
+* polarity. Takes effect immediately without stopping the output.
+*******************************************************************************/
+int rc_pwm_set_polarity(int ss, char ch, int inverted){
+	if(unlikely(ss<0 || ss>2)){
+		fprintf(stderr,"ERROR in rc_pwm_set_polarity, PWM subsystem must be between 0 and 2\n");
 		return -1;
 	}
-	
-	return 0;
-	
+	if(simple_pwm_initialized[ss]==0){
+		fprintf(stderr,"ERROR in rc_pwm_set_polarity, call rc_pwm_init first\n");
+		return -1;
+	}
+	return set_pwm_polarity_mmap(ss, ch, inverted);
 }
-
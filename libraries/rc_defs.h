@@ -80,7 +80,6 @@
 #define DC_JACK_ADC_CH  5
 #define V_DIV_RATIO 11.0
 
-#define POLL_TIMEOUT 100 /* 0.1 seconds */
 #define INTERRUPT_PIN 117  //gpio3.21 P9.25
 
 //#define UART4_PATH "/dev/ttyO4"
@@ -88,7 +87,13 @@
 // PRU Servo & encoder Control parameters
 #define SERVO_PRU_NUM 	 1
 #define ENCODER_PRU_NUM 	 0
-#define PRU_SERVO_LOOP_INSTRUCTIONS	48	// instructions per PRU servo timer loop 
+#define PRU_SERVO_LOOP_INSTRUCTIONS	48	// instructions per PRU servo timer loop
+
+// encoder velocity is reported as 0 after this long without an edge
+#define ENCODER_STOPPED_NS	1000000000
+
+// PRU DShot parameters
+#define DSHOT_CMD_REPEATS		10		// times a command frame is repeated
 
 
 #endif //ROBOTICS_CAPE_DEFS
@@ -0,0 +1,8 @@
+/*******************************************************************************
+* rc_lazy_init.h
+*
+* internal, lets subsystems not requested in rc_initialize_ex bring themselves
+* up on first use. Takes RC_INIT_ flags from roboticscape.h.
+*******************************************************************************/
+
+int lazy_initialize(unsigned int subsystems);
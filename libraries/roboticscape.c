@@ -8,23 +8,72 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h> // for system()
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "roboticscape.h"
+#include "rc_lazy_init.h"
 #include "rc_defs.h"
 #include "gpio/rc_gpio_setup.h"
 #include "mmap/rc_mmap_gpio_adc.h"	// used for fast gpio functions
 #include "mmap/rc_mmap_pwmss.h"		// used for fast pwm functions
 #include "other/rc_pru.h"
+#include "other/rc_trace.h"
+#include "other/rc_hub.h"
 #include "gpio/rc_buttons.h"
+#include "gpio/rc_gpio_events.h"
 #include "pwm/rc_motors.h"
 
 #define CAPE_NAME	"RoboticsCape"
 #define MAX_BUF		512
+#define UENV_FILE	"/boot/uEnv.txt"
 
 /*******************************************************************************
 * Global Variables
 *******************************************************************************/
 // global roboticscape state
 enum rc_state_t rc_state = UNINITIALIZED;
+// RC_INIT_ flags of subsystems brought up, started, finished, and failed
+static volatile unsigned int subsystems_initialized = 0;
+static unsigned int subsystems_attempted = 0;
+static unsigned int subsystems_done = 0;
+static unsigned int subsystems_failed = 0;
+// steps rc_initialize_ex has started threads for which haven't begun yet
+static unsigned int subsystems_pending = 0;
+static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t init_cond = PTHREAD_COND_INITIALIZER;
+// staged by rc_set_init_imu_dmp for the RC_INIT_IMU_DMP step
+static rc_imu_data_t* init_imu_data = NULL;
+static rc_imu_config_t init_imu_config;
+
+/*******************************************************************************
+* Initialization steps
+*
+* requires are brought up first whenever the step is. after are only waited
+* for if they are being brought up at the same time, the motors and encoders
+* both read-modify-write the PWMSS clock config so must not overlap.
+*******************************************************************************/
+#define INIT_STEPS 8
+
+typedef struct init_step_t{
+	const char* name;
+	unsigned int requires;
+	unsigned int after;
+} init_step_t;
+
+static const init_step_t init_steps[INIT_STEPS] = {
+	{"gpio",		0,				0},					// RC_INIT_GPIO
+	{"adc",			0,				0},					// RC_INIT_ADC
+	{"encoders",	0,				0},					// RC_INIT_ENCODERS
+	{"motors",		RC_INIT_GPIO,	RC_INIT_ENCODERS},	// RC_INIT_MOTORS
+	{"buttons",		RC_INIT_GPIO,	0},					// RC_INIT_BUTTONS
+	{"pru",			0,				0},					// RC_INIT_PRU
+	{"cycles",		0,				0},					// RC_INIT_CYCLES
+	{"imu_dmp",		0,				0}					// RC_INIT_IMU_DMP
+};
+static uint64_t init_start_ns = 0;
+static uint64_t step_start_ns[INIT_STEPS];
+static uint64_t step_end_ns[INIT_STEPS];
 
 
 
@@ -35,12 +84,319 @@ int is_cape_loaded();
 void shutdown_signal_handler(int signo);
 
 
+/*******************************************************************************
+* static int uenv_uses_roboticscape()
+*
+* looks for the roboticscape overlay in uEnv.txt for older device trees, this
+* used to be done by forking grep
+*******************************************************************************/
+static int uenv_uses_roboticscape(){
+	FILE* fd;
+	char line[MAX_BUF];
+	int found = 0;
+
+	fd = fopen(UENV_FILE, "r");
+	if(fd==NULL) return 0;
+	while(!found && fgets(line, sizeof(line), fd)!=NULL){
+		if(strstr(line, "roboticscape")!=NULL) found = 1;
+	}
+	fclose(fd);
+	return found;
+}
+
+/*******************************************************************************
+* static int run_step(unsigned int bit)
+*
+* brings up one subsystem, called without init_mutex held so independent
+* steps can run at the same time
+*******************************************************************************/
+static int run_step(unsigned int bit){
+	int ret = 0;
+
+	switch(bit){
+	case RC_INIT_GPIO:
+		#ifdef DEBUG
+		printf("Initializing: PINMUX\n");
+		#endif
+		rc_set_default_pinmux();
+		#ifdef DEBUG
+		printf("Initializing: GPIO\n");
+		#endif
+		if(configure_gpio_pins()<0){
+			printf("ERROR: failed to configure GPIO\n");
+			ret = -1;
+			break;
+		}
+		#ifdef DEBUG
+		printf("Initializing: MMAP GPIO\n");
+		#endif
+		if(initialize_mmap_gpio()){
+			printf("mmap_gpio_adc.c failed to initialize gpio\n");
+			ret = -1;
+		}
+		break;
+
+	case RC_INIT_ADC:
+		#ifdef DEBUG
+		printf("Initializing: ADC\n");
+		#endif
+		if(initialize_mmap_adc()){
+			fprintf(stderr,"mmap_gpio_adc.c failed to initialize adc\n");
+			ret = -1;
+		}
+		break;
+
+	case RC_INIT_ENCODERS:
+		#ifdef DEBUG
+		printf("Initializing: eQEP\n");
+		#endif
+		// this also zero's out the encoder counters
+		if(init_eqep(0)){
+			fprintf(stderr,"WARNING: failed to initialize eQEP0\n");
+			ret = -1;
+		}
+		if(init_eqep(1)){
+			fprintf(stderr,"WARNING: failed to initialize eQEP1\n");
+			ret = -1;
+		}
+		if(init_eqep(2)){
+			fprintf(stderr,"WARNING: failed to initialize eQEP2\n");
+			ret = -1;
+		}
+		break;
+
+	case RC_INIT_MOTORS:
+		#ifdef DEBUG
+		printf("Initializing: Motors\n");
+		#endif
+		if(initialize_motors()){
+			fprintf(stderr,"WARNING: Failed to initialize motors\n");
+			ret = -1;
+		}
+		break;
+
+	case RC_INIT_BUTTONS:
+		#ifdef DEBUG
+		printf("Initializing: Buttons\n");
+		#endif
+		if(initialize_button_handlers()<0){
+			fprintf(stderr,"ERROR: failed to start button handlers\n");
+			ret = -1;
+		}
+		break;
+
+	case RC_INIT_PRU:
+		#ifdef DEBUG
+		printf("Initializing: PRU\n");
+		#endif
+		if(initialize_pru()) ret = -1;
+		break;
+
+	case RC_INIT_CYCLES:
+		#ifdef DEBUG
+		printf("Initializing: cycle counter\n");
+		#endif
+		rc_cycles_init();
+		break;
+
+	case RC_INIT_IMU_DMP:
+		#ifdef DEBUG
+		printf("Initializing: IMU DMP\n");
+		#endif
+		if(init_imu_data==NULL){
+			fprintf(stderr,"ERROR: call rc_set_init_imu_dmp before using RC_INIT_IMU_DMP\n");
+			ret = -1;
+		}
+		else if(rc_initialize_imu_dmp(init_imu_data, init_imu_config)){
+			fprintf(stderr,"ERROR: failed to initialize IMU DMP\n");
+			ret = -1;
+		}
+		break;
+
+	default:
+		break;
+	}
+	return ret;
+}
+
+/*******************************************************************************
+* static int init_locked(unsigned int bit)
+*
+* Brings up one subsystem and any it requires, init_mutex must be held. Each
+* is only attempted once, later calls wait for that attempt if it's still
+* running and return its result.
+*******************************************************************************/
+static int init_locked(unsigned int bit){
+	int i = __builtin_ctz(bit);
+	unsigned int req, r;
+	int ret = 0;
+
+	for(req=init_steps[i].requires; req; req&=req-1){
+		r = req & -req;
+		if(init_locked(r)){
+			subsystems_attempted |= bit;
+			subsystems_done |= bit;
+			subsystems_failed |= bit;
+			subsystems_pending &= ~bit;
+			pthread_cond_broadcast(&init_cond);
+			return -1;
+		}
+	}
+	// another thread is already bringing it up, or something it must follow
+	// is underway or about to be
+	while(((subsystems_attempted & bit) && !(subsystems_done & bit)) || \
+			((subsystems_attempted|subsystems_pending) & \
+			init_steps[i].after & ~subsystems_done)){
+		pthread_cond_wait(&init_cond, &init_mutex);
+	}
+	if(subsystems_done & bit) return (subsystems_failed & bit) ? -1 : 0;
+	subsystems_attempted |= bit;
+	subsystems_pending &= ~bit;
+	pthread_mutex_unlock(&init_mutex);
+
+	step_start_ns[i] = rc_nanos_since_boot();
+	ret = run_step(bit);
+	step_end_ns[i] = rc_nanos_since_boot();
+
+	pthread_mutex_lock(&init_mutex);
+	subsystems_done |= bit;
+	if(ret) subsystems_failed |= bit;
+	else subsystems_initialized |= bit;
+	pthread_cond_broadcast(&init_cond);
+	return ret;
+}
+
+/*******************************************************************************
+* int lazy_initialize(unsigned int subsystems)
+*
+* brings up the given subsystems if they haven't been yet, returns -1 if any
+* of them failed
+*******************************************************************************/
+int lazy_initialize(unsigned int subsystems){
+	int i;
+	int ret = 0;
+
+	if((subsystems_initialized & subsystems)==subsystems) return 0;
+	pthread_mutex_lock(&init_mutex);
+	for(i=0; i<INIT_STEPS; i++){
+		if(subsystems & (1u<<i)) ret |= init_locked(1u<<i);
+	}
+	pthread_mutex_unlock(&init_mutex);
+	return ret;
+}
+
+/*******************************************************************************
+* static void* init_step_thread(void* ptr)
+*******************************************************************************/
+static void* init_step_thread(void* ptr){
+	lazy_initialize((unsigned int)(uintptr_t)ptr);
+	return NULL;
+}
+
+/*******************************************************************************
+* static void init_parallel(unsigned int subsystems)
+*
+* Starts a thread for each step so that independent steps overlap, each one
+* waits in init_locked for whatever it depends on. Falls back to running a
+* step in this thread if its thread can't be started.
+*******************************************************************************/
+static void init_parallel(unsigned int subsystems){
+	pthread_t threads[INIT_STEPS];
+	int started[INIT_STEPS];
+	int i;
+
+	pthread_mutex_lock(&init_mutex);
+	subsystems_pending |= subsystems & ~subsystems_attempted;
+	pthread_mutex_unlock(&init_mutex);
+
+	for(i=0; i<INIT_STEPS; i++){
+		started[i] = 0;
+		if(!(subsystems & (1u<<i))) continue;
+		if(pthread_create(&threads[i], NULL, init_step_thread, \
+									(void*)(uintptr_t)(1u<<i))==0){
+			started[i] = 1;
+		}
+	}
+	for(i=0; i<INIT_STEPS; i++){
+		if(started[i]) pthread_join(threads[i], NULL);
+		else if(subsystems & (1u<<i)) lazy_initialize(1u<<i);
+	}
+}
+
+/*******************************************************************************
+* unsigned int rc_get_initialized_subsystems()
+*******************************************************************************/
+unsigned int rc_get_initialized_subsystems(){
+	return subsystems_initialized;
+}
+
+/*******************************************************************************
+* int rc_set_init_imu_dmp(rc_imu_data_t* data, rc_imu_config_t conf)
+*
+* stages the arguments for the RC_INIT_IMU_DMP step
+*******************************************************************************/
+int rc_set_init_imu_dmp(rc_imu_data_t* data, rc_imu_config_t conf){
+	if(data==NULL){
+		fprintf(stderr,"ERROR: in rc_set_init_imu_dmp, received NULL pointer\n");
+		return -1;
+	}
+	init_imu_data = data;
+	init_imu_config = conf;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_get_init_time(unsigned int step, uint64_t* start_ns,
+*												uint64_t* duration_ns)
+*******************************************************************************/
+int rc_get_init_time(unsigned int step, uint64_t* start_ns,\
+												uint64_t* duration_ns){
+	int i;
+	if(step==0 || (step&(step-1)) || step>=(1u<<INIT_STEPS)){
+		fprintf(stderr,"ERROR: rc_get_init_time takes a single RC_INIT_ flag\n");
+		return -1;
+	}
+	i = __builtin_ctz(step);
+	if(!(subsystems_done & step)) return -1;
+	if(start_ns!=NULL){
+		*start_ns = step_start_ns[i]>init_start_ns ? \
+								step_start_ns[i]-init_start_ns : 0;
+	}
+	if(duration_ns!=NULL) *duration_ns = step_end_ns[i]-step_start_ns[i];
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_print_init_times()
+*******************************************************************************/
+int rc_print_init_times(){
+	int i;
+	uint64_t start, dur;
+	printf("step      start_ms  took_ms\n");
+	for(i=0; i<INIT_STEPS; i++){
+		if(rc_get_init_time(1u<<i, &start, &dur)) continue;
+		printf("%-8s %9.2f %8.2f%s\n", init_steps[i].name, start/1000000.0,\
+			dur/1000000.0, (subsystems_failed&(1u<<i)) ? "  FAILED" : "");
+	}
+	return 0;
+}
+
 /*******************************************************************************
 * int rc_initialize()
 * sets up necessary hardware and software
 * should be the first thing your program calls
 *******************************************************************************/
 int rc_initialize(){
+	return rc_initialize_ex(RC_INIT_ALL);
+}
+
+/*******************************************************************************
+* int rc_initialize_ex(unsigned int subsystems)
+*
+* like rc_initialize() but only brings up the requested subsystems, the rest
+* are brought up on first use
+*******************************************************************************/
+int rc_initialize_ex(unsigned int subsystems){
 	FILE *fd; 
 	rc_bb_model_t model;
 
@@ -61,7 +417,7 @@ int rc_initialize(){
 	model = rc_get_bb_model();
 	if(model!=BB_BLACK_RC && model!=BB_BLACK_W_RC && model!=BB_BLUE){
 		// also check uEnv.txt in case using older device tree
-		if(system("grep -q roboticscape /boot/uEnv.txt")!=0){
+		if(!uenv_uses_roboticscape()){
 			fprintf(stderr,"WARNING: RoboticsCape library should only be run on BB Blue, Black, and Black wireless when the roboticscape device tree is in use.\n");
 			fprintf(stderr,"If you are on a BB Black or Black Wireless, please execute \"configure_robotics_dt.sh\" and reboot to enable the device tree\n");
 		}
@@ -76,78 +432,19 @@ int rc_initialize(){
 	#endif
 	rc_enable_signal_handler();
 
-
-	// initialize pinmux
+	// bring up the requested subsystems, independent ones at the same time
+	init_start_ns = rc_nanos_since_boot();
+	init_parallel(subsystems);
 	#ifdef DEBUG
-	printf("Initializing: PINMUX\n");
+	rc_print_init_times();
 	#endif
-	rc_set_default_pinmux();
 
-	// initialize gpio pins
-	#ifdef DEBUG
-	printf("Initializing: GPIO\n");
-	#endif
-	if(configure_gpio_pins()<0){
-		printf("ERROR: failed to configure GPIO\n");
+	// gpio, adc, buttons, and the imu are required, the others only warn
+	if(subsystems_failed & subsystems & (RC_INIT_GPIO|RC_INIT_ADC|\
+									RC_INIT_BUTTONS|RC_INIT_IMU_DMP)){
 		return -1;
 	}
 
-	// now use mmap for fast gpio
-	#ifdef DEBUG
-	printf("Initializing: MMAP GPIO\n");
-	#endif
-	if(initialize_mmap_gpio()){
-		printf("mmap_gpio_adc.c failed to initialize gpio\n");
-		return -1;
-	}
-
-	// now adc
-	#ifdef DEBUG
-	printf("Initializing: ADC\n");
-	#endif
-	if(initialize_mmap_adc()){
-		fprintf(stderr,"mmap_gpio_adc.c failed to initialize adc\n");
-		return -1;
-	}
-
-	// eQep encoder counters
-	#ifdef DEBUG
-	printf("Initializing: eQEP\n");
-	#endif
-	// this also zero's out the encoder counters
-	if(init_eqep(0)){
-		fprintf(stderr,"WARNING: failed to initialize eQEP0\n");
-	}
-	if(init_eqep(1)){
-		fprintf(stderr,"WARNING: failed to initialize eQEP1\n");
-	}
-	if(init_eqep(2)){
-		fprintf(stderr,"WARNING: failed to initialize eQEP2\n");
-	}
-
-	// motors
-	#ifdef DEBUG
-	printf("Initializing: Motors\n");
-	#endif
-	if(initialize_motors()){
-		fprintf(stderr,"WARNING: Failed to initialize motors\n");
-	}
-
-	//set up function pointers for button press events
-	#ifdef DEBUG
-	printf("Initializing: Buttons\n");
-	#endif
-	if(initialize_button_handlers()<0){
-		fprintf(stderr,"ERROR: failed to start button threads\n");
-		return -1;
-	}
-
-	// start PRU
-	#ifdef DEBUG
-	printf("Initializing: PRU\n");
-	#endif
-	initialize_pru();
-
 	// create new pid file with process id
 	#ifdef DEBUG
 		printf("opening PID_FILE\n");
@@ -168,7 +465,7 @@ int rc_initialize(){
  	#endif
 
 	// wait to let threads start up
-	rc_usleep(10000);
+	if(subsystems&RC_INIT_BUTTONS) rc_usleep(10000);
 
 	return 0;
 }
@@ -186,9 +483,15 @@ int rc_cleanup(){
 	printf("\nExiting Cleanly\n");
 	
 	#ifdef DEBUG
-	printf("waiting for button handlers to join\n");
+	printf("stopping gpio event thread\n");
 	#endif
-	wait_for_button_handlers_to_join();
+	stop_button_handlers();
+	stop_gpio_event_thread();
+
+	#ifdef DEBUG
+	printf("stopping continuous adc\n");
+	#endif
+	mmap_adc_stop_continuous();
 
 	#ifdef DEBUG
 	printf("turning off GPIOs & PWM\n");
@@ -199,7 +502,7 @@ int rc_cleanup(){
 	#ifdef DEBUG
 	printf("Turning off motors\n");
 	#endif
-	rc_disable_motors();
+	if(subsystems_initialized & RC_INIT_MOTORS) rc_disable_motors();
 
 	#ifdef DEBUG
 	printf("Turning off SPI slaves\n");
@@ -211,11 +514,46 @@ int rc_cleanup(){
 	printf("Turning off servo power rail\n");
 	#endif
 	rc_disable_servo_power_rail();
-	
+
+	#ifdef DEBUG
+	printf("Stopping DShot\n");
+	#endif
+	rc_stop_dshot();
+
+	#ifdef DEBUG
+	printf("Stopping sensor hub server\n");
+	#endif
+	rc_hub_stop_server();
+
+	#ifdef DEBUG
+	printf("Stopping odometry\n");
+	#endif
+	rc_stop_odometry();
+
+	#ifdef DEBUG
+	printf("Stopping scheduler\n");
+	#endif
+	rc_sched_stop();
+
+	#ifdef DEBUG
+	printf("Stopping barometer sampler\n");
+	#endif
+	rc_bmp_stop_sampler();
+
+	#ifdef DEBUG
+	printf("Stopping vertical estimator\n");
+	#endif
+	rc_stop_vertical_estimator();
+
 	#ifdef DEBUG
 	printf("Stopping dsm service\n");
 	#endif
 	rc_stop_dsm_service();	
+
+	#ifdef DEBUG
+	printf("Writing trace\n");
+	#endif
+	write_trace_on_exit();
 	
 	#ifdef DEBUG
 	printf("Deleting PID file\n");
@@ -359,6 +697,11 @@ int rc_get_encoder_pos(int ch){
 		fprintf(stderr,"Encoder Channel must be from 1 to 4\n");
 		return -1;
 	}
+	if(hub_client){
+		rc_encoder_snapshot_t snap;
+		if(rc_hub_latest(RC_HUB_ENCODERS, &snap)) return -1;
+		return snap.pos[ch-1];
+	}
 	// 4th channel is counted by the PRU not eQEP
 	if(ch==4) return get_pru_encoder_pos();
 	// first 3 channels counted by eQEP
@@ -381,14 +724,116 @@ int rc_set_encoder_pos(int ch, int val){
 	return write_eqep(ch-1, val);
 }
 
+/*******************************************************************************
+* int rc_get_encoder_state(int ch, rc_encoder_state_t* state)
+* 
+* position, edge-timed velocity, and time of last edge
+*******************************************************************************/
+int rc_get_encoder_state(int ch, rc_encoder_state_t* state){
+	if(ch<1 || ch>4){
+		fprintf(stderr,"Encoder Channel must be from 1 to 4\n");
+		return -1;
+	}
+	if(state==NULL){
+		fprintf(stderr,"ERROR: in rc_get_encoder_state, received NULL pointer\n");
+		return -1;
+	}
+	// 4th channel is timestamped by the PRU
+	if(ch==4) return get_pru_encoder_state(state);
+	// first 3 channels measured by eQEP capture unit
+	if(read_eqep_velocity(ch-1, &state->velocity, &state->last_edge_ns)){
+		return -1;
+	}
+	state->pos = read_eqep(ch-1);
+	return 0;
+}
+
+/*******************************************************************************
+* float rc_get_encoder_velocity(int ch)
+* 
+* returns velocity in counts per second, 0 on error
+*******************************************************************************/
+float rc_get_encoder_velocity(int ch){
+	rc_encoder_state_t state;
+	if(rc_get_encoder_state(ch, &state)) return 0.0f;
+	return state.velocity;
+}
+
+/*******************************************************************************
+* int rc_set_encoder_velocity_config(int ch, int unit_period_us,
+*								int capture_prescaler, int event_prescaler)
+* 
+* configures eQEP unit timer and capture unit for channels 1-3
+*******************************************************************************/
+int rc_set_encoder_velocity_config(int ch, int unit_period_us,			\
+								int capture_prescaler, int event_prescaler){
+	eqep_config_t config;
+	if(ch<1 || ch>3){
+		fprintf(stderr,"ERROR: velocity config only applies to channels 1-3\n");
+		return -1;
+	}
+	config.unit_period_us = unit_period_us;
+	config.capture_prescaler = capture_prescaler;
+	config.event_prescaler = event_prescaler;
+	return init_eqep_config(ch-1, &config);
+}
+
+/*******************************************************************************
+* int rc_get_encoder_snapshot(rc_encoder_snapshot_t* snap)
+* 
+* all 4 encoder counts read back to back with one timestamp
+*******************************************************************************/
+int rc_get_encoder_snapshot(rc_encoder_snapshot_t* snap){
+	uint64_t t1, t2;
+	if(snap==NULL){
+		fprintf(stderr,"ERROR: in rc_get_encoder_snapshot, received NULL pointer\n");
+		return -1;
+	}
+	if(hub_client) return rc_hub_latest(RC_HUB_ENCODERS, snap);
+	t1 = rc_nanos_since_boot();
+	if(read_eqep_all(snap->pos)) return -1;
+	snap->pos[3] = get_pru_encoder_pos();
+	t2 = rc_nanos_since_boot();
+	snap->timestamp_ns = t1 + ((t2-t1)/2);
+	snap->spread_ns = t2-t1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_get_encoder_snapshot_latched(rc_encoder_snapshot_t* snap)
+* 
+* channels 1-3 latched together by the eQEP unit timers, channel 4 read now
+*******************************************************************************/
+int rc_get_encoder_snapshot_latched(rc_encoder_snapshot_t* snap){
+	if(snap==NULL){
+		fprintf(stderr,"ERROR: in rc_get_encoder_snapshot_latched, received NULL pointer\n");
+		return -1;
+	}
+	if(read_eqep_latched_all(snap->pos, &snap->timestamp_ns)) return -1;
+	snap->pos[3] = get_pru_encoder_pos();
+	snap->spread_ns = rc_nanos_since_boot() - snap->timestamp_ns;
+	return 0;
+}
+
 /*******************************************************************************
 * float rc_battery_voltage()
 * 
 * returns the LiPo battery voltage on the robotics cape
 * this accounts for the voltage divider ont he cape
+* in continuous mode this is the output of the channel's pipeline
 *******************************************************************************/
 float rc_battery_voltage(){
-	float v = (rc_adc_volt(LIPO_ADC_CH)*V_DIV_RATIO)+LIPO_OFFSET; 
+	float v;
+	if(hub_client){
+		rc_hub_adc_t adc;
+		if(rc_hub_latest(RC_HUB_ADC, &adc)) return -1;
+		return adc.battery_v;
+	}
+	if(mmap_adc_get_value(LIPO_ADC_CH, &v, NULL)<0){
+		v = rc_adc_volt(LIPO_ADC_CH);
+		if(v<0) return -1;
+		v = (v*V_DIV_RATIO)+LIPO_OFFSET;
+	}
 	if(v<0.3) v = 0.0;
 	return v;
 }
@@ -398,9 +843,20 @@ float rc_battery_voltage(){
 * 
 * returns the DC power jack voltage on the robotics cape
 * this accounts for the voltage divider ont he cape
+* in continuous mode this is the output of the channel's pipeline
 *******************************************************************************/
 float rc_dc_jack_voltage(){
-	float v = (rc_adc_volt(DC_JACK_ADC_CH)*V_DIV_RATIO)+DC_JACK_OFFSET; 
+	float v;
+	if(hub_client){
+		rc_hub_adc_t adc;
+		if(rc_hub_latest(RC_HUB_ADC, &adc)) return -1;
+		return adc.jack_v;
+	}
+	if(mmap_adc_get_value(DC_JACK_ADC_CH, &v, NULL)<0){
+		v = rc_adc_volt(DC_JACK_ADC_CH);
+		if(v<0) return -1;
+		v = (v*V_DIV_RATIO)+DC_JACK_OFFSET;
+	}
 	if(v<0.3) v = 0.0;
 	return v;
 }
@@ -411,10 +867,17 @@ float rc_dc_jack_voltage(){
 * returns the raw adc reading
 *******************************************************************************/
 int rc_adc_raw(int ch){
+	float v;
 	if(ch<0 || ch>6){
 		fprintf(stderr,"ERROR: analog pin must be in 0-6\n");
 		return -1;
 	}
+	// the hub only has voltages, convert back
+	if(hub_client){
+		v = rc_adc_volt(ch);
+		if(v<0) return -1;
+		return v*4095.0/1.8 + 0.5;
+	}
 	return mmap_adc_read_raw((uint8_t)ch);
 }
 
@@ -428,10 +891,137 @@ float rc_adc_volt(int ch){
 		fprintf(stderr,"ERROR: analog pin must be in 0-6\n");
 		return -1;
 	}
+	if(hub_client){
+		rc_hub_adc_t adc;
+		if(rc_hub_latest(RC_HUB_ADC, &adc)) return -1;
+		return adc.volt[ch];
+	}
 	int raw_adc = mmap_adc_read_raw((uint8_t)ch);
+	if(raw_adc<0) return -1;
 	return raw_adc * 1.8 / 4095.0;
 }
 
+/*******************************************************************************
+* int rc_adc_start_continuous(uint8_t ch_mask, int rate_hz, int priority)
+*
+* samples channels in ch_mask continuously in hardware, see roboticscape.h
+*******************************************************************************/
+int rc_adc_start_continuous(uint8_t ch_mask, int rate_hz, int priority){
+	if(ch_mask==0 || ch_mask&0x80){
+		fprintf(stderr,"ERROR: rc_adc_start_continuous channels must be in 0-6\n");
+		return -1;
+	}
+	if(rate_hz<1){
+		fprintf(stderr,"ERROR: rc_adc_start_continuous rate must be >=1hz\n");
+		return -1;
+	}
+	return mmap_adc_start_continuous(ch_mask, rate_hz, priority);
+}
+
+/*******************************************************************************
+* int rc_adc_stop_continuous()
+*
+* returns the ADC to one-shot reads
+*******************************************************************************/
+int rc_adc_stop_continuous(){
+	return mmap_adc_stop_continuous();
+}
+
+/*******************************************************************************
+* int rc_adc_latest(int ch, int* raw, uint64_t* timestamp_ns)
+*
+* newest continuous sample of a channel, never blocks
+*******************************************************************************/
+int rc_adc_latest(int ch, int* raw, uint64_t* timestamp_ns){
+	if(ch<0 || ch>6){
+		fprintf(stderr,"ERROR: analog pin must be in 0-6\n");
+		return -1;
+	}
+	if(raw==NULL){
+		fprintf(stderr,"ERROR: in rc_adc_latest, received NULL pointer\n");
+		return -1;
+	}
+	return mmap_adc_latest(ch, raw, timestamp_ns);
+}
+
+/*******************************************************************************
+* int rc_adc_read_buffer(int ch, int* raw, uint64_t* timestamp_ns, int n)
+*
+* copies up to n of the newest continuous samples, oldest first
+*******************************************************************************/
+int rc_adc_read_buffer(int ch, int* raw, uint64_t* timestamp_ns, int n){
+	if(ch<0 || ch>6){
+		fprintf(stderr,"ERROR: analog pin must be in 0-6\n");
+		return -1;
+	}
+	if(raw==NULL || n<0){
+		fprintf(stderr,"ERROR: in rc_adc_read_buffer, invalid argument\n");
+		return -1;
+	}
+	return mmap_adc_read_buffer(ch, raw, timestamp_ns, n);
+}
+
+/*******************************************************************************
+* int rc_adc_get_overruns()
+*******************************************************************************/
+int rc_adc_get_overruns(){
+	return mmap_adc_get_overruns();
+}
+
+/*******************************************************************************
+* rc_adc_channel_config_t rc_adc_default_channel_config(int ch)
+*******************************************************************************/
+rc_adc_channel_config_t rc_adc_default_channel_config(int ch){
+	return mmap_adc_default_config(ch);
+}
+
+/*******************************************************************************
+* int rc_adc_set_channel_config(int ch, rc_adc_channel_config_t conf)
+*
+* sets the hardware averaging, filter, decimation, and scaling of a channel
+*******************************************************************************/
+int rc_adc_set_channel_config(int ch, rc_adc_channel_config_t conf){
+	if(ch<0 || ch>6){
+		fprintf(stderr,"ERROR: analog pin must be in 0-6\n");
+		return -1;
+	}
+	return mmap_adc_set_config(ch, conf);
+}
+
+/*******************************************************************************
+* int rc_adc_get_value(int ch, float* value, uint64_t* timestamp_ns)
+*
+* newest pipeline output of a channel, never blocks
+*******************************************************************************/
+int rc_adc_get_value(int ch, float* value, uint64_t* timestamp_ns){
+	if(ch<0 || ch>6){
+		fprintf(stderr,"ERROR: analog pin must be in 0-6\n");
+		return -1;
+	}
+	if(value==NULL){
+		fprintf(stderr,"ERROR: in rc_adc_get_value, received NULL pointer\n");
+		return -1;
+	}
+	return mmap_adc_get_value(ch, value, timestamp_ns);
+}
+
+/*******************************************************************************
+* int rc_adc_read_values(int ch, float* value, uint64_t* timestamp_ns, int n)
+*
+* copies up to n of the newest pipeline outputs, oldest first
+*******************************************************************************/
+int rc_adc_read_values(int ch, float* value, uint64_t* timestamp_ns, int n){
+	if(ch<0 || ch>6){
+		fprintf(stderr,"ERROR: analog pin must be in 0-6\n");
+		return -1;
+	}
+	if(value==NULL || n<0){
+		fprintf(stderr,"ERROR: in rc_adc_read_values, invalid argument\n");
+		return -1;
+	}
+	return mmap_adc_read_values(ch, value, timestamp_ns, n);
+}
+
 /*******************************************************************************
 * int rc_enable_servo_power_rail()
 * 
@@ -64,6 +64,43 @@ typedef struct timeval timeval;
 * Robotics Cape device tree is not loaded then this function will return -1 and
 * print an error message to indicate what is wrong. Otherwise it will return 0
 * to indicate success.
+*
+* @ int rc_initialize_ex(unsigned int subsystems)
+*
+* rc_initialize() brings up every subsystem which takes a while and leaves
+* threads running that a small tool or service may never use.
+* rc_initialize_ex does the PID file, signal handler, and device tree check
+* like rc_initialize() but only brings up the subsystems OR'd together in
+* subsystems, rc_initialize() is rc_initialize_ex(RC_INIT_ALL). Subsystems
+* that weren't requested are brought up on first use instead: the motors by
+* the motor functions, the buttons by setting a button function, the PRU by
+* the servo, ESC, and 4th encoder functions, the ADC by reading it, and the
+* eQEP encoders by reading them. RC_INIT_GPIO sets the pinmux and exports the
+* cape's GPIO pins which the motors and buttons also need so it's included
+* whenever they are brought up. The IMU needs none of these. RC_INIT_CYCLES
+* calibrates rc_cycles(), which otherwise falls back to the system clock.
+*
+* Requested subsystems that don't depend on each other are brought up at the
+* same time in separate threads, so the slowest step rather than the sum of
+* them sets how long rc_initialize_ex takes. RC_INIT_IMU_DMP isn't part of
+* RC_INIT_ALL, stage its arguments with rc_set_init_imu_dmp() first and the
+* DMP firmware upload will overlap the GPIO and PRU setup instead of following
+* them. If it fails rc_initialize_ex returns -1.
+*
+* @ unsigned int rc_get_initialized_subsystems()
+*
+* Returns the RC_INIT_ flags of the subsystems brought up so far.
+*
+* @ int rc_get_init_time(unsigned int step, uint64_t* start_ns,
+*												uint64_t* duration_ns)
+*
+* Gets when a single RC_INIT_ step started relative to the last
+* rc_initialize_ex call and how long it took, either pointer may be NULL.
+* Returns -1 if the step hasn't been run.
+*
+* @ int rc_print_init_times()
+*
+* Prints the start and duration of each step that's been run.
 * 
 * @ int rc_cleanup() 
 *
@@ -102,7 +139,22 @@ typedef struct timeval timeval;
 * Re-enables the built-in signal handler if it was disabled before. The built-in 
 * signal handler is enabled by default in rc_initialize().
 *******************************************************************************/
+#define RC_INIT_GPIO		(1<<0)	// pinmux and cape gpio pins
+#define RC_INIT_ADC			(1<<1)
+#define RC_INIT_ENCODERS	(1<<2)	// eQEP channels 1-3
+#define RC_INIT_MOTORS		(1<<3)
+#define RC_INIT_BUTTONS		(1<<4)
+#define RC_INIT_PRU			(1<<5)	// servos, ESCs, DShot, encoder 4
+#define RC_INIT_CYCLES		(1<<6)	// rc_cycles() calibration
+#define RC_INIT_ALL			0x7F
+#define RC_INIT_IMU_DMP		(1<<7)	// see rc_set_init_imu_dmp()
+
 int rc_initialize();	// call at the beginning of main()
+int rc_initialize_ex(unsigned int subsystems);
+unsigned int rc_get_initialized_subsystems();
+int rc_get_init_time(unsigned int step, uint64_t* start_ns,\
+												uint64_t* duration_ns);
+int rc_print_init_times();
 int rc_cleanup();		// call at the end of main()
 int rc_kill();	// not usually necessary, use kill_robot example instead
 void rc_disable_signal_handler();
@@ -225,8 +277,9 @@ int rc_blink_led(rc_led_t led, float hz, float period);
 * @ int rc_set_mode_pressed_func(int (*func)(void))
 * @ int rc_set_mode_released_func(int (*func)(void))
 *
-* rc_initialize() sets up interrupt handlers that run in the background to
-* poll changes in button state in a way that uses minimal resources. The 
+* rc_initialize() registers both buttons with the GPIO event thread (see GPIO
+* EVENTS) so button changes are handled in the background with minimal
+* resources. Each button is debounced for 1.5ms. The 
 * user can assign which function should be called when either button is pressed
 * or released. Functions can also be assigned under both conditions.
 * for example, a timer could be started when a button is pressed and stopped
@@ -278,6 +331,13 @@ rc_button_state_t rc_get_mode_button();
 * corresponding to full power reverse to full power forward.
 * rc_set_motor_all() applies the same duty cycle to all 4 motor channels.
 *
+* @ int rc_set_motors(const float duty[4])
+*
+* Sets all 4 motors in one call with duty[0] going to motor 1. The direction
+* pins are written with one set and one clear per GPIO bank and both PWM
+* subsystems are updated through their shadow registers so all 4 motors change
+* together. This is cheaper than 4 calls to rc_set_motor in a fast loop.
+*
 * @ int rc_set_motor_free_spin(int motor)
 * @ int set motor_free_spin_all()
 *
@@ -296,6 +356,7 @@ int rc_enable_motors();
 int rc_disable_motors();
 int rc_set_motor(int motor, float duty);
 int rc_set_motor_all(float duty);
+int rc_set_motors(const float duty[4]);
 int rc_set_motor_free_spin(int motor);
 int rc_set_motor_free_spin_all();
 int rc_set_motor_brake(int motor);
@@ -322,10 +383,78 @@ int rc_set_motor_brake_all();
 * reset to 0 when initialize_cape() is called. However, the user can reset
 * the counter to zero or any other signed 32 bit value with rc_set_encoder_pos().
 *
+* @ int rc_get_encoder_state(int ch, rc_encoder_state_t* state)
+*
+* Differencing positions over a fixed time step gives a very quantized velocity
+* with low resolution encoders at low speed. The PRU also timestamps every edge
+* it counts with a 5ns timer so velocity can instead be taken from the time
+* between edges. rc_get_encoder_state fills in the position, velocity in counts
+* per second, and the rc_nanos_since_boot() time of the last edge. Between
+* edges the velocity decays as one count over the time since the last edge
+* and reads 0 after one second without an edge.
+*
+* Channels 1-3 measure velocity with the eQEP capture unit and unit timer so
+* this also costs no CPU time. At low speed the capture unit times the period
+* of a whole quadrature cycle with 1.28us resolution. At high speed, or when
+* the capture period is invalid due to a stop or direction change, the change
+* in position latched every 10ms by the unit timer is used. The capture values
+* are latched together with the position so velocity lags by up to one unit
+* period. For these channels last_edge_ns is the time of the last completed
+* quadrature cycle.
+*
+* @ float rc_get_encoder_velocity(int ch)
+*
+* Shortcut returning only the velocity in counts per second.
+*
+* @ int rc_set_encoder_velocity_config(int ch, int unit_period_us,
+*									int capture_prescaler, int event_prescaler)
+*
+* Optionally tune the eQEP velocity measurement for channels 1-3. The unit timer
+* latches position every unit_period_us. The capture timer runs at
+* 100mhz/2^capture_prescaler (0-7) and times 2^event_prescaler counts (0-11).
+* The capture timer overflows after 65536 ticks which sets the lowest measurable
+* speed. Defaults are 10000us, 7, and 2.
+*
+* @ int rc_get_encoder_snapshot(rc_encoder_snapshot_t* snap)
+*
+* Reading channels one at a time with rc_get_encoder_pos samples each at a
+* different instant. rc_get_encoder_snapshot reads all 4 counters back to back
+* and stamps them with a single rc_nanos_since_boot() time taken half way
+* through. spread_ns is how long the reads took which bounds the error in the
+* timestamp for any one channel.
+*
+* @ int rc_get_encoder_snapshot_latched(rc_encoder_snapshot_t* snap)
+*
+* Channels 1-3 are instead taken from the positions latched simultaneously in
+* hardware by the eQEP unit timers, every 10ms by default, and timestamp_ns is
+* the time of that latch. Channel 4 has no hardware latch and is read at call
+* time, spread_ns is then the time between the latch and that read. The unit
+* periods of channels 1-3 must match. The first call synchronizes the unit
+* timers and returns -1, as do calls within one unit period after that or
+* after changing the velocity config.
+*
 * See the test_encoders example for sample use case.
 ******************************************************************************/
+typedef struct rc_encoder_snapshot_t{
+	int pos[4];				// positions of channels 1-4
+	uint64_t timestamp_ns;	// rc_nanos_since_boot() time of the sample
+	uint32_t spread_ns;		// uncertainty of the timestamp
+} rc_encoder_snapshot_t;
+
+typedef struct rc_encoder_state_t{
+	int pos;				// position in encoder counts
+	float velocity;			// counts per second
+	uint64_t last_edge_ns;	// rc_nanos_since_boot() time of the last edge
+} rc_encoder_state_t;
+
 int rc_get_encoder_pos(int ch);
 int rc_set_encoder_pos(int ch, int value);
+int rc_get_encoder_state(int ch, rc_encoder_state_t* state);
+float rc_get_encoder_velocity(int ch);
+int rc_set_encoder_velocity_config(int ch, int unit_period_us,			\
+								int capture_prescaler, int event_prescaler);
+int rc_get_encoder_snapshot(rc_encoder_snapshot_t* snap);
+int rc_get_encoder_snapshot_latched(rc_encoder_snapshot_t* snap);
 
 /******************************************************************************
 * ANALOG VOLTAGE SIGNALS
@@ -336,7 +465,7 @@ int rc_set_encoder_pos(int ch, int value);
 * The Robotics cape includes two voltage dividers for safe measurement of the
 * 2-cell lithium battery voltage and the voltage of any power source connected
 * to the 6-16V DC power jack. These can be read with rc_battery_voltage()
-* and rc_dc_jack_voltage()
+* and rc_dc_jack_voltage() which return -1 if the ADC channel can't be read.
 * 
 * @ int rc_adc_raw(int ch)
 * @ float rc_adc_volt(int ch)
@@ -357,12 +486,114 @@ int rc_set_encoder_pos(int ch, int value);
 * 12-bit ADC. rc_adc_volt(int ch) additionally converts this raw value to 
 * a voltage. ch must be from 0 to 6.
 *
+* @ int rc_adc_start_continuous(uint8_t ch_mask, int rate_hz, int priority)
+* @ int rc_adc_stop_continuous()
+*
+* By default each read above starts a conversion and waits for it. In
+* continuous mode the ADC instead samples every channel in ch_mask (bit n for
+* AIN n) rate_hz times a second in hardware and a background thread moves the
+* samples into a buffer for each channel. The thread runs at SCHED_FIFO
+* priority if priority>0. While running, rc_adc_raw and rc_adc_volt return
+* the latest sample without waiting and the battery and DC jack functions
+* return the latest output of their channel's pipeline described below. The
+* highest rate depends on the number of channels and their hardware
+* averaging, about 3.5khz each with all 7 at the default of 8. Channels not
+* in ch_mask, and channels with no sample yet, return -1 until continuous mode
+* is stopped. Calling
+* rc_adc_start_continuous again restarts with the new settings.
+*
+* @ int rc_adc_latest(int ch, int* raw, uint64_t* timestamp_ns)
+*
+* Gets the newest raw sample of a channel and when it was taken in
+* rc_nanos_since_boot() time. timestamp_ns may be NULL. Never blocks. Returns 0
+* on success or -1 if there is no sample yet or continuous mode is stopped.
+*
+* @ int rc_adc_read_buffer(int ch, int* raw, uint64_t* timestamp_ns, int n)
+*
+* Copies up to n of the newest samples, oldest first, for filtering or
+* logging at the full rate. Up to 128 samples are kept. timestamp_ns may be
+* NULL. Returns the number of samples copied or -1 on error or if continuous
+* mode is stopped.
+*
+* @ int rc_adc_get_overruns()
+*
+* Returns how many times the hardware FIFO overflowed and samples were lost
+* since continuous mode started.
+*
+* @ rc_adc_channel_config_t rc_adc_default_channel_config(int ch)
+* @ int rc_adc_set_channel_config(int ch, rc_adc_channel_config_t conf)
+*
+* In continuous mode every sample also goes through a processing pipeline set
+* up for each channel: the hardware averages hw_avg conversions (1,2,4,8 or
+* 16) into one sample, the voltage is run through filter if it's not NULL,
+* one out of every decimation outputs is kept, and that is multiplied by
+* scale and offset added. The filter runs at the full sample rate so its dt
+* should be 1/rate_hz. It belongs to the ADC thread while in use so don't
+* march it elsewhere. The defaults are hw_avg 8, decimation 1, no filter, and
+* a scale of 1 except for the battery and DC jack channels which are scaled
+* to the real voltage before their dividers. Changing a channel while
+* continuous mode is running restarts it.
+*
+* @ int rc_adc_get_value(int ch, float* value, uint64_t* timestamp_ns)
+* @ int rc_adc_read_values(int ch, float* value, uint64_t* timestamp_ns, int n)
+*
+* Like rc_adc_latest and rc_adc_read_buffer but return the pipeline output.
+* The timestamp is that of the last sample that went into each output.
+*
 * See the test_adc example for sample use case.
 ******************************************************************************/
+typedef struct rc_adc_channel_config_t{
+	int hw_avg;					// conversions averaged per sample, 1-16
+	int decimation;				// keep 1 in this many filter outputs
+	struct rc_filter_t* filter;	// optional filter at the sample rate or NULL
+	float scale;				// output = filtered volts * scale + offset
+	float offset;
+} rc_adc_channel_config_t;
+
 float rc_battery_voltage();
 float rc_dc_jack_voltage();
 int   rc_adc_raw(int ch);
 float rc_adc_volt(int ch);
+int rc_adc_start_continuous(uint8_t ch_mask, int rate_hz, int priority);
+int rc_adc_stop_continuous();
+int rc_adc_latest(int ch, int* raw, uint64_t* timestamp_ns);
+int rc_adc_read_buffer(int ch, int* raw, uint64_t* timestamp_ns, int n);
+int rc_adc_get_overruns();
+rc_adc_channel_config_t rc_adc_default_channel_config(int ch);
+int rc_adc_set_channel_config(int ch, rc_adc_channel_config_t conf);
+int rc_adc_get_value(int ch, float* value, uint64_t* timestamp_ns);
+int rc_adc_read_values(int ch, float* value, uint64_t* timestamp_ns, int n);
+
+/*******************************************************************************
+* BATTERY MONITOR
+*
+* The rc_battery_monitor service started at boot already samples and filters
+* the battery and DC jack voltages to drive the battery LEDs. It publishes
+* what it finds into a small shared memory segment a few times a second so
+* programs that need the battery voltage don't have to read and filter the
+* ADC themselves.
+*
+* @ int rc_get_battery_state(rc_battery_state_t* state)
+*
+* Copies the latest reading from the battery monitor without touching the ADC
+* and doesn't need rc_initialize() or root. pack_v and jack_v are moving
+* averages over the last 2 seconds. num_cells and cell_v are for the 2S pack
+* on the balance connector if one is connected, otherwise for a 2-4 cell pack
+* on the DC jack, num_cells is 0 if no pack was found. Returns -1 if the
+* battery monitor isn't running.
+*******************************************************************************/
+typedef struct rc_battery_state_t{
+	float pack_v;			// filtered 2S balance connector voltage
+	float jack_v;			// filtered DC jack voltage
+	float cell_v;			// voltage per cell of the pack in use
+	int num_cells;			// 0 if no pack was found
+	int pack_connected;		// 1 if a 2S pack is on the balance connector
+	int charging;			// 1 if the 2S pack is being charged from the jack
+	uint64_t timestamp_ns;	// rc_nanos_since_boot() time of the update
+	uint64_t updates;		// readings published since the monitor started
+} rc_battery_state_t;
+
+int rc_get_battery_state(rc_battery_state_t* state);
 
 
 /******************************************************************************
@@ -447,6 +678,170 @@ int rc_send_oneshot_pulse_normalized(int ch, float input);
 int rc_send_oneshot_pulse_normalized_all(float input);
 
 
+/******************************************************************************
+* DSHOT DIGITAL ESC PROTOCOL
+*
+* As an alternative to the analog pulse widths above, the 8 servo channels can
+* drive ESCs with the DShot150, DShot300, or DShot600 digital protocols. This
+* removes the need for ESC calibration and allows sending commands such as
+* beeps and spin direction changes. DShot is generated by an alternate program
+* in the PRU1 firmware, so while it is running the servo pulse functions above
+* are unavailable.
+*
+* @ int rc_initialize_dshot(rc_dshot_speed_t speed)
+* @ int rc_stop_dshot()
+*
+* rc_initialize_dshot restarts PRU1 in DShot mode at the requested bit rate.
+* Only the normal output-only protocol is sent. Bidirectional DShot with eRPM
+* replies is not supported since the PRU can't turn the servo pads around to
+* inputs. rc_stop_dshot returns PRU1 to the normal servo program and is also
+* called by rc_cleanup().
+*
+* @ int rc_send_dshot_throttle_all(float throttle[8])
+*
+* Sends one frame to every channel at the same time. A throttle of 0 to 1 maps
+* to the full DShot throttle range of 48-2047 and anything below 0 sends the
+* motor stop value 0. Frames must be sent regularly, typically at the feedback
+* controller rate, or the ESC will disarm. Returns -1 if the previous frame is
+* still being sent.
+*
+* @ int rc_send_dshot_values_all(int values[8], int telemetry)
+*
+* Sends raw 11-bit DShot values 0-2047 to every channel, values 1-47 are
+* commands. telemetry sets the telemetry request bit in every frame.
+*
+* @ int rc_send_dshot_command_all(rc_dshot_cmd_t cmd)
+*
+* Sends a command to all ESCs. Most commands are only accepted after being
+* received several times in a row so the frame is repeated 10 times. The
+* motors must be stopped for commands to be accepted.
+******************************************************************************/
+typedef enum rc_dshot_speed_t{
+	DSHOT_150 = 150,
+	DSHOT_300 = 300,
+	DSHOT_600 = 600
+} rc_dshot_speed_t;
+
+typedef enum rc_dshot_cmd_t{
+	DSHOT_CMD_MOTOR_STOP = 0,
+	DSHOT_CMD_BEEP1 = 1,
+	DSHOT_CMD_BEEP2 = 2,
+	DSHOT_CMD_BEEP3 = 3,
+	DSHOT_CMD_BEEP4 = 4,
+	DSHOT_CMD_BEEP5 = 5,
+	DSHOT_CMD_ESC_INFO = 6,
+	DSHOT_CMD_SPIN_DIRECTION_1 = 7,
+	DSHOT_CMD_SPIN_DIRECTION_2 = 8,
+	DSHOT_CMD_3D_MODE_OFF = 9,
+	DSHOT_CMD_3D_MODE_ON = 10,
+	DSHOT_CMD_SAVE_SETTINGS = 12,
+	DSHOT_CMD_SPIN_DIRECTION_NORMAL = 20,
+	DSHOT_CMD_SPIN_DIRECTION_REVERSED = 21
+} rc_dshot_cmd_t;
+
+int rc_initialize_dshot(rc_dshot_speed_t speed);
+int rc_stop_dshot();
+int rc_send_dshot_throttle_all(float throttle[8]);
+int rc_send_dshot_values_all(int values[8], int telemetry);
+int rc_send_dshot_command_all(rc_dshot_cmd_t cmd);
+
+
+/******************************************************************************
+* PRU MAILBOX AND EVENTS
+*
+* Each PRU firmware publishes a header in shared memory with its version and
+* the features it supports which rc_initialize() checks before using the PRUs.
+* The firmware can also post timestamped events to a lock-free ring, one ring
+* per PRU core. PRU0 counts encoder channel 4 and PRU1 runs the servo or DShot
+* program. Events are off by default to keep PRU overhead down.
+*
+* @ int rc_pru_get_features(int core)
+*
+* Returns the RC_PRU_FEAT_* bits reported by the firmware on core 0 or 1, or
+* -1 if the header is missing or from a different firmware version.
+*
+* @ int rc_pru_enable_event(int core, rc_pru_event_type_t type, int enable)
+*
+* Turns posting of one type of event on or off. Encoder edge and error events
+* come from core 0, frame done events from core 1 while running DShot. The
+* servo program is cycle counted and posts no events.
+*
+* @ int rc_pru_read_event(int core, rc_pru_event_t* event)
+*
+* Pops the oldest event from a core's ring. Returns 1 if an event was read, 0
+* if the ring is empty, and -1 on error. Only one thread may read each core.
+* data holds the encoder count, DShot frame sequence number, or error code.
+* RC_PRU_ERR_ENC_SKIP means both encoder 4 channels changed between two polls
+* so a count was lost. The timestamp is in rc_nanos_since_boot() time and is
+* only meaningful for events read within 21 seconds of being posted.
+*
+* @ int rc_pru_get_dropped_events(int core)
+*
+* Returns the number of events lost because the ring was full since the core
+* was started.
+******************************************************************************/
+#define RC_PRU_FEAT_SERVO		0x01
+#define RC_PRU_FEAT_ENCODER		0x02
+#define RC_PRU_FEAT_EDGE_TIME	0x04
+#define RC_PRU_FEAT_DSHOT		0x08
+#define RC_PRU_FEAT_COMMANDS	0x10
+#define RC_PRU_FEAT_EVENTS		0x20
+#define RC_PRU_ERR_ENC_SKIP		1
+
+typedef enum rc_pru_event_type_t{
+	RC_PRU_EVENT_EDGE = 1,
+	RC_PRU_EVENT_FRAME_DONE = 2,
+	RC_PRU_EVENT_ERROR = 3
+} rc_pru_event_type_t;
+
+typedef struct rc_pru_event_t{
+	rc_pru_event_type_t type;
+	int data;
+	uint64_t timestamp_ns;
+} rc_pru_event_t;
+
+int rc_pru_get_features(int core);
+int rc_pru_enable_event(int core, rc_pru_event_type_t type, int enable);
+int rc_pru_read_event(int core, rc_pru_event_t* event);
+int rc_pru_get_dropped_events(int core);
+
+
+/******************************************************************************
+* PRU EMULATOR
+*
+* For running and benchmarking servo and encoder code on a machine without
+* PRUs such as a build server. rc_pru_emulator_start() creates the PRU shared
+* memory in a file, or in an anonymous memfd if path is NULL, starts a thread
+* that plays the part of both PRU firmwares, and points the library at it.
+* Call it instead of rc_initialize(), after which the servo, encoder 4, and
+* PRU mailbox functions work as normal. If a path is given, another process
+* run with the environment variable RC_PRU_SHM_FILE set to that path maps the
+* same file in place of the PRU when its PRU subsystem comes up, normally on
+* the first servo, encoder 4, or PRU mailbox call. That process must not call
+* rc_initialize() since it requires root and the cape hardware, which a
+* machine using the emulator doesn't have.
+*
+* The emulated PRU1 consumes servo pulses with the same timing as the servo
+* firmware. The emulated PRU0 counts encoder 4 at the rate given to
+* rc_pru_emulator_set_encoder_rate() and from an optional script file with
+* one command per line, times in seconds from the start:
+*
+*	<time> rate <counts per second>
+*	<time> step <counts>
+*
+* Lines starting with # are ignored.
+*
+* @ int rc_pru_emulator_get_pulses(int ch, int* width_us)
+*
+* Returns the number of pulses completed on servo channel ch since the
+* emulator started and optionally writes the width of the last one.
+******************************************************************************/
+int rc_pru_emulator_start(const char* path, const char* script);
+int rc_pru_emulator_stop();
+int rc_pru_emulator_set_encoder_rate(float counts_per_sec);
+int rc_pru_emulator_get_pulses(int ch, int* width_us);
+
+
 /******************************************************************************
 * DSM2/DSMX RC radio functions
 *
@@ -540,6 +935,12 @@ int   rc_calibrate_dsm_routine();
 * triggering the buffer read followed by the execution of a function of your
 * choosing set with the rc_set_imu_interrupt_func() function.
 *
+* @ int rc_set_init_imu_dmp(rc_imu_data_t* data, rc_imu_config_t conf)
+*
+* Stages the arguments for the RC_INIT_IMU_DMP step of rc_initialize_ex() so
+* the DMP is started alongside the other subsystems, equivalent to calling
+* rc_initialize_imu_dmp(data, conf) afterwards.
+*
 * @ enum rc_accel_fsr_t rc_gyro_fsr_t
 * 
 * The user may choose from 4 full scale ranges of the accelerometer and
@@ -711,6 +1112,7 @@ int rc_read_imu_temp(rc_imu_data_t* data);
 
 // interrupt-driven sampling mode functions
 int rc_initialize_imu_dmp(rc_imu_data_t* data, rc_imu_config_t conf);
+int rc_set_init_imu_dmp(rc_imu_data_t* data, rc_imu_config_t conf);
 int rc_set_imu_interrupt_func(void (*func)(void));
 int rc_stop_imu_interrupt_func();
 int rc_was_last_imu_read_successful();
@@ -722,6 +1124,71 @@ int rc_calibrate_mag_routine();
 int rc_is_gyro_calibrated();
 int rc_is_mag_calibrated();
 
+/*******************************************************************************
+* DIFFERENTIAL DRIVE ODOMETRY
+*
+* Wheeled robots all need to turn encoder counts into a position and heading.
+* The odometry module does this in one place in a background thread so that
+* user code only needs to read the result.
+*
+* @ rc_odometry_config_t rc_default_odometry_config()
+* @ int rc_initialize_odometry(rc_odometry_config_t config)
+* @ int rc_stop_odometry()
+*
+* Start with the default config and fill in the geometry of your robot.
+* counts_per_rev is encoder counts per revolution of the wheel including any
+* gearbox and the polarities must be set so both wheels count up when driving
+* forward. The thread runs at rate_hz, with SCHED_FIFO at the given priority if
+* it is >0. Each step takes an encoder snapshot so both wheels are sampled at
+* the same instant. rc_stop_odometry waits up to one period plus 0.5s for the
+* thread to exit and returns -1 if it didn't, odometry is then still running
+* and can be stopped again. rc_stop_odometry is also called by rc_cleanup().
+*
+* To fuse IMU yaw, start the IMU in DMP mode and set imu_data to the same data
+* struct. Each step the heading change is then a blend of imu_weight of the DMP
+* yaw change and the remainder from the wheels, reducing error from wheel slip.
+* Set imu_polarity to -1 if the cape is mounted so yaw increases clockwise.
+*
+* @ int rc_get_odometry(rc_odometry_t* pose)
+* @ int rc_reset_odometry()
+*
+* rc_get_odometry copies the most recent pose. x and y are in meters in the
+* frame the robot started in with x forward, theta in radians anticlockwise
+* from x. This never blocks the integrator thread and can be called from any
+* thread at any rate. rc_reset_odometry zeros the pose.
+******************************************************************************/
+typedef struct rc_odometry_config_t{
+	int left_ch;			// encoder channels 1-4
+	int right_ch;
+	int left_polarity;		// 1 or -1 so driving forward counts up
+	int right_polarity;
+	float counts_per_rev;	// encoder counts per wheel revolution
+	float wheel_radius_m;
+	float track_width_m;	// distance between the wheels
+	int rate_hz;			// integration rate
+	int priority;			// SCHED_FIFO priority, 0 for normal scheduling
+	rc_imu_data_t* imu_data;	// NULL to use encoders only
+	int imu_polarity;		// 1 or -1 so yaw increases anticlockwise
+	float imu_weight;		// 0-1 fraction of heading change from the IMU
+} rc_odometry_config_t;
+
+typedef struct rc_odometry_t{
+	float x;				// position in meters
+	float y;
+	float theta;			// heading in radians
+	float v;				// forward speed in m/s
+	float omega;			// turn rate in rad/s
+	float left_m;			// total distance travelled by each wheel
+	float right_m;
+	uint64_t timestamp_ns;	// rc_nanos_since_boot() time of the encoder sample
+} rc_odometry_t;
+
+rc_odometry_config_t rc_default_odometry_config();
+int rc_initialize_odometry(rc_odometry_config_t config);
+int rc_stop_odometry();
+int rc_get_odometry(rc_odometry_t* pose);
+int rc_reset_odometry();
+
 /*******************************************************************************
 * BMP280 Barometer
 *
@@ -776,6 +1243,24 @@ int rc_is_mag_calibrated();
 * If you know the current sea level pressure for your region and weather, you 
 * can use this to correct the altititude reading. This is not necessary if you
 * only care about differential altitude from a starting point.
+*
+* @ int rc_bmp_start_sampler(float alt_time_constant, int priority)
+* Starts a background thread that reads each new sample at the barometer's
+* output data rate for the oversample given to rc_initialize_barometer(). Reads
+* are timed to fall between the IMU's DMP FIFO reads on the same bus so neither
+* has to wait for or warn about the other. Compensation and a first order low
+* pass of the altitude with the given time constant in seconds, 0 for none,
+* are done in the thread. priority is the SCHED_FIFO priority, 0 for normal.
+* rc_read_barometer() returns straight away while the sampler runs and the
+* rc_bmp_get_ functions return its latest sample.
+*
+* @ int rc_bmp_stop_sampler()
+* Stops the background sampler, also done by rc_power_off_barometer() and
+* rc_cleanup().
+*
+* @ int rc_bmp_get_data(rc_bmp_data_t* data)
+* Copies the latest sample from the background sampler without blocking it.
+* Returns -1 if there isn't a sample yet.
 *******************************************************************************/
 typedef enum rc_bmp_oversample_t{
 	BMP_OVERSAMPLE_1  =	(0x01<<2), // update rate 182 HZ
@@ -801,6 +1286,186 @@ float rc_bmp_get_pressure_pa();
 float rc_bmp_get_altitude_m();
 int rc_set_sea_level_pressure_pa(float pa);
 
+typedef struct rc_bmp_data_t{
+	uint64_t timestamp_ns;	// rc_nanos_since_boot() time the sample was read
+	float temp_c;
+	float pressure_pa;
+	float alt_m;			// unfiltered
+	float alt_filtered_m;
+	uint64_t samples;		// samples read since the sampler started
+	uint64_t skipped;		// periods the bus was never free
+	uint64_t errors;		// failed reads
+} rc_bmp_data_t;
+
+int rc_bmp_start_sampler(float alt_time_constant, int priority);
+int rc_bmp_stop_sampler();
+int rc_bmp_get_data(rc_bmp_data_t* data);
+
+/*******************************************************************************
+* VERTICAL STATE ESTIMATOR
+*
+* Altitude hold needs height and climb rate at the control loop rate but the
+* barometer alone is slow, noisy and late. This fuses earth frame vertical
+* acceleration from the IMU with barometer altitude in a 3 state Kalman filter
+* of height, vertical velocity, and accelerometer bias.
+*
+* @ rc_vertical_config_t rc_default_vertical_config()
+* @ int rc_start_vertical_estimator(rc_vertical_config_t config)
+* @ int rc_stop_vertical_estimator()
+*
+* Start the IMU in DMP mode and the barometer sampler with rc_bmp_start_sampler()
+* first, rc_start_vertical_estimator returns -1 otherwise. The estimator then
+* steps in the IMU interrupt after each FIFO read and before the function set
+* with rc_set_imu_interrupt_func(), so that function can read an estimate for
+* the same sample. Nothing is allocated or locked while running. Each new
+* barometer sample is compared with the height predicted baro_delay_s before
+* it was read, to account for the barometer's measurement time and any
+* internal filter, and corrects the current estimate.
+* accel_std and baro_std_m are the standard deviations of the vertical
+* acceleration and barometer altitude noise, bias_drift how fast the
+* accelerometer bias may wander in m/s^2 per root second. Height is relative to
+* the first barometer sample. rc_stop_vertical_estimator is also called by
+* rc_cleanup().
+*
+* @ int rc_get_vertical_state(rc_vertical_state_t* state)
+* @ int rc_reset_vertical_estimator()
+*
+* rc_get_vertical_state copies the latest estimate without blocking the IMU
+* thread and returns -1 until there is one. rc_reset_vertical_estimator
+* restarts the filter at rest from the next barometer sample, for example
+* when a vehicle is put down on the ground again.
+*******************************************************************************/
+typedef struct rc_vertical_config_t{
+	float accel_std;		// m/s^2
+	float bias_drift;		// m/s^2 per root second
+	float baro_std_m;
+	float baro_delay_s;		// barometer sample age when read
+} rc_vertical_config_t;
+
+typedef struct rc_vertical_state_t{
+	float z_m;				// height above the start, up positive
+	float vz_ms;			// vertical velocity, up positive
+	float az_ms2;			// bias corrected vertical acceleration
+	float accel_bias;		// estimated accelerometer bias m/s^2
+	float z_std_m;			// standard deviation of z_m
+	float origin_alt_m;		// barometer altitude of z_m=0
+	uint64_t timestamp_ns;	// rc_nanos_since_boot() time of the IMU sample
+	uint64_t baro_updates;	// barometer samples fused
+} rc_vertical_state_t;
+
+rc_vertical_config_t rc_default_vertical_config();
+int rc_start_vertical_estimator(rc_vertical_config_t config);
+int rc_stop_vertical_estimator();
+int rc_get_vertical_state(rc_vertical_state_t* state);
+int rc_reset_vertical_estimator();
+
+/*******************************************************************************
+* SENSOR HUB
+*
+* rc_initialize() kills any other process using the cape so normally one
+* program has to do everything. The sensor hub lets one process own the
+* hardware and publish sensor data into POSIX shared memory where any number
+* of other processes, such as loggers and telemetry, can read it. Clients can
+* be started and stopped at any time without disturbing the owner.
+*
+* @ int rc_hub_start_server(unsigned int streams, int rate_hz, int priority)
+* @ int rc_hub_stop_server()
+*
+* Called by the process that owns the hardware after rc_initialize() and
+* after starting whichever sensors it publishes. streams is an OR of the
+* RC_HUB_ flags below. IMU samples are published from the IMU interrupt
+* straight after each DMP FIFO read so the IMU must be in DMP mode. The other
+* streams and a heartbeat are published by a background thread at rate_hz
+* with SCHED_FIFO priority if priority>0. Encoders are published as a
+* snapshot of all 4 channels. ADC voltages are published as rc_adc_volt()
+* returns them, so the continuous ADC pipeline filters are used if running.
+* DSM channels are checked every period and published when a new packet has
+* arrived or the connection state changed, without clearing the server's
+* rc_is_new_dsm_data() flag. Barometer samples are only published while
+* rc_bmp_start_sampler() is running. Publishing never blocks on a client.
+* The region is kept after rc_hub_stop_server() so a restarted server picks
+* up where the last left off and connected clients carry on.
+* rc_hub_stop_server() is also called by rc_cleanup().
+*
+* @ int rc_hub_connect()
+* @ int rc_hub_disconnect()
+*
+* Called by a client instead of rc_initialize(), it does not touch the
+* hardware or kill other processes. Once connected these functions read the
+* latest sample from the hub instead of the hardware: rc_get_encoder_pos,
+* rc_get_encoder_snapshot, rc_adc_raw, rc_adc_volt, rc_battery_voltage,
+* rc_dc_jack_voltage, the rc_get_dsm_ and rc_is_dsm_ functions,
+* rc_num_dsm_channels, rc_nanos_since_last_dsm_packet, rc_bmp_get_temperature,
+* rc_bmp_get_pressure_pa, rc_bmp_get_altitude_m and rc_bmp_get_data. Each is a
+* copy out of shared memory with no system call. rc_is_new_dsm_data() is
+* tracked separately for each client. The encoder and ADC getters return -1
+* while the hub has no sample. Clients must run as root like the server.
+*
+* @ int rc_hub_server_alive()
+*
+* returns 1 if the server process exists and its heartbeat is less than a second
+* or 3 server periods old, whichever is longer, otherwise 0. The getters keep
+* returning the last published values if the server dies.
+*
+* @ int rc_hub_latest(unsigned int stream, void* sample)
+* @ int rc_hub_read(unsigned int stream, uint32_t* cursor, void* samples, int n)
+* @ int rc_hub_wait(unsigned int stream, uint32_t cursor, int timeout_ms)
+*
+* Direct access to a single stream, one RC_HUB_ flag. The sample type for each
+* stream is given next to the flags. The last RC_HUB_RING_LEN-1 samples of each
+* stream can be read back. rc_hub_latest copies the newest and returns -1 if
+* there isn't one. rc_hub_read copies up to n samples, oldest first, from the
+* position in cursor and advances it, returning the number copied. Start cursor
+* at 0 for everything still kept or at the value from rc_hub_cursor() for only
+* new samples. A reader that falls too far behind skips to the oldest sample
+* kept. rc_hub_wait sleeps until there is a sample past cursor, returning 0, or
+* until timeout_ms passes, returning 1. A negative timeout waits forever. It
+* returns -1 if the server isn't alive.
+*
+* @ uint32_t rc_hub_cursor(unsigned int stream)
+*
+* the number of samples published to a stream, the cursor for the next one
+*******************************************************************************/
+#define RC_HUB_IMU			(1<<0)	// rc_hub_imu_t
+#define RC_HUB_ENCODERS		(1<<1)	// rc_encoder_snapshot_t
+#define RC_HUB_ADC			(1<<2)	// rc_hub_adc_t
+#define RC_HUB_DSM			(1<<3)	// rc_hub_dsm_t
+#define RC_HUB_BARO			(1<<4)	// rc_bmp_data_t
+#define RC_HUB_ALL			0x1F
+#define RC_HUB_RING_LEN		256
+
+typedef struct rc_hub_imu_t{
+	uint64_t timestamp_ns;	// rc_nanos_since_boot() time of the interrupt
+	rc_imu_data_t data;
+} rc_hub_imu_t;
+
+typedef struct rc_hub_adc_t{
+	uint64_t timestamp_ns;	// rc_nanos_since_boot() time of the read
+	float volt[7];			// rc_adc_volt() of channels 0-6
+	float battery_v;
+	float jack_v;
+} rc_hub_adc_t;
+
+typedef struct rc_hub_dsm_t{
+	uint64_t timestamp_ns;	// rc_nanos_since_boot() time it was published
+	uint64_t packet_ns;		// rc_nanos_since_epoch() time of the last packet
+	int active;
+	int channels;
+	int resolution;
+	int raw[9];				// microseconds, channels 1-9
+	float normalized[9];
+} rc_hub_dsm_t;
+
+int rc_hub_start_server(unsigned int streams, int rate_hz, int priority);
+int rc_hub_stop_server();
+int rc_hub_connect();
+int rc_hub_disconnect();
+int rc_hub_server_alive();
+int rc_hub_latest(unsigned int stream, void* sample);
+int rc_hub_read(unsigned int stream, uint32_t* cursor, void* samples, int n);
+int rc_hub_wait(unsigned int stream, uint32_t cursor, int timeout_ms);
+uint32_t rc_hub_cursor(unsigned int stream);
+
 /*******************************************************************************
 * I2C functions
 *
@@ -995,6 +1660,10 @@ void rc_print_bb_model();
 *
 * rc_set_default_pinmux() puts everything back to standard and is used by 
 * initialize_cape
+*
+* The mode of each pin is read from the pinmux helper the first time it's
+* touched and remembered, pins already in the requested mode aren't written
+* again. Another process changing the pinmux behind our back won't be noticed.
 *******************************************************************************/
 // Cape and Blue
 #define GPS_HEADER_PIN_3		2	// P9_22, normally GPS UART2 RX
@@ -1061,6 +1730,133 @@ int rc_gpio_fd_close(int fd);
 int rc_gpio_set_value_mmap(int pin, int state);
 int rc_gpio_get_value_mmap(int pin);
 
+/*******************************************************************************
+* GPIO PORT
+*
+* Direct register access to whole GPIO banks for code that toggles pins often,
+* such as bit-banged protocols, LEDs, and motor direction pins. A bank has 32
+* pins so gpio number n is bit n%32 of bank n/32. Writes go through the
+* SETDATAOUT and CLEARDATAOUT registers which only affect the bits written as
+* 1. Each write is one store with no read-modify-write, so threads working on
+* different pins of the same bank can't undo each other's changes.
+*
+* @ volatile uint32_t* rc_gpio_bank_mmap(int bank)
+*
+* Returns a pointer to the registers of GPIO bank 0-3, mapping /dev/mem and
+* enabling the bank clocks first if necessary. Returns NULL on failure.
+*
+* @ int rc_gpio_pin_init(rc_gpio_pin_t* pin, int gpio)
+*
+* Fills in a pin handle with the bank pointer and bit mask for a gpio number
+* so later calls don't have to look them up. Pinmux and direction must
+* already be configured. Returns 0 on success or -1 on failure.
+*
+* @ void rc_gpio_pin_set(const rc_gpio_pin_t* pin)
+* @ void rc_gpio_pin_clear(const rc_gpio_pin_t* pin)
+* @ void rc_gpio_pin_write(const rc_gpio_pin_t* pin, int state)
+* @ void rc_gpio_pin_toggle(const rc_gpio_pin_t* pin)
+* @ int rc_gpio_pin_read(const rc_gpio_pin_t* pin)
+*
+* Single pin operations on a handle from rc_gpio_pin_init. rc_gpio_pin_read
+* returns 1 or 0 from the input register.
+*
+* @ void rc_gpio_port_set(volatile uint32_t* bank, uint32_t mask)
+* @ void rc_gpio_port_clear(volatile uint32_t* bank, uint32_t mask)
+* @ void rc_gpio_port_write(volatile uint32_t* bank, uint32_t set, uint32_t clr)
+* @ void rc_gpio_port_toggle(volatile uint32_t* bank, uint32_t mask)
+* @ uint32_t rc_gpio_port_read(volatile uint32_t* bank)
+*
+* Operate on any set of pins in one bank at once. rc_gpio_port_write sets the
+* bits in set then clears the bits in clr. rc_gpio_port_toggle reads the
+* output register to decide which bits to set and which to clear, so it is
+* only free of lost updates against other threads if they don't also toggle
+* the same pins. rc_gpio_port_read returns all 32 input bits.
+*
+* These are implemented inline here so they compile down to one or two loads
+* and stores.
+*******************************************************************************/
+#define RC_GPIO_DATAIN			(0x138/4)	// word offsets into a bank
+#define RC_GPIO_DATAOUT			(0x13C/4)
+#define RC_GPIO_CLEARDATAOUT	(0x190/4)
+#define RC_GPIO_SETDATAOUT		(0x194/4)
+
+typedef struct rc_gpio_pin_t{
+	volatile uint32_t* bank;	// from rc_gpio_bank_mmap()
+	uint32_t mask;				// 1<<(gpio%32)
+} rc_gpio_pin_t;
+
+volatile uint32_t* rc_gpio_bank_mmap(int bank);
+int rc_gpio_pin_init(rc_gpio_pin_t* pin, int gpio);
+
+static inline void rc_gpio_port_set(volatile uint32_t* bank, uint32_t mask){
+	bank[RC_GPIO_SETDATAOUT] = mask;
+}
+static inline void rc_gpio_port_clear(volatile uint32_t* bank, uint32_t mask){
+	bank[RC_GPIO_CLEARDATAOUT] = mask;
+}
+static inline void rc_gpio_port_write(volatile uint32_t* bank, uint32_t set,\
+								uint32_t clr){
+	if(set) bank[RC_GPIO_SETDATAOUT] = set;
+	if(clr) bank[RC_GPIO_CLEARDATAOUT] = clr;
+}
+static inline void rc_gpio_port_toggle(volatile uint32_t* bank, uint32_t mask){
+	uint32_t out = bank[RC_GPIO_DATAOUT] & mask;
+	rc_gpio_port_write(bank, mask & ~out, out);
+}
+static inline uint32_t rc_gpio_port_read(volatile uint32_t* bank){
+	return bank[RC_GPIO_DATAIN];
+}
+static inline void rc_gpio_pin_set(const rc_gpio_pin_t* pin){
+	pin->bank[RC_GPIO_SETDATAOUT] = pin->mask;
+}
+static inline void rc_gpio_pin_clear(const rc_gpio_pin_t* pin){
+	pin->bank[RC_GPIO_CLEARDATAOUT] = pin->mask;
+}
+static inline void rc_gpio_pin_write(const rc_gpio_pin_t* pin, int state){
+	if(state) pin->bank[RC_GPIO_SETDATAOUT] = pin->mask;
+	else pin->bank[RC_GPIO_CLEARDATAOUT] = pin->mask;
+}
+static inline void rc_gpio_pin_toggle(const rc_gpio_pin_t* pin){
+	rc_gpio_port_toggle(pin->bank, pin->mask);
+}
+static inline int rc_gpio_pin_read(const rc_gpio_pin_t* pin){
+	return (pin->bank[RC_GPIO_DATAIN] & pin->mask) != 0;
+}
+
+/*******************************************************************************
+* GPIO EVENTS
+*
+* Background threads wait on edges from the watched pins and call the function
+* registered for each pin. Pins watched at the same priority share one thread
+* so the buttons and the IMU interrupt, which use this, each get a thread at
+* their own priority. User code can watch its own input pins the same way
+* instead of starting another thread.
+*
+* @ int rc_gpio_event_watch(int gpio, rc_pin_edge_t edge, int debounce_us,
+*									int priority, rc_gpio_event_func_t func)
+*
+* Starts calling func(gpio, value, timestamp_ns) for every edge of type edge
+* on the pin. value is the new level and timestamp_ns is the time of the edge
+* in rc_nanos_since_boot() time, taken by the kernel where the GPIO character
+* device is available. With debounce_us>0 the pin must hold its new level for
+* that long before func is called, and the timestamp is of the first edge.
+* The thread never sleeps to debounce so other pins aren't delayed. func is
+* called from the thread for priority, which runs at that SCHED_FIFO priority
+* or as a normal thread for 0. Up to 4 different priorities may be in use.
+* Callbacks should return quickly since they hold up the other pins of the
+* same priority. A pin held by another program through the GPIO character
+* device is reported and not taken over. Returns 0 on success or -1 on
+* failure, for example if the pin is already watched.
+*
+* @ int rc_gpio_event_unwatch(int gpio)
+*
+* Stops watching a pin. After this returns its function won't be called again.
+*******************************************************************************/
+typedef void (*rc_gpio_event_func_t)(int gpio, int value, uint64_t timestamp_ns);
+int rc_gpio_event_watch(int gpio, rc_pin_edge_t edge, int debounce_us,\
+							int priority, rc_gpio_event_func_t func);
+int rc_gpio_event_unwatch(int gpio);
+
 
 /*******************************************************************************
 * PWM
@@ -1076,7 +1872,9 @@ int rc_gpio_get_value_mmap(int pin);
 *
 * Configures subsystem 0, 1, or 2 to operate at a particular frequency. This may
 * be called at runtime to change the pwm frequency without stopping the motors
-* or pwm signal. Returns 0 on success or -1 on failure.
+* or pwm signal. Returns 0 on success or -1 on failure. Only the first call
+* goes through the sysfs driver, to export and enable the channels. After that
+* all PWM functions write the subsystem registers directly with no syscalls.
 *
 * @ int rc_pwm_close(int ss){
 *
@@ -1086,9 +1884,10 @@ int rc_gpio_get_value_mmap(int pin);
 *
 * @ int rc_pwm_set_duty(int ss, char ch, float duty)
 *
-* Updates the duty cycle through the file system userspace driver. subsystem ss
-* must be 0,1,or 2 and channel 'ch' must be A or B. Duty cycle must be bounded
-* between 0.0f (off) and 1.0f(full on). Returns 0 on success or -1 on failure.
+* Updates the duty cycle of subsystem ss which must be 0,1,or 2 and channel
+* 'ch' which must be A or B. Duty cycle must be bounded between 0.0f (off) and
+* 1.0f(full on). The subsystem is initialized at the default frequency if it
+* wasn't already. Returns 0 on success or -1 on failure.
 *
 * @ int rc_pwm_set_duty_ns(int ss, char ch, int duty_ns)
 *
@@ -1109,12 +1908,28 @@ int rc_gpio_get_value_mmap(int pin);
 * 1 and 2 are used by the motor H bridges. Channel 'ch' must be 'A' or 'B' and
 * duty must be from 0.0f to 1.0f. The subsystem must be intialized with
 * rc_pwm_init() before use. Returns 0 on success or -1 on failure.
+*
+* New duty values are held in the shadow compare registers and take effect at
+* the start of the next PWM period so a period is never cut short.
+*
+* @ int rc_pwm_set_duty_ab_mmap(int ss, float duty_a, float duty_b)
+*
+* Sets both channels of a subsystem so that they change in the same PWM
+* period. Returns 0 on success or -1 on failure.
+*
+* @ int rc_pwm_set_polarity(int ss, char ch, int inverted)
+*
+* Sets channel A or B to normal polarity (0), high for the duty cycle, or
+* inverted (1), low for the duty cycle. The subsystem must be intialized with
+* rc_pwm_init() first. Returns 0 on success or -1 on failure.
 *******************************************************************************/
 int rc_pwm_init(int ss, int frequency);
 int rc_pwm_close(int ss);
 int rc_pwm_set_duty(int ss, char ch, float duty);
 int rc_pwm_set_duty_ns(int ss, char ch, int duty_ns);
 int rc_pwm_set_duty_mmap(int ss, char ch, float duty);
+int rc_pwm_set_duty_ab_mmap(int ss, float duty_a, float duty_b);
+int rc_pwm_set_polarity(int ss, char ch, int inverted);
 
 /*******************************************************************************
 * time
@@ -1201,6 +2016,304 @@ uint64_t rc_nanos_thread_time();
 timespec rc_timespec_diff(timespec A, timespec B);
 void rc_timespec_add(timespec* start, double seconds);
 
+/*******************************************************************************
+* CYCLE COUNTER
+*
+* clock_gettime takes around 1us on the BeagleBone which is too slow for
+* profiling probes inside filters and control loops. rc_cycles() instead
+* reads a hardware cycle counter directly in a few instructions: the ARM PMU
+* cycle counter on the BeagleBone or the TSC on x86 host builds. If the
+* counter can't be read from userspace it falls back to rc_nanos_since_boot()
+* so code using it still works, just slower.
+*
+* @ int rc_cycles_init()
+*
+* Picks the counter and calibrates it against CLOCK_MONOTONIC, taking about
+* 10ms. rc_initialize() calls this, programs that don't use rc_initialize()
+* should call it once before taking any timestamps. The ARM PMU counter can
+* only be read from userspace once a kernel module has set PMUSERENR, which
+* isn't the default. Returns 0 if a hardware counter is in use or -1 when
+* using the fallback.
+*
+* @ uint64_t rc_cycles()
+* @ uint64_t rc_cycles_diff(uint64_t start, uint64_t end)
+* @ uint64_t rc_cycles_to_nanos(uint64_t cycles)
+*
+* rc_cycles() returns a raw timestamp. Only differences between two of them
+* are meaningful, take those with rc_cycles_diff which handles the 32 bit PMU
+* counter wrapping around and convert them with rc_cycles_to_nanos. The PMU
+* counter wraps every 4.3s at 1ghz so intervals must be shorter than that.
+* The counter is per-core which doesn't matter on the single core BeagleBone.
+*
+* @ uint64_t rc_cycles_overhead()
+*
+* The cycles taken by a back to back pair of rc_cycles() calls measured by
+* rc_cycles_init, subtract it from very short intervals.
+*
+* @ rc_cycles_source_t rc_cycles_source()
+* @ double rc_cycles_hz()
+*
+* The counter in use and its calibrated rate.
+*******************************************************************************/
+typedef enum rc_cycles_source_t{
+	RC_CYCLES_CLOCK,	// rc_nanos_since_boot() fallback
+	RC_CYCLES_PMU,		// ARM PMU cycle counter
+	RC_CYCLES_TSC		// x86 time stamp counter
+} rc_cycles_source_t;
+
+extern rc_cycles_source_t rc_cycles_src;
+
+static inline uint64_t rc_cycles(){
+#if defined(__arm__)
+	uint32_t c;
+	if(rc_cycles_src==RC_CYCLES_PMU){
+		__asm__ __volatile__("mrc p15, 0, %0, c9, c13, 0" : "=r"(c));
+		return c;
+	}
+#elif defined(__x86_64__) || defined(__i386__)
+	uint32_t lo, hi;
+	if(rc_cycles_src==RC_CYCLES_TSC){
+		__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+		return ((uint64_t)hi<<32)|lo;
+	}
+#endif
+	return rc_nanos_since_boot();
+}
+
+static inline uint64_t rc_cycles_diff(uint64_t start, uint64_t end){
+	if(rc_cycles_src==RC_CYCLES_PMU) return (uint32_t)(end-start);
+	return end-start;
+}
+
+int rc_cycles_init();
+uint64_t rc_cycles_to_nanos(uint64_t cycles);
+uint64_t rc_cycles_overhead();
+rc_cycles_source_t rc_cycles_source();
+double rc_cycles_hz();
+
+/*******************************************************************************
+* TRACING
+*
+* Records timestamped events from each thread so a missed deadline can be
+* traced to the IMU read, filter, DSM parser or motor output that took the
+* time. Events go into a ring buffer per thread with no locking, timestamped
+* with rc_cycles(). Each ring keeps the most recent RC_TRACE_RING_LEN events.
+*
+* @ RC_TRACE_BEGIN(name)
+* @ RC_TRACE_END(name)
+* @ RC_TRACE_INSTANT(name)
+* @ RC_TRACE_COUNTER(name, value)
+*
+* Mark the start and end of a span, a single point in time, or a counter
+* value. name must be a string literal or otherwise outlive the trace. These
+* compile to nothing unless RC_TRACE is defined, so probes can be left in
+* release code. Build the library with "make trace" to enable the probes
+* inside the library itself, and add -DRC_TRACE to your own program's flags
+* for your probes.
+*
+* @ int rc_trace_enable(const char* path)
+* @ int rc_trace_disable()
+*
+* Events are only recorded between these calls. When path isn't NULL
+* rc_cleanup() writes the trace there with rc_trace_write_json.
+*
+* @ int rc_trace_name_thread(const char* name)
+*
+* Names the calling thread's track in the trace. Otherwise the name set with
+* pthread_setname_np or the program name is used.
+*
+* @ int rc_trace_write_json(const char* path)
+*
+* Writes every thread's events in Chrome trace event JSON which can be opened
+* in chrome://tracing or ui.perfetto.dev. This is safe to call while other
+* threads are still recording. With the 32 bit PMU cycle counter the gap
+* between consecutive events in one thread must be under about 4s at 1ghz or
+* that thread's later timestamps will be off.
+*******************************************************************************/
+#define RC_TRACE_RING_LEN 4096
+
+void rc_trace_event(char type, const char* name, int64_t value);
+int rc_trace_enable(const char* path);
+int rc_trace_disable();
+int rc_trace_name_thread(const char* name);
+int rc_trace_write_json(const char* path);
+
+#ifdef RC_TRACE
+#define RC_TRACE_BEGIN(name)		rc_trace_event('B', name, 0)
+#define RC_TRACE_END(name)			rc_trace_event('E', name, 0)
+#define RC_TRACE_INSTANT(name)		rc_trace_event('i', name, 0)
+#define RC_TRACE_COUNTER(name,value)	rc_trace_event('C', name, value)
+#else
+#define RC_TRACE_BEGIN(name)		do{}while(0)
+#define RC_TRACE_END(name)			do{}while(0)
+#define RC_TRACE_INSTANT(name)		do{}while(0)
+#define RC_TRACE_COUNTER(name,value)	do{}while(0)
+#endif
+
+/*******************************************************************************
+* PERIODIC LOOPS
+*
+* rc_usleep(1000000/HZ) at the end of a loop adds the loop's own execution time
+* to every period so the rate drifts, and there's no way to tell when the
+* loop falls behind. An rc_loop_t instead sleeps until absolute deadlines on
+* CLOCK_MONOTONIC and keeps statistics of how late each wakeup was (jitter)
+* and how long each iteration ran.
+*
+* @ rc_loop_config_t rc_loop_default_config()
+*
+* 100hz, normal scheduling, any CPU, RC_LOOP_SKIP.
+*
+* @ int rc_loop_init(rc_loop_t* loop, rc_loop_config_t config)
+* @ int rc_loop_wait(rc_loop_t* loop)
+*
+* For a loop in a thread you already have. rc_loop_init sets the first
+* deadline one period from now and, if config.priority>0 or config.cpu>=0,
+* applies that SCHED_FIFO priority and CPU affinity to the calling thread.
+* Call rc_loop_wait at the end of each iteration. It returns 0 if the
+* deadline was met or the number of deadlines missed. What happens after an
+* overrun depends on config.overrun. RC_LOOP_SKIP drops the missed periods
+* and waits for the next deadline still in the future, keeping the phase.
+* RC_LOOP_CATCH_UP returns immediately so the missed iterations run back to
+* back until the loop is on schedule again.
+*
+* @ int rc_loop_start(rc_loop_t* loop, rc_loop_config_t config,
+*										void (*func)(void*), void* arg)
+* @ int rc_loop_stop(rc_loop_t* loop)
+*
+* Starts a new thread with the priority and affinity in config that calls
+* func(arg) once every period. It stops when rc_loop_stop is called or the
+* program state becomes EXITING. rc_loop_stop waits up to one period plus 0.5s
+* for the thread to exit and returns -1 if it didn't, calling it again waits
+* again. A loop can't be started again until its thread has been joined.
+*
+* @ int rc_loop_get_stats(rc_loop_t* loop, rc_loop_stats_t* stats)
+* @ int rc_loop_reset_stats(rc_loop_t* loop)
+* @ int rc_loop_print_stats(rc_loop_t* loop, const char* name)
+*
+* Copies a consistent set of statistics from any thread, clears them, or
+* prints a summary. Both histograms use the same bins: bin 0 counts times
+* under 1us and bin n counts times from 2^(n-1) to 2^n us, the last bin
+* holds everything longer.
+*******************************************************************************/
+#include <pthread.h>
+#define RC_LOOP_HIST_BINS 16
+
+typedef enum rc_loop_overrun_t{
+	RC_LOOP_SKIP,
+	RC_LOOP_CATCH_UP
+} rc_loop_overrun_t;
+
+typedef struct rc_loop_config_t{
+	float rate_hz;
+	int priority;			// SCHED_FIFO priority, 0 for normal scheduling
+	int cpu;				// CPU to run on, -1 for any
+	rc_loop_overrun_t overrun;
+} rc_loop_config_t;
+
+typedef struct rc_loop_stats_t{
+	uint64_t iterations;
+	uint64_t overruns;		// iterations that ended after the next deadline
+	uint64_t skipped;		// periods dropped by RC_LOOP_SKIP
+	uint64_t jitter_sum_ns;
+	uint64_t exec_sum_ns;
+	uint64_t jitter_max_ns;	// latest wakeup after a deadline
+	uint64_t exec_max_ns;	// longest iteration
+	uint32_t jitter_hist[RC_LOOP_HIST_BINS];
+	uint32_t exec_hist[RC_LOOP_HIST_BINS];
+} rc_loop_stats_t;
+
+typedef struct rc_loop_t{
+	rc_loop_config_t config;
+	uint64_t period_ns;
+	uint64_t next_ns;		// next deadline in rc_nanos_since_boot() time
+	uint64_t wake_ns;		// when the current iteration started
+	rc_loop_stats_t stats;
+	volatile unsigned int seq;	// odd while stats are being written
+	volatile int reset_flag;
+	// used by rc_loop_start
+	pthread_t thread;
+	volatile int running;
+	int joinable;			// thread not yet joined by rc_loop_stop
+	void (*func)(void*);
+	void* arg;
+	int initialized;
+} rc_loop_t;
+
+rc_loop_config_t rc_loop_default_config();
+int rc_loop_init(rc_loop_t* loop, rc_loop_config_t config);
+int rc_loop_wait(rc_loop_t* loop);
+int rc_loop_start(rc_loop_t* loop, rc_loop_config_t config,\
+									void (*func)(void*), void* arg);
+int rc_loop_stop(rc_loop_t* loop);
+int rc_loop_get_stats(rc_loop_t* loop, rc_loop_stats_t* stats);
+int rc_loop_reset_stats(rc_loop_t* loop);
+int rc_loop_print_stats(rc_loop_t* loop, const char* name);
+
+/*******************************************************************************
+* RATE GROUP SCHEDULER
+*
+* Instead of one thread per periodic job, the scheduler runs every registered
+* task from a single thread. Each tick of the base rate it runs the tasks that
+* are due in the order they were added, so an estimator added before a
+* controller added before an output task always sees this tick's data, and
+* there is only one wakeup per tick however many tasks there are. Tasks must
+* not block since they delay every task after them.
+*
+* @ int rc_sched_init(rc_loop_config_t config)
+*
+* Sets the base rate, priority, CPU and overrun policy of the scheduler thread
+* and removes any tasks. Must not be called while the scheduler is running.
+*
+* @ int rc_sched_add_task(const char* name, int divisor, int offset,
+*						int budget_us, void (*func)(void*), void* arg)
+*
+* Registers func(arg) to run every divisor ticks, so divisor 10 with a 1khz
+* base rate runs it at 100hz. offset from 0 to divisor-1 picks which tick of
+* those it runs on so slow tasks can be spread across ticks rather than all
+* landing on tick 0. If a run takes longer than budget_us the task's overrun
+* count goes up and its overrun flag is set, 0 disables the budget. Returns
+* the task id or -1 on error. Tasks can only be added while stopped.
+*
+* @ int rc_sched_start()
+* @ int rc_sched_start_imu()
+* @ int rc_sched_stop()
+*
+* rc_sched_start runs the ticks from its own rc_loop_t thread at the base
+* rate. rc_sched_start_imu instead runs one tick in each IMU interrupt
+* by taking over the function set with rc_set_imu_interrupt_func, the base
+* rate given to rc_sched_init should then match the IMU sample rate. This
+* ties the whole schedule to fresh IMU data. rc_sched_stop is also called
+* by rc_cleanup().
+*
+* @ int rc_sched_get_task_stats(int id, rc_sched_task_stats_t* stats)
+* @ int rc_sched_clear_overrun(int id)
+* @ int rc_sched_print_stats()
+*
+* Copies a task's statistics without blocking the scheduler, clears its
+* overrun flag, or prints a summary of every task and, when timer driven,
+* the tick loop's jitter.
+*******************************************************************************/
+#define RC_SCHED_MAX_TASKS 16
+
+typedef struct rc_sched_task_stats_t{
+	uint64_t runs;
+	uint64_t overruns;		// runs longer than the budget
+	uint64_t exec_sum_ns;
+	uint64_t exec_max_ns;
+	uint64_t budget_ns;		// 0 if there is no budget
+	int overrun_flag;		// set on overrun until rc_sched_clear_overrun
+} rc_sched_task_stats_t;
+
+int rc_sched_init(rc_loop_config_t config);
+int rc_sched_add_task(const char* name, int divisor, int offset,\
+						int budget_us, void (*func)(void*), void* arg);
+int rc_sched_start();
+int rc_sched_start_imu();
+int rc_sched_stop();
+int rc_sched_get_task_stats(int id, rc_sched_task_stats_t* stats);
+int rc_sched_clear_overrun(int id);
+int rc_sched_print_stats();
+
 /*******************************************************************************
 * Other Functions
 *
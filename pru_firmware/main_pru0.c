@@ -38,6 +38,10 @@
 #include <pru_cfg.h>
 #include <pru_ctrl.h>
 #include "resource_table_pru1.h"
+#include "rc_pru_defs.h"
+
+// shared memory as seen from the PRU
+#define PRU_SHAREDMEM		((volatile uint32_t*)PRU_SHAREDMEM_LOCAL)
 
 // The function is defined in pru1_asm_blinky.asm in same dir
 // We just need to add a declaration here, the defination can be
@@ -53,6 +57,20 @@ void main(void)
 	// C28 defaults to 0x00000000, we need to set bits 23:8 to 0x0100 in order to have it point to 0x00010000	 */
 	PRU0_CTRL.CTPPR0_bit.C28_BLK_POINTER = 0x0100;
 
+	// reset the mailbox and publish the header, magic last so the ARM never
+	// sees a valid magic with a stale version or feature set
+	volatile uint32_t* hdr = PRU_SHAREDMEM + (PRU0_HDR/4);
+	hdr[HDR_MAGIC/4] = 0;
+	hdr[HDR_EVENT_MASK/4] = 0;
+	hdr[HDR_CMD/4] = PRU_CMD_NONE;
+	hdr[HDR_EVT_HEAD/4] = 0;
+	hdr[HDR_EVT_TAIL/4] = 0;
+	hdr[HDR_EVT_DROPPED/4] = 0;
+	hdr[HDR_VERSION/4] = PRU_FW_VERSION;
+	hdr[HDR_FEATURES/4] = PRU_FEAT_ENCODER | PRU_FEAT_EDGE_TIME | \
+								PRU_FEAT_COMMANDS | PRU_FEAT_EVENTS;
+	hdr[HDR_MAGIC/4] = PRU_MAILBOX_MAGIC;
+
 	start();
 }
 
@@ -37,17 +37,41 @@
 #include <stdint.h>
 #include <pru_cfg.h>
 #include "resource_table_pru1.h"
+#include "rc_pru_defs.h"
 
-// The function is defined in pru1_asm_blinky.asm in same dir
+// shared memory as seen from the PRU, the ARM writes DSHOT_MODE_MAGIC to
+// the DSHOT_MODE word before starting PRU1 to select the DShot firmware.
+#define PRU_SHAREDMEM		((volatile uint32_t*)PRU_SHAREDMEM_LOCAL)
+
+// The functions are defined in pru1-servo.asm and pru1-dshot.asm in same dir
 // We just need to add a declaration here, the defination can be
 // seperately linked
 extern void start(void);
+extern void start_dshot(void);
 
 void main(void)
 {
     /* Clear SYSCFG[STANDBY_INIT] to enable OCP master port */
 	CT_CFG.SYSCFG_bit.STANDBY_INIT = 0;
 
-	start();
+	int dshot = (PRU_SHAREDMEM[DSHOT_MODE/4] == DSHOT_MODE_MAGIC);
+
+	// reset the mailbox and publish the header, magic last so the ARM never
+	// sees a valid magic with a stale version or feature set. The servo loop
+	// is cycle counted so only the DShot program posts events.
+	volatile uint32_t* hdr = PRU_SHAREDMEM + (PRU1_HDR/4);
+	hdr[HDR_MAGIC/4] = 0;
+	hdr[HDR_EVENT_MASK/4] = 0;
+	hdr[HDR_CMD/4] = PRU_CMD_NONE;
+	hdr[HDR_EVT_HEAD/4] = 0;
+	hdr[HDR_EVT_TAIL/4] = 0;
+	hdr[HDR_EVT_DROPPED/4] = 0;
+	hdr[HDR_VERSION/4] = PRU_FW_VERSION;
+	if(dshot) hdr[HDR_FEATURES/4] = PRU_FEAT_DSHOT | PRU_FEAT_EVENTS;
+	else hdr[HDR_FEATURES/4] = PRU_FEAT_SERVO;
+	hdr[HDR_MAGIC/4] = PRU_MAILBOX_MAGIC;
+
+	if(dshot) start_dshot();
+	else start();
 }
 
@@ -31,20 +31,24 @@
 ; of the authors and should not be interpreted as representing official policies, 
 ; either expressed or implied, of the FreeBSD Project.
 
-;	.cdecls "robotics_cape_defs.h"
+; shared memory layout and mailbox definitions
+	.cdecls C, NOLIST, "rc_pru_defs.h"
 
 ; PRU setup definitions
 	; .asg    C4,     CONST_SYSCFG         
+	.asg    C26,    CONST_IEP
 	.asg    C28,    CONST_PRUSHAREDRAM   
  
 	.asg	0x22000,	PRU0_CTRL
 	.asg    0x24000,    PRU1_CTRL       ; page 19
 	; .asg    0x28,       CTPPR0          ; page 75
+	.asg	0x00,		IEP_GLOBAL_CFG
+	.asg	0x0C,		IEP_COUNT
+	.asg	0x111,		IEP_ENABLE		; CNT_ENABLE, increment by 1 per clock
  
 	.asg	0x000,	OWN_RAM
 	.asg	0x020,	OTHER_RAM
 	.asg    0x100,	SHARED_RAM       ; This is so prudebug can find it.
-	.asg    64,     CNT_OFFSET
 
 ; Encoder counting definitions
 ; these pin definitions are specific to SD-101D Robotics Cape
@@ -56,18 +60,62 @@
 	.asg	14,			A
 	.asg	15,			B
 
+; edge timestamp registers, r2-r5 are written to shared memory in one burst
+	.asg	r2,			COUNT	; position
+	.asg	r3,			PERIOD	; IEP ticks (5ns) between the last two edges
+	.asg	r4,			DIR		; +1 or -1 for the direction of the last edge
+	.asg	r5,			NOW		; IEP timestamp of the last edge
+	.asg	r6,			LAST	; IEP timestamp of the edge before
+	.asg	r7,			SEQ		; sequence counter
+
+; mailbox registers, the header and ring are past the 255 byte reach of a
+; constant table immediate offset so they are addressed through base registers
+	.asg	r8,			CMD		; command read from the header
+	.asg	r9,			RESULT	; command result
+	.asg	r10,		EVT		; event word then timestamp, r10-r11
+	.asg	r12,		HEAD	; ring head then tail, r12-r13
+	.asg	r13,		TAIL
+	.asg	r14,		NEXT
+	.asg	r15,		TMP
+	.asg	r20,		HBASE	; PRU0 header
+	.asg	r21,		RBASE	; PRU0 event ring
+
 increment	.macro 
-	LBCO	&r2, CONST_PRUSHAREDRAM, CNT_OFFSET, 4	; load existing counter from shared memory
-	ADD 	r2, r2, 1		; increment
-	SBCO	&r2, CONST_PRUSHAREDRAM, CNT_OFFSET, 4	; write to shared memory
-	QBA CHECKPINS				; jump back to main CHECKPINS
+	LBCO	&COUNT, CONST_PRUSHAREDRAM, CNT_OFFSET, 4	; load existing counter from shared memory
+	ADD 	COUNT, COUNT, 1		; increment
+	LDI		DIR, 1
+	QBA PUBLISH				; timestamp and write to shared memory
 	.endm
 
 decrement	.macro
-	LBCO	&r2, CONST_PRUSHAREDRAM, CNT_OFFSET, 4	; load existing counter from shared memory
-	SUB 	r2, r2, 1		; subtract 1
-	SBCO	&r2, CONST_PRUSHAREDRAM, CNT_OFFSET, 4	; write to shared memory
-	QBA CHECKPINS				;/ jump back to main CHECKPINS
+	LBCO	&COUNT, CONST_PRUSHAREDRAM, CNT_OFFSET, 4	; load existing counter from shared memory
+	SUB 	COUNT, COUNT, 1		; subtract 1
+	LDI32	DIR, 0xFFFFFFFF
+	QBA PUBLISH				; timestamp and write to shared memory
+	.endm
+
+; push an event onto the ring if the ARM has enabled its type. data is a
+; register holding the 24 bit payload, NOW is used as the timestamp.
+postevent	.macro type, data
+	LBBO	&TMP, HBASE, HDR_EVENT_MASK, 4
+	QBBC	$E?, TMP, type			; event type not enabled
+	LBBO	&HEAD, HBASE, HDR_EVT_HEAD, 8	; loads HEAD and TAIL
+	ADD		NEXT, HEAD, 1
+	AND		NEXT, NEXT, EVT_RING_LEN-1
+	QBNE	$W?, NEXT, TAIL
+	LBBO	&TMP, HBASE, HDR_EVT_DROPPED, 4	; ring full, count the loss
+	ADD		TMP, TMP, 1
+	SBBO	&TMP, HBASE, HDR_EVT_DROPPED, 4
+	QBA		$E?
+$W?:
+	LDI32	TMP, 0x00FFFFFF
+	AND		EVT, data, TMP
+	LDI		EVT.b3, type
+	MOV		r11, NOW
+	LSL		TMP, HEAD, 3			; EVT_SIZE bytes per event
+	SBBO	&EVT, RBASE, TMP, EVT_SIZE
+	SBBO	&NEXT, HBASE, HDR_EVT_HEAD, 4	; publish after the event is written
+$E?:
 	.endm
 
 	.clink
@@ -80,21 +128,31 @@ start:
 	; LDI     r0, SHARED_RAM              ; Set C28 to point to shared RAM
 	; LDI32   r1, PRU0_CTRL + CTPPR0		; Note we use beginning of shared ram unlike example which
 	; SBBO    &r0, r1, 0, 4				; has arbitrary 2048 offset
+
+; start the free running IEP timer used to timestamp edges, it wraps every 21s
+	LDI		r2, IEP_ENABLE
+	SBCO	&r2, CONST_IEP, IEP_GLOBAL_CFG, 4
+
+	LDI32	HBASE, PRU_SHAREDMEM_LOCAL + PRU0_HDR
+	LDI32	RBASE, PRU_SHAREDMEM_LOCAL + PRU0_EVT_RING
 	
 ; initialize by setting current state of two channels		
 	MOV 	OLD, r31				
-	zero	&r2, 4
-	SBCO	&r2, CONST_PRUSHAREDRAM, CNT_OFFSET, 4	; write 0 to shared memory
+	zero	&r2, 24						; clears r2-r7
+	SBCO	&r2, CONST_PRUSHAREDRAM, CNT_OFFSET, 20	; write 0 to shared memory
 	
-; CHECKPINS here forever looking for pin changes
+; CHECKPINS here forever looking for pin changes or a command from the ARM
 CHECKPINS:
 	XOR EXOR, OLD, r31
 	QBBS A_CHANGED, EXOR, A	; Branch if CHA has toggled
 	QBBS B_CHANGED, EXOR, B ; Branch if CHB has toggled
+	LBBO	&CMD, HBASE, HDR_CMD, 4
+	QBNE COMMAND, CMD, PRU_CMD_NONE
 	QBA CHECKPINS
 	
 	
 A_CHANGED:
+	QBBS SKIPPED, EXOR, B		; both changed, direction is unknown
 	MOV OLD, r31			; update old value now that something changed
 	QBBC A_FELL,  CH, A 		; Branch if CHA has fallen
 	QBBS DECREMENT, CH, B		; A has risen, if B is HIGH, decrement
@@ -121,6 +179,53 @@ DECREMENT:
 INCREMENT:
 	increment
 
+; both channels changed between two polls so an edge was missed. Resync to
+; the current pin state and report it rather than guessing a direction.
+SKIPPED:
+	MOV		OLD, r31
+	LBCO	&NOW, CONST_IEP, IEP_COUNT, 4
+	LDI		RESULT, PRU_ERR_ENC_SKIP
+	postevent PRU_EVT_ERROR, RESULT
+	QBA CHECKPINS
+
+; timestamp the edge and publish count, period, direction, and time. SEQ is
+; odd while the block is being written so the ARM can detect a torn read.
+PUBLISH:
+	LBCO	&NOW, CONST_IEP, IEP_COUNT, 4
+	SUB		PERIOD, NOW, LAST
+	MOV		LAST, NOW
+	ADD		SEQ, SEQ, 1
+	SBCO	&SEQ, CONST_PRUSHAREDRAM, ENC_SEQ_OFFSET, 4
+	SBCO	&COUNT, CONST_PRUSHAREDRAM, CNT_OFFSET, 16
+	ADD		SEQ, SEQ, 1
+	SBCO	&SEQ, CONST_PRUSHAREDRAM, ENC_SEQ_OFFSET, 4
+	postevent PRU_EVT_EDGE, COUNT
+	QBA CHECKPINS
+
+; handle a command from the ARM, the result is written before the command
+; word is cleared so the ARM sees the result as soon as the command is 0
+COMMAND:
+	QBEQ	CMD_PING, CMD, PRU_CMD_PING
+	QBEQ	CMD_SET_COUNT, CMD, PRU_CMD_SET_COUNT
+	LDI32	RESULT, 0xFFFFFFFF			; unknown command
+	QBA		CMD_DONE
+CMD_PING:
+	LDI		RESULT, PRU_FW_VERSION
+	QBA		CMD_DONE
+CMD_SET_COUNT:
+	LBBO	&COUNT, HBASE, HDR_CMD_ARG, 4
+	ADD		SEQ, SEQ, 1
+	SBCO	&SEQ, CONST_PRUSHAREDRAM, ENC_SEQ_OFFSET, 4
+	SBCO	&COUNT, CONST_PRUSHAREDRAM, CNT_OFFSET, 4
+	ADD		SEQ, SEQ, 1
+	SBCO	&SEQ, CONST_PRUSHAREDRAM, ENC_SEQ_OFFSET, 4
+	LDI		RESULT, 0
+CMD_DONE:
+	SBBO	&RESULT, HBASE, HDR_CMD_RESULT, 4
+	LDI		CMD, PRU_CMD_NONE
+	SBBO	&CMD, HBASE, HDR_CMD, 4
+	QBA CHECKPINS
+
 		
 	HALT	; we should never actually get here
-	
\ No newline at end of file
+	
@@ -0,0 +1,139 @@
+;*
+;* pru1-dshot.asm
+;*
+;* DShot digital ESC protocol for the 8 servo channels on PRU1. This is linked
+;* into the same PRU1 firmware as pru1-servo.asm and main_pru1.c jumps here
+;* instead of the servo loop when the ARM has written DSHOT_MODE_MAGIC into
+;* the DSHOT_MODE word of shared memory before (re)starting PRU1.
+;*
+;* All 8 channels are sent simultaneously. The ARM does all the encoding and
+;* hands over a frame that is already transposed to be bit-parallel: one r30
+;* mask per frame bit (MSB first) containing the channels whose bit is a 1.
+;* Every bit toggles all active lines twice, first at the start of the bit,
+;* then at T0H for channels sending a 0 and at T1H for channels sending a 1.
+;* The lines idle low. Only the normal output-only DShot is sent, the PRU
+;* can't switch the pads to inputs so the bidirectional eRPM reply is not
+;* supported.
+
+	.cdecls "main_pru1.c"
+
+; wait for the number of 2-instruction loops stored in reg, reg must be >=1
+DELAYREG	.macro reg
+$M?:	SUB	reg, reg, 1
+	QBNE	$M?, reg, 0
+	.endm
+
+; send one bit on all active channels, ones is the mask of channels sending 1
+SENDBIT	.macro ones
+	XOR		r30, r30, ACTIVE			; all active lines to their asserted level
+	XOR		r26, ACTIVE, ones			; channels sending a zero
+	MOV		r27, T0H
+	DELAYREG r27
+	XOR		r30, r30, r26				; release the zeros at T0H
+	MOV		r27, T1H
+	DELAYREG r27
+	XOR		r30, r30, ones				; release the ones at T1H
+	MOV		r27, TREST
+	DELAYREG r27
+	.endm
+
+	.asg    C4,     CONST_SYSCFG
+	.asg    C26,    CONST_IEP
+	.asg    C28,    CONST_PRUSHAREDRAM
+
+	.asg    0x24000,    PRU1_CTRL       ; page 19
+	.asg    0x28,       CTPPR0          ; page 75
+	.asg    0x100,	SHARED_RAM
+	.asg	0x0C,		IEP_COUNT
+
+; the shared memory layout comes from rc_pru_defs.h through main_pru1.c. The
+; DShot block is past the 255 byte reach of a constant table immediate
+; offset so it is addressed through DBASE instead.
+	.asg	r29,	DBASE				; start of the DShot block
+	.asg	r3,		T0H					; loops from start of bit to T0H
+	.asg	r4,		T1H					; loops from T0H to T1H
+	.asg	r5,		TREST				; loops from T1H to end of bit
+	.asg	r6,		ACTIVE				; mask of channels in use
+
+; mailbox registers, only used between frames when r10-r25 are free
+	.asg	r10,	EVT					; event word then timestamp, r10-r11
+	.asg	r12,	HEAD				; ring head then tail, r12-r13
+	.asg	r13,	TAIL
+	.asg	r14,	NEXT
+	.asg	r15,	TMP
+	.asg	r20,	HBASE				; PRU1 header
+	.asg	r21,	RBASE				; PRU1 event ring
+
+	.clink
+	.global start_dshot
+start_dshot:
+	LBCO	&r0, CONST_SYSCFG, 4, 4		; Enable OCP master port
+	CLR 	r0, r0, 4
+	SBCO	&r0, CONST_SYSCFG, 4, 4
+
+	LDI     r0, SHARED_RAM              ; Set C28 to point to shared RAM
+	LDI32   r1, PRU1_CTRL + CTPPR0
+	SBBO    &r0, r1, 0, 4
+
+	LDI32	DBASE, PRU_SHAREDMEM_LOCAL + DSHOT_MODE
+	LDI		r30, 0x0					; outputs low until the first frame
+	LDI		r0, 0x0
+	SBBO	&r0, DBASE, DSHOT_SEQ-DSHOT_MODE, 4
+	SBBO	&r0, DBASE, DSHOT_CTRL-DSHOT_MODE, 4	; tell ARM we are running
+
+WAIT_FRAME:
+	LBBO	&r2, DBASE, DSHOT_CTRL-DSHOT_MODE, 4
+	QBEQ	WAIT_FRAME, r2, 0
+
+	LBBO	&r3, DBASE, DSHOT_TIMING-DSHOT_MODE, 16
+	LBBO	&r10, DBASE, DSHOT_BITS-DSHOT_MODE, 64
+
+	SENDBIT	r10
+	SENDBIT	r11
+	SENDBIT	r12
+	SENDBIT	r13
+	SENDBIT	r14
+	SENDBIT	r15
+	SENDBIT	r16
+	SENDBIT	r17
+	SENDBIT	r18
+	SENDBIT	r19
+	SENDBIT	r20
+	SENDBIT	r21
+	SENDBIT	r22
+	SENDBIT	r23
+	SENDBIT	r24
+	SENDBIT	r25
+
+	LBBO	&r0, DBASE, DSHOT_SEQ-DSHOT_MODE, 4
+	ADD		r0, r0, 1
+	SBBO	&r0, DBASE, DSHOT_SEQ-DSHOT_MODE, 4
+
+; post a frame done event if the ARM has enabled them
+	LDI32	HBASE, PRU_SHAREDMEM_LOCAL + PRU1_HDR
+	LBBO	&TMP, HBASE, HDR_EVENT_MASK, 4
+	QBBC	FRAME_ACK, TMP, PRU_EVT_FRAME_DONE
+	LBBO	&HEAD, HBASE, HDR_EVT_HEAD, 8	; loads HEAD and TAIL
+	ADD		NEXT, HEAD, 1
+	AND		NEXT, NEXT, EVT_RING_LEN-1
+	QBNE	POST_EVENT, NEXT, TAIL
+	LBBO	&TMP, HBASE, HDR_EVT_DROPPED, 4	; ring full, count the loss
+	ADD		TMP, TMP, 1
+	SBBO	&TMP, HBASE, HDR_EVT_DROPPED, 4
+	QBA		FRAME_ACK
+POST_EVENT:
+	LDI32	RBASE, PRU_SHAREDMEM_LOCAL + PRU1_EVT_RING
+	LDI32	TMP, 0x00FFFFFF
+	AND		EVT, r0, TMP
+	LDI		EVT.b3, PRU_EVT_FRAME_DONE
+	LBCO	&r11, CONST_IEP, IEP_COUNT, 4
+	LSL		TMP, HEAD, 3				; EVT_SIZE bytes per event
+	SBBO	&EVT, RBASE, TMP, EVT_SIZE
+	SBBO	&NEXT, HBASE, HDR_EVT_HEAD, 4	; publish after the event is written
+
+FRAME_ACK:
+	LDI		r0, 0x0
+	SBBO	&r0, DBASE, DSHOT_CTRL-DSHOT_MODE, 4	; frame complete
+	QBA		WAIT_FRAME
+
+	HALT	; we should never actually get here